@@ -0,0 +1,77 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "OVBvh.h"
+#include "OVCamera.h"
+#include "OVCommon.h"
+#include "OVModel.h"
+
+namespace ov
+{
+
+// The model view matrix RenderFrame() loads: the offset pose of the viewer,
+// rotations in degrees, applied after the model's pose
+Mat4
+ComposeModelView(const Vec3& offsetRotation, const Vec3& offsetTranslation, double offsetScale,
+                 const Mat3& R, const Vec3& t);
+
+// Whether a sphere in model units reaches into the view frustum of a
+// projection from BuildProjectionMatrix(), with planes taken from the
+// product of the matrices the frame is drawn with
+bool
+IsSphereInFrustum(const double projectionMatrix[16], const Mat4& modelView, const Vec3& center, double radius);
+
+// 2D labels of one frame
+struct FrameAnnotation
+{
+    bool                     isVisible; // the box is not empty
+    float                    box[4];    // x0, y0, x1, y1 of the projected vertices in front of
+                                        // the camera, clipped to the frame
+    std::vector<cv::Point2f> keypoints;
+    std::vector<bool>        isInFront; // of the camera, per keypoint
+    std::vector<bool>        isKeypointVisible; // in front, in the frame and not hidden by the model
+    float                    visibleRatio;      // of the model's surface seen in the frame
+};
+
+// Projects the model's vertices, and a set of keypoints, into the frames
+// with the camera and the model view they are drawn with; nothing is read
+// back from GL. Vertices are kept as separate x, y and z arrays so the
+// transform and the projection vectorize over all of them. Cameras with
+// distortion coefficients go through cv::projectPoints() instead.
+// Occlusion is traced against a BVH of the model, from the camera center
+// to the keypoints and to fixed samples of the surface.
+class FrameAnnotator
+{
+public:
+    // Vertices of every shape, and the BVH built for the model; the same
+    // model is not set up again
+    void setModel(const std::shared_ptr<const Model>& model, const std::shared_ptr<const MeshBvh>& bvh);
+    // Keypoints in model units, one "x y z" row each
+    bool loadKeypoints(const std::string& filename);
+    void clearKeypoints() { _keypoints.resize(3, 0); }
+    void setCamera(const CameraParameters& camera) { _camera = camera; }
+
+    void annotate(const Mat4& modelView, FrameAnnotation& annotation) const;
+
+private:
+    std::shared_ptr<const Model>   _model;
+    Eigen::ArrayXf                 _x;
+    Eigen::ArrayXf                 _y;
+    Eigen::ArrayXf                 _z;
+    std::shared_ptr<const MeshBvh> _bvh;
+    Mat3X                          _keypoints;
+    CameraParameters               _camera;
+};
+
+// One JSON line:
+//   {"frame":12,"file":"000012.png","bbox":[x0,y0,x1,y1],"visible_ratio":0.41,
+//    "keypoints":[[u,v],null,...],"keypoints_visible":[1,0,...]}
+// bbox is null when nothing of the model is in the frame, keypoints
+// behind the camera are null
+std::string
+FormatAnnotation(int frameIndex, const std::string& filename, const FrameAnnotation& annotation);
+
+} // namespace ov
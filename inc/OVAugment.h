@@ -0,0 +1,25 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <stdint.h>
+
+namespace ov
+{
+
+// Above this sigma the blur switches from a separable kernel to a
+// recursive filter whose cost does not grow with sigma
+const double RecursiveBlurSigma = 8;
+
+// Blur, noise and min-max normalization of an 8-bit frame in one fused
+// pass over the output. The noise of every sample comes from a
+// counter-based generator keyed by (seed, sample index), so the result is
+// bit-identical for any number of threads and any frame order.
+// A noiseVariance of 0 leaves out the noise and the normalization.
+void
+AugmentFrame(cv::Mat& image, double blurSigma, double noiseVariance, uint64_t seed);
+
+// Standard normal samples 2 * counter and 2 * counter + 1 of a stream
+void
+GaussianPair(uint64_t seed, uint64_t counter, float& n0, float& n1);
+
+} // namespace ov
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+namespace ov
+{
+
+// Background images of a list file (one name per line) or of the images
+// in a directory, sorted by name
+bool
+ListBackgrounds(const std::string& path, std::vector<std::string>& files);
+
+struct BackgroundPoolOptions
+{
+    BackgroundPoolOptions() : numThreads(0), capacity(32), seed(0) {}
+
+    int      numThreads; // decoding threads, <= 0 for automatic
+    int      capacity;   // positions decoded ahead, and images kept resident
+    uint64_t seed;       // of the shuffles
+    cv::Size size;       // images are resized to it, empty keeps their size
+};
+
+// Decodes backgrounds ahead of use. The pool hands out an endless sequence
+// of its files: every pass over them is a new shuffle, the same for the
+// same seed. Decoding threads fill the positions from the last one asked
+// for on, images are kept continuous BGR as UploadBackground() takes them,
+// and only those of the next <capacity> positions stay resident. A file
+// that cannot be decoded is reported once, from the decoding thread, and
+// comes back as an empty image.
+class BackgroundPool
+{
+public:
+    BackgroundPool(const std::vector<std::string>& files, const BackgroundPoolOptions& options);
+    ~BackgroundPool();
+
+    int getNumFiles() const { return (int)_files.size(); }
+    const std::string& getFile(int64_t position);
+
+    // Waits for the image of the position; positions before it are done
+    // with. The image is shared with the pool, read only.
+    cv::Mat get(int64_t position);
+
+private:
+    BackgroundPool(const BackgroundPool&);
+    BackgroundPool& operator=(const BackgroundPool&);
+
+    struct Entry
+    {
+        Entry() : isDone(false) {}
+
+        cv::Mat image;
+        bool    isDone;
+    };
+
+    // Index into _files, requires the lock
+    int getFileIndex(int64_t position);
+    void decodeLoop();
+
+    std::vector<std::string>                       _files;
+    BackgroundPoolOptions                          _options;
+    std::vector<bool>                              _isBroken;   // reported, not decoded again
+    std::unordered_map<int64_t, std::vector<int> > _orders;     // shuffles of the passes in the window
+    std::unordered_map<int, Entry>                 _resident;   // by file index
+    int64_t                                        _first;      // the window is [_first, _first + capacity)
+    bool                                           _isStopping;
+    std::mutex                                     _mutex;
+    std::condition_variable                        _wakeDecoders;
+    std::condition_variable                        _decoded;
+    std::vector<std::thread>                       _threads;
+};
+
+} // namespace ov
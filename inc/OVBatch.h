@@ -0,0 +1,254 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "OVAnnotation.h"
+#include "OVCamera.h"
+#include "OVCommon.h"
+#include "OVModel.h"
+#include "OVSink.h"
+
+namespace ov
+{
+
+// Outputs drawn with the color frame. Every channel is written through
+// a sink of the line's type in a subdirectory of the output named after
+// it, frame for frame.
+enum FRAME_CHANNEL
+{
+    CHANNEL_DEPTH   = 1, // distance along the optical axis in model units, 0 where nothing is drawn
+    CHANNEL_MASK    = 2, // 8-bit ID of the shape or material, see MASK_MODE
+    CHANNEL_NORMALS = 4  // eye space unit normals, x right, y down, z forward
+};
+
+const int NumFrameChannels = 3;
+
+// Name of the channel with the given index, and its subdirectory
+const char*
+GetChannelName(int index);
+
+struct ChannelOptions
+{
+    ChannelOptions() : channels(0), maskMode(MASK_SHAPE), isHalf(true) {}
+
+    int  channels; // FRAME_CHANNEL flags
+    int  maskMode;
+    bool isHalf;   // depth and normals as float16 instead of float32
+};
+
+// channels=depth,mask,normals, mask=shape|material, channel-format=f16|f32
+bool
+ParseChannelOption(const std::string& key, const std::string& value, ChannelOptions& options);
+
+// Frames of poses that put the model's bounding sphere outside the view
+// frustum show nothing of the model
+enum CULLING_MODE
+{
+    CULLING_OFF,  // rendered like the others
+    CULLING_SKIP, // left out
+    CULLING_MARK  // left out, and recorded as empty in the manifest
+};
+
+// One line of a batch file:
+//   <model> <image> <camera> <poses> <blur> <noise> <output> [key=value]...
+// The optional tokens choose the line's sink, see ParseSinkOption(), its
+// extra channels, see ParseChannelOption(), its 2D labels with
+// annotations=on and keypoints=<file>, see FrameAnnotator, and
+// backgrounds=<list file or directory>: every pose is rendered once without
+// a background and composited over each of the images, see
+// ListBackgrounds(). Frame i * <number of backgrounds> + b is pose i over
+// image b of a shuffle that is new for every pose and fixed by the line's
+// index, see BackgroundPool. culling=off|skip|mark chooses a CULLING_MODE.
+// dedup=<step> makes frames a hard link to an earlier frame of the run with
+// the same content, poses rounded to multiples of the step (0 for exact
+// matches); PNG sinks only, and frames with noise match only themselves
+// as their seeds differ. dedup=off is the default.
+struct BatchLine
+{
+    std::string    modelFile;
+    std::string    imageFile;
+    std::string    cameraFile;
+    std::string    posesFile;
+    double         blurSigma;
+    double         noiseVariance;
+    std::string    outputDir;       // relative to the batch file
+    std::string    backgroundsFile; // composite mode if set
+    SinkOptions    sink;
+    ChannelOptions channels;
+    bool           isAnnotated;     // writes <output>annotations.jsonl
+    std::string    keypointsFile;   // projected into the annotations if set
+    int            culling;         // CULLING_MODE
+    double         dedupStep;       // pose rounding of dedup=, < 0 for none
+};
+
+// error tells what is wrong with a line that cannot be parsed
+bool
+ParseBatchLine(const std::string& line, BatchLine& batchLine, std::string& error);
+
+// Blank lines are skipped; reports the first line that cannot be parsed,
+// with its number and the offending token, and returns false
+bool
+LoadBatchFile(const std::string& filename, std::vector<BatchLine>& batchLines);
+
+// Keeps the parsed assets of a batch run keyed by file name, so lines that
+// share a model, background or camera file load it only once. Poses are
+// streamed by the batch loop instead of being cached. Assets
+// of upcoming lines can be prefetched on background threads while the
+// current line renders; getters wait for a pending load to complete.
+// A long-lived cache can be bounded: the least recently used assets that
+// are done loading go first.
+class AssetCache
+{
+public:
+    // Assets of each kind kept, 0 for all
+    explicit AssetCache(size_t maxEntries = 0) : _maxEntries(maxEntries), _useCount(0) {}
+
+    void prefetch(const BatchLine& batchLine);
+
+    // Models are not unitized, the batch poses are in model units
+    std::shared_ptr<const Model> getModel(const std::string& filename);
+    // The occlusion BVH of a model, built once on first use, or on
+    // prefetch for lines with annotations; NULL if the model fails
+    std::shared_ptr<const MeshBvh> getBvh(const std::string& modelFile);
+    cv::Mat getBackground(const std::string& filename);
+    bool getCamera(const std::string& filename, CameraParameters& camera);
+
+private:
+    template <typename T>
+    struct Entry
+    {
+        std::shared_future<T> future;
+        uint64_t              lastUse;
+    };
+
+    template <typename T, typename Load>
+    std::shared_future<T> request(std::unordered_map<std::string, Entry<T> >& cache,
+                                  const std::string& filename,
+                                  Load load);
+    std::shared_ptr<const MeshBvh> buildBvh(const std::string& modelFile);
+
+    std::mutex _mutex;
+    size_t     _maxEntries;
+    uint64_t   _useCount;
+    std::unordered_map<std::string, Entry<std::shared_ptr<const Model> > >            _models;
+    std::unordered_map<std::string, Entry<std::shared_ptr<const MeshBvh> > >          _bvhs;
+    std::unordered_map<std::string, Entry<cv::Mat> >                                  _backgrounds;
+    std::unordered_map<std::string, Entry<std::shared_ptr<const CameraParameters> > > _cameras;
+};
+
+// Where the frames of a batch run are drawn. Implemented by the offscreen
+// renderer the viewer and the command-line tool run batches with.
+class BatchRenderer
+{
+public:
+    virtual ~BatchRenderer() {}
+
+    // Models are not unitized, textures are still decoded in the model
+    virtual bool setModel(const std::shared_ptr<const Model>& model) = 0;
+    virtual bool setBackground(const cv::Mat& image) = 0;
+    virtual void setCamera(const CameraParameters& camera) = 0;
+    // Draw one pose and read back the BGR frame
+    virtual bool render(const Mat3& R, const Vec3& t, cv::Mat& image) = 0;
+    // Draw one pose without the background and read back the BGRA frame,
+    // color premultiplied by alpha; false if the renderer cannot
+    virtual bool renderLayer(const Mat3& R, const Vec3& t, cv::Mat& image) { return false; }
+    // Draw one pose like render() and read back the channels the options
+    // ask for as well, in FRAME_CHANNEL order: depth CV_32F, mask CV_8U,
+    // normals CV_32FC3; false if the renderer cannot
+    virtual bool renderChannels(const Mat3& R, const Vec3& t, const ChannelOptions& options,
+                                cv::Mat& image, std::vector<cv::Mat>& channels) { return false; }
+    // The model view a pose is drawn with, with the renderer's offset pose
+    virtual Mat4 getModelView(const Mat3& R, const Vec3& t)
+    {
+        return ComposeModelView(Vec3::Zero(), Vec3::Zero(), 1, R, t);
+    }
+    // The projection of the camera set last; false if the renderer cannot tell
+    virtual bool getProjectionMatrix(double projectionMatrix[16]) { return false; }
+};
+
+// Makes a renderer with a context of its own on the calling thread, none
+// if it cannot
+typedef std::function<std::unique_ptr<BatchRenderer>()> RendererFactory;
+
+struct BatchOptions
+{
+    BatchOptions() : numWorkers(0), numRenderers(1), progressInterval(0.5), isResuming(false), shardIndex(0), numShards(1),
+                     isCancelled(NULL) {}
+
+    int         numWorkers;       // post-processing threads, <= 0 for automatic
+    // Render threads, see createRenderer. One by default: contexts of one
+    // GPU share it, whether more help depends on the driver and the scene.
+    int         numRenderers;
+    std::string outputRoot;       // output directories are relative to it, default is the batch file's directory
+    double      progressInterval; // seconds between progress callbacks
+    bool        isResuming;       // skip frames the manifest records as valid
+    std::string manifestFile;     // default is <output root>/<batch name>.manifest
+    int         shardIndex;       // render only the frames of this shard
+    int         numShards;
+    // Polled before every frame, once set the frames pushed so far are
+    // written and the run stops; none for a run to the end
+    const std::atomic<bool>* isCancelled;
+    // Makes the renderers of the render threads, see RenderPool; with one
+    // thread, or without a factory, the renderer passed to RunBatch draws
+    RendererFactory createRenderer;
+};
+
+// Deterministic split of the frames over the shards; interleaving keeps
+// the shards balanced when the lines differ in cost
+inline bool
+IsInShard(int lineIndex, int frameIndex, const BatchOptions& options)
+{
+    return (lineIndex + frameIndex) % options.numShards == options.shardIndex;
+}
+
+// The combined manifest of a run, sharded runs also write one per shard
+std::string
+GetManifestFile(const std::string& batchFile, const BatchOptions& options);
+
+std::string
+GetShardManifestFile(const std::string& batchFile, const BatchOptions& options, int shardIndex);
+
+struct BatchProgress
+{
+    int         lineIndex;
+    int         numLines;
+    int         frameIndex;
+    int         numFrames;        // -1 while a text pose file is still being read
+    std::string posesFile;
+    double      blurSigma;
+    double      noiseVariance;
+};
+
+typedef std::function<void(const BatchProgress&)> BatchProgressCallback;
+
+struct BatchStats
+{
+    std::string summary;    // pipeline utilization, for people
+    int         numWritten;
+    int         numSkipped; // still valid from an earlier run
+    int         numCulled;  // left out by the lines' culling
+    int         numLinked;  // links to identical frames, see dedup=
+    int64_t     numBytes;
+    double      seconds;
+    bool        isCancelled; // stopped before the last frame
+};
+
+// Render every line of a batch file and write the post-processed frames.
+// Every written frame is recorded in the manifest, the shard's own one
+// when sharded. Returns false if the batch file or any of its assets cannot
+// be read or a frame could not be written. A cancelled run leaves a
+// manifest a later run can resume from.
+bool
+RunBatch(const std::string& batchFile,
+         BatchRenderer& renderer,
+         const BatchOptions& options,
+         const BatchProgressCallback& progress,
+         BatchStats& stats);
+
+} // namespace ov
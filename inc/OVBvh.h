@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include "OVCommon.h"
+#include "OVModel.h"
+
+namespace ov
+{
+
+struct BvhBuildNode;
+
+// Bounding volume hierarchy over the triangles of a model for occlusion
+// queries. The tree is split by the surface area heuristic over binned
+// centroids, large ranges are built on several threads. Rays are traced
+// in packets of four with SSE: one box test covers the packet, and a
+// subtree is skipped once every ray of the packet is blocked.
+class MeshBvh
+{
+public:
+    MeshBvh() {}
+
+    void build(const Model& model);
+    bool isEmpty() const { return _nodes.empty(); }
+
+    // For every point: 1 if the segment from the camera center to the
+    // point, both in model coordinates, crosses no triangle. Points on the
+    // surface do not block themselves. Const, may run on several threads.
+    void testVisibility(const Vec3& center, const Mat3X& points, byte* isVisible) const;
+
+    // Points spread over the surface by area, for visible surface ratios;
+    // the same for the same model
+    const Mat3X& getSurfaceSamples() const { return _samples; }
+
+private:
+    struct Node
+    {
+        float lower[3];
+        float upper[3];
+        int   offset;  // leaf: first triangle, inner node: the second child, the first follows the node
+        int   count;   // triangles of a leaf, 0 for an inner node
+    };
+
+    // v0 and the edges to v1 and v2, in leaf order
+    struct Triangle
+    {
+        float v0[3];
+        float e1[3];
+        float e2[3];
+    };
+
+    int flatten(const BvhBuildNode& node);
+    // Rays of one packet, at most four, sharing the origin
+    void tracePacket(const float origin[3], const float (*targets)[3], int numRays, byte* isVisible) const;
+
+    std::vector<Node>     _nodes;
+    std::vector<Triangle> _triangles;
+    Mat3X                 _samples;
+};
+
+} // namespace ov
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace ov
+{
+
+// Pinhole intrinsics and lens distortion as stored by the OpenCV
+// calibration tools
+struct CameraParameters
+{
+    double              fx;
+    double              fy;
+    double              cx;
+    double              cy;
+    int                 width;
+    int                 height;
+    std::vector<double> distortion; // k1 k2 p1 p2 [k3 [k4 k5 k6]], empty for none
+};
+
+bool
+LoadCameraParameters(const std::string& filename, CameraParameters& camera);
+
+} // namespace ov
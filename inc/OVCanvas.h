@@ -14,11 +14,16 @@
 #define wxUSE_GUI 1
 
 #include <fstream>
+#include <memory>
 #include <queue>
 #include <unordered_map>
 #include "wx/glcanvas.h"
 #include "ObjViewer.h"
+#include "OVCamera.h"
 #include "OVCommon.h"
+#include "OVModel.h"
+#include "OVRender.h"
+#include "OVTexture.h"
 #include "TinyObjLoader.h"
 
 namespace ov
@@ -27,7 +32,9 @@ namespace ov
 class ObjViewer;
 class PenPoseTracker;
 
-// The canvas window
+// The canvas window, an interactive client of a Renderer: it holds the
+// trackball pose and the texture streaming, the renderer the scene and
+// the camera
 class OVCanvas : public wxGLCanvas
 {
 public:
@@ -39,15 +46,16 @@ public:
 
     ~OVCanvas();
 
-    static int FrameWidth;
-    static int FrameHeight;
-    static double PlaneNear;
-    static double PlaneFar;
-
     void setRenderMode(int renderMode);
     bool setForegroundObject(const std::string& filename, bool isUnitization = true);
+    // A model loaded on another thread; its textures are uploaded and dropped
+    void setLoadedModel(const std::shared_ptr<Model>& model);
+    void setForegroundModel(const std::shared_ptr<const Model>& model,
+                            const std::unordered_map<std::string, GLuint>& textureIds);
     bool setBackgroundImamge(const std::string& filename);
+    void setBackgroundImamge(const cv::Mat& image);
     bool readCameraParameters(const std::string& camParamFile);
+    void setCameraParameters(const CameraParameters& camera);
     void forceRender(const Mat3& R, const Vec3& t);
     void printScreen(cv::Mat& image);
     void resetMatrix();
@@ -55,6 +63,7 @@ public:
     void setLightingOn(bool lightingOn);
     void setOffsetPose(const Vec3& r, const Vec3& t, const double s);
     void getOffsetPose(Vec3& r, Vec3& t, double& s);
+    const double* getProjectionMatrix() const { return _renderer.getProjectionMatrix(); }
 
 protected:
     void onMouse(wxMouseEvent& evt);
@@ -66,40 +75,23 @@ protected:
 private:
     // OpenGL functions
     void oglInit();
-    void drawBackground(GLuint backgroundImageTextureId);
-    void drawForeground(const std::vector<tinyobj::shape_t>& shapes,
-                        const std::vector<tinyobj::material_t>& materials,
-                        const std::unordered_map<std::string, GLuint>& textureIds);
-    void unitize(std::vector<tinyobj::shape_t>& shapes);
+    // Of the background, a default before one is set
+    cv::Size getFrameSize() const;
 
     // Widgets
     ObjViewer*   _objViewer;
     wxGLContext* _oglContext;
 
-    // Foreground objects
-    std::vector<tinyobj::shape_t>           _shapes;
-    std::vector<tinyobj::material_t>        _materials;
-    std::unordered_map<std::string, GLuint> _textureIds;
-
-    // Backgroubd image
-    cv::Mat _backgroundImage;
-    GLuint  _backgroundImageTextureId;
+    // Scene, camera and options, in the canvas's context
+    Renderer        _renderer;
+    TextureStreamer _textureStreamer;
 
     // Selections
-    int  _renderMode;
     bool _isNewFile;
-    bool _lightingOn;
-
-    // Offset transformation coefficients
-    Vec3   _offsetRotation;
-    Vec3   _offsetTranslation;
-    double _offsetScale;
-
-    // For OpenGL rendering
-    double _modelViewMatrix[16];
-    double _projectionMatrix[16];
-    Mat3   _R;
-    Vec3   _t;
+
+    // Pose of the model, moved with the mouse
+    Mat3 _R;
+    Vec3 _t;
 
     // For trackball
     Vec2 _mousePos;
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace ov
+{
+
+// A foreground rendered once over a transparent clear, blended over any
+// number of backgrounds. The blend is "over" with the premultiplied color
+// GL leaves on a transparent black target:
+//   frame = color + background * (255 - alpha) / 255
+// Rows are blended only between their first and last covered pixel, the
+// rest of the frame is the background's.
+class ForegroundLayer
+{
+public:
+    // From the BGRA readback of a transparent render
+    void set(const cv::Mat& bgra);
+
+    // The BGR background must have the layer's size; the frame is new
+    // memory, the background is only read
+    void composite(const cv::Mat& background, cv::Mat& image) const;
+
+    cv::Size size() const { return _color.size(); }
+
+private:
+    cv::Mat          _color;  // premultiplied BGR
+    cv::Mat          _weight; // 255 - alpha for every channel
+    std::vector<int> _first;  // covered pixels of row y are [_first[y], _last[y])
+    std::vector<int> _last;
+};
+
+} // namespace ov
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include "OVCamera.h"
+
+namespace ov
+{
+
+// Lens distortion of rendered frames. GL draws pinhole images, so a camera
+// with distortion coefficients is rendered undistorted on a canvas that is
+// larger by a margin on every side, and every frame is warped through a
+// lookup table into the camera's distorted image. The background, a photo
+// taken through the lens, is undistorted onto the canvas once so it comes
+// back unchanged up to resampling.
+class LensDistortion
+{
+public:
+    // Builds both tables, which takes a while; use GetLensDistortion()
+    explicit LensDistortion(const CameraParameters& camera);
+
+    // Pinhole camera of the canvas
+    const CameraParameters& getRenderCamera() const { return _renderCamera; }
+    int getMargin() const { return _margin; }
+
+    // Photo of the camera onto the canvas
+    void undistort(const cv::Mat& image, cv::Mat& canvas) const;
+    // Rendered canvas into the camera's frame; a continuous frame of the
+    // camera's size is written in place. Depth, IDs and normals are not
+    // blended across edges, they take cv::INTER_NEAREST.
+    void distort(const cv::Mat& canvas, cv::Mat& image, int interpolation = cv::INTER_LINEAR) const;
+
+private:
+    CameraParameters _renderCamera;
+    int              _margin;
+    // Fixed point tables as cv::remap uses them without conversion:
+    // integer positions and interpolation weights
+    cv::Mat          _distortPositions;   // frame pixel -> canvas
+    cv::Mat          _distortWeights;
+    cv::Mat          _undistortPositions; // canvas pixel -> photo
+    cv::Mat          _undistortWeights;
+};
+
+// True if the camera has any non-zero distortion coefficient
+bool
+HasDistortion(const CameraParameters& camera);
+
+// The tables of a camera, built on first use and kept for the process
+std::shared_ptr<const LensDistortion>
+GetLensDistortion(const CameraParameters& camera);
+
+} // namespace ov
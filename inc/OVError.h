@@ -0,0 +1,21 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+namespace ov
+{
+
+typedef std::function<void(const std::string&)> ErrorHandler;
+
+// Install the function that receives every reported error. The default
+// handler writes to std::cerr; the GUI replaces it with a message box.
+void
+SetErrorHandler(const ErrorHandler& handler);
+
+// Report an error without knowing who is listening. Safe to call from any
+// thread, the installed handler decides how (and where) to show it.
+void
+ReportError(const std::string& msg);
+
+} // namespace ov
@@ -0,0 +1,17 @@
+#pragma once
+
+// OpenGL 1.1 of the Windows SDK, with the names of later versions the
+// renderer uses
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <GL/gl.h>
+
+#ifndef GL_BGR
+#define GL_BGR GL_BGR_EXT
+#endif
+
+#ifndef GL_BGRA
+#define GL_BGRA GL_BGRA_EXT
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ov
+{
+
+const uint64_t HashBasis = 14695981039346656037ULL;
+
+// 64-bit FNV-1a, pass the previous hash to continue over several buffers
+uint64_t
+HashBytes(const void* data, size_t size, uint64_t hash = HashBasis);
+
+bool
+HashFile(const std::string& filename, uint64_t& hash);
+
+// Record of the frames a batch run has written. Every frame is appended
+// and flushed as soon as it is on disk, with the hash of everything it was
+// made from and the checksum of the written file, so a run that died can
+// be resumed by skipping frames that are still valid.
+//
+// One tab separated line per frame:
+//   <frame file relative to the output root> <input hash> <size> <output hash> <write time>
+// Frames left out as empty have no file, their size and output hash are 0.
+// The write time is the file's when it was recorded, 0 if unknown, as in
+// manifests of older runs; frames in containers have none.
+class Manifest
+{
+public:
+    // Add the entries of an earlier run, replacing entries of the same
+    // frames; a torn last line is ignored
+    bool load(const std::string& filename);
+    // Write the loaded and recorded entries as a new manifest
+    bool save(const std::string& filename) const;
+    // Start recording, keeping the loaded entries' lines when appending
+    bool open(const std::string& filename, const std::string& outputRoot, bool isAppend);
+    void close();
+
+    // Thread-safe, called once the frame file is written
+    void record(const std::string& frameFile, uint64_t inputHash, const std::vector<unsigned char>& data);
+    void recordEmpty(const std::string& frameFile, uint64_t inputHash);
+    // The frame file is a link to a recorded one, with its size and checksum
+    void recordLink(const std::string& frameFile, uint64_t inputHash, const std::string& targetFile);
+    // The frame file exists, was made from the same input and is intact,
+    // or the frame was left out as empty for the same input. A file of the
+    // recorded size and write time is trusted, others are hashed.
+    bool isValid(const std::string& frameFile, uint64_t inputHash) const;
+
+private:
+    struct Entry
+    {
+        uint64_t inputHash;
+        uint64_t size;
+        uint64_t outputHash;
+        uint64_t writeTime;
+    };
+
+    std::string relativePath(const std::string& frameFile) const;
+    static void WriteEntry(std::ostream& stream, const std::string& path, const Entry& entry);
+    void append(const std::string& frameFile, const Entry& entry);
+
+    std::unordered_map<std::string, Entry> _entries;
+    std::string                            _outputRoot;
+    std::ofstream                          _file;
+    mutable std::mutex                     _mutex;
+};
+
+// Combine manifests into one, entries of later parts win
+bool
+MergeManifests(const std::vector<std::string>& parts, const std::string& filename);
+
+} // namespace ov
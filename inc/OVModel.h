@@ -0,0 +1,101 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "OVCommon.h"
+#include "TinyObjLoader.h"
+
+namespace ov
+{
+
+// Everything of an OBJ model that can be loaded without a GL context,
+// so it can be parsed on a worker thread and shared between users.
+struct Model
+{
+    std::string                              filename;
+    std::vector<tinyobj::shape_t>            shapes;
+    std::vector<tinyobj::material_t>         materials;
+    std::unordered_map<std::string, cv::Mat> textures;  // decoded diffuse maps by name
+    Vec3                                     boundingCenter;
+    double                                   boundingRadius;
+};
+
+// What the ID masks of a model tell apart; a pixel's ID is the index of
+// its shape or material + 1, 0 is the background
+enum MASK_MODE
+{
+    MASK_NONE,
+    MASK_SHAPE,
+    MASK_MATERIAL
+};
+
+// Where a model load is, for progress displays
+struct LoadProgress
+{
+    LoadProgress() : bytesParsed(0), numBytes(0), texturesDecoded(0), numTextures(0) {}
+
+    int64_t bytesParsed;
+    int64_t numBytes;        // of the OBJ file
+    int     texturesDecoded;
+    int     numTextures;     // known once the OBJ file is parsed
+};
+
+// Called on the loading thread every few hundred KB and after every
+// texture; returning false cancels the load
+typedef std::function<bool(const LoadProgress&)> LoadProgressCallback;
+
+// False if the model cannot be read, or the load was cancelled; only the
+// former is reported
+bool
+LoadModel(Model& model, const std::string& filename, bool isUnitization = true,
+          const LoadProgressCallback& progress = LoadProgressCallback());
+
+// Loads a model on a thread of its own so the GUI stays responsive. The
+// owner polls isDone() and takes the model, which is all it needs to do on
+// its own thread, with the GL upload. Starting another load or destroying
+// the loader cancels the one in flight.
+class ModelLoader
+{
+public:
+    ModelLoader();
+    ~ModelLoader();
+
+    void start(const std::string& filename, bool isUnitization = true);
+    // Waits until the thread has noticed, at most one texture decode
+    void cancel();
+
+    bool isLoading() const { return _thread.joinable(); }
+    bool isDone() const { return _isDone; }
+    const std::string& getFilename() const { return _filename; }
+    LoadProgress getProgress() const;
+    // The loaded model once done, NULL if it could not be read; the loader
+    // is idle afterwards
+    std::shared_ptr<Model> take();
+
+private:
+    ModelLoader(const ModelLoader&);
+    ModelLoader& operator=(const ModelLoader&);
+
+    std::thread            _thread;
+    std::string            _filename;
+    std::atomic<bool>      _isCancelled;
+    std::atomic<bool>      _isDone;
+    mutable std::mutex     _mutex;
+    LoadProgress           _progress;
+    std::shared_ptr<Model> _model;
+};
+
+void
+Unitize(std::vector<tinyobj::shape_t>& shapes);
+
+void
+ComputeBoundingSphere(const std::vector<tinyobj::shape_t>& shapes, Vec3& center, double& radius);
+
+} // namespace ov
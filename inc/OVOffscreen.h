@@ -0,0 +1,130 @@
+#pragma once
+
+#include "OVGL.h"
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "OVBatch.h"
+#include "OVCamera.h"
+#include "OVCommon.h"
+#include "OVDistortion.h"
+#include "OVModel.h"
+#include "OVRender.h"
+#include "OVTexture.h"
+
+namespace ov
+{
+
+enum OFFSCREEN_BACKEND
+{
+    OFFSCREEN_GPU,      // hardware context on a hidden window, frames go to a framebuffer object
+    OFFSCREEN_SOFTWARE, // GDI generic implementation drawing into a DIB section
+};
+
+// A GL context that needs no visible window. Everything except create()
+// must be called from the thread that created it.
+class OffscreenContext
+{
+public:
+    OffscreenContext();
+    ~OffscreenContext();
+
+    // The software backend cannot grow its bitmap, frames larger than
+    // maxWidth x maxHeight are rejected
+    bool create(int backend, int maxWidth, int maxHeight);
+    void destroy();
+    bool makeCurrent();
+    // Size the render target and viewport for the next frames
+    bool resize(int width, int height);
+
+    int getBackend() const { return _backend; }
+
+private:
+    typedef void   (APIENTRY *GenFunc)(GLsizei n, GLuint* ids);
+    typedef void   (APIENTRY *DeleteFunc)(GLsizei n, const GLuint* ids);
+    typedef void   (APIENTRY *BindFunc)(GLenum target, GLuint id);
+    typedef void   (APIENTRY *RenderbufferStorageFunc)(GLenum target, GLenum format, GLsizei width, GLsizei height);
+    typedef void   (APIENTRY *FramebufferRenderbufferFunc)(GLenum target, GLenum attachment, GLenum renderbufferTarget, GLuint renderbuffer);
+    typedef GLenum (APIENTRY *CheckFramebufferStatusFunc)(GLenum target);
+
+    bool createWindowContext();
+    bool createBitmapContext(int maxWidth, int maxHeight);
+    bool loadFramebufferFunctions();
+    void deleteFramebuffer();
+
+    int     _backend;
+    HWND    _window;
+    HDC     _dc;
+    HBITMAP _bitmap;
+    HGDIOBJ _oldBitmap;
+    HGLRC   _context;
+    int     _maxWidth;
+    int     _maxHeight;
+    int     _width;
+    int     _height;
+
+    // Framebuffer object of the GPU backend
+    GLuint _framebuffer;
+    GLuint _colorBuffer;
+    GLuint _depthBuffer;
+
+    GenFunc                     _glGenFramebuffers;
+    DeleteFunc                  _glDeleteFramebuffers;
+    BindFunc                    _glBindFramebuffer;
+    GenFunc                     _glGenRenderbuffers;
+    DeleteFunc                  _glDeleteRenderbuffers;
+    BindFunc                    _glBindRenderbuffer;
+    RenderbufferStorageFunc     _glRenderbufferStorage;
+    FramebufferRenderbufferFunc _glFramebufferRenderbuffer;
+    CheckFramebufferStatusFunc  _glCheckFramebufferStatus;
+};
+
+// Batch renderer for the command-line tool, draws like the canvas with a
+// zero offset pose. Cameras with distortion coefficients are rendered on
+// the larger undistorted canvas of their LensDistortion and warped back.
+class OffscreenRenderer : public BatchRenderer
+{
+public:
+    OffscreenRenderer();
+    ~OffscreenRenderer();
+
+    bool create(int backend, int maxWidth, int maxHeight);
+    bool makeCurrent() { return _context.makeCurrent(); }
+    // Of whose textures stay uploaded, see TextureCache::setMaxModels()
+    void setMaxModels(size_t maxModels) { _textures.setMaxModels(maxModels); }
+
+    virtual bool setModel(const std::shared_ptr<const Model>& model);
+    virtual bool setBackground(const cv::Mat& image);
+    virtual void setCamera(const CameraParameters& camera);
+    virtual bool render(const Mat3& R, const Vec3& t, cv::Mat& image);
+    virtual bool renderLayer(const Mat3& R, const Vec3& t, cv::Mat& image);
+    // Depth and mask come from the color pass's depth and stencil
+    // buffers, normals take a second pass without lighting or textures
+    virtual bool renderChannels(const Mat3& R, const Vec3& t, const ChannelOptions& options,
+                                cv::Mat& image, std::vector<cv::Mat>& channels);
+    // Of the canvas for a lens, which covers more than the frame
+    virtual bool getProjectionMatrix(double projectionMatrix[16]);
+
+private:
+    // A canvas of a lens into the camera's frame, frames pass through
+    void warp(cv::Mat& canvas, cv::Mat& image, int interpolation);
+    // The background as drawn: undistorted onto the canvas for a lens
+    bool uploadBackground();
+
+    OffscreenContext _context;
+    TextureCache     _textures;
+    Renderer         _renderer;   // draws the canvas of a lens, the frame otherwise
+
+    cv::Mat _background;
+    int     _width;  // of the frames
+    int     _height;
+
+    std::shared_ptr<const LensDistortion> _distortion; // none for a pinhole camera
+    CameraParameters                      _camera;
+    cv::Mat                               _canvas;     // undistorted frame of a lens
+    cv::Mat                               _depth;      // depth buffer of the last frame
+    cv::Mat                               _normals;    // colors of the normals pass
+};
+
+} // namespace ov
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "OVComposite.h"
+#include "OVSink.h"
+
+namespace ov
+{
+
+// Bounded lock-free multi-producer/multi-consumer queue.
+// Dmitry Vyukov's array based design: every cell carries a sequence number
+// telling producers and consumers whose turn it is.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        _cells.reset(new Cell[size]);
+        _mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        _enqueuePos.store(0, std::memory_order_relaxed);
+        _dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    bool tryPush(T& value)
+    {
+        size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = _cells[pos & _mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; // full
+            else
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool tryPop(T& value)
+    {
+        size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = _cells[pos & _mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; // empty
+            else
+                pos = _dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T                   value;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t                  _mask;
+    // Keep the two cursors on separate cache lines
+    alignas(64) std::atomic<size_t> _enqueuePos;
+    alignas(64) std::atomic<size_t> _dequeuePos;
+};
+
+// Blocks the threads waiting on a lock-free queue until another thread
+// notifies them. The condition is tested under the lock and notify()
+// takes it, so a change made just before notify() is never missed.
+class QueueSignal
+{
+public:
+    // isReady may pop or push, it is called until it returns true
+    template <typename Predicate>
+    void wait(Predicate isReady)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, isReady);
+    }
+    void notify()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+        }
+        _condition.notify_all();
+    }
+
+private:
+    std::mutex              _mutex;
+    std::condition_variable _condition;
+};
+
+// Seed of the noise of one frame, independent of the order frames are processed in
+uint64_t
+FrameSeed(int sequence, int frame);
+
+// A rendered frame on its way to the disk
+struct FrameJob
+{
+    FrameJob()
+        : index(0), blurSigma(0), noiseVariance(0), noiseSeed(0), inputHash(0), frameIndex(0),
+          isHalf(false), isClosingSink(false)
+    {
+        std::fill(pose, pose + PoseSize, 0.0);
+    }
+
+    int         index;          // assigned by the pipeline, defines the output order
+    cv::Mat     image;
+    double      blurSigma;
+    double      noiseVariance;
+    uint64_t    noiseSeed;
+    uint64_t    inputHash;      // passed to the written callback
+    std::string filename;
+    int         frameIndex;     // the frame's row, kept by containers
+    double      pose[PoseSize];
+    std::shared_ptr<FrameSink> sink;
+    // If set, image is the background it is composited over before the
+    // rest of the processing
+    std::shared_ptr<const ForegroundLayer> layer;
+    // Float images are written as float16, in CV_16U images
+    bool        isHalf;
+    // If set, the frame is a file written before, linked to by its filename
+    // once the frames pushed ahead of it are written; image stays empty
+    std::string linkTarget;
+    // If set, the job is no frame: the sink is closed once the frames
+    // pushed ahead of it are written, a failure counts as an error
+    bool        isClosingSink;
+};
+
+// Called on the writer thread after a frame is written to its sink
+typedef std::function<void(const std::string& filename, uint64_t inputHash, const std::vector<uchar>& data)> FrameWrittenCallback;
+// Called on the writer thread after a frame is linked to its target
+typedef std::function<void(const std::string& filename, uint64_t inputHash, const std::string& target)> FrameLinkedCallback;
+
+// Post-processes and writes rendered frames on a pool of worker threads.
+// The render thread only pushes frames; a bounded queue throttles it when
+// the workers fall behind. Frames are blurred, noised and encoded for their
+// sink in parallel, then handed to the sink by a single writer in the
+// order they were pushed. Workers stay a bounded number of frames ahead
+// of the writer, so a slow frame throttles the render thread too.
+class FramePipeline
+{
+public:
+    // numWorkers <= 0 uses all but one hardware thread
+    FramePipeline(int numWorkers = 0, int queueSize = 0);
+    ~FramePipeline();
+
+    // Set before the first frame is pushed
+    void setWrittenCallback(const FrameWrittenCallback& callback) { _writtenCallback = callback; }
+    void setLinkedCallback(const FrameLinkedCallback& callback) { _linkedCallback = callback; }
+    // Blocks while the queue is full
+    void push(FrameJob& job);
+    // Wait until every pushed frame has been written
+    void finish();
+
+    int getNumWorkers() const { return (int)_workers.size(); }
+    int getNumWritten() const { return _numWritten; }
+    int getNumLinked() const { return _numLinked; }
+    int getNumErrors() const { return _numErrors; }
+    int64_t getEncodedBytes() const { return _encodedBytes; }
+    // Wall time since the pipeline was created, until finish() returned
+    double getSeconds() const;
+    // Per-stage utilization since the pipeline was created
+    std::string getStats() const;
+
+private:
+    void workerLoop();
+    void writerLoop();
+
+    BoundedQueue<FrameJob>     _jobQueue;
+    BoundedQueue<EncodedFrame> _encodedQueue;
+    // The threads sleep on these while their queue is empty or full
+    QueueSignal                _jobPushed;
+    QueueSignal                _jobPopped;
+    QueueSignal                _framePushed;
+    QueueSignal                _framePopped;
+    QueueSignal                _frameWritten;
+    std::vector<std::thread>   _workers;
+    std::thread                _writer;
+    std::atomic<bool>          _isFinishing;
+    std::atomic<size_t>        _numWorkersDone;
+    int                        _nextIndex;
+    int                        _maxAhead;       // of a job's index over _numDone
+    std::atomic<int>           _numDone;        // frames the writer is done with, in order
+    std::atomic<int>           _numWritten;
+    std::atomic<int>           _numLinked;
+    std::atomic<int>           _numErrors;
+    FrameWrittenCallback       _writtenCallback;
+    FrameLinkedCallback        _linkedCallback;
+
+    // Busy time of every stage in microseconds
+    std::chrono::steady_clock::time_point _startTime;
+    std::chrono::steady_clock::time_point _finishTime;
+    std::atomic<int64_t> _stallTime;
+    std::atomic<int64_t> _augmentTime;
+    std::atomic<int64_t> _encodeTime;
+    std::atomic<int64_t> _writeTime;
+    std::atomic<int64_t> _encodedBytes;
+    std::atomic<int64_t> _rawBytes;     // frames before encoding
+};
+
+} // namespace ov
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace ov
+{
+
+enum PNG_ENCODER
+{
+    PNG_ENCODER_OPENCV, // libpng through cv::imencode
+    PNG_ENCODER_FAST    // PngEncoder below
+};
+
+// How the frames of a batch line are PNG encoded
+struct PngOptions
+{
+    PngOptions() : encoder(PNG_ENCODER_OPENCV), level(-1), strategy(cv::IMWRITE_PNG_STRATEGY_DEFAULT) {}
+
+    int encoder;
+    // OpenCV: zlib level 0-9, -1 for its default of level 1 with the Sub filter
+    // Fast:   0 stored, 1 Up filter and greedy matching (default),
+    //         2 best filter per row and a short match search
+    int level;
+    int strategy; // cv::IMWRITE_PNG_STRATEGY_*, OpenCV with a level only
+};
+
+// png=opencv|fast, png-level=N, png-strategy=default|filtered|huffman|rle|fixed
+bool
+ParsePngOption(const std::string& key, const std::string& value, PngOptions& options);
+
+// Frames larger than this are deflated in independent row bands in parallel
+const int PngBandBytes = 1 << 20;
+
+// A PNG encoder for 8-bit gray, BGR and BGRA frames that trades ratio for
+// speed: rows are filtered and deflated with the fixed Huffman code and a
+// single hash probe per position, in the spirit of fpng. Large frames are
+// split into row bands that are deflated in parallel and joined at byte
+// boundaries; the band count depends on the frame size only, so the
+// output does not depend on the machine. Keep one encoder per thread, its
+// buffers are reused from frame to frame.
+class PngEncoder
+{
+public:
+    bool encode(const cv::Mat& image, int level, std::vector<uchar>& png);
+
+private:
+    struct Band
+    {
+        int                  firstRow;
+        int                  numRows;
+        std::vector<uchar>   filtered;
+        std::vector<uchar>   deflated;
+        std::vector<int32_t> head;     // newest position of every hash
+        std::vector<int32_t> previous; // older positions with the same hash, level 2
+        std::vector<uchar>   row;      // the current row in PNG channel order
+        std::vector<uchar>   lastRow;
+        uint32_t             adler;
+    };
+
+    void encodeBand(const cv::Mat& image, int level, Band& band, bool isLast);
+
+    std::vector<Band> _bands;
+};
+
+// Encode with the line's settings; other depths fall back to OpenCV
+bool
+EncodePng(const cv::Mat& image, const PngOptions& options, PngEncoder& encoder, std::vector<uchar>& png);
+
+} // namespace ov
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "OVCommon.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+// A pose is 12 numbers: the rotation column by column, then the translation
+const int PoseSize = 12;
+
+void
+PoseToRt(const double* pose, Mat3& R, Vec3& t);
+
+// Binary pose files: a 24 byte header followed by the poses back to back
+//   char     magic[8];    "OVPOSES1"
+//   uint32_t scalarSize;  4 for float, 8 for double
+//   uint32_t reserved;
+//   uint64_t numPoses;
+struct PoseFileHeader
+{
+    char     magic[8];
+    uint32_t scalarSize;
+    uint32_t reserved;
+    uint64_t numPoses;
+};
+
+// Reads text or binary pose files one pose at a time from a mapped view,
+// without holding the parsed poses in memory. Text files have one pose per
+// line, numbers separated by white space; blank lines are skipped and
+// numbers after the twelfth are ignored.
+class PoseReader
+{
+public:
+    PoseReader();
+
+    bool open(const std::string& filename);
+    void close();
+
+    // False at the end of the file or on a malformed line, see hasError()
+    bool next(double pose[PoseSize]);
+    bool hasError() const { return _hasError; }
+    // Known up front for binary files only, -1 otherwise
+    int64_t getNumPoses() const { return _numPoses; }
+
+private:
+    bool nextText(double pose[PoseSize]);
+
+    std::string _filename;
+    MappedFile  _file;
+    const char* _cursor;
+    const char* _end;
+    bool        _isBinary;
+    uint32_t    _scalarSize;
+    int64_t     _numPoses;
+    int64_t     _index;
+    int         _line;
+    bool        _hasError;
+};
+
+// All poses of a file in one contiguous buffer, PoseSize values per pose
+bool
+LoadPoses(const std::string& filename, std::vector<double>& poses);
+
+bool
+LoadPoses(const std::string& filename, std::vector<float>& poses);
+
+// Write a pose file of either format in the binary format
+bool
+ConvertPoseFile(const std::string& inputFile, const std::string& outputFile, bool isFloat);
+
+} // namespace ov
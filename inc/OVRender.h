@@ -0,0 +1,183 @@
+#pragma once
+
+#include "OVGL.h"
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "OVCamera.h"
+#include "OVCommon.h"
+#include "OVModel.h"
+#include "TinyObjLoader.h"
+
+namespace ov
+{
+
+enum RENDER_MODE
+{
+    RENDER_SOLID,
+    RENDER_WIREFRAME,
+};
+
+// glBlendFuncSeparate (GL 1.4), an entry point of one context
+typedef void (APIENTRY *BlendFuncSeparateFunc)(GLenum srcColor, GLenum dstColor, GLenum srcAlpha, GLenum dstAlpha);
+
+// The context's glBlendFuncSeparate, NULL if its driver has none
+BlendFuncSeparateFunc
+GetBlendFuncSeparate();
+
+// Everything needed to draw one frame, independent of where it is drawn
+struct RenderParameters
+{
+    GLuint                                         backgroundTextureId;
+    const Model*                                   model;
+    const std::unordered_map<std::string, GLuint>* textureIds;
+    Mat3                                           R;
+    Vec3                                           t;
+    Vec3                                           offsetRotation;    // degrees
+    Vec3                                           offsetTranslation;
+    double                                         offsetScale;
+    int                                            renderMode;
+    bool                                           lightingOn;
+    bool                                           isTransparent; // no background, alpha is the coverage
+    int                                            maskMode;      // MASK_MODE, IDs go to the stencil buffer
+    BlendFuncSeparateFunc                          blendFuncSeparate; // of the current context, may be NULL
+};
+
+// Fixed state shared by every context that renders frames
+void
+InitRenderState();
+
+// Fill a column-major OpenGL projection matrix from pinhole intrinsics
+void
+BuildProjectionMatrix(const CameraParameters& camera,
+                      double planeNear,
+                      double planeFar,
+                      double projectionMatrix[16]);
+
+// Draw background and model with the projection matrix already loaded
+void
+RenderFrame(const RenderParameters& params);
+
+void
+DrawBackground(GLuint backgroundImageTextureId);
+
+void
+DrawForeground(const std::vector<tinyobj::shape_t>& shapes,
+               const std::vector<tinyobj::material_t>& materials,
+               const std::unordered_map<std::string, GLuint>& textureIds,
+               int maskMode = MASK_NONE);
+
+// Draw the model's eye space normals n as the colors (n + 1) / 2 over
+// black, with the projection matrix already loaded; the depth buffer is
+// the frame's again
+void
+RenderNormals(const RenderParameters& params);
+
+void
+UploadBackground(GLuint backgroundImageTextureId, const cv::Mat& image);
+
+// Read the BGR, or with 4 channels BGRA, pixels of the current viewport,
+// top row first; a continuous image of the viewport's size is filled in place
+void
+ReadPixels(cv::Mat& image, int channels = 3);
+
+// Read the depth buffer of the current viewport as floats in [0, 1], top
+// row first; 1 where nothing was drawn
+void
+ReadDepth(cv::Mat& depth);
+
+// Read the stencil buffer of the current viewport, top row first
+void
+ReadStencil(cv::Mat& mask);
+
+// Depth buffer values of a projection from BuildProjectionMatrix() to the
+// distance along the optical axis, 0 where nothing was drawn
+void
+LinearizeDepth(const cv::Mat& depth, double planeNear, double planeFar, cv::Mat& linear);
+
+// Colors of RenderNormals() to unit normals, x right, y down, z forward;
+// 0 where nothing was drawn, which the pass's depth buffer tells
+void
+DecodeNormals(const cv::Mat& colors, const cv::Mat& depth, cv::Mat& normals);
+
+// One scene and the camera it is seen through: model, background,
+// projection, viewport, offset pose and drawing options. Instances share
+// no state, so several can draw at the same time on different threads,
+// each with a GL context of its own current. The context is the caller's;
+// every call that touches GL needs it current.
+class Renderer
+{
+public:
+    Renderer();
+
+    // Render state, entry points and the background texture of the
+    // current context
+    void create();
+    // The background texture; model textures belong to whoever uploaded them
+    void destroy();
+
+    // The texture IDs are of the current context
+    void setModel(const std::shared_ptr<const Model>& model,
+                  const std::unordered_map<std::string, GLuint>& textureIds);
+    const std::shared_ptr<const Model>& getModel() const { return _model; }
+    // Uploads the image, its size is the default frame size
+    void setBackground(const cv::Mat& image);
+    const cv::Size& getBackgroundSize() const { return _backgroundSize; }
+
+    void setCamera(const CameraParameters& camera);
+    const CameraParameters& getCamera() const { return _camera; }
+    // Of the projection, applied to the camera set last and the next ones
+    void setPlanes(double planeNear, double planeFar);
+    double getPlaneNear() const { return _planeNear; }
+    double getPlaneFar() const { return _planeFar; }
+    // Column-major, zero until a camera is set
+    const double* getProjectionMatrix() const { return _projectionMatrix; }
+    bool hasCamera() const { return _projectionMatrix[11] != 0; }
+    // The viewport frames are drawn to, left as it is while 0
+    void setViewport(int width, int height);
+
+    // Rotations in degrees, applied after the pose, see RenderParameters
+    void setOffsetPose(const Vec3& r, const Vec3& t, double s);
+    void getOffsetPose(Vec3& r, Vec3& t, double& s) const;
+    void setRenderMode(int renderMode) { _renderMode = renderMode; }
+    void setLightingOn(bool lightingOn) { _lightingOn = lightingOn; }
+
+    // Draw one pose with the viewport and projection loaded first
+    void render(const Mat3& R, const Vec3& t, bool isTransparent = false, int maskMode = MASK_NONE) const;
+    // RenderNormals() of one pose, the depth buffer is the frame's again
+    void renderNormals(const Mat3& R, const Vec3& t) const;
+
+    // Diameter in pixels of the model's bounding sphere for a pose
+    double getScreenSize(const Mat3& R, const Vec3& t) const;
+
+private:
+    Renderer(const Renderer&);
+    Renderer& operator=(const Renderer&);
+
+    void loadProjection() const;
+    void fillParameters(const Mat3& R, const Vec3& t, RenderParameters& params) const;
+
+    std::shared_ptr<const Model>            _model;
+    std::unordered_map<std::string, GLuint> _textureIds;
+    GLuint                                  _backgroundTextureId;
+    cv::Size                                _backgroundSize;
+
+    CameraParameters _camera;
+    double           _planeNear;
+    double           _planeFar;
+    double           _projectionMatrix[16];
+    int              _viewportWidth;
+    int              _viewportHeight;
+
+    Vec3   _offsetRotation;
+    Vec3   _offsetTranslation;
+    double _offsetScale;
+    int    _renderMode;
+    bool   _lightingOn;
+
+    BlendFuncSeparateFunc _blendFuncSeparate; // of the context create() ran in
+};
+
+} // namespace ov
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "OVBatch.h"
+#include "OVCamera.h"
+#include "OVCommon.h"
+#include "OVModel.h"
+
+namespace ov
+{
+
+// What a frame task of a RenderPool draws
+enum RENDER_TASK
+{
+    RENDER_TASK_FRAME,    // BatchRenderer::render()
+    RENDER_TASK_LAYER,    // BatchRenderer::renderLayer()
+    RENDER_TASK_CHANNELS  // BatchRenderer::renderChannels()
+};
+
+// Everything a line's frames are drawn with, read by every render thread
+struct RenderScene
+{
+    std::shared_ptr<const Model> model;
+    cv::Mat                      background;
+    CameraParameters             camera;
+};
+
+struct RenderResult
+{
+    RenderResult() : isOk(false) {}
+
+    bool                 isOk;     // false if the renderer could not draw the frame
+    cv::Mat              image;
+    std::vector<cv::Mat> channels; // of RENDER_TASK_CHANNELS, in FRAME_CHANNEL order
+};
+
+// Draws frames on several threads, each with a renderer, and so a GL
+// context, of its own made by the factory on that thread. The scene is
+// shared as CPU data, every renderer uploads the model's textures once.
+// Tasks are dealt round robin over per-thread deques; a thread takes from
+// the front of its own and steals from the back of the others' when it
+// runs out. The results are futures, the caller takes them in the order it
+// needs. Without threads the caller's renderer draws every task at once.
+class RenderPool
+{
+public:
+    // numThreads <= 1 draws on the calling thread
+    RenderPool(BatchRenderer& renderer, int numThreads, const RendererFactory& createRenderer);
+    ~RenderPool();
+
+    // For the tasks submitted from now on. The caller's renderer gets the
+    // camera in any case, for its model views and projection; false if it
+    // rejects the scene. Threads report their errors with the frames.
+    bool setScene(const std::shared_ptr<const RenderScene>& scene);
+    std::shared_future<RenderResult> submit(int type, const Mat3& R, const Vec3& t, const ChannelOptions& options);
+
+    int getNumThreads() const { return (int)_threads.size(); }
+
+private:
+    RenderPool(const RenderPool&);
+    RenderPool& operator=(const RenderPool&);
+
+    struct Task
+    {
+        int                                type;
+        Mat3                               R;
+        Vec3                               t;
+        ChannelOptions                     options;
+        std::shared_ptr<const RenderScene> scene;
+        std::promise<RenderResult>         promise;
+    };
+
+    struct TaskDeque
+    {
+        std::mutex                          mutex;
+        std::deque<std::shared_ptr<Task> >  tasks;
+    };
+
+    void run(int threadIndex);
+    // One of the tasks reserved by the caller, its own first
+    std::shared_ptr<Task> take(int threadIndex);
+    static void Draw(BatchRenderer& renderer, const Task& task, RenderResult& result);
+
+    BatchRenderer&                     _renderer;
+    RendererFactory                    _createRenderer;
+    std::shared_ptr<const RenderScene> _scene;
+
+    std::vector<std::unique_ptr<TaskDeque> > _deques;
+    std::vector<std::thread>                 _threads;
+    std::mutex                               _mutex;
+    std::condition_variable                  _condition;
+    std::condition_variable                  _submitted; // wakes take() after a missed round
+    int                                      _numQueued; // not reserved by a thread yet
+    uint64_t                                 _numSubmitted;
+    bool                                     _isStopping;
+    int                                      _nextDeque;
+};
+
+} // namespace ov
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "OVBatch.h"
+
+namespace ov
+{
+
+// A render server keeps models, textures and backgrounds resident and
+// renders pose batches for local clients over the named pipe
+// \\.\pipe\<name>. A client writes a request: ServerRequestHeader, the
+// model path, the background path and numPoses * PoseSize doubles. The
+// server answers with ServerResponseHeader, messageLength bytes of text
+// and, for SERVER_RESULT_INLINE, the BGR frames, top row first. Requests
+// of concurrent clients are queued and rendered together, grouped by
+// model and background; the render thread only draws, the augmentation
+// runs on the client's connection thread.
+const uint32_t ServerProtocolVersion = 1;
+const uint32_t ServerMaxPoses = 1 << 20;  // per request
+const uint32_t ServerMaxPathLength = 4096;
+const uint64_t ServerMaxFrameBytes = (uint64_t)1 << 31; // of all the frames of a request
+const uint32_t ServerMaxAssets = 16;     // models and backgrounds each kept resident
+
+enum SERVER_REQUEST
+{
+    SERVER_RENDER = 1,
+    SERVER_STATS  = 2, // the latency histograms as text
+    SERVER_STOP   = 3  // finish the queued requests and exit
+};
+
+enum SERVER_RESULT
+{
+    SERVER_RESULT_INLINE = 0, // frames follow the response on the pipe
+    SERVER_RESULT_SHARED = 1  // frames are in the named mapping of the response
+};
+
+struct ServerRequestHeader
+{
+    char     magic[4];         // "OVRQ"
+    uint32_t version;
+    uint32_t type;             // SERVER_REQUEST
+    uint32_t result;           // SERVER_RESULT
+    uint32_t numPoses;
+    uint32_t modelLength;      // bytes of the model path
+    uint32_t backgroundLength; // bytes of the background path, 0 for black frames
+    int32_t  width;            // of the camera, and of black frames
+    int32_t  height;
+    uint32_t reserved;
+    double   fx;
+    double   fy;
+    double   cx;
+    double   cy;
+    double   blurSigma;
+    double   noiseVariance;
+    uint64_t seed;             // frame i's noise is keyed by (seed, i)
+};
+
+struct ServerResponseHeader
+{
+    char     magic[4];        // "OVRS"
+    int32_t  status;          // 0 on success, else the message is the error
+    uint32_t numFrames;
+    int32_t  width;
+    int32_t  height;
+    int32_t  channels;
+    uint64_t frameBytes;
+    uint32_t messageLength;
+    uint32_t reserved;
+    char     mappingName[64]; // SERVER_RESULT_SHARED, valid until the client's next request
+};
+
+// Log-scale latency histogram, four buckets per power of two from one
+// microsecond up. Recording is lock-free.
+class LatencyHistogram
+{
+public:
+    static const int NumBuckets = 128;
+
+    LatencyHistogram();
+
+    void record(double seconds);
+    int64_t getCount() const { return _count.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the percentile, in seconds
+    double getPercentile(double percentile) const;
+    // "n=... p50=... p90=... p99=... max=..." in milliseconds
+    std::string summary() const;
+
+private:
+    std::atomic<int64_t> _buckets[NumBuckets];
+    std::atomic<int64_t> _count;
+    std::atomic<int64_t> _maxMicroseconds;
+};
+
+class RenderServer
+{
+public:
+    RenderServer(BatchRenderer& renderer, const std::string& name);
+    ~RenderServer();
+
+    // Serves until a client sends SERVER_STOP. Renders on the calling
+    // thread, which must own the renderer's context. The stats go to log
+    // every statsInterval seconds while requests come in.
+    bool run(double statsInterval, const std::function<void(const std::string&)>& log);
+
+    std::string getStats() const;
+
+private:
+    struct Connection;
+    struct Job;
+
+    RenderServer(const RenderServer&);
+    RenderServer& operator=(const RenderServer&);
+
+    void acceptClients(void* firstPipe);
+    void serveClient(Connection& connection);
+    bool handleRender(Connection& connection, const ServerRequestHeader& request,
+                      const std::chrono::steady_clock::time_point& received);
+    bool isStopping();
+    void renderJobs(std::vector<Job*>& jobs);
+    bool renderJob(Job& job);
+    void stop();
+
+    BatchRenderer& _renderer;
+    std::string    _name;
+    AssetCache     _assets;
+
+    // Render thread state, so unchanged assets are not set again
+    std::shared_ptr<const Model> _currentModel;
+    std::string                  _currentBackground;
+    cv::Size                     _frameSize;
+
+    std::mutex              _mutex;
+    std::condition_variable _jobsChanged;
+    std::vector<Job*>       _jobs;
+    bool                    _isStopping;
+    bool                    _isAccepting;
+
+    std::thread                              _acceptThread;
+    std::mutex                               _connectionsMutex;
+    std::vector<std::unique_ptr<Connection>> _connections;
+    int                                      _numConnections;
+
+    LatencyHistogram     _queueLatency;  // received until the renderer takes it
+    LatencyHistogram     _renderLatency;
+    LatencyHistogram     _totalLatency;  // received until the response is written
+    std::atomic<int64_t> _numFrames;
+    std::atomic<int64_t> _numBatches;    // render thread wake-ups
+    std::atomic<int64_t> _numBatchedJobs;
+};
+
+} // namespace ov
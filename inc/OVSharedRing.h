@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <stdint.h>
+#include "OVCamera.h"
+#include "OVPose.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+// Frames published through a named shared memory ring, for a consumer on
+// the same machine that reads them in place instead of decoding files.
+// One producer, up to SharedRingMaxReaders readers; every reader sees
+// every frame published after it attached. The producer waits for
+// attached readers that are a whole ring behind and never for readers
+// that are not there. No locks: the producer publishes with a release
+// store of the head, every reader owns its cursor.
+//
+// The mapping is the header, padded to SharedRingHeaderSize, followed by
+// numSlots slots of slotSize bytes. A slot is a SharedFrameHeader padded
+// to SharedFrameHeaderSize and the frame's BGR pixels, rows top down.
+const int      SharedRingMaxReaders = 16;
+const int      SharedRingHeaderSize = 4096;
+const int      SharedFrameHeaderSize = 256;
+const uint64_t SharedRingNone = ~0ULL; // a free reader cursor, a slot being written
+
+struct SharedRingCursor
+{
+    std::atomic<uint64_t> position; // next frame to read, SharedRingNone if free
+    char                  padding[56];
+};
+
+struct SharedRingHeader
+{
+    char                  magic[8];  // "OVRING01", written once the ring is ready
+    uint32_t              numSlots;
+    uint32_t              reserved;
+    uint64_t              slotSize;
+    uint64_t              totalSize;
+    alignas(64) std::atomic<uint64_t> head;     // frames published so far
+    std::atomic<uint32_t> isClosed;             // the producer is done
+    alignas(64) SharedRingCursor readers[SharedRingMaxReaders];
+};
+
+struct SharedFrameHeader
+{
+    std::atomic<uint64_t> sequence;  // the frame's number, SharedRingNone while written
+    int32_t               lineIndex; // of the batch file
+    int32_t               frameIndex;
+    int32_t               width;
+    int32_t               height;
+    int32_t               channels;
+    int32_t               depth;     // of the samples, CV_8U for color frames
+    uint64_t              dataSize;
+    uint64_t              inputHash;
+    double                pose[PoseSize];
+    double                fx;
+    double                fy;
+    double                cx;
+    double                cy;
+    int32_t               cameraWidth;
+    int32_t               cameraHeight;
+};
+
+// Spin a little, then yield, then sleep while polling the ring
+class Backoff
+{
+public:
+    Backoff() : _count(0) {}
+    void wait()
+    {
+        if (_count < 16)
+            ++_count;
+        else if (_count < 64)
+        {
+            ++_count;
+            std::this_thread::yield();
+        }
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    void reset() { _count = 0; }
+
+private:
+    int _count;
+};
+
+// The producer side; publish() is called from one thread only
+class SharedFrameRing
+{
+public:
+    // slotBytes of 0 sizes the slots by the first frame
+    SharedFrameRing(const std::string& name, int numSlots, uint64_t slotBytes, double readerTimeout);
+    ~SharedFrameRing();
+
+    // Waits while an attached reader still holds the slot; a reader that
+    // does not move for readerTimeout seconds is detached
+    bool publish(const SharedFrameHeader& metadata, const uchar* data, size_t size);
+
+private:
+    SharedFrameRing(const SharedFrameRing&);
+    SharedFrameRing& operator=(const SharedFrameRing&);
+
+    bool create(uint64_t frameBytes);
+    void waitForReaders(uint64_t sequence);
+
+    std::string       _name;
+    int               _numSlots;
+    uint64_t          _slotBytes;
+    double            _readerTimeout;
+    HANDLE            _mapping;
+    uchar*            _view;
+    SharedRingHeader* _header;
+    uint64_t          _head;
+};
+
+// The consumer side. Frames are read in place:
+//   while (const SharedFrameHeader* frame = reader.acquire())
+//   {
+//       cv::Mat image(frame->height, frame->width, CV_8UC3, (void*)reader.getPixels(frame));
+//       ...
+//       reader.release();
+//   }
+class SharedRingReader
+{
+public:
+    SharedRingReader();
+    ~SharedRingReader();
+
+    // Attaches at the next frame to be published; false while the ring
+    // is not there or has no free reader slot, which callers may retry
+    bool open(const std::string& name);
+    void close();
+
+    // The next frame, NULL while there is none
+    const SharedFrameHeader* acquire();
+    const uchar* getPixels(const SharedFrameHeader* frame) const { return (const uchar*)frame + SharedFrameHeaderSize; }
+    // Done with the acquired frame; false if it was overwritten meanwhile,
+    // which happens only if this reader was detached for being too slow
+    bool release();
+    // The producer has finished and every frame is read
+    bool isFinished() const;
+
+private:
+    SharedRingReader(const SharedRingReader&);
+    SharedRingReader& operator=(const SharedRingReader&);
+
+    SharedFrameHeader* getSlot(uint64_t sequence) const;
+    void reattach();
+
+    HANDLE            _mapping;
+    uchar*            _view;
+    SharedRingHeader* _header;
+    int               _index;
+    uint64_t          _position;
+};
+
+} // namespace ov
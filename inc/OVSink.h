@@ -0,0 +1,288 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "OVCamera.h"
+#include "OVPng.h"
+#include "OVPose.h"
+
+namespace ov
+{
+
+// Where the frames of a batch line go. PNG files, one per frame, are the
+// default; the containers keep a line's frames in a few large files.
+enum SINK_TYPE
+{
+    SINK_PNG,   // <output>/000000.png, ...
+    SINK_PACK,  // append-only frames plus an index of offsets and poses
+    SINK_TAR,   // tar archives of PNG files and their poses
+    SINK_RAW,   // fixed-size records of raw pixels, for memory mapping
+    SINK_SHM    // a shared memory ring read in place by another process
+};
+
+// How the workers encode a frame for its sink
+enum FRAME_ENCODING
+{
+    ENCODING_PNG,
+    ENCODING_PNG_FAST, // the fast encoder at level 1, whatever the line asks for
+    ENCODING_RAW       // BGR rows top down, no padding
+};
+
+// Containers start a new file once the current one would grow past this
+const int DefaultSinkShardMegabytes = 1024;
+
+// The optional key=value tokens of a batch line
+struct SinkOptions
+{
+    SinkOptions() : type(SINK_PNG), isCompressed(true), shardMegabytes(DefaultSinkShardMegabytes),
+                    ringName("ObjViewerFrames"), ringSlots(8), ringSlotMegabytes(0), ringTimeout(30) {}
+
+    int         type;
+    bool        isCompressed;      // pack frames as fast PNG or raw pixels
+    int         shardMegabytes;    // 0 keeps every frame of a line in one file
+    PngOptions  png;               // of png and tar sinks
+    std::string ringName;          // lines with the same name share the ring
+    int         ringSlots;
+    int         ringSlotMegabytes; // 0 sizes the slots by the first frame
+    double      ringTimeout;       // seconds before a stuck reader is detached
+};
+
+// sink=png|pack|tar|raw|shm, compression=fast|none, shard-mb=N,
+// shm-name=NAME, shm-slots=N, shm-slot-mb=N, shm-timeout=SEC and the
+// options of ParsePngOption()
+bool
+ParseSinkOption(const std::string& key, const std::string& value, SinkOptions& options);
+
+class FrameSink;
+
+// A post-processed frame on its way from a worker to the writer
+struct EncodedFrame
+{
+    EncodedFrame() : isClosingSink(false) {}
+
+    int                        index;      // pipeline order
+    int                        frameIndex; // pose of the batch line
+    uint64_t                   inputHash;
+    std::string                filename;   // the frame's file, or its name within a container
+    int                        width;
+    int                        height;
+    int                        channels;
+    int                        depth;      // of the samples: CV_8U, CV_16U (float16 too) or CV_32F
+    int                        encoding;
+    double                     pose[PoseSize];
+    std::shared_ptr<FrameSink> sink;
+    std::vector<uchar>         data;
+    std::string                linkTarget; // the frame is this file, data is empty
+    bool                       isClosingSink; // no frame, the sink is closed
+};
+
+// Receives the frames of one batch line, in order, on the pipeline's
+// writer thread. Frames hold a reference to their sink; the files are
+// completed by close() after the last frame. Destructors of sinks that
+// were not closed complete them as well, but cannot tell if they failed.
+class FrameSink
+{
+public:
+    virtual ~FrameSink() {}
+
+    virtual int getEncoding() const = 0;
+    virtual bool write(const EncodedFrame& frame) = 0;
+    // false if the files cannot be completed; no frames are written after
+    virtual bool close() { return true; }
+
+    // Read by the workers, set before the first frame
+    void setPngOptions(const PngOptions& options) { _pngOptions = options; }
+    const PngOptions& getPngOptions() const { return _pngOptions; }
+
+private:
+    PngOptions _pngOptions;
+};
+
+// Writes every frame to its own file
+class PngDirectorySink : public FrameSink
+{
+public:
+    virtual int getEncoding() const { return ENCODING_PNG; }
+    virtual bool write(const EncodedFrame& frame);
+};
+
+// Frames appended to <prefix>-00000.<extension>, -00001, ... A new file
+// is started when the next frame would not fit the shard size.
+class ContainerSink : public FrameSink
+{
+public:
+    ContainerSink(const std::string& dir, const std::string& prefix, const std::string& extension, int shardMegabytes);
+
+    virtual bool write(const EncodedFrame& frame);
+    // Derived destructors call this too, endShard() is gone by the time
+    // the base is destroyed
+    virtual bool close();
+
+protected:
+    // Called with the container open, shard by shard
+    virtual bool beginShard(const EncodedFrame& first) { return true; }
+    virtual bool writeFrame(const EncodedFrame& frame) = 0;
+    virtual bool endShard() { return true; }
+    // Bytes a frame adds to the container
+    virtual uint64_t getFrameSize(const EncodedFrame& frame) const { return frame.data.size(); }
+
+    std::string getShardFile(int shard, const std::string& extension) const;
+
+    std::ofstream _file;
+    uint64_t      _offset;    // bytes written to the current container
+    int           _shard;
+
+private:
+    bool openShard();
+    bool closeShard();
+
+    std::string _dir;
+    std::string _prefix;
+    std::string _extension;
+    uint64_t    _shardBytes;
+};
+
+// Pack files hold the encoded frames back to back. Their index, a .idx
+// file next to each pack, is a 16 byte header followed by one entry per
+// frame, appended after the frame:
+//   char     magic[8];   "OVPACKI1"
+//   uint32_t entrySize;  sizeof(PackIndexEntry)
+//   uint32_t reserved;
+struct PackIndexEntry
+{
+    uint64_t offset;
+    uint64_t size;
+    int32_t  frameIndex;
+    int32_t  width;
+    int32_t  height;
+    int32_t  channels;
+    uint32_t encoding;   // FRAME_ENCODING
+    uint32_t depth;      // of the samples, CV_8U = 0 in packs of color frames only
+    uint64_t inputHash;
+    double   pose[PoseSize];
+};
+
+class PackSink : public ContainerSink
+{
+public:
+    PackSink(const std::string& dir, const std::string& prefix, bool isCompressed, int shardMegabytes);
+    virtual ~PackSink() { close(); }
+
+    virtual int getEncoding() const { return _isCompressed ? ENCODING_PNG_FAST : ENCODING_RAW; }
+
+protected:
+    virtual bool beginShard(const EncodedFrame& first);
+    virtual bool writeFrame(const EncodedFrame& frame);
+    virtual bool endShard();
+
+private:
+    bool          _isCompressed;
+    std::ofstream _index;
+};
+
+// POSIX ustar archives: 000000.png and 000000.pose, the pose as text
+class TarSink : public ContainerSink
+{
+public:
+    TarSink(const std::string& dir, const std::string& prefix, int shardMegabytes);
+    virtual ~TarSink() { close(); }
+
+    virtual int getEncoding() const { return ENCODING_PNG; }
+
+protected:
+    virtual bool writeFrame(const EncodedFrame& frame);
+    virtual bool endShard();
+    virtual uint64_t getFrameSize(const EncodedFrame& frame) const;
+
+private:
+    bool writeEntry(const std::string& name, const void* data, size_t size);
+};
+
+// Raw files are a 64 byte header and fixed-size records, so frame k of a
+// file is at RawFramesHeaderSize + k * recordSize:
+//   char     magic[8];    "OVFRAMES"
+//   uint32_t width, height, channels;
+//   uint32_t recordSize;  multiple of 64
+//   uint64_t numFrames;   filled in when the file is complete, a reader of
+//                         a torn file can use the file size instead
+//   uint32_t depth;       of the samples, CV_8U = 0 in files of color frames
+// A record starts with a RawFrameRecord, the pixels follow at
+// RawRecordPrefixSize. All frames of a line have the background's size.
+const int RawFramesHeaderSize = 64;
+const int RawRecordPrefixSize = 128;
+
+struct RawFramesHeader
+{
+    char     magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t recordSize;
+    uint64_t numFrames;
+    uint32_t depth;
+};
+
+struct RawFrameRecord
+{
+    int64_t  frameIndex;
+    uint64_t inputHash;
+    double   pose[PoseSize];
+};
+
+class RawSink : public ContainerSink
+{
+public:
+    RawSink(const std::string& dir, const std::string& prefix, int shardMegabytes);
+    virtual ~RawSink() { close(); }
+
+    virtual int getEncoding() const { return ENCODING_RAW; }
+
+protected:
+    virtual bool beginShard(const EncodedFrame& first);
+    virtual bool writeFrame(const EncodedFrame& frame);
+    virtual bool endShard();
+    virtual uint64_t getFrameSize(const EncodedFrame& frame) const;
+
+private:
+    RawFramesHeader _header;    // of the current file, sized by its first frame
+};
+
+class SharedFrameRing;
+
+// Publishes raw frames with their pose and camera into a SharedFrameRing
+class SharedMemorySink : public FrameSink
+{
+public:
+    SharedMemorySink(const std::shared_ptr<SharedFrameRing>& ring, int lineIndex, const CameraParameters& camera);
+
+    virtual int getEncoding() const { return ENCODING_RAW; }
+    virtual bool write(const EncodedFrame& frame);
+
+private:
+    std::shared_ptr<SharedFrameRing> _ring;
+    int                              _lineIndex;
+    CameraParameters                 _camera;
+};
+
+// Makes the sinks of a batch run. Containers are named
+// <dir>frames<shard suffix>-00000.*, rings <name><shard suffix>; a ring
+// stays open until the factory and the last of its frames are gone.
+class SinkFactory
+{
+public:
+    explicit SinkFactory(const std::string& shardSuffix) : _shardSuffix(shardSuffix) {}
+
+    std::shared_ptr<FrameSink> create(const SinkOptions& options, const std::string& dir,
+                                      int lineIndex, const CameraParameters& camera);
+
+private:
+    std::string                                                       _shardSuffix;
+    std::unordered_map<std::string, std::shared_ptr<SharedFrameRing> > _rings;
+};
+
+} // namespace ov
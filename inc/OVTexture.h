@@ -1,18 +1,77 @@
 #pragma once
 
-#include <GL/gl.h>
+#include "OVGL.h"
 #include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
+#include <stdint.h>
 #include "TinyObjLoader.h"
 
+#ifndef GL_TEXTURE_BASE_LEVEL
+#define GL_TEXTURE_BASE_LEVEL 0x813C
+#endif
+
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+
 namespace ov
 {
 
+class TextureStreamer;
+
+// Decode the diffuse maps of the materials, keyed by texture name. progress
+// gets the number of maps decoded and their total after each one, returning
+// false stops decoding.
 bool
-LoadTextures(std::vector<tinyobj::material_t>& materials,
-             std::unordered_map<std::string, GLuint>& textureIds,
-             const std::string& dir);
+DecodeTextures(const std::vector<tinyobj::material_t>& materials,
+               std::unordered_map<std::string, cv::Mat>& textures,
+               const std::string& dir,
+               const std::function<bool(int, int)>& progress = std::function<bool(int, int)>());
+
+// Upload decoded textures to the current GL context. Large textures are
+// handed to the streamer when one is given.
+void
+UploadTextures(const std::unordered_map<std::string, cv::Mat>& textures,
+               std::unordered_map<std::string, GLuint>& textureIds,
+               const std::string& dir,
+               TextureStreamer* streamer = NULL);
+
+// Delete textures created by UploadTextures without a streamer
+void
+DeleteTextures(std::unordered_map<std::string, GLuint>& textureIds);
+
+// Uploads the textures of each model once per GL context, keyed by model
+// file name. Owned by the GL thread; clear() must run with the context current.
+class TextureCache
+{
+public:
+    TextureCache() : _maxModels(0), _useCount(0) {}
+
+    const std::unordered_map<std::string, GLuint>& get(const std::string& modelFile,
+                                                       const std::unordered_map<std::string, cv::Mat>& textures);
+    void clear();
+    // Textures of at most this many models stay, the least recently used
+    // are deleted first; 0 keeps all
+    void setMaxModels(size_t maxModels) { _maxModels = maxModels; }
+
+private:
+    struct Entry
+    {
+        std::unordered_map<std::string, GLuint> textureIds;
+        uint64_t                                lastUse;
+    };
+
+    std::unordered_map<std::string, Entry> _entries;
+    size_t                                 _maxModels;
+    uint64_t                               _useCount;
+};
 
 bool
 LoadTexture(cv::Mat& texture, const std::string& filename);
@@ -20,4 +79,87 @@ LoadTexture(cv::Mat& texture, const std::string& filename);
 bool
 LoadTGA(cv::Mat& texture, const std::string& filename);
 
+// Keeps very large textures partially resident. Only the coarse mip levels
+// are uploaded when a model is opened; finer levels are built on a worker
+// thread when the object covers enough pixels on screen, and dropped again
+// when they exceed the memory budget. They are built from the image decoded
+// when the model was opened, which is kept until the system runs low on
+// memory; after that the file is decoded again for every request.
+class TextureStreamer
+{
+public:
+    TextureStreamer();
+    ~TextureStreamer();
+
+    // Textures whose longer side exceeds this size are streamed
+    static int StreamingSize;
+    // Longer side of the finest level uploaded at open time
+    static int CoarseSize;
+    // Bytes of finer-than-coarse levels allowed to stay resident
+    static size_t MemoryBudget;
+
+    // Create a texture from the decoded level 0 image, which is not kept
+    // (GL thread only)
+    GLuint add(const std::string& filename, const cv::Mat& texture);
+    // Delete all streamed textures and drop pending work (GL thread only)
+    void clear();
+    // Request levels for the current on-screen size of the object in pixels,
+    // upload finished levels and evict under pressure (GL thread only)
+    void update(double screenSize);
+    // Called from the worker whenever new levels are ready to upload
+    void setReadyCallback(const std::function<void()>& callback) { _readyCallback = callback; }
+
+    size_t residentBytes() const { return _residentBytes; }
+
+private:
+    struct Texture
+    {
+        std::string filename;
+        GLuint      id;
+        int         width;
+        int         height;
+        int         format;
+        int         maxLevel;
+        int         coarseLevel;    // always resident
+        int         residentLevel;  // finest level on the GPU
+        int         requestedLevel; // finest level asked from the worker
+        int         neededLevel;    // finest level worth having on screen
+    };
+
+    struct Request
+    {
+        size_t      index;
+        int         level;
+        unsigned    generation;
+        std::string filename;
+        int         coarseLevel;
+    };
+
+    struct Result
+    {
+        size_t               index;
+        int                  level;
+        unsigned             generation;
+        std::vector<cv::Mat> levels; // levels [level, coarseLevel)
+    };
+
+    void workerLoop();
+    void evict(Texture& texture, int keepLevel);
+    size_t levelBytes(const Texture& texture, int level) const;
+    bool isUnderMemoryPressure() const;
+
+    std::vector<Texture> _textures;
+    size_t               _residentBytes;
+
+    std::thread             _worker;
+    std::mutex              _mutex;
+    std::condition_variable _condition;
+    std::deque<Request>     _requests;
+    std::vector<Result>     _results;
+    unsigned                _generation;
+    bool                    _isStopping;
+
+    std::function<void()> _readyCallback;
+};
+
 } // namespace ov
@@ -3,10 +3,19 @@
 #include <Eigen/Dense>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/opencv.hpp>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
 #include <cmath>
-#include <AtlBase.h>
+#include <stdint.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#ifndef OV_HEADLESS
 #include "ObjViewer.h"
+#endif
 #include "OVCommon.h"
 
 namespace ov
@@ -14,14 +23,6 @@ namespace ov
 
 #define TRACKBALLSIZE 0.8
 
-#ifndef GL_BGR
-#define GL_BGR GL_BGR_EXT
-#endif
-
-#ifndef GL_BGRA
-#define GL_BGRA GL_BGRA_EXT
-#endif
-
 std::string
 GetFileName(const std::string& s);
 
@@ -46,11 +47,13 @@ FromRotationMatirxToAxisAngle(const Mat3& R);
 Mat3
 FromAxisAngleToRotationMatrix(const Vec3& r);
 
+#ifndef OV_HEADLESS
 wxCheckBox*
 CreateCheckBoxAndAddToSizer(wxWindow* parent,
                             wxSizer *sizer,
                             wxString labelStr,
                             wxWindowID id);
+#endif
 
 Mat
 LoadMatrix(std::string fileName);
@@ -64,4 +67,37 @@ IsDirectoryExists(std::string dirName);
 void
 CreateDirectorys(std::string path);
 
+// Size and last write time of a file, the time in 100 ns ticks; false
+// if there is no such file
+bool
+GetFileStatus(const std::string& filename, uint64_t& size, uint64_t& writeTime);
+
+// Make link the same file as target: a hard link where the file system
+// allows it, a copy otherwise. A file at link is replaced, not written through.
+bool
+LinkFile(const std::string& target, const std::string& link);
+
+// Read-only view of a whole file
+class MappedFile
+{
+public:
+    MappedFile() : _file(INVALID_HANDLE_VALUE), _mapping(NULL), _data(NULL), _size(0) {}
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& filename);
+    void close();
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    HANDLE      _file;
+    HANDLE      _mapping;
+    const char* _data;
+    size_t      _size;
+};
+
 } // namespace ov
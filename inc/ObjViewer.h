@@ -13,24 +13,24 @@
 
 #define wxUSE_GUI 1
 
+#include <atomic>
 #include <fstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include <opencv2/opencv.hpp>
 #include <wx/tglbtn.h>
+#include <wx/timer.h>
+#include "OVBatch.h"
 #include "OVCanvas.h"
+#include "OVModel.h"
+#include "OVRender.h"
 
 
 namespace ov
 {
 
 
-enum RENDER_MODE
-{
-    RENDER_SOLID,
-    RENDER_WIREFRAME,
-};
-
 enum WINDOW_ID
 {
     ID_ANY = -1,
@@ -38,12 +38,16 @@ enum WINDOW_ID
     ID_MENU_OPEN_BACKGROUND_IMAGE,
     ID_MENU_SAVE_IMAGE,
     ID_MENU_GEN_SEQ,
+    ID_MENU_CANCEL_LOAD,
+    ID_MENU_CANCEL_GEN_SEQ,
     ID_MENU_EXIT,
     ID_MENU_HELP,
     ID_CANVAS,
     ID_RENDER_MODE_RADIO,
     ID_RESET,
     ID_LIGHTING,
+    ID_CANCEL_GEN_SEQ,
+    ID_LOAD_TIMER,
 };
 
 
@@ -61,7 +65,10 @@ class ObjViewer : public wxFrame
     void onMenuFileSaveImage(wxCommandEvent& evt);
     void onMenuGenerateSequence(wxCommandEvent& evt);
     void onMenuFileExit(wxCommandEvent& evt);
+    void onMenuCancelLoad(wxCommandEvent& evt);
+    void onCancelGenerateSequence(wxCommandEvent& evt);
     void onMenuHelpAbout(wxCommandEvent& evt);
+    void onLoadTimer(wxTimerEvent& evt);
     void onRenderModeRadio(wxCommandEvent& evt);
     void onLightingCheck(wxCommandEvent& evt);
     void onReset(wxCommandEvent& evt);
@@ -69,17 +76,29 @@ class ObjViewer : public wxFrame
 
   private:  
     void reLayout();
+    void cancelModelLoad();
+    // Called on the GUI thread once the batch worker is done
+    void onSequenceGenerated(const BatchStats& stats, bool isOk);
 
     wxBoxSizer*           _mainSizer;
 
     // ================== Canvas part ==================
     OVCanvas*             _ovCanvas;
+    // Models are loaded on a worker, the timer shows the progress and
+    // installs the model when it is done
+    ModelLoader           _modelLoader;
+    wxTimer               _loadTimer;
+    // Sequences are generated on a worker with a render target of its own,
+    // it posts the progress and stops at the next frame when cancelled
+    std::thread           _batchThread;
+    std::atomic<bool>     _isBatchCancelled;
 
     // ================== Controller part ==================
     wxBoxSizer*           _controllerSizer;
     wxRadioBox*           _renderModeRadioBox;
     wxButton*             _resetButton;
     wxCheckBox*           _lightingCheckBox;
+    wxButton*             _cancelGenSeqButton;
 
     // Some options
     int  _renderMode;
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include "OVAnnotation.h"
+#include "OVDistortion.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+Mat4
+ComposeModelView(const Vec3& offsetRotation, const Vec3& offsetTranslation, double offsetScale,
+                 const Mat3& R, const Vec3& t)
+{
+    // glTranslate, glRotate about z, y and x, glScale, then the pose
+    const double toRadians = CV_PI / 180;
+    Mat3 rotation = (Eigen::AngleAxisd(offsetRotation[2] * toRadians, Vec3::UnitZ())
+                     * Eigen::AngleAxisd(offsetRotation[1] * toRadians, Vec3::UnitY())
+                     * Eigen::AngleAxisd(offsetRotation[0] * toRadians, Vec3::UnitX())).toRotationMatrix();
+    Mat4 modelView = Mat4::Identity();
+    modelView.topLeftCorner<3, 3>() = offsetScale * rotation * R;
+    modelView.topRightCorner<3, 1>() = offsetScale * rotation * t + offsetTranslation;
+    return modelView;
+}
+
+bool
+IsSphereInFrustum(const double projectionMatrix[16], const Mat4& modelView, const Vec3& center, double radius)
+{
+    Mat4 projection = Eigen::Map<const Mat4>(projectionMatrix);
+    Mat4 clip = projection * modelView;
+    // Scales of the model view stretch the radius; the larger one is safe
+    double scale = modelView.topLeftCorner<3, 3>().colwise().norm().maxCoeff();
+
+    // The six planes, w + x, w - x, w + y, ... >= 0 inside
+    for (int i = 0; i < 6; ++i)
+    {
+        Vec4 plane = clip.row(3).transpose() + (i % 2 == 0 ? 1.0 : -1.0) * clip.row(i / 2).transpose();
+        double norm = (projection.row(3) + (i % 2 == 0 ? 1.0 : -1.0) * projection.row(i / 2)).head<3>().norm();
+        if (norm > 0 && plane.head<3>().dot(center) + plane[3] < -radius * scale * norm)
+            return false;
+    }
+    return true;
+}
+
+void
+FrameAnnotator::setModel(const std::shared_ptr<const Model>& model, const std::shared_ptr<const MeshBvh>& bvh)
+{
+    _bvh = bvh;
+    if (model == _model)
+        return;
+    _model = model;
+
+    size_t numVertices = 0;
+    for (size_t i = 0; i < model->shapes.size(); ++i)
+        numVertices += model->shapes[i].mesh.positions.size() / 3;
+    _x.resize(numVertices);
+    _y.resize(numVertices);
+    _z.resize(numVertices);
+
+    int k = 0;
+    for (size_t i = 0; i < model->shapes.size(); ++i)
+    {
+        const std::vector<float>& positions = model->shapes[i].mesh.positions;
+        for (size_t j = 0; j + 2 < positions.size(); j += 3, ++k)
+        {
+            _x[k] = positions[j];
+            _y[k] = positions[j + 1];
+            _z[k] = positions[j + 2];
+        }
+    }
+}
+
+bool
+FrameAnnotator::loadKeypoints(const std::string& filename)
+{
+    Mat keypoints = LoadMatrix(filename);
+    if (keypoints.rows() == 0 || keypoints.cols() != 3)
+        return false;
+    _keypoints = keypoints.transpose();
+    return true;
+}
+
+// Pixel positions of camera space points, whatever their z
+static void
+Project(const Eigen::ArrayXf& x, const Eigen::ArrayXf& y, const Eigen::ArrayXf& z,
+        const CameraParameters& camera, Eigen::ArrayXf& u, Eigen::ArrayXf& v)
+{
+    if (!HasDistortion(camera))
+    {
+        u = (float)camera.fx * x / z + (float)camera.cx;
+        v = (float)camera.fy * y / z + (float)camera.cy;
+        return;
+    }
+
+    int n = (int)x.size();
+    cv::Mat points(n, 1, CV_32FC3);
+    for (int i = 0; i < n; ++i)
+    {
+        float* p = points.ptr<float>(i);
+        p[0] = x[i];
+        p[1] = y[i];
+        p[2] = z[i];
+    }
+    cv::Mat K = cv::Mat::eye(3, 3, CV_64F);
+    K.at<double>(0, 0) = camera.fx;
+    K.at<double>(1, 1) = camera.fy;
+    K.at<double>(0, 2) = camera.cx;
+    K.at<double>(1, 2) = camera.cy;
+    cv::Mat D((int)camera.distortion.size(), 1, CV_64F, (void*)camera.distortion.data());
+    cv::Mat zero = cv::Mat::zeros(3, 1, CV_64F);
+    cv::Mat pixels;
+    cv::projectPoints(points, zero, zero, K, D, pixels);
+
+    u.resize(n);
+    v.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        const float* p = pixels.ptr<float>(i);
+        u[i] = p[0];
+        v[i] = p[1];
+    }
+}
+
+// Camera space coordinates of model space points
+static void
+Transform(const Mat4& modelView, const Mat3X& points, Eigen::ArrayXf& x, Eigen::ArrayXf& y, Eigen::ArrayXf& z)
+{
+    Mat3X camera = (modelView.topLeftCorner<3, 3>() * points).colwise() + modelView.topRightCorner<3, 1>();
+    x = camera.row(0).transpose().cast<float>().array();
+    y = camera.row(1).transpose().cast<float>().array();
+    z = camera.row(2).transpose().cast<float>().array();
+}
+
+static bool
+IsInFrame(float u, float v, const CameraParameters& camera)
+{
+    return u >= 0 && v >= 0 && u < camera.width && v < camera.height;
+}
+
+void
+FrameAnnotator::annotate(const Mat4& modelView, FrameAnnotation& annotation) const
+{
+    Eigen::Matrix4f m = modelView.cast<float>();
+
+    // Camera space, one fused loop over the vertices per coordinate
+    Eigen::ArrayXf x = m(0, 0) * _x + m(0, 1) * _y + m(0, 2) * _z + m(0, 3);
+    Eigen::ArrayXf y = m(1, 0) * _x + m(1, 1) * _y + m(1, 2) * _z + m(1, 3);
+    Eigen::ArrayXf z = m(2, 0) * _x + m(2, 1) * _y + m(2, 2) * _z + m(2, 3);
+    Eigen::ArrayXf u, v;
+    Project(x, y, z, _camera, u, v);
+
+    const float inf = std::numeric_limits<float>::infinity();
+    annotation.isVisible = false;
+    annotation.box[0] = annotation.box[1] = annotation.box[2] = annotation.box[3] = 0;
+    if (x.size() > 0 && (z > 0).any())
+    {
+        float x0 = std::max((z > 0).select(u, inf).minCoeff(), 0.0f);
+        float y0 = std::max((z > 0).select(v, inf).minCoeff(), 0.0f);
+        float x1 = std::min((z > 0).select(u, -inf).maxCoeff(), (float)_camera.width);
+        float y1 = std::min((z > 0).select(v, -inf).maxCoeff(), (float)_camera.height);
+        if (x0 < x1 && y0 < y1)
+        {
+            annotation.isVisible = true;
+            annotation.box[0] = x0;
+            annotation.box[1] = y0;
+            annotation.box[2] = x1;
+            annotation.box[3] = y1;
+        }
+    }
+
+    // The camera center in model units
+    Vec3 center = -modelView.topLeftCorner<3, 3>().inverse() * modelView.topRightCorner<3, 1>();
+    std::vector<byte> isUnoccluded;
+
+    const Mat3X& samples = _bvh->getSurfaceSamples();
+    int numSamples = (int)samples.cols();
+    annotation.visibleRatio = 0;
+    if (numSamples > 0)
+    {
+        Eigen::ArrayXf sx, sy, sz;
+        Transform(modelView, samples, sx, sy, sz);
+        Project(sx, sy, sz, _camera, u, v);
+        isUnoccluded.resize(numSamples);
+        _bvh->testVisibility(center, samples, isUnoccluded.data());
+        int numVisible = 0;
+        for (int i = 0; i < numSamples; ++i)
+            numVisible += isUnoccluded[i] && sz[i] > 0 && IsInFrame(u[i], v[i], _camera);
+        annotation.visibleRatio = (float)numVisible / numSamples;
+    }
+
+    int numKeypoints = (int)_keypoints.cols();
+    annotation.keypoints.resize(numKeypoints);
+    annotation.isInFront.resize(numKeypoints);
+    annotation.isKeypointVisible.resize(numKeypoints);
+    if (numKeypoints == 0)
+        return;
+    Eigen::ArrayXf kx, ky, kz;
+    Transform(modelView, _keypoints, kx, ky, kz);
+    Project(kx, ky, kz, _camera, u, v);
+    isUnoccluded.resize(numKeypoints);
+    _bvh->testVisibility(center, _keypoints, isUnoccluded.data());
+    for (int i = 0; i < numKeypoints; ++i)
+    {
+        annotation.keypoints[i] = cv::Point2f(u[i], v[i]);
+        annotation.isInFront[i] = kz[i] > 0;
+        annotation.isKeypointVisible[i] = isUnoccluded[i] && kz[i] > 0 && IsInFrame(u[i], v[i], _camera);
+    }
+}
+
+std::string
+FormatAnnotation(int frameIndex, const std::string& filename, const FrameAnnotation& annotation)
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(2)
+       << "{\"frame\":" << frameIndex << ",\"file\":\"" << filename << "\",\"bbox\":";
+    if (annotation.isVisible)
+    {
+        ss << "[" << annotation.box[0] << "," << annotation.box[1] << ","
+           << annotation.box[2] << "," << annotation.box[3] << "]";
+    }
+    else
+        ss << "null";
+    ss << ",\"visible_ratio\":" << annotation.visibleRatio;
+
+    if (!annotation.keypoints.empty())
+    {
+        ss << ",\"keypoints\":[";
+        for (size_t i = 0; i < annotation.keypoints.size(); ++i)
+        {
+            if (i > 0)
+                ss << ",";
+            if (annotation.isInFront[i])
+                ss << "[" << annotation.keypoints[i].x << "," << annotation.keypoints[i].y << "]";
+            else
+                ss << "null";
+        }
+        ss << "],\"keypoints_visible\":[";
+        for (size_t i = 0; i < annotation.isKeypointVisible.size(); ++i)
+            ss << (i > 0 ? "," : "") << (annotation.isKeypointVisible[i] ? 1 : 0);
+        ss << "]";
+    }
+    ss << "}";
+    return ss.str();
+}
+
+} // namespace ov
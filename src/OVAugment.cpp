@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <vector>
+#include "OVAugment.h"
+
+namespace ov
+{
+
+static uint64_t
+Mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void
+GaussianPair(uint64_t seed, uint64_t counter, float& n0, float& n1)
+{
+    uint64_t bits = Mix64(seed + (counter + 1) * 0x9E3779B97F4A7C15ULL);
+
+    // Box-Muller on two 32 bit uniforms, u1 in (0, 1] keeps the log finite
+    double u1 = ((bits >> 32) + 1.0) / 4294967296.0;
+    double u2 = (bits & 0xFFFFFFFFULL) / 4294967296.0;
+    double r = std::sqrt(-2.0 * std::log(u1));
+    double theta = 6.283185307179586 * u2;
+    n0 = (float)(r * std::cos(theta));
+    n1 = (float)(r * std::sin(theta));
+}
+
+// Index of a sample outside [0, length) mirrored like BORDER_REFLECT_101
+static int
+Reflect101(int p, int length)
+{
+    if (length == 1)
+        return 0;
+    while (p < 0 || p >= length)
+        p = p < 0 ? -p : 2 * length - p - 2;
+    return p;
+}
+
+// State shared by the bands of one frame
+struct AugmentContext
+{
+    int      rowLength;     // samples per row
+    double   noiseSigma;
+    uint64_t seed;
+    std::mutex mutex;
+    int      minValue;
+    int      maxValue;
+};
+
+// Last step of every sample: round the blurred value, add the noise and
+// keep track of the range for the normalization
+static void
+FinishSamples(const float* blurred, uchar* out, int count, uint64_t firstIndex, AugmentContext& context,
+              int& minValue, int& maxValue)
+{
+    if (context.noiseSigma == 0)
+    {
+        for (int i = 0; i < count; ++i)
+            out[i] = cv::saturate_cast<uchar>(blurred[i]);
+        return;
+    }
+
+    float n[2];
+    uint64_t index = firstIndex;
+    if (index & 1)
+        GaussianPair(context.seed, index >> 1, n[0], n[1]);
+    for (int i = 0; i < count; ++i, ++index)
+    {
+        if ((index & 1) == 0)
+            GaussianPair(context.seed, index >> 1, n[0], n[1]);
+
+        // The noise used to be filled into an 8 bit image, which clips
+        // the negative half; that is kept so outputs stay comparable
+        int noise = std::max(0, cvRound(n[index & 1] * context.noiseSigma));
+        int value = std::min(255, (int)cv::saturate_cast<uchar>(blurred[i]) + std::min(255, noise));
+        out[i] = (uchar)value;
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+}
+
+static void
+MergeRange(AugmentContext& context, int minValue, int maxValue)
+{
+    std::lock_guard<std::mutex> lock(context.mutex);
+    context.minValue = std::min(context.minValue, minValue);
+    context.maxValue = std::max(context.maxValue, maxValue);
+}
+
+// Rows of a separable Gaussian: vertical then horizontal taps into a
+// per-band row buffer, finished straight into the output
+class SeparableBlurBody : public cv::ParallelLoopBody
+{
+public:
+    SeparableBlurBody(const cv::Mat& src, cv::Mat& dst, const std::vector<float>& kernel, AugmentContext& context)
+        : _src(src), _dst(dst), _kernel(kernel), _context(context)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        int radius = (int)_kernel.size() / 2;
+        int width = _src.cols;
+        int channels = _src.channels();
+        int rowLength = _context.rowLength;
+        std::vector<float> column((width + 2 * radius) * channels);
+        std::vector<float> blurred(rowLength);
+        int minValue = 255, maxValue = 0;
+
+        for (int y = range.start; y < range.end; ++y)
+        {
+            // Vertical pass into the middle of the padded row
+            float* center = column.data() + radius * channels;
+            for (int i = 0; i < rowLength; ++i)
+                center[i] = 0;
+            for (int k = -radius; k <= radius; ++k)
+            {
+                const uchar* row = _src.ptr<uchar>(Reflect101(y + k, _src.rows));
+                float w = _kernel[k + radius];
+                for (int i = 0; i < rowLength; ++i)
+                    center[i] += w * row[i];
+            }
+            for (int x = 1; x <= radius; ++x)
+            {
+                int left = Reflect101(-x, width);
+                int right = Reflect101(width - 1 + x, width);
+                for (int c = 0; c < channels; ++c)
+                {
+                    center[-x * channels + c] = center[left * channels + c];
+                    center[(width - 1 + x) * channels + c] = center[right * channels + c];
+                }
+            }
+
+            // Horizontal pass
+            for (int i = 0; i < rowLength; ++i)
+            {
+                float sum = 0;
+                for (int k = -radius; k <= radius; ++k)
+                    sum += _kernel[k + radius] * center[i + k * channels];
+                blurred[i] = sum;
+            }
+
+            FinishSamples(blurred.data(), _dst.ptr<uchar>(y), rowLength, (uint64_t)y * rowLength,
+                          _context, minValue, maxValue);
+        }
+        MergeRange(_context, minValue, maxValue);
+    }
+
+private:
+    const cv::Mat&            _src;
+    cv::Mat&                  _dst;
+    const std::vector<float>& _kernel;
+    AugmentContext&           _context;
+};
+
+// Young and van Vliet's recursive Gaussian
+struct RecursiveCoefficients
+{
+    float B, b1, b2, b3;
+};
+
+static RecursiveCoefficients
+GetRecursiveCoefficients(double sigma)
+{
+    double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330
+                            : 3.97156 - 4.14554 * std::sqrt(1 - 0.26891 * sigma);
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+    RecursiveCoefficients c;
+    c.b1 = (float)((2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q) / b0);
+    c.b2 = (float)(-(1.4281 * q * q + 1.26661 * q * q * q) / b0);
+    c.b3 = (float)(0.422205 * q * q * q / b0);
+    c.B = 1 - (c.b1 + c.b2 + c.b3);
+    return c;
+}
+
+// Forward and backward recursion along the rows into the float buffer
+class RecursiveRowBody : public cv::ParallelLoopBody
+{
+public:
+    RecursiveRowBody(const cv::Mat& src, cv::Mat& buffer, const RecursiveCoefficients& c)
+        : _src(src), _buffer(buffer), _c(c)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        int width = _src.cols;
+        int channels = _src.channels();
+        for (int y = range.start; y < range.end; ++y)
+        {
+            const uchar* in = _src.ptr<uchar>(y);
+            float* out = _buffer.ptr<float>(y);
+            for (int ch = 0; ch < channels; ++ch)
+            {
+                float w1 = in[ch], w2 = w1, w3 = w1;
+                for (int x = 0; x < width; ++x)
+                {
+                    float w = _c.B * in[x * channels + ch] + _c.b1 * w1 + _c.b2 * w2 + _c.b3 * w3;
+                    out[x * channels + ch] = w;
+                    w3 = w2;
+                    w2 = w1;
+                    w1 = w;
+                }
+                w2 = w3 = w1;
+                for (int x = width - 1; x >= 0; --x)
+                {
+                    float v = _c.B * out[x * channels + ch] + _c.b1 * w1 + _c.b2 * w2 + _c.b3 * w3;
+                    out[x * channels + ch] = v;
+                    w3 = w2;
+                    w2 = w1;
+                    w1 = v;
+                }
+            }
+        }
+    }
+
+private:
+    const cv::Mat&               _src;
+    cv::Mat&                     _buffer;
+    const RecursiveCoefficients& _c;
+};
+
+// Recursion down and up strips of columns; the upward pass is the last
+// time a sample is touched, so it is finished right there
+class RecursiveColumnBody : public cv::ParallelLoopBody
+{
+public:
+    static const int StripLength = 64;
+
+    RecursiveColumnBody(cv::Mat& buffer, cv::Mat& dst, const RecursiveCoefficients& c, AugmentContext& context)
+        : _buffer(buffer), _dst(dst), _c(c), _context(context)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        int rowLength = _context.rowLength;
+        int rows = _buffer.rows;
+        std::vector<float> w1(StripLength), w2(StripLength), w3(StripLength);
+        int minValue = 255, maxValue = 0;
+
+        for (int strip = range.start; strip < range.end; ++strip)
+        {
+            int begin = strip * StripLength;
+            int count = std::min(StripLength, rowLength - begin);
+
+            const float* first = _buffer.ptr<float>(0) + begin;
+            for (int i = 0; i < count; ++i)
+                w1[i] = w2[i] = w3[i] = first[i];
+            for (int y = 0; y < rows; ++y)
+            {
+                float* row = _buffer.ptr<float>(y) + begin;
+                for (int i = 0; i < count; ++i)
+                {
+                    float w = _c.B * row[i] + _c.b1 * w1[i] + _c.b2 * w2[i] + _c.b3 * w3[i];
+                    row[i] = w;
+                    w3[i] = w2[i];
+                    w2[i] = w1[i];
+                    w1[i] = w;
+                }
+            }
+
+            for (int i = 0; i < count; ++i)
+                w2[i] = w3[i] = w1[i];
+            for (int y = rows - 1; y >= 0; --y)
+            {
+                float* row = _buffer.ptr<float>(y) + begin;
+                for (int i = 0; i < count; ++i)
+                {
+                    float v = _c.B * row[i] + _c.b1 * w1[i] + _c.b2 * w2[i] + _c.b3 * w3[i];
+                    row[i] = v;
+                    w3[i] = w2[i];
+                    w2[i] = w1[i];
+                    w1[i] = v;
+                }
+                FinishSamples(row, _dst.ptr<uchar>(y) + begin, count, (uint64_t)y * rowLength + begin,
+                              _context, minValue, maxValue);
+            }
+        }
+        MergeRange(_context, minValue, maxValue);
+    }
+
+private:
+    cv::Mat&                     _buffer;
+    cv::Mat&                     _dst;
+    const RecursiveCoefficients& _c;
+    AugmentContext&              _context;
+};
+
+void
+AugmentFrame(cv::Mat& image, double blurSigma, double noiseVariance, uint64_t seed)
+{
+    if (image.empty() || (blurSigma == 0 && noiseVariance == 0))
+        return;
+    CV_Assert(image.depth() == CV_8U && image.isContinuous());
+
+    AugmentContext context;
+    context.rowLength = image.cols * image.channels();
+    context.noiseSigma = noiseVariance;
+    context.seed = seed;
+    context.minValue = 255;
+    context.maxValue = 0;
+
+    cv::Mat output(image.size(), image.type());
+    if (blurSigma > RecursiveBlurSigma)
+    {
+        RecursiveCoefficients c = GetRecursiveCoefficients(blurSigma);
+        cv::Mat buffer(image.size(), CV_MAKETYPE(CV_32F, image.channels()));
+        cv::parallel_for_(cv::Range(0, image.rows), RecursiveRowBody(image, buffer, c));
+        int numStrips = (context.rowLength + RecursiveColumnBody::StripLength - 1) / RecursiveColumnBody::StripLength;
+        cv::parallel_for_(cv::Range(0, numStrips), RecursiveColumnBody(buffer, output, c, context));
+    }
+    else
+    {
+        // Same kernel size as cv::GaussianBlur picks for 8 bit images
+        std::vector<float> kernel(1, 1.f);
+        if (blurSigma > 0)
+        {
+            int size = cvRound(blurSigma * 3 * 2 + 1) | 1;
+            kernel.resize(size);
+            double sum = 0;
+            for (int i = 0; i < size; ++i)
+            {
+                double x = i - (size - 1) * 0.5;
+                kernel[i] = (float)std::exp(-x * x / (2 * blurSigma * blurSigma));
+                sum += kernel[i];
+            }
+            for (int i = 0; i < size; ++i)
+                kernel[i] = (float)(kernel[i] / sum);
+        }
+        cv::parallel_for_(cv::Range(0, image.rows), SeparableBlurBody(image, output, kernel, context));
+    }
+
+    // Stretch to the full range like normalize(..., NORM_MINMAX) through a table
+    if (noiseVariance != 0 && (context.minValue != 0 || context.maxValue != 255))
+    {
+        double range = context.maxValue - context.minValue;
+        double scale = range > 0 ? 255 / range : 0;
+        cv::Mat table(1, 256, CV_8U);
+        for (int v = 0; v < 256; ++v)
+            table.at<uchar>(v) = cv::saturate_cast<uchar>((v - context.minValue) * scale);
+        cv::LUT(output, table, output);
+    }
+
+    image = output;
+}
+
+} // namespace ov
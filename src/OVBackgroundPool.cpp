@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <random>
+#include "OVBackgroundPool.h"
+#include "OVError.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+static bool
+IsImageFile(const std::string& filename)
+{
+    static const char* extensions[] = { "bmp", "jpg", "jpeg", "jpe", "jp2", "png", "ppm", "pgm", "tif", "tiff" };
+
+    std::string ext = GetExt(filename);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+    for (int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i)
+    {
+        if (ext == extensions[i])
+            return true;
+    }
+    return false;
+}
+
+bool
+ListBackgrounds(const std::string& path, std::vector<std::string>& files)
+{
+    if (IsDirectoryExists(path))
+    {
+        std::vector<std::string> names;
+        cv::glob(path, names, false);
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            if (IsImageFile(names[i]))
+                files.push_back(names[i]);
+        }
+        std::sort(files.begin(), files.end());
+        return !files.empty();
+    }
+
+    std::ifstream file(path);
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos)
+            continue;
+        size_t last = line.find_last_not_of(" \t\r");
+        files.push_back(line.substr(first, last - first + 1));
+    }
+    return !files.empty();
+}
+
+BackgroundPool::BackgroundPool(const std::vector<std::string>& files, const BackgroundPoolOptions& options)
+    : _files(files)
+    , _options(options)
+    , _isBroken(files.size(), false)
+    , _first(0)
+    , _isStopping(false)
+{
+    _options.capacity = std::max(_options.capacity, 1);
+    // Decoding shares the machine with rendering and post-processing
+    int numThreads = _options.numThreads;
+    if (numThreads <= 0)
+        numThreads = std::max(1, (int)std::thread::hardware_concurrency() / 4);
+    if (!_files.empty())
+    {
+        for (int i = 0; i < numThreads; ++i)
+            _threads.push_back(std::thread(&BackgroundPool::decodeLoop, this));
+    }
+}
+
+BackgroundPool::~BackgroundPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _isStopping = true;
+    }
+    _wakeDecoders.notify_all();
+    for (size_t i = 0; i < _threads.size(); ++i)
+        _threads[i].join();
+}
+
+int
+BackgroundPool::getFileIndex(int64_t position)
+{
+    int64_t numFiles = (int64_t)_files.size();
+    int64_t pass = position / numFiles;
+    std::vector<int>& order = _orders[pass];
+    if (order.empty())
+    {
+        // Fisher-Yates on the engine's raw output; the distributions of
+        // <random> differ between standard libraries, the engine does not
+        std::mt19937_64 random(_options.seed + (uint64_t)pass * 0x9E3779B97F4A7C15ull);
+        order.resize(_files.size());
+        for (int i = 0; i < order.size(); ++i)
+            order[i] = i;
+        for (int i = (int)order.size() - 1; i > 0; --i)
+            std::swap(order[i], order[random() % (i + 1)]);
+    }
+    return order[position % numFiles];
+}
+
+const std::string&
+BackgroundPool::getFile(int64_t position)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _files[getFileIndex(position)];
+}
+
+cv::Mat
+BackgroundPool::get(int64_t position)
+{
+    if (_files.empty())
+        return cv::Mat();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (position != _first)
+    {
+        // Move the window and drop what it no longer covers
+        _first = position;
+        std::vector<bool> isNeeded(_files.size(), false);
+        for (int64_t p = _first; p < _first + _options.capacity; ++p)
+            isNeeded[getFileIndex(p)] = true;
+        for (auto it = _resident.begin(); it != _resident.end();)
+        {
+            if (isNeeded[it->first])
+                ++it;
+            else
+                it = _resident.erase(it);
+        }
+        int64_t numFiles = (int64_t)_files.size();
+        for (auto it = _orders.begin(); it != _orders.end();)
+        {
+            if (it->first < _first / numFiles || it->first > (_first + _options.capacity) / numFiles)
+                it = _orders.erase(it);
+            else
+                ++it;
+        }
+        _wakeDecoders.notify_all();
+    }
+
+    int fileIndex = getFileIndex(position);
+    _decoded.wait(lock, [&]()
+    {
+        auto it = _resident.find(fileIndex);
+        return it != _resident.end() && it->second.isDone;
+    });
+    return _resident[fileIndex].image;
+}
+
+void
+BackgroundPool::decodeLoop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_isStopping)
+    {
+        // The first position of the window nobody decodes yet
+        int fileIndex = -1;
+        for (int64_t p = _first; p < _first + _options.capacity; ++p)
+        {
+            int i = getFileIndex(p);
+            if (_resident.find(i) == _resident.end())
+            {
+                fileIndex = i;
+                break;
+            }
+        }
+        if (fileIndex < 0)
+        {
+            _wakeDecoders.wait(lock);
+            continue;
+        }
+
+        _resident[fileIndex];
+        cv::Mat image;
+        if (!_isBroken[fileIndex])
+        {
+            std::string filename = _files[fileIndex];
+            lock.unlock();
+            image = cv::imread(filename, CV_LOAD_IMAGE_COLOR);
+            if (image.empty())
+                ReportError("Cannot open \"" + filename + "\".\n");
+            else if (_options.size.area() > 0 && image.size() != _options.size)
+            {
+                cv::Mat resized;
+                cv::resize(image, resized, _options.size, 0, 0, cv::INTER_AREA);
+                image = resized;
+            }
+            lock.lock();
+            if (image.empty())
+                _isBroken[fileIndex] = true;
+        }
+
+        // Gone if the window moved on while decoding
+        auto it = _resident.find(fileIndex);
+        if (it != _resident.end())
+        {
+            it->second.image = image;
+            it->second.isDone = true;
+            _decoded.notify_all();
+        }
+    }
+}
+
+} // namespace ov
@@ -0,0 +1,926 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include "OVBackgroundPool.h"
+#include "OVBatch.h"
+#include "OVComposite.h"
+#include "OVError.h"
+#include "OVManifest.h"
+#include "OVPipeline.h"
+#include "OVPose.h"
+#include "OVRenderPool.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+static const char* ChannelNames[NumFrameChannels] = { "depth", "mask", "normals" };
+
+const char*
+GetChannelName(int index)
+{
+    return ChannelNames[index];
+}
+
+bool
+ParseChannelOption(const std::string& key, const std::string& value, ChannelOptions& options)
+{
+    if (key == "channels")
+    {
+        options.channels = 0;
+        std::stringstream names(value);
+        std::string name;
+        while (std::getline(names, name, ','))
+        {
+            int index = (int)(std::find(ChannelNames, ChannelNames + NumFrameChannels, name) - ChannelNames);
+            if (index == NumFrameChannels)
+                return false;
+            options.channels |= 1 << index;
+        }
+    }
+    else if (key == "mask")
+    {
+        if (value == "shape")
+            options.maskMode = MASK_SHAPE;
+        else if (value == "material")
+            options.maskMode = MASK_MATERIAL;
+        else
+            return false;
+    }
+    else if (key == "channel-format")
+    {
+        if (value == "f16")
+            options.isHalf = true;
+        else if (value == "f32")
+            options.isHalf = false;
+        else
+            return false;
+    }
+    else
+        return false;
+    return true;
+}
+
+bool
+ParseBatchLine(const std::string& line, BatchLine& batchLine, std::string& error)
+{
+    std::stringstream lineStream(line);
+    std::string blurSigma, noiseVariance;
+    lineStream >> batchLine.modelFile
+               >> batchLine.imageFile
+               >> batchLine.cameraFile
+               >> batchLine.posesFile
+               >> blurSigma
+               >> noiseVariance
+               >> batchLine.outputDir;
+    if (lineStream.fail())
+    {
+        error = "expected <model> <image> <camera> <poses> <blur> <noise> <output>";
+        return false;
+    }
+
+    try
+    {
+        batchLine.blurSigma = std::stod(blurSigma);
+        batchLine.noiseVariance = std::stod(noiseVariance);
+    }
+    catch (const std::exception&)
+    {
+        error = "the blur \"" + blurSigma + "\" or the noise \"" + noiseVariance + "\" is not a number";
+        return false;
+    }
+
+    batchLine.isAnnotated = false;
+    batchLine.culling = CULLING_OFF;
+    batchLine.dedupStep = -1;
+    std::string option;
+    while (lineStream >> option)
+    {
+        error = "invalid option \"" + option + "\"";
+        size_t separator = option.find('=');
+        if (separator == std::string::npos)
+            return false;
+        std::string key = option.substr(0, separator);
+        std::string value = option.substr(separator + 1);
+        if (key == "backgrounds")
+            batchLine.backgroundsFile = value;
+        else if (key == "annotations" && (value == "on" || value == "off"))
+            batchLine.isAnnotated = value == "on";
+        else if (key == "keypoints")
+        {
+            batchLine.keypointsFile = value;
+            batchLine.isAnnotated = true;
+        }
+        else if (key == "culling")
+        {
+            if (value == "off")
+                batchLine.culling = CULLING_OFF;
+            else if (value == "skip")
+                batchLine.culling = CULLING_SKIP;
+            else if (value == "mark")
+                batchLine.culling = CULLING_MARK;
+            else
+                return false;
+        }
+        else if (key == "dedup")
+        {
+            if (value == "off")
+                batchLine.dedupStep = -1;
+            else
+            {
+                try
+                {
+                    batchLine.dedupStep = std::stod(value);
+                }
+                catch (const std::exception&)
+                {
+                    return false;
+                }
+                if (batchLine.dedupStep < 0)
+                    return false;
+            }
+        }
+        else if (!ParseSinkOption(key, value, batchLine.sink) && !ParseChannelOption(key, value, batchLine.channels))
+            return false;
+    }
+    error.clear();
+    return true;
+}
+
+bool
+LoadBatchFile(const std::string& filename, std::vector<BatchLine>& batchLines)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        ReportError("Cannot open \"" + filename + "\".\n");
+        return false;
+    }
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        BatchLine batchLine;
+        std::string error;
+        if (!ParseBatchLine(line, batchLine, error))
+        {
+            ReportError("Line " + std::to_string(lineNumber) + " of \"" + filename + "\": " + error + ".\n");
+            return false;
+        }
+        batchLines.push_back(batchLine);
+    }
+    return true;
+}
+
+static std::shared_ptr<const Model>
+LoadBatchModel(const std::string& filename)
+{
+    std::shared_ptr<Model> model = std::make_shared<Model>();
+    if (!LoadModel(*model, filename, false))
+        return std::shared_ptr<const Model>();
+    return model;
+}
+
+static cv::Mat
+LoadBackground(const std::string& filename)
+{
+    return cv::imread(filename, CV_LOAD_IMAGE_COLOR);
+}
+
+static std::shared_ptr<const CameraParameters>
+LoadCamera(const std::string& filename)
+{
+    std::shared_ptr<CameraParameters> camera = std::make_shared<CameraParameters>();
+    if (!LoadCameraParameters(filename, *camera))
+        return std::shared_ptr<const CameraParameters>();
+    return camera;
+}
+
+template <typename T, typename Load>
+std::shared_future<T>
+AssetCache::request(std::unordered_map<std::string, Entry<T> >& cache,
+                    const std::string& filename,
+                    Load load)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = cache.find(filename);
+    if (it != cache.end())
+    {
+        it->second.lastUse = ++_useCount;
+        return it->second.future;
+    }
+
+    // Only loaded assets are dropped, releasing the last reference to a
+    // pending one would wait for it under the lock
+    if (_maxEntries > 0 && cache.size() >= _maxEntries)
+    {
+        auto oldest = cache.end();
+        for (auto entry = cache.begin(); entry != cache.end(); ++entry)
+        {
+            if (entry->second.future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                continue;
+            if (oldest == cache.end() || entry->second.lastUse < oldest->second.lastUse)
+                oldest = entry;
+        }
+        if (oldest != cache.end())
+            cache.erase(oldest);
+    }
+
+    Entry<T>& entry = cache[filename];
+    entry.future = std::async(std::launch::async, load, filename).share();
+    entry.lastUse = ++_useCount;
+    return entry.future;
+}
+
+void
+AssetCache::prefetch(const BatchLine& batchLine)
+{
+    request(_models, batchLine.modelFile, &LoadBatchModel);
+    request(_backgrounds, batchLine.imageFile, &LoadBackground);
+    request(_cameras, batchLine.cameraFile, &LoadCamera);
+    if (batchLine.isAnnotated)
+        request(_bvhs, batchLine.modelFile, [this](const std::string& modelFile) { return buildBvh(modelFile); });
+}
+
+std::shared_ptr<const Model>
+AssetCache::getModel(const std::string& filename)
+{
+    return request(_models, filename, &LoadBatchModel).get();
+}
+
+std::shared_ptr<const MeshBvh>
+AssetCache::getBvh(const std::string& modelFile)
+{
+    return request(_bvhs, modelFile, [this](const std::string& modelFile) { return buildBvh(modelFile); }).get();
+}
+
+// Runs on a loader thread, after the model's own
+std::shared_ptr<const MeshBvh>
+AssetCache::buildBvh(const std::string& modelFile)
+{
+    std::shared_ptr<const Model> model = getModel(modelFile);
+    if (!model)
+        return std::shared_ptr<const MeshBvh>();
+    std::shared_ptr<MeshBvh> bvh = std::make_shared<MeshBvh>();
+    bvh->build(*model);
+    return bvh;
+}
+
+cv::Mat
+AssetCache::getBackground(const std::string& filename)
+{
+    return request(_backgrounds, filename, &LoadBackground).get();
+}
+
+bool
+AssetCache::getCamera(const std::string& filename, CameraParameters& camera)
+{
+    std::shared_ptr<const CameraParameters> result = request(_cameras, filename, &LoadCamera).get();
+    if (!result)
+        return false;
+    camera = *result;
+    return true;
+}
+
+static std::string
+GetOutputRoot(const std::string& batchFile, const BatchOptions& options)
+{
+    std::string outputRoot = options.outputRoot.empty() ? GetDir(batchFile) : options.outputRoot;
+    if (!outputRoot.empty() && outputRoot.back() != '/' && outputRoot.back() != '\\')
+        outputRoot += '\\';
+    return outputRoot;
+}
+
+std::string
+GetManifestFile(const std::string& batchFile, const BatchOptions& options)
+{
+    if (!options.manifestFile.empty())
+        return options.manifestFile;
+
+    std::string name = GetFileName(batchFile);
+    if (!GetBaseName(name).empty())
+        name = GetBaseName(name);
+    return GetOutputRoot(batchFile, options) + name + ".manifest";
+}
+
+std::string
+GetShardManifestFile(const std::string& batchFile, const BatchOptions& options, int shardIndex)
+{
+    std::string manifestFile = GetManifestFile(batchFile, options);
+    return GetBaseName(manifestFile)
+           + ".shard-" + std::to_string(shardIndex) + "-of-" + std::to_string(options.numShards)
+           + ".manifest";
+}
+
+// Files are hashed once per run
+static uint64_t
+GetFileHash(const std::string& filename, std::unordered_map<std::string, uint64_t>& fileHashes)
+{
+    auto it = fileHashes.find(filename);
+    if (it == fileHashes.end())
+    {
+        uint64_t fileHash = 0;
+        HashFile(filename, fileHash);
+        it = fileHashes.insert(std::make_pair(filename, fileHash)).first;
+    }
+    return it->second;
+}
+
+// Hash of everything a line's frames are made from except the pose: the
+// model with its textures, the background, the camera and the parameters
+static uint64_t
+HashLineInputs(const BatchLine& batchLine, const Model& model, std::unordered_map<std::string, uint64_t>& fileHashes)
+{
+    std::vector<std::string> files;
+    files.push_back(batchLine.modelFile);
+    for (auto it = model.textures.begin(); it != model.textures.end(); ++it)
+        files.push_back(GetDir(batchLine.modelFile) + it->first);
+    files.push_back(batchLine.imageFile);
+    files.push_back(batchLine.cameraFile);
+
+    uint64_t hash = HashBasis;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        uint64_t fileHash = GetFileHash(files[i], fileHashes);
+        hash = HashBytes(&fileHash, sizeof(fileHash), hash);
+    }
+    hash = HashBytes(&batchLine.blurSigma, sizeof(batchLine.blurSigma), hash);
+    hash = HashBytes(&batchLine.noiseVariance, sizeof(batchLine.noiseVariance), hash);
+    return hash;
+}
+
+// Hash of everything a frame's bytes are made from: the line's inputs and
+// encoding, the pose rounded to the line's dedup step, the background and
+// the noise seed if there is noise. Frames of any line with the same hash
+// are the same file.
+static uint64_t
+HashFrameContent(uint64_t lineContentHash, const BatchLine& batchLine, const double pose[PoseSize],
+                 uint64_t backgroundHash, uint64_t noiseSeed)
+{
+    uint64_t hash = lineContentHash;
+    if (batchLine.dedupStep > 0)
+    {
+        int64_t steps[PoseSize];
+        for (int k = 0; k < PoseSize; ++k)
+            steps[k] = std::llround(pose[k] / batchLine.dedupStep);
+        hash = HashBytes(steps, sizeof(steps), hash);
+    }
+    else
+        hash = HashBytes(pose, sizeof(double) * PoseSize, hash);
+    hash = HashBytes(&backgroundHash, sizeof(backgroundHash), hash);
+    if (batchLine.noiseVariance > 0)
+        hash = HashBytes(&noiseSeed, sizeof(noiseSeed), hash);
+    return hash;
+}
+
+// A layer drawn once for all of a pose's backgrounds
+struct PendingLayer
+{
+    std::shared_future<RenderResult>       result;
+    std::shared_ptr<const ForegroundLayer> layer; // made by the first frame pushed
+};
+
+// Jobs waiting for the render pool, in the order they go to the pipeline:
+// a frame and its channels, or links to earlier frames
+struct PendingFrame
+{
+    PendingFrame() : type(RENDER_TASK_FRAME), line(NULL), poseIndex(0) {}
+
+    int                              type;   // RENDER_TASK of the result
+    const BatchLine*                 line;   // named with the pose if drawing fails
+    int                              poseIndex;
+    std::shared_future<RenderResult> result; // none for links and composites
+    std::shared_ptr<PendingLayer>    layer;  // of a composite
+    std::vector<FrameJob>            jobs;
+};
+
+// Fill in what the pool drew and push the jobs; false if it could not draw
+static bool
+PushPendingFrame(PendingFrame& pending, FramePipeline& pipeline)
+{
+    if (pending.layer)
+    {
+        if (!pending.layer->layer)
+        {
+            const RenderResult& result = pending.layer->result.get();
+            if (!result.isOk)
+            {
+                ReportError("The renderer cannot draw the transparent frames backgrounds= needs.\n");
+                return false;
+            }
+            std::shared_ptr<ForegroundLayer> layer = std::make_shared<ForegroundLayer>();
+            layer->set(result.image);
+            pending.layer->layer = layer;
+        }
+        pending.jobs[0].layer = pending.layer->layer;
+    }
+    else if (pending.result.valid())
+    {
+        const RenderResult& result = pending.result.get();
+        if (!result.isOk)
+        {
+            std::string what = pending.type == RENDER_TASK_CHANNELS ? "the channels of pose " : "pose ";
+            ReportError("The renderer cannot draw " + what + std::to_string(pending.poseIndex) + " of \""
+                        + pending.line->posesFile + "\" with \"" + pending.line->modelFile + "\".\n");
+            return false;
+        }
+        pending.jobs[0].image = result.image;
+        for (size_t k = 0; k < result.channels.size() && k + 1 < pending.jobs.size(); ++k)
+            pending.jobs[k + 1].image = result.channels[k];
+    }
+    for (size_t k = 0; k < pending.jobs.size(); ++k)
+        pipeline.push(pending.jobs[k]);
+    return true;
+}
+
+bool
+RunBatch(const std::string& batchFile,
+         BatchRenderer& renderer,
+         const BatchOptions& options,
+         const BatchProgressCallback& progress,
+         BatchStats& stats)
+{
+    std::vector<BatchLine> batchLines;
+    if (!LoadBatchFile(batchFile, batchLines))
+        return false;
+
+    std::string outputRoot = GetOutputRoot(batchFile, options);
+    if (!outputRoot.empty() && !IsDirectoryExists(outputRoot))
+        CreateDirectorys(outputRoot);
+
+    // Frames are recorded as soon as they are written, a resumed run
+    // appends to the records of the one it continues. Shards write their
+    // own manifests for the coordinator to merge.
+    std::string manifestFile = GetManifestFile(batchFile, options);
+    Manifest manifest;
+    bool isResuming = options.isResuming && manifest.load(manifestFile);
+    if (options.numShards > 1)
+    {
+        manifestFile = GetShardManifestFile(batchFile, options, options.shardIndex);
+        isResuming = options.isResuming && (manifest.load(manifestFile) || isResuming);
+    }
+    if (!manifest.open(manifestFile, outputRoot, isResuming))
+        return false;
+    std::unordered_map<std::string, uint64_t> fileHashes;
+    int numSkipped = 0;
+    int numCulled = 0;
+    bool isCancelled = false;
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point lastProgress = Clock::now();
+    bool isOk = true;
+
+    // Containers and rings are per shard, rings outlive the lines they serve
+    std::string shardSuffix;
+    if (options.numShards > 1)
+        shardSuffix = ".shard-" + std::to_string(options.shardIndex) + "-of-" + std::to_string(options.numShards);
+    SinkFactory sinkFactory(shardSuffix);
+
+    // Assets shared by several lines are loaded once per run, and the
+    // annotator's BVH built once per model
+    AssetCache assetCache;
+    FrameAnnotator annotator;
+    FramePipeline pipeline(options.numWorkers);
+    pipeline.setWrittenCallback([&manifest](const std::string& filename, uint64_t inputHash, const std::vector<uchar>& data)
+    {
+        manifest.record(filename, inputHash, data);
+    });
+    pipeline.setLinkedCallback([&manifest](const std::string& filename, uint64_t inputHash, const std::string& target)
+    {
+        manifest.recordLink(filename, inputHash, target);
+    });
+    // Frame files of the run by the hash of their content, for dedup=
+    std::unordered_map<uint64_t, std::string> framesByContent;
+
+    // Frames are drawn on the render threads as they become free and
+    // pushed in their order; a few per thread are kept in flight
+    RenderPool renderPool(renderer, options.numRenderers, options.createRenderer);
+    std::deque<PendingFrame> pendingFrames;
+    size_t maxPendingFrames = std::max(1, 4 * renderPool.getNumThreads());
+    auto pushPendingFrames = [&](size_t numKept)
+    {
+        while (pendingFrames.size() > numKept)
+        {
+            bool isPushed = PushPendingFrame(pendingFrames.front(), pipeline);
+            pendingFrames.pop_front();
+            if (!isPushed)
+                return false;
+        }
+        return true;
+    };
+    for (int lineIndex = 0; lineIndex < (int)batchLines.size() && isOk && !isCancelled; ++lineIndex)
+    {
+        const BatchLine& batchLine = batchLines[lineIndex];
+        if (lineIndex == 0)
+            assetCache.prefetch(batchLine);
+        // Load the next line's assets while this one renders
+        if (lineIndex + 1 < (int)batchLines.size())
+            assetCache.prefetch(batchLines[lineIndex + 1]);
+
+        // 1. .OBJ model file
+        std::shared_ptr<RenderScene> scene = std::make_shared<RenderScene>();
+        std::shared_ptr<const Model> model = assetCache.getModel(batchLine.modelFile);
+        if (!model)
+        {
+            isOk = false;
+            break;
+        }
+        scene->model = model;
+
+        // 2. Background image file
+        cv::Mat background = assetCache.getBackground(batchLine.imageFile);
+        if (background.empty())
+        {
+            ReportError("Cannot open \"" + batchLine.imageFile + "\".\n");
+            isOk = false;
+            break;
+        }
+        scene->background = background;
+
+        // 3. Camera parameter file
+        CameraParameters camera;
+        if (!assetCache.getCamera(batchLine.cameraFile, camera))
+        {
+            isOk = false;
+            break;
+        }
+        scene->camera = camera;
+        if (!renderPool.setScene(scene))
+        {
+            isOk = false;
+            break;
+        }
+
+        // Images the poses are composited over, if any, decoded ahead
+        // and fitted to the frame
+        std::unique_ptr<BackgroundPool> backgrounds;
+        if (!batchLine.backgroundsFile.empty())
+        {
+            std::vector<std::string> files;
+            if (!ListBackgrounds(batchLine.backgroundsFile, files))
+            {
+                ReportError("Cannot read the backgrounds of \"" + batchLine.backgroundsFile + "\".\n");
+                isOk = false;
+                break;
+            }
+            BackgroundPoolOptions poolOptions;
+            poolOptions.seed = (uint64_t)lineIndex;
+            poolOptions.size = background.size();
+            backgrounds.reset(new BackgroundPool(files, poolOptions));
+        }
+        int numBackgrounds = backgrounds ? backgrounds->getNumFiles() : 1;
+
+        // 4. Poses file, streamed pose by pose
+        PoseReader poses;
+        if (!poses.open(batchLine.posesFile))
+        {
+            isOk = false;
+            break;
+        }
+
+        // 5. Output directory and sink
+        std::string imageDir = outputRoot + batchLine.outputDir;
+        if (!IsDirectoryExists(imageDir))
+            CreateDirectorys(imageDir);
+        std::shared_ptr<FrameSink> sink = sinkFactory.create(batchLine.sink, imageDir, lineIndex, camera);
+        // Containers are rewritten as a whole, only PNG frames can be kept
+        bool isSkipping = isResuming && batchLine.sink.type == SINK_PNG;
+
+        // Extra channels, each through a sink of its own in a subdirectory
+        const ChannelOptions& channelOptions = batchLine.channels;
+        if (channelOptions.channels && backgrounds)
+        {
+            ReportError("The channels of a line cannot be combined with backgrounds=.\n");
+            isOk = false;
+            break;
+        }
+        if (channelOptions.channels && !channelOptions.isHalf && sink->getEncoding() != ENCODING_RAW)
+        {
+            ReportError("PNG holds float16 channels only, float32 needs sink=raw, sink=shm or sink=pack with compression=none.\n");
+            isOk = false;
+            break;
+        }
+        std::vector<std::string> channelDirs;
+        std::vector<std::shared_ptr<FrameSink> > channelSinks;
+        std::vector<uint64_t> channelKeys;
+        for (int c = 0; c < NumFrameChannels; ++c)
+        {
+            if (!(channelOptions.channels & (1 << c)))
+                continue;
+            std::string channelDir = imageDir + GetChannelName(c) + '\\';
+            if (!IsDirectoryExists(channelDir))
+                CreateDirectorys(channelDir);
+            SinkOptions channelSink = batchLine.sink;
+            channelSink.ringName += std::string("-") + GetChannelName(c);
+            channelDirs.push_back(channelDir);
+            channelSinks.push_back(sinkFactory.create(channelSink, channelDir, lineIndex, camera));
+            // Part of the channel frames' input hash
+            int key[3] = { c, channelOptions.maskMode, channelOptions.isHalf };
+            channelKeys.push_back(HashBytes(key, sizeof(key)));
+        }
+
+        // 2D labels of every frame of the shard, resumed or not, projected
+        // without rendering
+        std::ofstream annotations;
+        if (batchLine.isAnnotated)
+        {
+            std::shared_ptr<const MeshBvh> bvh = assetCache.getBvh(batchLine.modelFile);
+            if (!bvh)
+            {
+                isOk = false;
+                break;
+            }
+            annotator.setModel(model, bvh);
+            annotator.setCamera(camera);
+            annotator.clearKeypoints();
+            if (!batchLine.keypointsFile.empty() && !annotator.loadKeypoints(batchLine.keypointsFile))
+            {
+                ReportError("Cannot read the keypoints of \"" + batchLine.keypointsFile + "\".\n");
+                isOk = false;
+                break;
+            }
+            std::string annotationsFile = imageDir + "annotations" + shardSuffix + ".jsonl";
+            annotations.open(annotationsFile);
+            if (!annotations.is_open())
+            {
+                ReportError("Cannot write \"" + annotationsFile + "\".\n");
+                isOk = false;
+                break;
+            }
+        }
+
+        // The frustum the poses are culled against, as the renderer draws them
+        double projectionMatrix[16];
+        bool isCulling = batchLine.culling != CULLING_OFF && renderer.getProjectionMatrix(projectionMatrix);
+
+        BatchProgress p;
+        p.lineIndex = lineIndex;
+        p.numLines = (int)batchLines.size();
+        p.frameIndex = 0;
+        p.numFrames = poses.getNumPoses() < 0 ? -1 : (int)poses.getNumPoses() * numBackgrounds;
+        p.posesFile = batchLine.posesFile;
+        p.blurSigma = batchLine.blurSigma;
+        p.noiseVariance = batchLine.noiseVariance;
+
+        uint64_t lineHash = HashLineInputs(batchLine, *model, fileHashes);
+        // Only frames of their own file can be links
+        bool isDeduplicating = batchLine.dedupStep >= 0 && batchLine.sink.type == SINK_PNG;
+        uint64_t lineContentHash = lineHash;
+        const PngOptions& pngOptions = batchLine.sink.png;
+        lineContentHash = HashBytes(&pngOptions.encoder, sizeof(int), lineContentHash);
+        lineContentHash = HashBytes(&pngOptions.level, sizeof(int), lineContentHash);
+        lineContentHash = HashBytes(&pngOptions.strategy, sizeof(int), lineContentHash);
+        lineContentHash = HashBytes(&channelOptions.channels, sizeof(int), lineContentHash);
+        lineContentHash = HashBytes(&channelOptions.maskMode, sizeof(int), lineContentHash);
+        lineContentHash = HashBytes(&channelOptions.isHalf, sizeof(bool), lineContentHash);
+        double pose[PoseSize];
+        int i = 0;
+        for (; !isCancelled && poses.next(pose) && isOk; ++i)
+        {
+            Mat3 R;
+            Vec3 t;
+            PoseToRt(pose, R, t);
+
+            // Rendered once for all of the pose's backgrounds
+            std::shared_ptr<PendingLayer> layer;
+            Mat4 modelView = renderer.getModelView(R, t);
+            // Annotated once for all of the pose's backgrounds, and only if
+            // a frame of this shard gets a line
+            FrameAnnotation annotation;
+            bool isAnnotated = false;
+            bool isCulled = isCulling && !IsSphereInFrustum(projectionMatrix, modelView,
+                                                            model->boundingCenter, model->boundingRadius);
+            for (int b = 0; b < numBackgrounds; ++b)
+            {
+                int frameIndex = i * numBackgrounds + b;
+                if (!IsInShard(lineIndex, frameIndex, options))
+                    continue;
+                if (options.isCancelled && *options.isCancelled)
+                {
+                    isCancelled = true;
+                    break;
+                }
+
+                // The seed is part of the input, a frame's noise depends on its position
+                uint64_t noiseSeed = FrameSeed(lineIndex, frameIndex);
+                uint64_t inputHash = HashBytes(pose, sizeof(pose), lineHash);
+                uint64_t backgroundHash = 0;
+                if (backgrounds)
+                {
+                    backgroundHash = GetFileHash(backgrounds->getFile(frameIndex), fileHashes);
+                    inputHash = HashBytes(&backgroundHash, sizeof(backgroundHash), inputHash);
+                }
+                inputHash = HashBytes(&noiseSeed, sizeof(noiseSeed), inputHash);
+                uint64_t contentHash = 0;
+                if (isDeduplicating)
+                    contentHash = HashFrameContent(lineContentHash, batchLine, pose, backgroundHash, noiseSeed);
+
+                std::string filename = imageDir + ZeroPadNumber(frameIndex, 6);
+                if (batchLine.sink.type == SINK_PNG)
+                    filename += ".png";
+                if (batchLine.isAnnotated && !(isCulled && batchLine.culling == CULLING_SKIP))
+                {
+                    if (!isAnnotated)
+                        annotator.annotate(modelView, annotation);
+                    isAnnotated = true;
+                    annotations << FormatAnnotation(frameIndex, filename.substr(imageDir.size()), annotation) << "\n";
+                }
+                std::vector<std::string> channelFiles(channelDirs.size());
+                bool isValid = isSkipping && manifest.isValid(filename, inputHash);
+                for (size_t k = 0; k < channelDirs.size(); ++k)
+                {
+                    channelFiles[k] = channelDirs[k] + ZeroPadNumber(frameIndex, 6);
+                    if (batchLine.sink.type == SINK_PNG)
+                        channelFiles[k] += ".png";
+                    isValid = isValid && manifest.isValid(channelFiles[k], HashBytes(&channelKeys[k], sizeof(uint64_t), inputHash));
+                }
+                if (isValid)
+                {
+                    ++numSkipped;
+                    // Culled frames that were marked have no file to link to
+                    if (isDeduplicating && !isCulled)
+                    {
+                        framesByContent.insert(std::make_pair(contentHash, filename));
+                        for (size_t k = 0; k < channelDirs.size(); ++k)
+                            framesByContent.insert(std::make_pair(HashBytes(&channelKeys[k], sizeof(uint64_t), contentHash), channelFiles[k]));
+                    }
+                    continue;
+                }
+
+                // Nothing of the model would be drawn
+                if (isCulled)
+                {
+                    ++numCulled;
+                    if (batchLine.culling == CULLING_MARK)
+                    {
+                        manifest.recordEmpty(filename, inputHash);
+                        for (size_t k = 0; k < channelDirs.size(); ++k)
+                            manifest.recordEmpty(channelFiles[k], HashBytes(&channelKeys[k], sizeof(uint64_t), inputHash));
+                    }
+                    continue;
+                }
+
+                // The same frame was pushed before, link to it once it is written
+                if (isDeduplicating && framesByContent.count(contentHash))
+                {
+                    PendingFrame links;
+                    links.type = RENDER_TASK_FRAME;
+                    links.jobs.resize(1 + channelDirs.size());
+                    for (size_t k = 0; k < links.jobs.size(); ++k)
+                    {
+                        FrameJob& link = links.jobs[k];
+                        uint64_t key = k == 0 ? contentHash : HashBytes(&channelKeys[k - 1], sizeof(uint64_t), contentHash);
+                        link.linkTarget = framesByContent[key];
+                        link.inputHash = k == 0 ? inputHash : HashBytes(&channelKeys[k - 1], sizeof(uint64_t), inputHash);
+                        link.filename = k == 0 ? filename : channelFiles[k - 1];
+                        link.frameIndex = frameIndex;
+                        std::copy(pose, pose + PoseSize, link.pose);
+                    }
+                    pendingFrames.push_back(links);
+                    if (!pushPendingFrames(maxPendingFrames - 1))
+                    {
+                        isOk = false;
+                        break;
+                    }
+                    continue;
+                }
+
+                // Drawing runs on the render pool, post-processing and
+                // encoding on the pipeline's workers
+                PendingFrame pending;
+                pending.line = &batchLine;
+                pending.poseIndex = i;
+                pending.jobs.resize(1 + channelDirs.size());
+                FrameJob& job = pending.jobs[0];
+                if (!channelDirs.empty())
+                {
+                    pending.type = RENDER_TASK_CHANNELS;
+                    pending.result = renderPool.submit(RENDER_TASK_CHANNELS, R, t, channelOptions);
+                }
+                else if (!backgrounds)
+                {
+                    pending.type = RENDER_TASK_FRAME;
+                    pending.result = renderPool.submit(RENDER_TASK_FRAME, R, t, channelOptions);
+                }
+                else
+                {
+                    if (!layer)
+                    {
+                        layer = std::make_shared<PendingLayer>();
+                        layer->result = renderPool.submit(RENDER_TASK_LAYER, R, t, channelOptions);
+                    }
+                    // Backgrounds that cannot be decoded are reported by
+                    // the pool, their frames are left out
+                    job.image = backgrounds->get(frameIndex);
+                    if (job.image.empty())
+                        continue;
+                    pending.type = RENDER_TASK_LAYER;
+                    pending.layer = layer;
+                }
+                job.blurSigma = batchLine.blurSigma;
+                job.noiseVariance = batchLine.noiseVariance;
+                job.noiseSeed = noiseSeed;
+                job.inputHash = inputHash;
+                job.filename = filename;
+                job.frameIndex = frameIndex;
+                std::copy(pose, pose + PoseSize, job.pose);
+                job.sink = sink;
+                if (isDeduplicating)
+                {
+                    framesByContent[contentHash] = filename;
+                    for (size_t k = 0; k < channelDirs.size(); ++k)
+                        framesByContent[HashBytes(&channelKeys[k], sizeof(uint64_t), contentHash)] = channelFiles[k];
+                }
+
+                // The channels go unblurred and without noise
+                for (size_t k = 0; k < channelDirs.size(); ++k)
+                {
+                    FrameJob& channelJob = pending.jobs[k + 1];
+                    channelJob.blurSigma = 0;
+                    channelJob.noiseVariance = 0;
+                    channelJob.noiseSeed = noiseSeed;
+                    channelJob.inputHash = HashBytes(&channelKeys[k], sizeof(uint64_t), inputHash);
+                    channelJob.filename = channelFiles[k];
+                    channelJob.frameIndex = frameIndex;
+                    std::copy(pose, pose + PoseSize, channelJob.pose);
+                    channelJob.sink = channelSinks[k];
+                    channelJob.isHalf = channelOptions.isHalf;
+                }
+                pendingFrames.push_back(pending);
+                if (!pushPendingFrames(maxPendingFrames - 1))
+                {
+                    isOk = false;
+                    break;
+                }
+
+                Clock::time_point now = Clock::now();
+                if (progress && std::chrono::duration<double>(now - lastProgress).count() >= options.progressInterval)
+                {
+                    lastProgress = now;
+                    p.frameIndex = frameIndex;
+                    progress(p);
+                }
+            }
+        }
+        if (poses.hasError())
+            isOk = false;
+
+        // The line's sinks are closed in order, after its last frame is
+        // written; a failed run leaves them to their destructors
+        if (isOk)
+        {
+            PendingFrame closing;
+            closing.type = RENDER_TASK_FRAME;
+            closing.jobs.resize(1 + channelSinks.size());
+            for (size_t k = 0; k < closing.jobs.size(); ++k)
+            {
+                FrameJob& close = closing.jobs[k];
+                close.isClosingSink = true;
+                close.sink = k == 0 ? sink : channelSinks[k - 1];
+                close.filename = k == 0 ? imageDir : channelDirs[k - 1];
+                close.frameIndex = -1;
+            }
+            pendingFrames.push_back(closing);
+            if (!pushPendingFrames(maxPendingFrames - 1))
+                isOk = false;
+        }
+
+        // The line is complete, report its last frame
+        if (progress && i > 0 && !isCancelled)
+        {
+            lastProgress = Clock::now();
+            p.frameIndex = i * numBackgrounds - 1;
+            p.numFrames = i * numBackgrounds;
+            progress(p);
+        }
+    }
+
+    // A cancelled run still writes the frames it has drawn, a failed one
+    // drops them
+    if (isOk && !pushPendingFrames(0))
+        isOk = false;
+    pendingFrames.clear();
+    pipeline.finish();
+    manifest.close();
+    stats.summary = pipeline.getStats();
+    if (isResuming)
+        stats.summary += ", " + std::to_string(numSkipped) + " frames resumed";
+    if (numCulled > 0)
+        stats.summary += ", " + std::to_string(numCulled) + " frames culled";
+    if (isCancelled)
+        stats.summary += ", cancelled";
+    stats.numWritten = pipeline.getNumWritten();
+    stats.numSkipped = numSkipped;
+    stats.numLinked = pipeline.getNumLinked();
+    stats.numCulled = numCulled;
+    stats.numBytes = pipeline.getEncodedBytes();
+    stats.seconds = pipeline.getSeconds();
+    stats.isCancelled = isCancelled;
+    return isOk && pipeline.getNumErrors() == 0;
+}
+
+} // namespace ov
@@ -0,0 +1,404 @@
+#include <opencv2/opencv.hpp>
+#include <emmintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <future>
+#include <memory>
+#include "OVBvh.h"
+
+namespace ov
+{
+
+static const int   NumBins           = 16;
+static const int   MaxLeafSize       = 4;
+static const int   MaxDepth          = 60;     // the traversal stack holds one node per level
+static const int   ParallelSize      = 16384;  // ranges this large build their halves on two threads
+static const int   NumSurfaceSamples = 1024;
+static const float StartDistance     = 1e-4f;  // hits this close to the camera, in segment lengths, are ignored
+static const float EndDistance       = 1e-3f;  // and as close to the point, its own triangles
+
+struct BvhBuildNode
+{
+    float                      lower[3];
+    float                      upper[3];
+    int                        first;
+    int                        count;
+    std::unique_ptr<BvhBuildNode> children[2];
+};
+
+struct BvhPrimitive
+{
+    float lower[3];
+    float upper[3];
+    float centroid[3];
+    int   index;
+};
+
+static float
+HalfArea(const float lower[3], const float upper[3])
+{
+    float dx = upper[0] - lower[0];
+    float dy = upper[1] - lower[1];
+    float dz = upper[2] - lower[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static void
+Grow(float lower[3], float upper[3], const float otherLower[3], const float otherUpper[3])
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        lower[k] = std::min(lower[k], otherLower[k]);
+        upper[k] = std::max(upper[k], otherUpper[k]);
+    }
+}
+
+static void
+ResetBounds(float lower[3], float upper[3])
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        lower[k] = FLT_MAX;
+        upper[k] = -FLT_MAX;
+    }
+}
+
+static std::unique_ptr<BvhBuildNode>
+BuildRange(std::vector<BvhPrimitive>& primitives, int begin, int end, int depth)
+{
+    std::unique_ptr<BvhBuildNode> node(new BvhBuildNode());
+    node->first = begin;
+    node->count = end - begin;
+
+    float centroidLower[3], centroidUpper[3];
+    ResetBounds(node->lower, node->upper);
+    ResetBounds(centroidLower, centroidUpper);
+    for (int i = begin; i < end; ++i)
+    {
+        Grow(node->lower, node->upper, primitives[i].lower, primitives[i].upper);
+        Grow(centroidLower, centroidUpper, primitives[i].centroid, primitives[i].centroid);
+    }
+    if (node->count <= MaxLeafSize || depth >= MaxDepth)
+        return node;
+
+    // Binned SAH: the cheapest split between bins over the three axes
+    int bestAxis = -1;
+    int bestBin = 0;
+    float bestCost = FLT_MAX;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float extent = centroidUpper[axis] - centroidLower[axis];
+        if (extent <= 0)
+            continue;
+        float scale = NumBins / extent;
+
+        int counts[NumBins] = { 0 };
+        float lowers[NumBins][3], uppers[NumBins][3];
+        for (int b = 0; b < NumBins; ++b)
+            ResetBounds(lowers[b], uppers[b]);
+        for (int i = begin; i < end; ++i)
+        {
+            int b = std::min((int)((primitives[i].centroid[axis] - centroidLower[axis]) * scale), NumBins - 1);
+            ++counts[b];
+            Grow(lowers[b], uppers[b], primitives[i].lower, primitives[i].upper);
+        }
+
+        // Left sides by sweeping up, right sides by sweeping down
+        float leftCosts[NumBins - 1];
+        float lower[3], upper[3];
+        ResetBounds(lower, upper);
+        int count = 0;
+        for (int b = 0; b < NumBins - 1; ++b)
+        {
+            Grow(lower, upper, lowers[b], uppers[b]);
+            count += counts[b];
+            leftCosts[b] = count > 0 ? count * HalfArea(lower, upper) : 0;
+        }
+        ResetBounds(lower, upper);
+        count = 0;
+        for (int b = NumBins - 1; b > 0; --b)
+        {
+            Grow(lower, upper, lowers[b], uppers[b]);
+            count += counts[b];
+            float cost = leftCosts[b - 1] + (count > 0 ? count * HalfArea(lower, upper) : 0);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b - 1;
+            }
+        }
+    }
+
+    // A leaf when splitting costs more than testing every triangle, with a
+    // node visit costing about one triangle test
+    float area = HalfArea(node->lower, node->upper);
+    if (bestAxis >= 0 && area > 0 && bestCost / area + 1 >= node->count && node->count <= 4 * MaxLeafSize)
+        return node;
+
+    int middle = (begin + end) / 2;
+    if (bestAxis >= 0)
+    {
+        float lower = centroidLower[bestAxis];
+        float scale = NumBins / (centroidUpper[bestAxis] - lower);
+        BvhPrimitive* first = primitives.data() + begin;
+        BvhPrimitive* last = primitives.data() + end;
+        middle = (int)(std::partition(first, last, [&](const BvhPrimitive& p)
+        {
+            return std::min((int)((p.centroid[bestAxis] - lower) * scale), NumBins - 1) <= bestBin;
+        }) - primitives.data());
+        if (middle == begin || middle == end)
+            middle = (begin + end) / 2;
+    }
+
+    if (node->count >= ParallelSize)
+    {
+        std::future<std::unique_ptr<BvhBuildNode> > left =
+            std::async(std::launch::async, BuildRange, std::ref(primitives), begin, middle, depth + 1);
+        node->children[1] = BuildRange(primitives, middle, end, depth + 1);
+        node->children[0] = left.get();
+    }
+    else
+    {
+        node->children[0] = BuildRange(primitives, begin, middle, depth + 1);
+        node->children[1] = BuildRange(primitives, middle, end, depth + 1);
+    }
+    node->count = 0;
+    return node;
+}
+
+int
+MeshBvh::flatten(const BvhBuildNode& node)
+{
+    int index = (int)_nodes.size();
+    _nodes.push_back(Node());
+    std::copy(node.lower, node.lower + 3, _nodes[index].lower);
+    std::copy(node.upper, node.upper + 3, _nodes[index].upper);
+    _nodes[index].count = node.count;
+    if (node.count > 0)
+    {
+        _nodes[index].offset = node.first;
+        return index;
+    }
+    flatten(*node.children[0]);
+    int second = flatten(*node.children[1]);
+    _nodes[index].offset = second;
+    return index;
+}
+
+void
+MeshBvh::build(const Model& model)
+{
+    _nodes.clear();
+    _triangles.clear();
+
+    std::vector<Triangle> triangles;
+    for (size_t i = 0; i < model.shapes.size(); ++i)
+    {
+        const tinyobj::mesh_t& mesh = model.shapes[i].mesh;
+        for (size_t j = 0; j + 2 < mesh.indices.size(); j += 3)
+        {
+            const float* v0 = &mesh.positions[mesh.indices[j] * 3];
+            const float* v1 = &mesh.positions[mesh.indices[j + 1] * 3];
+            const float* v2 = &mesh.positions[mesh.indices[j + 2] * 3];
+            Triangle triangle;
+            for (int k = 0; k < 3; ++k)
+            {
+                triangle.v0[k] = v0[k];
+                triangle.e1[k] = v1[k] - v0[k];
+                triangle.e2[k] = v2[k] - v0[k];
+            }
+            triangles.push_back(triangle);
+        }
+    }
+    _samples.resize(3, 0);
+    if (triangles.empty())
+        return;
+
+    std::vector<BvhPrimitive> primitives(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+        const Triangle& triangle = triangles[i];
+        BvhPrimitive& primitive = primitives[i];
+        for (int k = 0; k < 3; ++k)
+        {
+            float a = triangle.v0[k];
+            float b = a + triangle.e1[k];
+            float c = a + triangle.e2[k];
+            primitive.lower[k] = std::min(a, std::min(b, c));
+            primitive.upper[k] = std::max(a, std::max(b, c));
+            primitive.centroid[k] = (a + b + c) / 3;
+        }
+        primitive.index = (int)i;
+    }
+
+    std::unique_ptr<BvhBuildNode> root = BuildRange(primitives, 0, (int)primitives.size(), 0);
+    _triangles.resize(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i)
+        _triangles[i] = triangles[primitives[i].index];
+    flatten(*root);
+
+    // Stratified over the summed areas; the point within a triangle comes
+    // from a fixed low discrepancy sequence
+    std::vector<double> areas(_triangles.size());
+    double total = 0;
+    for (size_t i = 0; i < _triangles.size(); ++i)
+    {
+        const Triangle& triangle = _triangles[i];
+        Vec3 e1(triangle.e1[0], triangle.e1[1], triangle.e1[2]);
+        Vec3 e2(triangle.e2[0], triangle.e2[1], triangle.e2[2]);
+        total += 0.5 * e1.cross(e2).norm();
+        areas[i] = total;
+    }
+    if (total <= 0)
+        return;
+    _samples.resize(3, NumSurfaceSamples);
+    for (int k = 0; k < NumSurfaceSamples; ++k)
+    {
+        double position = (k + 0.5) / NumSurfaceSamples * total;
+        size_t i = std::min((size_t)(std::upper_bound(areas.begin(), areas.end(), position) - areas.begin()),
+                            areas.size() - 1);
+        double a = std::fmod(k * 0.6180339887, 1.0);
+        double b = std::fmod(k * 0.7548776662, 1.0);
+        if (a + b > 1)
+        {
+            a = 1 - a;
+            b = 1 - b;
+        }
+        const Triangle& triangle = _triangles[i];
+        for (int j = 0; j < 3; ++j)
+            _samples(j, k) = triangle.v0[j] + a * triangle.e1[j] + b * triangle.e2[j];
+    }
+}
+
+void
+MeshBvh::tracePacket(const float origin[3], const float (*targets)[3], int numRays, byte* isVisible) const
+{
+    // Lanes past numRays repeat the first ray and never count
+    float d[3][4], inverse[3][4];
+    for (int i = 0; i < 4; ++i)
+    {
+        const float* target = targets[i < numRays ? i : 0];
+        for (int k = 0; k < 3; ++k)
+        {
+            d[k][i] = target[k] - origin[k];
+            // No zeros, (bound - origin) * inverse stays a number
+            float nonZero = std::fabs(d[k][i]) < 1e-20f ? (d[k][i] < 0 ? -1e-20f : 1e-20f) : d[k][i];
+            inverse[k][i] = 1 / nonZero;
+        }
+    }
+    const __m128 ox = _mm_set1_ps(origin[0]);
+    const __m128 oy = _mm_set1_ps(origin[1]);
+    const __m128 oz = _mm_set1_ps(origin[2]);
+    const __m128 dx = _mm_loadu_ps(d[0]);
+    const __m128 dy = _mm_loadu_ps(d[1]);
+    const __m128 dz = _mm_loadu_ps(d[2]);
+    const __m128 ix = _mm_loadu_ps(inverse[0]);
+    const __m128 iy = _mm_loadu_ps(inverse[1]);
+    const __m128 iz = _mm_loadu_ps(inverse[2]);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 tMin = _mm_set1_ps(StartDistance);
+    const __m128 tMax = _mm_set1_ps(1 - EndDistance);
+
+    // Set lanes are still open
+    __m128 open = _mm_castsi128_ps(_mm_setr_epi32(-1, numRays > 1 ? -1 : 0, numRays > 2 ? -1 : 0, numRays > 3 ? -1 : 0));
+
+    int stack[MaxDepth + 4];
+    int size = 0;
+    stack[size++] = 0;
+    while (size > 0 && _mm_movemask_ps(open) != 0)
+    {
+        int index = stack[--size];
+        const Node& node = _nodes[index];
+
+        __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lower[0]), ox), ix);
+        __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.upper[0]), ox), ix);
+        __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lower[1]), oy), iy);
+        __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.upper[1]), oy), iy);
+        __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.lower[2]), oz), iz);
+        __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.upper[2]), oz), iz);
+        __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)),
+                                  _mm_max_ps(_mm_min_ps(z0, z1), zero));
+        __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)),
+                                 _mm_min_ps(_mm_max_ps(z0, z1), one));
+        if (_mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(tNear, tFar), open)) == 0)
+            continue;
+
+        if (node.count == 0)
+        {
+            stack[size++] = node.offset;
+            stack[size++] = index + 1;
+            continue;
+        }
+
+        // Moller-Trumbore, four rays against each triangle
+        for (int j = node.offset; j < node.offset + node.count; ++j)
+        {
+            const Triangle& triangle = _triangles[j];
+            __m128 e1x = _mm_set1_ps(triangle.e1[0]);
+            __m128 e1y = _mm_set1_ps(triangle.e1[1]);
+            __m128 e1z = _mm_set1_ps(triangle.e1[2]);
+            __m128 e2x = _mm_set1_ps(triangle.e2[0]);
+            __m128 e2y = _mm_set1_ps(triangle.e2[1]);
+            __m128 e2z = _mm_set1_ps(triangle.e2[2]);
+
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            // Parallel rays divide by zero; the comparisons below fail on the NaNs
+            __m128 inverseDet = _mm_div_ps(one, det);
+
+            __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(triangle.v0[0]));
+            __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(triangle.v0[1]));
+            __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(triangle.v0[2]));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)),
+                                  inverseDet);
+
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)),
+                                  inverseDet);
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)),
+                                  inverseDet);
+
+            __m128 hit = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+            hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+            hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(t, tMin), _mm_cmplt_ps(t, tMax)));
+            open = _mm_andnot_ps(hit, open);
+        }
+    }
+
+    int mask = _mm_movemask_ps(open);
+    for (int i = 0; i < numRays; ++i)
+        isVisible[i] = (mask >> i) & 1;
+}
+
+void
+MeshBvh::testVisibility(const Vec3& center, const Mat3X& points, byte* isVisible) const
+{
+    int numPoints = (int)points.cols();
+    if (_nodes.empty())
+    {
+        std::fill(isVisible, isVisible + numPoints, 1);
+        return;
+    }
+
+    float origin[3] = { (float)center[0], (float)center[1], (float)center[2] };
+    float targets[4][3];
+    for (int i = 0; i < numPoints; i += 4)
+    {
+        int numRays = std::min(4, numPoints - i);
+        for (int j = 0; j < numRays; ++j)
+        {
+            for (int k = 0; k < 3; ++k)
+                targets[j][k] = (float)points(k, i + j);
+        }
+        tracePacket(origin, targets, numRays, isVisible + i);
+    }
+}
+
+} // namespace ov
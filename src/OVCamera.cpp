@@ -0,0 +1,43 @@
+#include <opencv2/opencv.hpp>
+#include "OVCamera.h"
+
+namespace ov
+{
+
+bool
+LoadCameraParameters(const std::string& filename, CameraParameters& camera)
+{
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened())
+        return false;
+    cv::Mat cameraMatrix;
+    fs["camera_matrix"] >> cameraMatrix;
+    if (cameraMatrix.rows != 3 || cameraMatrix.cols != 3)
+        return false;
+
+    camera.fx = cameraMatrix.at<double>(0, 0);
+    camera.fy = cameraMatrix.at<double>(1, 1);
+    camera.cx = cameraMatrix.at<double>(0, 2);
+    camera.cy = cameraMatrix.at<double>(1, 2);
+
+    fs["image_width"] >> camera.width;
+    fs["image_height"] >> camera.height;
+
+    // Optional, a pinhole camera has none
+    cv::Mat distortion;
+    fs["distortion_coefficients"] >> distortion;
+    camera.distortion.clear();
+    if (!distortion.empty())
+    {
+        distortion.convertTo(distortion, CV_64F);
+        camera.distortion.assign((const double*)distortion.data, (const double*)distortion.data + distortion.total());
+    }
+    size_t numCoefficients = camera.distortion.size();
+    if (numCoefficients != 0 && numCoefficients != 4 && numCoefficients != 5
+        && numCoefficients != 8 && numCoefficients != 12 && numCoefficients != 14)
+        return false;
+
+    return true;
+}
+
+} // namespace ov
@@ -0,0 +1,86 @@
+#include <emmintrin.h>
+#include <algorithm>
+#include "OVComposite.h"
+
+namespace ov
+{
+
+// out = color + background * weight / 255 over n bytes, 16 at a time.
+// x / 255 rounded is (x + 128 + ((x + 128) >> 8)) >> 8 for x <= 255 * 255.
+static void
+BlendRow(const uchar* color, const uchar* weight, const uchar* background, uchar* out, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i*)(color + i));
+        __m128i w = _mm_loadu_si128((const __m128i*)(weight + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(background + i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(w, zero)), half);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(w, zero)), half);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_adds_epu8(c, _mm_packus_epi16(lo, hi)));
+    }
+    for (; i < n; ++i)
+    {
+        int x = background[i] * weight[i] + 128;
+        out[i] = (uchar)std::min(255, color[i] + ((x + (x >> 8)) >> 8));
+    }
+}
+
+void
+ForegroundLayer::set(const cv::Mat& bgra)
+{
+    CV_Assert(bgra.type() == CV_8UC4);
+    _color.create(bgra.rows, bgra.cols, CV_8UC3);
+    _weight.create(bgra.rows, bgra.cols, CV_8UC3);
+    _first.assign(bgra.rows, 0);
+    _last.assign(bgra.rows, 0);
+
+    for (int y = 0; y < bgra.rows; ++y)
+    {
+        const uchar* source = bgra.ptr<uchar>(y);
+        uchar* color = _color.ptr<uchar>(y);
+        uchar* weight = _weight.ptr<uchar>(y);
+        int first = bgra.cols, last = 0;
+        for (int x = 0; x < bgra.cols; ++x, source += 4, color += 3, weight += 3)
+        {
+            color[0] = source[0];
+            color[1] = source[1];
+            color[2] = source[2];
+            weight[0] = weight[1] = weight[2] = (uchar)(255 - source[3]);
+            if (source[3] != 0)
+            {
+                first = std::min(first, x);
+                last = x + 1;
+            }
+        }
+        if (first < last)
+        {
+            _first[y] = first;
+            _last[y] = last;
+        }
+    }
+}
+
+void
+ForegroundLayer::composite(const cv::Mat& background, cv::Mat& image) const
+{
+    CV_Assert(background.type() == CV_8UC3 && background.size() == _color.size());
+    background.copyTo(image);
+
+    for (int y = 0; y < image.rows; ++y)
+    {
+        if (_first[y] == _last[y])
+            continue;
+        int offset = 3 * _first[y];
+        BlendRow(_color.ptr<uchar>(y) + offset, _weight.ptr<uchar>(y) + offset,
+                 background.ptr<uchar>(y) + offset, image.ptr<uchar>(y) + offset,
+                 3 * (_last[y] - _first[y]));
+    }
+}
+
+} // namespace ov
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "OVDistortion.h"
+
+namespace ov
+{
+
+static cv::Mat
+GetCameraMatrix(const CameraParameters& camera, double shift)
+{
+    cv::Mat K = cv::Mat::eye(3, 3, CV_64F);
+    K.at<double>(0, 0) = camera.fx;
+    K.at<double>(1, 1) = camera.fy;
+    K.at<double>(0, 2) = camera.cx + shift;
+    K.at<double>(1, 2) = camera.cy + shift;
+    return K;
+}
+
+LensDistortion::LensDistortion(const CameraParameters& camera)
+{
+    int w = camera.width;
+    int h = camera.height;
+    cv::Mat K = GetCameraMatrix(camera, 0);
+    cv::Mat D((int)camera.distortion.size(), 1, CV_64F, (void*)camera.distortion.data());
+
+    // Where every pixel of the frame lies on the undistorted image
+    cv::Mat pixels(h * w, 1, CV_32FC2);
+    for (int y = 0; y < h; ++y)
+    {
+        cv::Point2f* row = pixels.ptr<cv::Point2f>(y * w);
+        for (int x = 0; x < w; ++x)
+            row[x] = cv::Point2f((float)x, (float)y);
+    }
+    cv::Mat positions;
+    cv::undistortPoints(pixels, positions, K, D, cv::Mat(), K);
+
+    // The canvas grows until every one of them is on it; lenses that
+    // would need more than half the frame again are cut off
+    float minX = 0, minY = 0, maxX = (float)(w - 1), maxY = (float)(h - 1);
+    for (int i = 0; i < h * w; ++i)
+    {
+        const cv::Point2f& p = positions.at<cv::Point2f>(i);
+        minX = std::min(minX, p.x);
+        minY = std::min(minY, p.y);
+        maxX = std::max(maxX, p.x);
+        maxY = std::max(maxY, p.y);
+    }
+    float overhang = std::max(std::max(-minX, -minY), std::max(maxX - (w - 1), maxY - (h - 1)));
+    _margin = std::min((int)std::ceil(overhang) + 1, std::max(w, h) / 2);
+
+    _renderCamera = camera;
+    _renderCamera.cx += _margin;
+    _renderCamera.cy += _margin;
+    _renderCamera.width = w + 2 * _margin;
+    _renderCamera.height = h + 2 * _margin;
+    _renderCamera.distortion.clear();
+
+    cv::Mat mapX(h, w, CV_32F), mapY(h, w, CV_32F);
+    for (int y = 0; y < h; ++y)
+    {
+        const cv::Point2f* row = positions.ptr<cv::Point2f>(y * w);
+        float* rowX = mapX.ptr<float>(y);
+        float* rowY = mapY.ptr<float>(y);
+        for (int x = 0; x < w; ++x)
+        {
+            rowX[x] = row[x].x + _margin;
+            rowY[x] = row[x].y + _margin;
+        }
+    }
+    cv::convertMaps(mapX, mapY, _distortPositions, _distortWeights, CV_16SC2);
+
+    // The other way: the lens model applied to every canvas pixel
+    cv::initUndistortRectifyMap(K, D, cv::Mat(), GetCameraMatrix(camera, _margin),
+                                cv::Size(_renderCamera.width, _renderCamera.height), CV_16SC2,
+                                _undistortPositions, _undistortWeights);
+}
+
+void
+LensDistortion::undistort(const cv::Mat& image, cv::Mat& canvas) const
+{
+    cv::remap(image, canvas, _undistortPositions, _undistortWeights, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+}
+
+void
+LensDistortion::distort(const cv::Mat& canvas, cv::Mat& image, int interpolation) const
+{
+    // Fixed point remap, vectorized and split over the threads by OpenCV
+    cv::remap(canvas, image, _distortPositions, _distortWeights, interpolation, cv::BORDER_CONSTANT);
+}
+
+bool
+HasDistortion(const CameraParameters& camera)
+{
+    for (size_t i = 0; i < camera.distortion.size(); ++i)
+    {
+        if (camera.distortion[i] != 0)
+            return true;
+    }
+    return false;
+}
+
+// Everything the tables depend on, as bytes
+static std::string
+GetCameraKey(const CameraParameters& camera)
+{
+    double values[4] = { camera.fx, camera.fy, camera.cx, camera.cy };
+    int    size[2] = { camera.width, camera.height };
+    std::string key((const char*)values, sizeof(values));
+    key.append((const char*)size, sizeof(size));
+    key.append((const char*)camera.distortion.data(), camera.distortion.size() * sizeof(double));
+    return key;
+}
+
+std::shared_ptr<const LensDistortion>
+GetLensDistortion(const CameraParameters& camera)
+{
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::shared_ptr<const LensDistortion> > cache;
+
+    std::string key = GetCameraKey(camera);
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const LensDistortion>& distortion = cache[key];
+    if (!distortion)
+        distortion = std::make_shared<LensDistortion>(camera);
+    return distortion;
+}
+
+} // namespace ov
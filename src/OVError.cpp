@@ -0,0 +1,33 @@
+#include <iostream>
+#include <mutex>
+#include "OVError.h"
+
+namespace ov
+{
+
+static std::mutex   ErrorMutex;
+static ErrorHandler Handler;
+
+void
+SetErrorHandler(const ErrorHandler& handler)
+{
+    std::lock_guard<std::mutex> lock(ErrorMutex);
+    Handler = handler;
+}
+
+void
+ReportError(const std::string& msg)
+{
+    ErrorHandler handler;
+    {
+        std::lock_guard<std::mutex> lock(ErrorMutex);
+        handler = Handler;
+    }
+
+    if (handler)
+        handler(msg);
+    else
+        std::cerr << msg << std::endl;
+}
+
+} // namespace ov
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "OVError.h"
+#include "OVManifest.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+static const uint64_t HashPrime = 1099511628211ULL;
+
+uint64_t
+HashBytes(const void* data, size_t size, uint64_t hash)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= HashPrime;
+    }
+    return hash;
+}
+
+bool
+HashFile(const std::string& filename, uint64_t& hash)
+{
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    hash = HashBasis;
+    std::vector<char> buffer(1 << 16);
+    while (file)
+    {
+        file.read(buffer.data(), buffer.size());
+        hash = HashBytes(buffer.data(), (size_t)file.gcount(), hash);
+    }
+    return file.eof();
+}
+
+static std::string
+ToHex(uint64_t value)
+{
+    std::ostringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << value;
+    return ss.str();
+}
+
+bool
+Manifest::load(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream lineStream(line);
+        std::string frameFile, inputHash, outputHash;
+        Entry entry;
+        if (!std::getline(lineStream, frameFile, '\t')
+            || !(lineStream >> inputHash >> entry.size >> outputHash)
+            || inputHash.size() != 16 || outputHash.size() != 16)
+            continue;
+        if (!(lineStream >> entry.writeTime))
+            entry.writeTime = 0;
+
+        try
+        {
+            entry.inputHash = std::stoull(inputHash, NULL, 16);
+            entry.outputHash = std::stoull(outputHash, NULL, 16);
+        }
+        catch (const std::exception&)
+        {
+            continue;
+        }
+        // Later lines of a resumed run replace earlier ones
+        _entries[frameFile] = entry;
+    }
+    return true;
+}
+
+bool
+Manifest::open(const std::string& filename, const std::string& outputRoot, bool isAppend)
+{
+    // A run killed mid-write leaves a torn last line; end it, so the next
+    // entry is not merged into it and lost on the next load
+    bool isTorn = false;
+    if (isAppend)
+    {
+        std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+        if (file.is_open() && file.tellg() > 0)
+        {
+            file.seekg(-1, std::ios::end);
+            isTorn = file.get() != '\n';
+        }
+    }
+
+    _outputRoot = outputRoot;
+    _file.open(filename, isAppend ? std::ios::out | std::ios::app : std::ios::out | std::ios::trunc);
+    if (!_file.is_open())
+    {
+        ReportError("Cannot write \"" + filename + "\".\n");
+        return false;
+    }
+    if (isTorn)
+        _file << '\n';
+    if (!isAppend)
+        _entries.clear();
+    return true;
+}
+
+bool
+Manifest::save(const std::string& filename) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<std::string> paths;
+    for (auto it = _entries.begin(); it != _entries.end(); ++it)
+        paths.push_back(it->first);
+    std::sort(paths.begin(), paths.end());
+
+    std::ofstream file(filename, std::ios::out | std::ios::trunc);
+    for (size_t i = 0; i < paths.size(); ++i)
+        WriteEntry(file, paths[i], _entries.find(paths[i])->second);
+    file.close();
+    if (file.fail())
+    {
+        ReportError("Cannot write \"" + filename + "\".\n");
+        return false;
+    }
+    return true;
+}
+
+void
+Manifest::close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_file.is_open())
+        _file.close();
+}
+
+void
+Manifest::record(const std::string& frameFile, uint64_t inputHash, const std::vector<unsigned char>& data)
+{
+    Entry entry;
+    entry.inputHash = inputHash;
+    entry.size = data.size();
+    entry.outputHash = HashBytes(data.data(), data.size());
+    uint64_t size;
+    if (!GetFileStatus(frameFile, size, entry.writeTime) || size != entry.size)
+        entry.writeTime = 0;
+    append(frameFile, entry);
+}
+
+void
+Manifest::recordEmpty(const std::string& frameFile, uint64_t inputHash)
+{
+    Entry entry;
+    entry.inputHash = inputHash;
+    entry.size = 0;
+    entry.outputHash = 0;
+    entry.writeTime = 0;
+    append(frameFile, entry);
+}
+
+void
+Manifest::recordLink(const std::string& frameFile, uint64_t inputHash, const std::string& targetFile)
+{
+    Entry entry;
+    bool isFound = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(relativePath(targetFile));
+        if (it != _entries.end())
+        {
+            entry = it->second;
+            isFound = true;
+        }
+    }
+    // The frame is on disk but cannot be told valid, a resumed run makes it again
+    if (!isFound)
+    {
+        ReportError("Cannot record \"" + frameFile + "\", its target \"" + targetFile + "\" is not in the manifest.\n");
+        return;
+    }
+    entry.inputHash = inputHash;
+    // A hard link shares the target's write time, a copy has its own
+    uint64_t size;
+    if (!GetFileStatus(frameFile, size, entry.writeTime) || size != entry.size)
+        entry.writeTime = 0;
+    append(frameFile, entry);
+}
+
+void
+Manifest::append(const std::string& frameFile, const Entry& entry)
+{
+    std::string path = relativePath(frameFile);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries[path] = entry;
+    if (_file.is_open())
+    {
+        WriteEntry(_file, path, entry);
+        _file.flush();
+    }
+}
+
+void
+Manifest::WriteEntry(std::ostream& stream, const std::string& path, const Entry& entry)
+{
+    stream << path << '\t' << ToHex(entry.inputHash) << '\t' << entry.size << '\t' << ToHex(entry.outputHash)
+           << '\t' << entry.writeTime << '\n';
+}
+
+bool
+Manifest::isValid(const std::string& frameFile, uint64_t inputHash) const
+{
+    Entry entry;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(relativePath(frameFile));
+        if (it == _entries.end() || it->second.inputHash != inputHash)
+            return false;
+        entry = it->second;
+    }
+    // Empty frames have no file, an empty file has the hash of no bytes
+    if (entry.size == 0 && entry.outputHash == 0)
+        return true;
+
+    uint64_t size, writeTime;
+    if (!GetFileStatus(frameFile, size, writeTime) || size != entry.size)
+        return false;
+    if (entry.writeTime != 0 && writeTime == entry.writeTime)
+        return true;
+
+    uint64_t outputHash;
+    return HashFile(frameFile, outputHash) && outputHash == entry.outputHash;
+}
+
+std::string
+Manifest::relativePath(const std::string& frameFile) const
+{
+    if (frameFile.compare(0, _outputRoot.size(), _outputRoot) == 0)
+        return frameFile.substr(_outputRoot.size());
+    return frameFile;
+}
+
+bool
+MergeManifests(const std::vector<std::string>& parts, const std::string& filename)
+{
+    Manifest manifest;
+    for (size_t i = 0; i < parts.size(); ++i)
+        manifest.load(parts[i]);
+    return manifest.save(filename);
+}
+
+} // namespace ov
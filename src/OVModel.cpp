@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include "OVError.h"
+#include "OVModel.h"
+#include "OVTexture.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+// Hands a file to the parser in large chunks and reports each one. A
+// cancelled load ends the stream, which ends the parser.
+class ProgressStreambuf : public std::streambuf
+{
+public:
+    ProgressStreambuf(std::istream& file, const std::function<bool(int64_t)>& onRead)
+        : _file(file), _onRead(onRead), _buffer(1 << 18), _bytesRead(0), _isCancelled(false)
+    {
+    }
+
+    bool isCancelled() const { return _isCancelled; }
+
+protected:
+    virtual int_type underflow()
+    {
+        if (_isCancelled)
+            return traits_type::eof();
+        _file.read(_buffer.data(), _buffer.size());
+        std::streamsize size = _file.gcount();
+        if (size <= 0)
+            return traits_type::eof();
+        _bytesRead += size;
+        if (_onRead && !_onRead(_bytesRead))
+        {
+            _isCancelled = true;
+            return traits_type::eof();
+        }
+        setg(_buffer.data(), _buffer.data(), _buffer.data() + size);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::istream&                _file;
+    std::function<bool(int64_t)> _onRead;
+    std::vector<char>            _buffer;
+    int64_t                      _bytesRead;
+    bool                         _isCancelled;
+};
+
+bool
+LoadModel(Model& model, const std::string& filename, bool isUnitization, const LoadProgressCallback& progress)
+{
+    std::string dir = GetDir(filename);
+    std::string err;
+
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        ReportError("Cannot open \"" + filename + "\".\n");
+        return false;
+    }
+    LoadProgress p;
+    file.seekg(0, std::ios::end);
+    p.numBytes = (int64_t)file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    ProgressStreambuf buffer(file, [&](int64_t bytesRead)
+    {
+        p.bytesParsed = std::min(bytesRead, p.numBytes);
+        return !progress || progress(p);
+    });
+    std::istream stream(&buffer);
+    tinyobj::MaterialFileReader materialReader(dir);
+
+    model.filename = filename;
+    if (!tinyobj::LoadObj(model.shapes,
+                          model.materials,
+                          err,
+                          stream,
+                          materialReader,
+                          tinyobj::triangulation | tinyobj::calculate_normals))
+    {
+        if (!buffer.isCancelled())
+            ReportError(err);
+        return false;
+    }
+    if (buffer.isCancelled())
+        return false;
+    p.bytesParsed = p.numBytes;
+
+    bool isDecoded = DecodeTextures(model.materials, model.textures, dir, [&](int decoded, int total)
+    {
+        p.texturesDecoded = decoded;
+        p.numTextures = total;
+        return !progress || progress(p);
+    });
+    if (!isDecoded)
+        return false;
+
+    if (isUnitization)
+        Unitize(model.shapes);
+    ComputeBoundingSphere(model.shapes, model.boundingCenter, model.boundingRadius);
+
+    return true;
+}
+
+void
+Unitize(std::vector<tinyobj::shape_t>& shapes)
+{
+    float maxx = FLT_MIN;
+    float minx = FLT_MAX;
+    float maxy = FLT_MIN;
+    float miny = FLT_MAX;
+    float maxz = FLT_MIN;
+    float minz = FLT_MAX;
+    float cx, cy, cz, w, h, d;
+    float scale;
+
+    for (int i = 0; i < shapes.size(); ++i)
+    {
+        for (int v = 0; v < shapes[i].mesh.positions.size() / 3; ++v)
+        {
+            if (maxx < shapes[i].mesh.positions[3 * v + 0])
+                maxx = shapes[i].mesh.positions[3 * v + 0];
+            if (minx > shapes[i].mesh.positions[3 * v + 0])
+                minx = shapes[i].mesh.positions[3 * v + 0];
+
+            if (maxy < shapes[i].mesh.positions[3 * v + 1])
+                maxy = shapes[i].mesh.positions[3 * v + 1];
+            if (miny > shapes[i].mesh.positions[3 * v + 1])
+                miny = shapes[i].mesh.positions[3 * v + 1];
+
+            if (maxz < shapes[i].mesh.positions[3 * v + 2])
+                maxz = shapes[i].mesh.positions[3 * v + 2];
+            if (minz > shapes[i].mesh.positions[3 * v + 2])
+                minz = shapes[i].mesh.positions[3 * v + 2];
+        }
+    }
+    
+    // Calculate model width, height, and depth
+    w = abs(maxx) + abs(minx);
+    h = abs(maxy) + abs(miny);
+    d = abs(maxz) + abs(minz);
+
+    // Calculate center of the model
+    cx = (maxx + minx) / 2.0f;
+    cy = (maxy + miny) / 2.0f;
+    cz = (maxz + minz) / 2.0f;
+
+    // Calculate unitizing scale factor
+    scale = 2.0 / std::max(std::max(w, h), d);
+
+    // Translate around center then scale
+    for (int i = 0; i < shapes.size(); ++i)
+    {
+        for (int v = 0; v < shapes[i].mesh.positions.size() / 3; ++v)
+        {
+            shapes[i].mesh.positions[3 * v + 0] -= cx;
+            shapes[i].mesh.positions[3 * v + 1] -= cy;
+            shapes[i].mesh.positions[3 * v + 2] -= cz;
+            shapes[i].mesh.positions[3 * v + 0] *= scale;
+            shapes[i].mesh.positions[3 * v + 1] *= scale;
+            shapes[i].mesh.positions[3 * v + 2] *= scale;
+        }
+    }
+}
+
+void
+ComputeBoundingSphere(const std::vector<tinyobj::shape_t>& shapes, Vec3& center, double& radius)
+{
+    Vec3 minPos = Vec3::Constant(DBL_MAX);
+    Vec3 maxPos = Vec3::Constant(-DBL_MAX);
+    for (int i = 0; i < shapes.size(); ++i)
+    {
+        for (int v = 0; v < shapes[i].mesh.positions.size() / 3; ++v)
+        {
+            Vec3 p(shapes[i].mesh.positions[3 * v + 0],
+                   shapes[i].mesh.positions[3 * v + 1],
+                   shapes[i].mesh.positions[3 * v + 2]);
+            minPos = minPos.cwiseMin(p);
+            maxPos = maxPos.cwiseMax(p);
+        }
+    }
+
+    if (minPos(0) > maxPos(0))
+    {
+        center = Vec3::Zero();
+        radius = 0;
+        return;
+    }
+    center = (minPos + maxPos) / 2;
+    radius = (maxPos - minPos).norm() / 2;
+}
+
+ModelLoader::ModelLoader()
+    : _isCancelled(false)
+    , _isDone(false)
+{
+}
+
+ModelLoader::~ModelLoader()
+{
+    cancel();
+}
+
+void
+ModelLoader::start(const std::string& filename, bool isUnitization)
+{
+    cancel();
+    _filename = filename;
+    _isCancelled = false;
+    _isDone = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _progress = LoadProgress();
+        _model.reset();
+    }
+
+    _thread = std::thread([this, filename, isUnitization]()
+    {
+        std::shared_ptr<Model> model = std::make_shared<Model>();
+        bool isLoaded = LoadModel(*model, filename, isUnitization, [this](const LoadProgress& p)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _progress = p;
+            return !_isCancelled;
+        });
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (isLoaded && !_isCancelled)
+                _model = model;
+        }
+        _isDone = true;
+    });
+}
+
+void
+ModelLoader::cancel()
+{
+    _isCancelled = true;
+    if (_thread.joinable())
+        _thread.join();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _model.reset();
+}
+
+LoadProgress
+ModelLoader::getProgress() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _progress;
+}
+
+std::shared_ptr<Model>
+ModelLoader::take()
+{
+    if (_thread.joinable())
+        _thread.join();
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::shared_ptr<Model> model;
+    model.swap(_model);
+    return model;
+}
+
+} // namespace ov
@@ -0,0 +1,533 @@
+#include "OVOffscreen.h"
+#include "OVError.h"
+#include "OVRender.h"
+#include "OVUtil.h"
+
+#ifndef GL_FRAMEBUFFER_EXT
+#define GL_FRAMEBUFFER_EXT 0x8D40
+#endif
+
+#ifndef GL_RENDERBUFFER_EXT
+#define GL_RENDERBUFFER_EXT 0x8D41
+#endif
+
+#ifndef GL_COLOR_ATTACHMENT0_EXT
+#define GL_COLOR_ATTACHMENT0_EXT 0x8CE0
+#endif
+
+#ifndef GL_DEPTH_ATTACHMENT_EXT
+#define GL_DEPTH_ATTACHMENT_EXT 0x8D00
+#endif
+
+#ifndef GL_STENCIL_ATTACHMENT_EXT
+#define GL_STENCIL_ATTACHMENT_EXT 0x8D20
+#endif
+
+#ifndef GL_DEPTH24_STENCIL8_EXT
+#define GL_DEPTH24_STENCIL8_EXT 0x88F0
+#endif
+
+#ifndef GL_FRAMEBUFFER_COMPLETE_EXT
+#define GL_FRAMEBUFFER_COMPLETE_EXT 0x8CD5
+#endif
+
+namespace ov
+{
+
+static const wchar_t* WindowClassName = L"OVOffscreenWindow";
+
+static LRESULT CALLBACK
+OffscreenWindowProc(HWND window, UINT message, WPARAM wParam, LPARAM lParam)
+{
+    return DefWindowProcW(window, message, wParam, lParam);
+}
+
+OffscreenContext::OffscreenContext()
+{
+    _backend = OFFSCREEN_GPU;
+    _window = NULL;
+    _dc = NULL;
+    _bitmap = NULL;
+    _oldBitmap = NULL;
+    _context = NULL;
+    _maxWidth = _maxHeight = 0;
+    _width = _height = 0;
+    _framebuffer = _colorBuffer = _depthBuffer = 0;
+}
+
+OffscreenContext::~OffscreenContext()
+{
+    destroy();
+}
+
+bool
+OffscreenContext::create(int backend, int maxWidth, int maxHeight)
+{
+    destroy();
+    _backend = backend;
+    if (backend == OFFSCREEN_SOFTWARE)
+    {
+        if (!createBitmapContext(maxWidth, maxHeight))
+        {
+            destroy();
+            return false;
+        }
+    }
+    else
+    {
+        if (!createWindowContext() || !makeCurrent() || !loadFramebufferFunctions())
+        {
+            destroy();
+            return false;
+        }
+    }
+
+    if (!makeCurrent())
+    {
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void
+OffscreenContext::destroy()
+{
+    if (_context)
+    {
+        wglMakeCurrent(_dc, _context);
+        deleteFramebuffer();
+        wglMakeCurrent(NULL, NULL);
+        wglDeleteContext(_context);
+        _context = NULL;
+    }
+    if (_bitmap)
+    {
+        SelectObject(_dc, _oldBitmap);
+        DeleteObject(_bitmap);
+        DeleteDC(_dc);
+        _bitmap = NULL;
+        _oldBitmap = NULL;
+        _dc = NULL;
+    }
+    if (_window)
+    {
+        if (_dc)
+            ReleaseDC(_window, _dc);
+        DestroyWindow(_window);
+        _window = NULL;
+        _dc = NULL;
+    }
+    _width = _height = 0;
+}
+
+bool
+OffscreenContext::makeCurrent()
+{
+    return _context && wglMakeCurrent(_dc, _context);
+}
+
+bool
+OffscreenContext::resize(int width, int height)
+{
+    if (width == _width && height == _height)
+        return true;
+
+    if (_backend == OFFSCREEN_SOFTWARE)
+    {
+        if (width > _maxWidth || height > _maxHeight)
+        {
+            ReportError("The frame of " + std::to_string(width) + "x" + std::to_string(height)
+                        + " exceeds the software renderer's maximum size of "
+                        + std::to_string(_maxWidth) + "x" + std::to_string(_maxHeight) + ".\n");
+            return false;
+        }
+    }
+    else
+    {
+        deleteFramebuffer();
+        _glGenFramebuffers(1, &_framebuffer);
+        _glBindFramebuffer(GL_FRAMEBUFFER_EXT, _framebuffer);
+
+        _glGenRenderbuffers(1, &_colorBuffer);
+        _glBindRenderbuffer(GL_RENDERBUFFER_EXT, _colorBuffer);
+        _glRenderbufferStorage(GL_RENDERBUFFER_EXT, GL_RGBA8, width, height);
+        _glFramebufferRenderbuffer(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, _colorBuffer);
+
+        _glGenRenderbuffers(1, &_depthBuffer);
+        _glBindRenderbuffer(GL_RENDERBUFFER_EXT, _depthBuffer);
+        _glRenderbufferStorage(GL_RENDERBUFFER_EXT, GL_DEPTH24_STENCIL8_EXT, width, height);
+        _glFramebufferRenderbuffer(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, _depthBuffer);
+        _glFramebufferRenderbuffer(GL_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, _depthBuffer);
+
+        if (_glCheckFramebufferStatus(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT)
+        {
+            ReportError("Cannot create a " + std::to_string(width) + "x" + std::to_string(height) + " framebuffer.\n");
+            deleteFramebuffer();
+            return false;
+        }
+    }
+
+    _width = width;
+    _height = height;
+    glViewport(0, 0, (GLsizei)width, (GLsizei)height);
+    return true;
+}
+
+bool
+OffscreenContext::createWindowContext()
+{
+    HINSTANCE instance = GetModuleHandleW(NULL);
+
+    WNDCLASSW windowClass;
+    ZeroMemory(&windowClass, sizeof(windowClass));
+    windowClass.style = CS_OWNDC;
+    windowClass.lpfnWndProc = OffscreenWindowProc;
+    windowClass.hInstance = instance;
+    windowClass.lpszClassName = WindowClassName;
+    // Fails harmlessly when another context registered it already
+    RegisterClassW(&windowClass);
+
+    // The window is never shown, it only provides a device context
+    _window = CreateWindowExW(0, WindowClassName, L"", WS_POPUP, 0, 0, 1, 1, NULL, NULL, instance, NULL);
+    if (!_window)
+    {
+        ReportError("Cannot create the offscreen window.\n");
+        return false;
+    }
+    _dc = GetDC(_window);
+
+    PIXELFORMATDESCRIPTOR pfd;
+    ZeroMemory(&pfd, sizeof(pfd));
+    pfd.nSize = sizeof(pfd);
+    pfd.nVersion = 1;
+    pfd.dwFlags = PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER;
+    pfd.iPixelType = PFD_TYPE_RGBA;
+    pfd.cColorBits = 32;
+    pfd.cDepthBits = 24;
+    pfd.cStencilBits = 8;
+    pfd.iLayerType = PFD_MAIN_PLANE;
+
+    int format = ChoosePixelFormat(_dc, &pfd);
+    if (!format || !SetPixelFormat(_dc, format, &pfd))
+    {
+        ReportError("Cannot set a pixel format for the offscreen window.\n");
+        return false;
+    }
+
+    _context = wglCreateContext(_dc);
+    if (!_context)
+    {
+        ReportError("Cannot create an OpenGL context.\n");
+        return false;
+    }
+    return true;
+}
+
+bool
+OffscreenContext::createBitmapContext(int maxWidth, int maxHeight)
+{
+    _maxWidth = maxWidth;
+    _maxHeight = maxHeight;
+
+    _dc = CreateCompatibleDC(NULL);
+    if (!_dc)
+    {
+        ReportError("Cannot create a memory device context.\n");
+        return false;
+    }
+
+    // Bottom-up 24 bit DIB, the layout glReadPixels expects
+    BITMAPINFO info;
+    ZeroMemory(&info, sizeof(info));
+    info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info.bmiHeader.biWidth = maxWidth;
+    info.bmiHeader.biHeight = maxHeight;
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 24;
+    info.bmiHeader.biCompression = BI_RGB;
+
+    void* bits = NULL;
+    _bitmap = CreateDIBSection(_dc, &info, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (!_bitmap)
+    {
+        ReportError("Cannot create a " + std::to_string(maxWidth) + "x" + std::to_string(maxHeight) + " bitmap.\n");
+        DeleteDC(_dc);
+        _dc = NULL;
+        return false;
+    }
+    _oldBitmap = SelectObject(_dc, _bitmap);
+
+    PIXELFORMATDESCRIPTOR pfd;
+    ZeroMemory(&pfd, sizeof(pfd));
+    pfd.nSize = sizeof(pfd);
+    pfd.nVersion = 1;
+    pfd.dwFlags = PFD_DRAW_TO_BITMAP | PFD_SUPPORT_OPENGL | PFD_SUPPORT_GDI;
+    pfd.iPixelType = PFD_TYPE_RGBA;
+    pfd.cColorBits = 24;
+    pfd.cDepthBits = 24;
+    pfd.cStencilBits = 8;
+    pfd.iLayerType = PFD_MAIN_PLANE;
+
+    int format = ChoosePixelFormat(_dc, &pfd);
+    if (!format || !SetPixelFormat(_dc, format, &pfd))
+    {
+        ReportError("Cannot set a pixel format for the offscreen bitmap.\n");
+        return false;
+    }
+
+    _context = wglCreateContext(_dc);
+    if (!_context)
+    {
+        ReportError("Cannot create a software OpenGL context.\n");
+        return false;
+    }
+    return true;
+}
+
+bool
+OffscreenContext::loadFramebufferFunctions()
+{
+    _glGenFramebuffers = (GenFunc)wglGetProcAddress("glGenFramebuffersEXT");
+    _glDeleteFramebuffers = (DeleteFunc)wglGetProcAddress("glDeleteFramebuffersEXT");
+    _glBindFramebuffer = (BindFunc)wglGetProcAddress("glBindFramebufferEXT");
+    _glGenRenderbuffers = (GenFunc)wglGetProcAddress("glGenRenderbuffersEXT");
+    _glDeleteRenderbuffers = (DeleteFunc)wglGetProcAddress("glDeleteRenderbuffersEXT");
+    _glBindRenderbuffer = (BindFunc)wglGetProcAddress("glBindRenderbufferEXT");
+    _glRenderbufferStorage = (RenderbufferStorageFunc)wglGetProcAddress("glRenderbufferStorageEXT");
+    _glFramebufferRenderbuffer = (FramebufferRenderbufferFunc)wglGetProcAddress("glFramebufferRenderbufferEXT");
+    _glCheckFramebufferStatus = (CheckFramebufferStatusFunc)wglGetProcAddress("glCheckFramebufferStatusEXT");
+
+    if (!_glGenFramebuffers || !_glDeleteFramebuffers || !_glBindFramebuffer
+        || !_glGenRenderbuffers || !_glDeleteRenderbuffers || !_glBindRenderbuffer
+        || !_glRenderbufferStorage || !_glFramebufferRenderbuffer || !_glCheckFramebufferStatus)
+    {
+        ReportError("The OpenGL driver does not support framebuffer objects, use the software backend.\n");
+        return false;
+    }
+    return true;
+}
+
+void
+OffscreenContext::deleteFramebuffer()
+{
+    if (_framebuffer)
+    {
+        _glBindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+        _glDeleteFramebuffers(1, &_framebuffer);
+    }
+    if (_colorBuffer)
+        _glDeleteRenderbuffers(1, &_colorBuffer);
+    if (_depthBuffer)
+        _glDeleteRenderbuffers(1, &_depthBuffer);
+    _framebuffer = _colorBuffer = _depthBuffer = 0;
+}
+
+OffscreenRenderer::OffscreenRenderer()
+{
+    _width = _height = 0;
+    _renderer.setPlanes(1, 10000);
+}
+
+OffscreenRenderer::~OffscreenRenderer()
+{
+    // Textures go before the context that owns them
+    if (_context.makeCurrent())
+    {
+        _textures.clear();
+        _renderer.destroy();
+    }
+}
+
+bool
+OffscreenRenderer::create(int backend, int maxWidth, int maxHeight)
+{
+    if (!_context.create(backend, maxWidth, maxHeight))
+        return false;
+
+    _renderer.create();
+    return true;
+}
+
+bool
+OffscreenRenderer::setModel(const std::shared_ptr<const Model>& model)
+{
+    _renderer.setModel(model, _textures.get(model->filename, model->textures));
+    return true;
+}
+
+bool
+OffscreenRenderer::setBackground(const cv::Mat& image)
+{
+    // Drawn again whenever the lens changes; callers may pass a header on
+    // memory they release after the call
+    _background = image.clone();
+    return uploadBackground();
+}
+
+bool
+OffscreenRenderer::uploadBackground()
+{
+    _width = _height = 0;
+    if (_background.empty())
+        return false;
+
+    if (!_distortion)
+    {
+        if (!_context.resize(_background.cols, _background.rows))
+            return false;
+        _renderer.setViewport(_background.cols, _background.rows);
+        _renderer.setBackground(_background);
+    }
+    else
+    {
+        if (_background.cols != _camera.width || _background.rows != _camera.height)
+        {
+            ReportError("The background of " + std::to_string(_background.cols) + "x" + std::to_string(_background.rows)
+                        + " does not match the camera's " + std::to_string(_camera.width) + "x" + std::to_string(_camera.height)
+                        + ", which its distortion needs.\n");
+            return false;
+        }
+        const CameraParameters& canvas = _distortion->getRenderCamera();
+        if (!_context.resize(canvas.width, canvas.height))
+            return false;
+        _renderer.setViewport(canvas.width, canvas.height);
+        cv::Mat undistorted;
+        _distortion->undistort(_background, undistorted);
+        _renderer.setBackground(undistorted);
+    }
+    _width = _background.cols;
+    _height = _background.rows;
+    return true;
+}
+
+bool
+OffscreenRenderer::getProjectionMatrix(double projectionMatrix[16])
+{
+    if (!_renderer.hasCamera())
+        return false;
+    std::copy(_renderer.getProjectionMatrix(), _renderer.getProjectionMatrix() + 16, projectionMatrix);
+    return true;
+}
+
+void
+OffscreenRenderer::setCamera(const CameraParameters& camera)
+{
+    std::shared_ptr<const LensDistortion> distortion;
+    if (HasDistortion(camera))
+        distortion = GetLensDistortion(camera);
+    _camera = camera;
+
+    _renderer.setCamera(distortion ? distortion->getRenderCamera() : camera);
+
+    // The canvas, and the background on it, change with the lens
+    if (distortion != _distortion)
+    {
+        _distortion = distortion;
+        uploadBackground();
+    }
+}
+
+bool
+OffscreenRenderer::render(const Mat3& R, const Vec3& t, cv::Mat& image)
+{
+    if (_width == 0 || _height == 0)
+        return false;
+
+    _renderer.render(R, t);
+    if (_distortion)
+    {
+        ReadPixels(_canvas);
+        _distortion->distort(_canvas, image);
+    }
+    else
+        ReadPixels(image);
+    return true;
+}
+
+bool
+OffscreenRenderer::renderLayer(const Mat3& R, const Vec3& t, cv::Mat& image)
+{
+    if (_width == 0 || _height == 0)
+        return false;
+
+    _renderer.render(R, t, true);
+    cv::Mat& layer = _distortion ? _canvas : image;
+    ReadPixels(layer, 4);
+
+    // The bitmap of the software backend has no alpha, the depth buffer
+    // tells which pixels the model covers
+    if (_context.getBackend() == OFFSCREEN_SOFTWARE)
+    {
+        ReadDepth(_depth);
+        for (int y = 0; y < layer.rows; ++y)
+        {
+            uchar* pixel = layer.ptr<uchar>(y);
+            const float* depth = _depth.ptr<float>(y);
+            for (int x = 0; x < layer.cols; ++x, pixel += 4)
+                pixel[3] = depth[x] < 1 ? 255 : 0;
+        }
+    }
+
+    if (_distortion)
+        _distortion->distort(_canvas, image);
+    return true;
+}
+
+void
+OffscreenRenderer::warp(cv::Mat& canvas, cv::Mat& image, int interpolation)
+{
+    if (_distortion)
+        _distortion->distort(canvas, image, interpolation);
+    else
+        image = canvas;
+}
+
+bool
+OffscreenRenderer::renderChannels(const Mat3& R, const Vec3& t, const ChannelOptions& options,
+                                  cv::Mat& image, std::vector<cv::Mat>& channels)
+{
+    if (_width == 0 || _height == 0)
+        return false;
+
+    // The frames are new memory, the pipeline still holds the last ones
+    channels.clear();
+    _renderer.render(R, t, false, (options.channels & CHANNEL_MASK) ? options.maskMode : MASK_NONE);
+    if (_distortion)
+    {
+        ReadPixels(_canvas);
+        _distortion->distort(_canvas, image);
+    }
+    else
+        ReadPixels(image);
+
+    if (options.channels & (CHANNEL_DEPTH | CHANNEL_NORMALS))
+        ReadDepth(_depth);
+    if (options.channels & CHANNEL_DEPTH)
+    {
+        cv::Mat depth;
+        LinearizeDepth(_depth, _renderer.getPlaneNear(), _renderer.getPlaneFar(), depth);
+        channels.push_back(cv::Mat());
+        warp(depth, channels.back(), cv::INTER_NEAREST);
+    }
+    if (options.channels & CHANNEL_MASK)
+    {
+        cv::Mat mask;
+        ReadStencil(mask);
+        channels.push_back(cv::Mat());
+        warp(mask, channels.back(), cv::INTER_NEAREST);
+    }
+    if (options.channels & CHANNEL_NORMALS)
+    {
+        _renderer.renderNormals(R, t);
+        ReadPixels(_normals);
+
+        cv::Mat normals;
+        DecodeNormals(_normals, _depth, normals);
+        channels.push_back(cv::Mat());
+        warp(normals, channels.back(), cv::INTER_NEAREST);
+    }
+    return true;
+}
+
+} // namespace ov
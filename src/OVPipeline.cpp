@@ -0,0 +1,382 @@
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include "OVAugment.h"
+#include "OVError.h"
+#include "OVPipeline.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t
+MicrosecondsSince(const Clock::time_point& start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+uint64_t
+FrameSeed(int sequence, int frame)
+{
+    // SplitMix64 finalizer spreads neighbouring frames over the whole state
+    uint64_t z = ((uint64_t)(uint32_t)sequence << 32 | (uint32_t)frame) + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static bool
+EncodeFrame(cv::Mat& image, int encoding, const PngOptions& options, PngEncoder& encoder, std::vector<uchar>& data)
+{
+    if (encoding == ENCODING_RAW)
+    {
+        if (!image.isContinuous())
+            image = image.clone();
+        data.assign(image.data, image.data + image.total() * image.elemSize());
+        return true;
+    }
+    if (encoding == ENCODING_PNG_FAST)
+    {
+        PngOptions fast;
+        fast.encoder = PNG_ENCODER_FAST;
+        fast.level = 1;
+        return EncodePng(image, fast, encoder, data);
+    }
+    return EncodePng(image, options, encoder, data);
+}
+
+// Round to nearest even, as the F16C instructions do
+static uint16_t
+FloatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+    if (magnitude > 0x7F800000)
+        return (uint16_t)(sign | 0x7E00);
+    // Past the largest half, 65504, by half a step and more
+    if (magnitude >= 0x477FF000)
+        return (uint16_t)(sign | 0x7C00);
+    // Below the smallest normal half, 2^-14
+    if (magnitude < 0x38800000)
+    {
+        if (magnitude < 0x33000000)
+            return (uint16_t)sign;
+        int shift = 126 - (int)(magnitude >> 23);
+        uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+            ++half;
+        return (uint16_t)(sign | half);
+    }
+    // Rebias the exponent and drop 13 bits of mantissa; a carry moves on
+    // to the exponent as it should
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t remainder = magnitude & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        ++half;
+    return (uint16_t)(sign | half);
+}
+
+static void
+ConvertToHalf(const cv::Mat& image, cv::Mat& half)
+{
+    half.create(image.size(), CV_MAKETYPE(CV_16U, image.channels()));
+    int rowLength = image.cols * image.channels();
+    for (int y = 0; y < image.rows; ++y)
+    {
+        const float* in = image.ptr<float>(y);
+        uint16_t* out = half.ptr<uint16_t>(y);
+        for (int x = 0; x < rowLength; ++x)
+            out[x] = FloatToHalf(in[x]);
+    }
+}
+
+static int
+DefaultNumWorkers(int numWorkers)
+{
+    if (numWorkers > 0)
+        return numWorkers;
+    return std::max(1, (int)std::thread::hardware_concurrency() - 1);
+}
+
+// Two frames per worker keep everybody busy without piling up memory
+static int
+DefaultQueueSize(int numWorkers, int queueSize)
+{
+    return (queueSize > 0) ? queueSize : 2 * DefaultNumWorkers(numWorkers);
+}
+
+FramePipeline::FramePipeline(int numWorkers, int queueSize)
+    : _jobQueue(DefaultQueueSize(numWorkers, queueSize)),
+      _encodedQueue(DefaultQueueSize(numWorkers, queueSize))
+{
+    // Every worker busy and a queue's worth of frames done ahead of the writer
+    _maxAhead = DefaultNumWorkers(numWorkers) + DefaultQueueSize(numWorkers, queueSize);
+    numWorkers = DefaultNumWorkers(numWorkers);
+
+    _isFinishing = false;
+    _numWorkersDone = 0;
+    _nextIndex = 0;
+    _numDone = 0;
+    _numWritten = 0;
+    _numLinked = 0;
+    _numErrors = 0;
+    _stallTime = 0;
+    _augmentTime = 0;
+    _encodeTime = 0;
+    _writeTime = 0;
+    _encodedBytes = 0;
+    _rawBytes = 0;
+    _startTime = _finishTime = Clock::now();
+
+    for (int i = 0; i < numWorkers; ++i)
+        _workers.push_back(std::thread(&FramePipeline::workerLoop, this));
+    _writer = std::thread(&FramePipeline::writerLoop, this);
+}
+
+FramePipeline::~FramePipeline()
+{
+    finish();
+}
+
+void
+FramePipeline::push(FrameJob& job)
+{
+    job.index = _nextIndex++;
+
+    if (!_jobQueue.tryPush(job))
+    {
+        Clock::time_point start = Clock::now();
+        _jobPopped.wait([&]() { return _jobQueue.tryPush(job); });
+        _stallTime += MicrosecondsSince(start);
+    }
+    _jobPushed.notify();
+}
+
+void
+FramePipeline::finish()
+{
+    if (_isFinishing)
+        return;
+
+    _isFinishing = true;
+    _jobPushed.notify();
+    for (size_t i = 0; i < _workers.size(); ++i)
+        _workers[i].join();
+    _writer.join();
+    _finishTime = Clock::now();
+}
+
+void
+FramePipeline::workerLoop()
+{
+    FrameJob job;
+    // Keeps its buffers from frame to frame
+    PngEncoder encoder;
+    // The frames are pushed on, waiting for room if the writer is behind
+    auto pushFrame = [this](EncodedFrame& frame)
+    {
+        if (!_encodedQueue.tryPush(frame))
+            _framePopped.wait([&]() { return _encodedQueue.tryPush(frame); });
+        _framePushed.notify();
+    };
+    for (;;)
+    {
+        // The producer stops pushing before it raises the flag, the queue
+        // is empty for good if it is empty after the flag is seen
+        bool isPopped = _jobQueue.tryPop(job);
+        if (!isPopped)
+            _jobPushed.wait([&]()
+            {
+                bool isFinishing = _isFinishing;
+                isPopped = _jobQueue.tryPop(job);
+                return isPopped || isFinishing;
+            });
+        if (!isPopped)
+            break;
+        _jobPopped.notify();
+
+        // Frames finished ahead of their turn wait in the writer; holding
+        // this one back bounds them, the writer's next frame always goes on
+        if (job.index >= _numDone + _maxAhead)
+            _frameWritten.wait([&]() { return job.index < _numDone + _maxAhead; });
+
+        // Links and closing sinks pass straight to the writer
+        if (!job.linkTarget.empty() || job.isClosingSink)
+        {
+            EncodedFrame frame;
+            frame.index = job.index;
+            frame.frameIndex = job.frameIndex;
+            frame.inputHash = job.inputHash;
+            frame.filename.swap(job.filename);
+            frame.linkTarget.swap(job.linkTarget);
+            frame.isClosingSink = job.isClosingSink;
+            frame.sink.swap(job.sink);
+            pushFrame(frame);
+            continue;
+        }
+
+        // Image processing
+        Clock::time_point start = Clock::now();
+        cv::Mat& image = job.image;
+        if (job.layer)
+        {
+            // Backgrounds of another size are fitted to the frame
+            cv::Mat background = image;
+            if (background.size() != job.layer->size())
+                cv::resize(image, background, job.layer->size(), 0, 0, cv::INTER_AREA);
+            // The background may be a cached asset, the frame is new memory
+            image = cv::Mat();
+            job.layer->composite(background, image);
+            job.layer.reset();
+        }
+        // Fused and keyed by pixel, the output is the same for any number of workers
+        AugmentFrame(image, job.blurSigma, job.noiseVariance, job.noiseSeed);
+        if (job.isHalf && image.depth() == CV_32F)
+        {
+            cv::Mat half;
+            ConvertToHalf(image, half);
+            image = half;
+        }
+        _augmentTime += MicrosecondsSince(start);
+
+        start = Clock::now();
+        EncodedFrame frame;
+        frame.index = job.index;
+        frame.frameIndex = job.frameIndex;
+        frame.inputHash = job.inputHash;
+        frame.filename.swap(job.filename);
+        frame.width = image.cols;
+        frame.height = image.rows;
+        frame.channels = image.channels();
+        frame.depth = image.depth();
+        frame.encoding = job.sink ? job.sink->getEncoding() : ENCODING_PNG;
+        std::copy(job.pose, job.pose + PoseSize, frame.pose);
+        PngOptions pngOptions = job.sink ? job.sink->getPngOptions() : PngOptions();
+        frame.sink.swap(job.sink);
+        if (!EncodeFrame(image, frame.encoding, pngOptions, encoder, frame.data))
+            frame.data.clear();
+        _rawBytes += image.total() * image.elemSize();
+        image.release();
+        _encodeTime += MicrosecondsSince(start);
+        _encodedBytes += frame.data.size();
+
+        pushFrame(frame);
+    }
+
+    ++_numWorkersDone;
+    _framePushed.notify();
+}
+
+void
+FramePipeline::writerLoop()
+{
+    // Frames finish out of order; hold them back until their turn comes
+    std::map<int, EncodedFrame> pending;
+    int nextIndex = 0;
+    EncodedFrame frame;
+    for (;;)
+    {
+        // The workers are done pushing once they are all counted
+        bool isPopped = _encodedQueue.tryPop(frame);
+        if (!isPopped)
+            _framePushed.wait([&]()
+            {
+                bool isDone = _numWorkersDone == _workers.size();
+                isPopped = _encodedQueue.tryPop(frame);
+                return isPopped || isDone;
+            });
+        if (!isPopped)
+            break;
+        _framePopped.notify();
+        int index = frame.index;
+        pending[index] = std::move(frame);
+
+        while (!pending.empty() && pending.begin()->first == nextIndex)
+        {
+            Clock::time_point start = Clock::now();
+            EncodedFrame& next = pending.begin()->second;
+            if (next.isClosingSink)
+            {
+                // The sink reports what it cannot complete
+                if (next.sink && !next.sink->close())
+                    ++_numErrors;
+            }
+            else if (!next.linkTarget.empty())
+            {
+                // The target was pushed earlier, it is written by now
+                if (LinkFile(next.linkTarget, next.filename))
+                {
+                    ++_numLinked;
+                    if (_linkedCallback)
+                        _linkedCallback(next.filename, next.inputHash, next.linkTarget);
+                }
+                else
+                {
+                    ReportError("Cannot link \"" + next.filename + "\".\n");
+                    ++_numErrors;
+                }
+            }
+            else if (next.data.empty() || !next.sink || !next.sink->write(next))
+            {
+                ReportError("Cannot write \"" + next.filename + "\".\n");
+                ++_numErrors;
+            }
+            else
+            {
+                ++_numWritten;
+                if (_writtenCallback)
+                    _writtenCallback(next.filename, next.inputHash, next.data);
+            }
+            pending.erase(pending.begin());
+            ++nextIndex;
+            _writeTime += MicrosecondsSince(start);
+        }
+        if (_numDone != nextIndex)
+        {
+            _numDone = nextIndex;
+            _frameWritten.notify();
+        }
+    }
+}
+
+double
+FramePipeline::getSeconds() const
+{
+    Clock::time_point end = _isFinishing ? _finishTime : Clock::now();
+    return std::chrono::duration<double>(end - _startTime).count();
+}
+
+std::string
+FramePipeline::getStats() const
+{
+    double wall = std::max(1.0, getSeconds() * 1e6);
+    double workers = (double)_workers.size();
+
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(0)
+       << "Frames: " << _numWritten
+       << (_numLinked > 0 ? " and " + std::to_string(_numLinked) + " linked" : std::string())
+       << ", render " << 100 * (1 - _stallTime / wall) << "%"
+       << ", blur/noise " << 100 * _augmentTime / (wall * workers) << "%"
+       << ", encode " << 100 * _encodeTime / (wall * workers) << "% of " << _workers.size() << " workers"
+       << " at " << _rawBytes / std::max<int64_t>(1, _encodeTime) << " MB/s each"
+       << ", write " << 100 * _writeTime / wall << "%"
+       << std::setprecision(1)
+       << ", " << _numWritten / (wall / 1e6) << " frames/s"
+       << ", " << _encodedBytes / wall << " MB/s";
+    return ss.str();
+}
+
+} // namespace ov
@@ -0,0 +1,627 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include "OVPng.h"
+
+namespace ov
+{
+
+static const int      HashBits = 15;
+static const int      WindowSize = 32768;
+static const int      MinMatch = 4;
+static const int      MaxMatch = 258;
+static const int      MaxStoredBlock = 65535;
+static const uint32_t AdlerBase = 65521;
+static const int      AdlerChunk = 5552; // most bytes before the sums can overflow
+
+bool
+ParsePngOption(const std::string& key, const std::string& value, PngOptions& options)
+{
+    if (key == "png")
+    {
+        if (value == "opencv")
+            options.encoder = PNG_ENCODER_OPENCV;
+        else if (value == "fast")
+            options.encoder = PNG_ENCODER_FAST;
+        else
+            return false;
+    }
+    else if (key == "png-level")
+    {
+        try
+        {
+            options.level = std::stoi(value);
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+        return options.level >= 0 && options.level <= 9;
+    }
+    else if (key == "png-strategy")
+    {
+        if (value == "default")
+            options.strategy = cv::IMWRITE_PNG_STRATEGY_DEFAULT;
+        else if (value == "filtered")
+            options.strategy = cv::IMWRITE_PNG_STRATEGY_FILTERED;
+        else if (value == "huffman")
+            options.strategy = cv::IMWRITE_PNG_STRATEGY_HUFFMAN_ONLY;
+        else if (value == "rle")
+            options.strategy = cv::IMWRITE_PNG_STRATEGY_RLE;
+        else if (value == "fixed")
+            options.strategy = cv::IMWRITE_PNG_STRATEGY_FIXED;
+        else
+            return false;
+    }
+    else
+        return false;
+    return true;
+}
+
+// CRC-32 of the PNG chunks, eight bytes per step
+struct CrcTables
+{
+    CrcTables()
+    {
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[0][n] = c;
+        }
+        for (int k = 1; k < 8; ++k)
+        {
+            for (int n = 0; n < 256; ++n)
+                table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xFF];
+        }
+    }
+
+    uint32_t table[8][256];
+};
+
+static uint32_t
+UpdateCrc(uint32_t crc, const uchar* data, size_t size)
+{
+    static const CrcTables tables;
+    const uint32_t (*t)[256] = tables.table;
+    crc = ~crc;
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint32_t one = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24);
+        uint32_t two = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24]
+              ^ t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    }
+    for (; size > 0; ++data, --size)
+        crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t
+UpdateAdler(uint32_t adler, const uchar* data, size_t size)
+{
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (size > 0)
+    {
+        size_t n = std::min(size, (size_t)AdlerChunk);
+        size -= n;
+        for (; n > 0; --n)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= AdlerBase;
+        b %= AdlerBase;
+    }
+    return a | b << 16;
+}
+
+// Adler-32 of two buffers back to back from the checksums of each, as
+// zlib's adler32_combine
+static uint32_t
+CombineAdler(uint32_t adler1, uint32_t adler2, uint64_t size2)
+{
+    uint32_t remainder = (uint32_t)(size2 % AdlerBase);
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = (uint32_t)((uint64_t)remainder * sum1 % AdlerBase);
+    sum1 += (adler2 & 0xFFFF) + AdlerBase - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + AdlerBase - remainder;
+    if (sum1 >= AdlerBase)
+        sum1 -= AdlerBase;
+    if (sum1 >= AdlerBase)
+        sum1 -= AdlerBase;
+    if (sum2 >= 2 * AdlerBase)
+        sum2 -= 2 * AdlerBase;
+    if (sum2 >= AdlerBase)
+        sum2 -= AdlerBase;
+    return sum1 | sum2 << 16;
+}
+
+static uint32_t
+ReverseBits(uint32_t code, int numBits)
+{
+    uint32_t reversed = 0;
+    for (int i = 0; i < numBits; ++i, code >>= 1)
+        reversed = reversed << 1 | (code & 1);
+    return reversed;
+}
+
+// The fixed Huffman code of deflate, with the extra bits of every length
+// and distance folded in, ready for an LSB-first bit stream
+struct FixedCode
+{
+    FixedCode()
+    {
+        for (int symbol = 0; symbol < 288; ++symbol)
+        {
+            if (symbol < 144)
+                setLiteral(symbol, 0x30 + symbol, 8);
+            else if (symbol < 256)
+                setLiteral(symbol, 0x190 + symbol - 144, 9);
+            else if (symbol < 280)
+                setLiteral(symbol, symbol - 256, 7);
+            else
+                setLiteral(symbol, 0xC0 + symbol - 280, 8);
+        }
+
+        static const int LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const int LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                             3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        for (int i = 0; i < 29; ++i)
+        {
+            int end = (i + 1 < 29) ? LengthBase[i + 1] : 259;
+            for (int length = LengthBase[i]; length < end; ++length)
+            {
+                int symbol = 257 + i;
+                lengthCode[length] = literalCode[symbol] | (length - LengthBase[i]) << literalBits[symbol];
+                lengthBits[length] = literalBits[symbol] + LengthExtra[i];
+            }
+        }
+
+        static const int DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                              513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        for (int i = 0; i < 30; ++i)
+        {
+            distanceBase[i] = DistanceBase[i];
+            distanceExtra[i] = i < 4 ? 0 : (i - 2) / 2;
+            distanceCode[i] = ReverseBits(i, 5);
+        }
+        for (int i = 0, distance = 1; i < 30; ++i)
+        {
+            for (; distance < ((i + 1 < 30) ? DistanceBase[i + 1] : WindowSize + 1); ++distance)
+                distanceSymbol[distance - 1] = (uchar)i;
+        }
+    }
+
+    void setLiteral(int symbol, uint32_t code, int numBits)
+    {
+        literalCode[symbol] = ReverseBits(code, numBits);
+        literalBits[symbol] = (uchar)numBits;
+    }
+
+    uint32_t literalCode[288];
+    uchar    literalBits[288];
+    uint32_t lengthCode[MaxMatch + 1];
+    uchar    lengthBits[MaxMatch + 1];
+    uint32_t distanceCode[30];
+    int      distanceBase[30];
+    int      distanceExtra[30];
+    uchar    distanceSymbol[WindowSize];
+};
+
+static const FixedCode&
+GetFixedCode()
+{
+    static const FixedCode code;
+    return code;
+}
+
+// LSB-first bits into a buffer that is known to be large enough
+class BitWriter
+{
+public:
+    explicit BitWriter(uchar* out) : _out(out), _bits(0), _numBits(0) {}
+
+    void put(uint32_t bits, int numBits)
+    {
+        _bits |= (uint64_t)bits << _numBits;
+        _numBits += numBits;
+        if (_numBits >= 32)
+        {
+            _out[0] = (uchar)_bits;
+            _out[1] = (uchar)(_bits >> 8);
+            _out[2] = (uchar)(_bits >> 16);
+            _out[3] = (uchar)(_bits >> 24);
+            _out += 4;
+            _bits >>= 32;
+            _numBits -= 32;
+        }
+    }
+
+    // Pad to a byte boundary
+    void align()
+    {
+        for (; _numBits > 0; _numBits -= 8)
+        {
+            *_out++ = (uchar)_bits;
+            _bits >>= 8;
+        }
+        _bits = 0;
+        _numBits = 0;
+    }
+
+    void putByte(uchar byte) { *_out++ = byte; }
+    uchar* end() const { return _out; }
+
+private:
+    uchar*   _out;
+    uint64_t _bits;
+    int      _numBits;
+};
+
+static uint32_t
+Read32(const uchar* p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static int
+Paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return (pb <= pc) ? b : c;
+}
+
+// PNG stores RGB(A), frames are BGR(A)
+static void
+ToPngOrder(const uchar* src, int cols, int channels, uchar* dst)
+{
+    if (channels < 3)
+    {
+        std::memcpy(dst, src, cols * channels);
+        return;
+    }
+    for (int x = 0; x < cols; ++x, src += channels, dst += channels)
+    {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        if (channels == 4)
+            dst[3] = src[3];
+    }
+}
+
+// Filter type 0 None, 1 Sub, 2 Up, 4 Paeth; out is the filtered row
+static void
+FilterRow(int type, const uchar* row, const uchar* lastRow, int size, int bpp, uchar* out)
+{
+    for (int x = 0; x < size; ++x)
+    {
+        int a = (x >= bpp) ? row[x - bpp] : 0;
+        int c = (x >= bpp) ? lastRow[x - bpp] : 0;
+        int predictor = 0;
+        if (type == 1)
+            predictor = a;
+        else if (type == 2)
+            predictor = lastRow[x];
+        else if (type == 4)
+            predictor = Paeth(a, lastRow[x], c);
+        out[x] = (uchar)(row[x] - predictor);
+    }
+}
+
+// Sum of the filtered bytes as signed values, the usual guess at which
+// filter compresses a row best
+static int
+FilterCost(int type, const uchar* row, const uchar* lastRow, int size, int bpp)
+{
+    int cost = 0;
+    for (int x = 0; x < size; ++x)
+    {
+        int a = (x >= bpp) ? row[x - bpp] : 0;
+        int c = (x >= bpp) ? lastRow[x - bpp] : 0;
+        int predictor = 0;
+        if (type == 1)
+            predictor = a;
+        else if (type == 2)
+            predictor = lastRow[x];
+        else if (type == 4)
+            predictor = Paeth(a, lastRow[x], c);
+        cost += std::abs((int)(signed char)(row[x] - predictor));
+    }
+    return cost;
+}
+
+static void
+PutLiteral(BitWriter& writer, const FixedCode& code, uchar literal)
+{
+    writer.put(code.literalCode[literal], code.literalBits[literal]);
+}
+
+static void
+PutMatch(BitWriter& writer, const FixedCode& code, int length, int distance)
+{
+    writer.put(code.lengthCode[length], code.lengthBits[length]);
+    int symbol = code.distanceSymbol[distance - 1];
+    writer.put(code.distanceCode[symbol] | (distance - code.distanceBase[symbol]) << 5, 5 + code.distanceExtra[symbol]);
+}
+
+void
+PngEncoder::encodeBand(const cv::Mat& image, int level, Band& band, bool isLast)
+{
+    int channels = image.channels();
+    int rowSize = image.cols * channels;
+    size_t size = (size_t)band.numRows * (rowSize + 1);
+    band.filtered.resize(size);
+    band.row.resize(rowSize);
+    band.lastRow.resize(rowSize);
+
+    // 1. Filter, the band's first row is predicted from the row above it
+    if (band.firstRow > 0)
+        ToPngOrder(image.ptr(band.firstRow - 1), image.cols, channels, band.lastRow.data());
+    else
+        std::fill(band.lastRow.begin(), band.lastRow.end(), 0);
+    uchar* out = band.filtered.data();
+    for (int r = band.firstRow; r < band.firstRow + band.numRows; ++r, out += rowSize + 1)
+    {
+        ToPngOrder(image.ptr(r), image.cols, channels, band.row.data());
+        int type = 0;
+        if (level == 1)
+            type = 2;
+        else if (level >= 2)
+        {
+            static const int Types[4] = { 0, 1, 2, 4 };
+            int bestCost = INT_MAX;
+            for (int i = 0; i < 4; ++i)
+            {
+                int cost = FilterCost(Types[i], band.row.data(), band.lastRow.data(), rowSize, channels);
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    type = Types[i];
+                }
+            }
+        }
+        out[0] = (uchar)type;
+        FilterRow(type, band.row.data(), band.lastRow.data(), rowSize, channels, out + 1);
+        band.row.swap(band.lastRow);
+    }
+    band.adler = UpdateAdler(1, band.filtered.data(), size);
+
+    // 2. Deflate. Bands but the last end on a byte boundary with an empty
+    // stored block, so the streams can be joined as they are.
+    band.deflated.resize(size + size / 8 + 5 * (size / MaxStoredBlock + 1) + 64);
+    BitWriter writer(band.deflated.data());
+    const uchar* data = band.filtered.data();
+    int n = (int)size;
+    if (level == 0)
+    {
+        int offset = 0;
+        do
+        {
+            int length = std::min(n - offset, MaxStoredBlock);
+            bool isFinal = isLast && offset + length == n;
+            writer.putByte(isFinal ? 1 : 0);
+            writer.putByte((uchar)length);
+            writer.putByte((uchar)(length >> 8));
+            writer.putByte((uchar)~length);
+            writer.putByte((uchar)(~length >> 8));
+            for (int i = 0; i < length; ++i)
+                writer.putByte(data[offset + i]);
+            offset += length;
+        } while (offset < n);
+        band.deflated.resize(writer.end() - band.deflated.data());
+        return;
+    }
+
+    const FixedCode& code = GetFixedCode();
+    band.head.assign(1 << HashBits, -1);
+    if (level >= 2)
+        band.previous.resize(WindowSize);
+    int maxTries = (level >= 2) ? 16 : 1;
+
+    writer.put(isLast ? 1 : 0, 1);
+    writer.put(1, 2); // fixed Huffman code
+    int pos = 0;
+    while (pos + MinMatch <= n)
+    {
+        uint32_t value = Read32(data + pos);
+        uint32_t hash = (value * 2654435761u) >> (32 - HashBits);
+        int candidate = band.head[hash];
+        band.head[hash] = pos;
+        if (level >= 2)
+            band.previous[pos & (WindowSize - 1)] = candidate;
+
+        int bestLength = 0, bestDistance = 0;
+        int maxLength = std::min(MaxMatch, n - pos);
+        for (int tries = maxTries; candidate >= 0 && pos - candidate <= WindowSize && tries > 0; --tries)
+        {
+            if (Read32(data + candidate) == value)
+            {
+                int length = MinMatch;
+                while (length < maxLength && data[candidate + length] == data[pos + length])
+                    ++length;
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestDistance = pos - candidate;
+                    if (length == maxLength)
+                        break;
+                }
+            }
+            if (level < 2)
+                break;
+            // Older entries can be overwritten by newer ones, the chain must go back in time
+            int next = band.previous[candidate & (WindowSize - 1)];
+            if (next >= candidate)
+                break;
+            candidate = next;
+        }
+
+        if (bestLength >= MinMatch)
+        {
+            PutMatch(writer, code, bestLength, bestDistance);
+            if (level >= 2)
+            {
+                for (int i = pos + 1; i < pos + bestLength && i + MinMatch <= n; ++i)
+                {
+                    uint32_t h = (Read32(data + i) * 2654435761u) >> (32 - HashBits);
+                    band.previous[i & (WindowSize - 1)] = band.head[h];
+                    band.head[h] = i;
+                }
+            }
+            pos += bestLength;
+        }
+        else
+            PutLiteral(writer, code, data[pos++]);
+    }
+    for (; pos < n; ++pos)
+        PutLiteral(writer, code, data[pos]);
+    writer.put(code.literalCode[256], code.literalBits[256]);
+
+    if (!isLast)
+    {
+        writer.put(0, 3);
+        writer.align();
+        writer.putByte(0x00);
+        writer.putByte(0x00);
+        writer.putByte(0xFF);
+        writer.putByte(0xFF);
+    }
+    else
+        writer.align();
+    band.deflated.resize(writer.end() - band.deflated.data());
+}
+
+class PngBandBody : public cv::ParallelLoopBody
+{
+public:
+    PngBandBody(const std::function<void(int)>& encodeBand) : _encodeBand(encodeBand) {}
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        for (int b = range.start; b < range.end; ++b)
+            _encodeBand(b);
+    }
+
+private:
+    std::function<void(int)> _encodeBand;
+};
+
+static uchar*
+PutUint32(uchar* p, uint32_t value)
+{
+    p[0] = (uchar)(value >> 24);
+    p[1] = (uchar)(value >> 16);
+    p[2] = (uchar)(value >> 8);
+    p[3] = (uchar)value;
+    return p + 4;
+}
+
+// Chunk data must already be in place after the length and type
+static uchar*
+FinishChunk(uchar* chunk, const char* type, uint32_t length)
+{
+    PutUint32(chunk, length);
+    std::memcpy(chunk + 4, type, 4);
+    return PutUint32(chunk + 8 + length, UpdateCrc(0, chunk + 4, length + 4));
+}
+
+bool
+PngEncoder::encode(const cv::Mat& image, int level, std::vector<uchar>& png)
+{
+    int channels = image.channels();
+    if (image.empty() || image.depth() != CV_8U || (channels != 1 && channels != 3 && channels != 4))
+        return false;
+    level = (level < 0) ? 1 : std::min(level, 2);
+
+    uint64_t size = (uint64_t)image.rows * (image.cols * channels + 1);
+    int numBands = (int)std::min<uint64_t>((size + PngBandBytes - 1) / PngBandBytes, image.rows);
+    _bands.resize(numBands);
+    for (int b = 0; b < numBands; ++b)
+    {
+        _bands[b].firstRow = (int)((int64_t)image.rows * b / numBands);
+        _bands[b].numRows = (int)((int64_t)image.rows * (b + 1) / numBands) - _bands[b].firstRow;
+    }
+    if (numBands == 1)
+        encodeBand(image, level, _bands[0], true);
+    else
+    {
+        PngBandBody body([this, &image, level, numBands](int b)
+        {
+            encodeBand(image, level, _bands[b], b + 1 == numBands);
+        });
+        cv::parallel_for_(cv::Range(0, numBands), body);
+    }
+
+    uint32_t adler = 1;
+    uint64_t deflatedSize = 0;
+    for (int b = 0; b < numBands; ++b)
+    {
+        adler = CombineAdler(adler, _bands[b].adler, _bands[b].filtered.size());
+        deflatedSize += _bands[b].deflated.size();
+    }
+    uint32_t idatSize = (uint32_t)(2 + deflatedSize + 4);
+
+    static const uchar Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static const uchar ColorTypes[5] = { 0, 0, 0, 2, 6 };
+    png.resize(8 + (12 + 13) + (12 + idatSize) + 12);
+    uchar* p = png.data();
+    std::memcpy(p, Signature, sizeof(Signature));
+    p += sizeof(Signature);
+
+    uchar* chunk = p;
+    p = PutUint32(chunk + 8, image.cols);
+    p = PutUint32(p, image.rows);
+    p[0] = 8;                     // bit depth
+    p[1] = ColorTypes[channels];
+    p[2] = p[3] = p[4] = 0;       // deflate, adaptive filtering, no interlace
+    p = FinishChunk(chunk, "IHDR", 13);
+
+    chunk = p;
+    p = chunk + 8;
+    *p++ = 0x78;                  // deflate with a 32K window, fastest
+    *p++ = 0x01;
+    for (int b = 0; b < numBands; ++b)
+    {
+        std::memcpy(p, _bands[b].deflated.data(), _bands[b].deflated.size());
+        p += _bands[b].deflated.size();
+    }
+    PutUint32(p, adler);
+    p = FinishChunk(chunk, "IDAT", idatSize);
+
+    FinishChunk(p, "IEND", 0);
+    return true;
+}
+
+bool
+EncodePng(const cv::Mat& image, const PngOptions& options, PngEncoder& encoder, std::vector<uchar>& png)
+{
+    if (options.encoder == PNG_ENCODER_FAST && encoder.encode(image, options.level, png))
+        return true;
+
+    // The level resets the strategy, it has to come first
+    std::vector<int> params;
+    if (options.level >= 0)
+    {
+        params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+        params.push_back(options.level);
+        params.push_back(cv::IMWRITE_PNG_STRATEGY);
+        params.push_back(options.strategy);
+    }
+    return cv::imencode(".png", image, png, params);
+}
+
+} // namespace ov
@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include "OVError.h"
+#include "OVPose.h"
+
+namespace ov
+{
+
+static const char PoseMagic[8] = { 'O', 'V', 'P', 'O', 'S', 'E', 'S', '1' };
+
+void
+PoseToRt(const double* pose, Mat3& R, Vec3& t)
+{
+    R << pose[0], pose[3], pose[6],
+         pose[1], pose[4], pose[7],
+         pose[2], pose[5], pose[8];
+    t << pose[9], pose[10], pose[11];
+}
+
+static bool
+IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static bool
+IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Decimal number at p, which is left after it. Up to 19 significant
+// digits with a small exponent are converted exactly by hand, anything
+// else goes through strtod.
+static bool
+ParseNumber(const char*& p, const char* end, double& value)
+{
+    static const double Powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const char* start = p;
+    bool isNegative = false;
+    if (p < end && (*p == '+' || *p == '-'))
+        isNegative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    bool hasDigits = false;
+    for (; p < end && IsDigit(*p); ++p)
+    {
+        hasDigits = true;
+        if (numDigits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa)
+                ++numDigits;
+        }
+        else
+            ++exponent;
+    }
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && IsDigit(*p); ++p)
+        {
+            hasDigits = true;
+            if (numDigits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa)
+                    ++numDigits;
+                --exponent;
+            }
+        }
+    }
+    if (!hasDigits)
+        return false;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool isExponentNegative = false;
+        if (p < end && (*p == '+' || *p == '-'))
+            isExponentNegative = *p++ == '-';
+        if (p >= end || !IsDigit(*p))
+            return false;
+        int e = 0;
+        for (; p < end && IsDigit(*p); ++p)
+            e = std::min(e * 10 + (*p - '0'), 100000);
+        exponent += isExponentNegative ? -e : e;
+    }
+    if (p < end && !IsSpace(*p))
+        return false;
+
+    if (mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
+    {
+        value = exponent < 0 ? mantissa / Powers[-exponent] : mantissa * Powers[exponent];
+        if (isNegative)
+            value = -value;
+    }
+    else
+        value = std::strtod(std::string(start, p).c_str(), NULL); // signed already
+    return true;
+}
+
+PoseReader::PoseReader()
+{
+    _cursor = _end = NULL;
+    _isBinary = false;
+    _scalarSize = 8;
+    _numPoses = -1;
+    _index = 0;
+    _line = 0;
+    _hasError = false;
+}
+
+bool
+PoseReader::open(const std::string& filename)
+{
+    close();
+    _filename = filename;
+    if (!_file.open(filename))
+    {
+        ReportError("Cannot open \"" + filename + "\".\n");
+        _hasError = true;
+        return false;
+    }
+    _cursor = _file.data();
+    _end = _file.data() + _file.size();
+
+    PoseFileHeader header;
+    if (_file.size() >= sizeof(header) && std::memcmp(_cursor, PoseMagic, sizeof(PoseMagic)) == 0)
+    {
+        std::memcpy(&header, _cursor, sizeof(header));
+        bool isValid = header.scalarSize == 4 || header.scalarSize == 8;
+        if (isValid)
+            isValid = header.numPoses <= (_file.size() - sizeof(header)) / (PoseSize * (uint64_t)header.scalarSize);
+        if (!isValid)
+        {
+            ReportError("\"" + filename + "\" is not a valid binary pose file.\n");
+            _hasError = true;
+            return false;
+        }
+        _isBinary = true;
+        _scalarSize = header.scalarSize;
+        _numPoses = (int64_t)header.numPoses;
+        _cursor += sizeof(header);
+    }
+    return true;
+}
+
+void
+PoseReader::close()
+{
+    _file.close();
+    _cursor = _end = NULL;
+    _isBinary = false;
+    _scalarSize = 8;
+    _numPoses = -1;
+    _index = 0;
+    _line = 0;
+    _hasError = false;
+}
+
+bool
+PoseReader::next(double pose[PoseSize])
+{
+    if (!_isBinary)
+        return nextText(pose);
+
+    if (_index >= _numPoses)
+        return false;
+    if (_scalarSize == 8)
+        std::memcpy(pose, _cursor, PoseSize * sizeof(double));
+    else
+    {
+        float values[PoseSize];
+        std::memcpy(values, _cursor, sizeof(values));
+        for (int i = 0; i < PoseSize; ++i)
+            pose[i] = values[i];
+    }
+    _cursor += PoseSize * _scalarSize;
+    ++_index;
+    return true;
+}
+
+bool
+PoseReader::nextText(double pose[PoseSize])
+{
+    while (_cursor < _end)
+    {
+        ++_line;
+        int count = 0;
+        for (;;)
+        {
+            while (_cursor < _end && *_cursor != '\n' && IsSpace(*_cursor))
+                ++_cursor;
+            if (_cursor >= _end || *_cursor == '\n')
+                break;
+
+            double value;
+            if (!ParseNumber(_cursor, _end, value))
+            {
+                ReportError("Cannot parse line " + std::to_string(_line) + " of \"" + _filename + "\".\n");
+                _hasError = true;
+                return false;
+            }
+            if (count < PoseSize)
+                pose[count] = value;
+            ++count;
+        }
+        if (_cursor < _end)
+            ++_cursor;
+
+        if (count == 0)
+            continue;
+        if (count < PoseSize)
+        {
+            ReportError("Line " + std::to_string(_line) + " of \"" + _filename + "\" has "
+                        + std::to_string(count) + " numbers, a pose needs " + std::to_string(PoseSize) + ".\n");
+            _hasError = true;
+            return false;
+        }
+        ++_index;
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+static bool
+LoadPosesAs(const std::string& filename, std::vector<T>& poses)
+{
+    poses.clear();
+    PoseReader reader;
+    if (!reader.open(filename))
+        return false;
+    if (reader.getNumPoses() > 0)
+        poses.reserve((size_t)reader.getNumPoses() * PoseSize);
+
+    double pose[PoseSize];
+    while (reader.next(pose))
+        poses.insert(poses.end(), pose, pose + PoseSize);
+    return !reader.hasError();
+}
+
+bool
+LoadPoses(const std::string& filename, std::vector<double>& poses)
+{
+    return LoadPosesAs(filename, poses);
+}
+
+bool
+LoadPoses(const std::string& filename, std::vector<float>& poses)
+{
+    return LoadPosesAs(filename, poses);
+}
+
+bool
+ConvertPoseFile(const std::string& inputFile, const std::string& outputFile, bool isFloat)
+{
+    PoseReader reader;
+    if (!reader.open(inputFile))
+        return false;
+
+    std::ofstream file(outputFile, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        ReportError("Cannot write \"" + outputFile + "\".\n");
+        return false;
+    }
+
+    // The count is filled in once all poses are written
+    PoseFileHeader header;
+    std::memcpy(header.magic, PoseMagic, sizeof(PoseMagic));
+    header.scalarSize = isFloat ? 4 : 8;
+    header.reserved = 0;
+    header.numPoses = 0;
+    file.write((const char*)&header, sizeof(header));
+
+    double pose[PoseSize];
+    while (reader.next(pose))
+    {
+        if (isFloat)
+        {
+            float values[PoseSize];
+            for (int i = 0; i < PoseSize; ++i)
+                values[i] = (float)pose[i];
+            file.write((const char*)values, sizeof(values));
+        }
+        else
+            file.write((const char*)pose, sizeof(pose));
+        ++header.numPoses;
+    }
+    if (reader.hasError())
+        return false;
+
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+    file.close();
+    if (file.fail())
+    {
+        ReportError("Cannot write \"" + outputFile + "\".\n");
+        return false;
+    }
+    return true;
+}
+
+} // namespace ov
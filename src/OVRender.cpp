@@ -0,0 +1,589 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "OVRender.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+void
+InitRenderState()
+{
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glShadeModel(GL_SMOOTH);
+    glEnable(GL_TEXTURE_2D);
+
+    glEnable(GL_LIGHT0);
+    glEnable(GL_LIGHT1);
+    glEnable(GL_LIGHT2);
+    glEnable(GL_LIGHT3);
+}
+
+void
+BuildProjectionMatrix(const CameraParameters& camera,
+                      double planeNear,
+                      double planeFar,
+                      double projectionMatrix[16])
+{
+    double fx = camera.fx;
+    double fy = camera.fy;
+    double cx = camera.cx;
+    double cy = camera.cy;
+    double w = camera.width;
+    double h = camera.height;
+
+    projectionMatrix[0] = 2 * fx / w;
+    projectionMatrix[1] = 0;
+    projectionMatrix[2] = 0;
+    projectionMatrix[3] = 0;
+    projectionMatrix[4] = 0;
+    projectionMatrix[5] = -2 * fy / h;
+    projectionMatrix[6] = 0;
+    projectionMatrix[7] = 0;
+    projectionMatrix[8] = 2 * (cx / w) - 1;
+    projectionMatrix[9] = 1 - 2 * (cy / h);
+    projectionMatrix[10] = (planeFar + planeNear) / (planeFar - planeNear);
+    projectionMatrix[11] = 1;
+    projectionMatrix[12] = 0;
+    projectionMatrix[13] = 0;
+    projectionMatrix[14] = 2 * planeFar * planeNear / (planeNear - planeFar);
+    projectionMatrix[15] = 0;
+}
+
+BlendFuncSeparateFunc
+GetBlendFuncSeparate()
+{
+    // Entry points are only valid for the context they were queried in;
+    // some drivers return small values instead of NULL for missing ones
+    PROC proc = wglGetProcAddress("glBlendFuncSeparate");
+    intptr_t value = (intptr_t)proc;
+    if (value == 0 || value == 1 || value == 2 || value == 3 || value == -1)
+        return NULL;
+    return (BlendFuncSeparateFunc)proc;
+}
+
+// Semitransparent effect. On a transparent target the alpha channel has to
+// add up to the coverage, which needs separate blending of alpha (GL 1.4);
+// without it, as in the GDI generic implementation, translucent surfaces
+// end up with their alpha squared; the offscreen renderer restores the
+// alpha of such targets from the depth buffer.
+static void
+EnableBlending(bool isTransparent, BlendFuncSeparateFunc blendFuncSeparate)
+{
+    glEnable(GL_BLEND);
+    if (isTransparent && blendFuncSeparate)
+        blendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    else
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+// The offset pose of the viewer, then the model's pose
+static void
+MultModelView(const RenderParameters& params)
+{
+    glTranslatef(params.offsetTranslation[0], params.offsetTranslation[1], params.offsetTranslation[2]);
+    glRotatef(params.offsetRotation[2], 0, 0, 1);
+    glRotatef(params.offsetRotation[1], 0, 1, 0);
+    glRotatef(params.offsetRotation[0], 1, 0, 0);
+    glScalef(params.offsetScale, params.offsetScale, params.offsetScale);
+    // Fill in modelViewMatrix
+    double modelViewMatrix[16];
+    for (int i = 0; i < 3; ++i)
+    {
+        modelViewMatrix[12 + i] = params.t(i, 0);
+        for (int j = 0; j < 3; ++j)
+            modelViewMatrix[i * 4 + j] = params.R(j, i);
+    }
+    modelViewMatrix[3] = modelViewMatrix[7] = modelViewMatrix[11] = 0;
+    modelViewMatrix[15] = 1;
+    glMultMatrixd(modelViewMatrix);
+}
+
+void
+RenderFrame(const RenderParameters& params)
+{
+    // Render the background image, a transparent frame keeps the clear color
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (!params.isTransparent)
+    {
+        glEnable(GL_TEXTURE_2D);
+        glDisable(GL_LIGHTING);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        DrawBackground(params.backgroundTextureId);
+        glDisable(GL_TEXTURE_2D);
+    }
+
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    if (params.lightingOn)
+    {
+        const GLfloat a[] = { 0.1f, 0.1f, 0.1f, 1.0f };
+        const GLfloat d[] = { 0.5f, 0.5f, 0.5f, 1.0f };
+        const GLfloat s[] = { 0.1f, 0.1f, 0.1f, 1.0f };
+        const GLfloat p0[] = { 7.0f, 0.0f, 0.0f, 1.0f };
+        const GLfloat p1[] = { -7.0f, 0.0f, 0.0f, 1.0f };
+        const GLfloat p2[] = { 0.0f, 7.0f, 0.0f, 1.0f };
+        const GLfloat p3[] = { 0.0f, -7.0f, 0.0f, 1.0f };
+        glLightfv(GL_LIGHT0, GL_AMBIENT, a);
+        glLightfv(GL_LIGHT0, GL_DIFFUSE, d);
+        glLightfv(GL_LIGHT0, GL_SPECULAR, s);
+        glLightfv(GL_LIGHT0, GL_POSITION, p0);
+        glLightfv(GL_LIGHT1, GL_AMBIENT, a);
+        glLightfv(GL_LIGHT1, GL_DIFFUSE, d);
+        glLightfv(GL_LIGHT1, GL_SPECULAR, s);
+        glLightfv(GL_LIGHT1, GL_POSITION, p1);
+        glLightfv(GL_LIGHT2, GL_AMBIENT, a);
+        glLightfv(GL_LIGHT2, GL_DIFFUSE, d);
+        glLightfv(GL_LIGHT2, GL_SPECULAR, s);
+        glLightfv(GL_LIGHT2, GL_POSITION, p2);
+        glLightfv(GL_LIGHT3, GL_AMBIENT, a);
+        glLightfv(GL_LIGHT3, GL_DIFFUSE, d);
+        glLightfv(GL_LIGHT3, GL_SPECULAR, s);
+        glLightfv(GL_LIGHT3, GL_POSITION, p3);
+        glEnable(GL_LIGHTING);
+    }
+
+    // Render the foreground target
+    MultModelView(params);
+
+    EnableBlending(params.isTransparent, params.blendFuncSeparate);
+    if (params.renderMode == RENDER_SOLID)
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    else
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    // The nearest surface is the last to pass the depth test, its ID stays
+    if (params.maskMode != MASK_NONE)
+    {
+        glClearStencil(0);
+        glClear(GL_STENCIL_BUFFER_BIT);
+        glEnable(GL_STENCIL_TEST);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    }
+    if (params.model)
+        DrawForeground(params.model->shapes, params.model->materials, *params.textureIds, params.maskMode);
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_BLEND);
+}
+
+void
+RenderNormals(const RenderParameters& params)
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    MultModelView(params);
+    if (!params.model)
+        return;
+
+    // The model view is a rotation and a uniform scale, it turns normals
+    // like points up to their length
+    double m[16];
+    glGetDoublev(GL_MODELVIEW_MATRIX, m);
+    const std::vector<tinyobj::shape_t>& shapes = params.model->shapes;
+    glBegin(GL_TRIANGLES);
+    for (int i = 0; i < shapes.size(); ++i)
+    {
+        const tinyobj::mesh_t& mesh = shapes[i].mesh;
+        for (int k = 0; k < mesh.indices.size(); ++k)
+        {
+            int idx = mesh.indices[k];
+            const float* n = &mesh.normals[3 * idx];
+            double x = m[0] * n[0] + m[4] * n[1] + m[8] * n[2];
+            double y = m[1] * n[0] + m[5] * n[1] + m[9] * n[2];
+            double z = m[2] * n[0] + m[6] * n[1] + m[10] * n[2];
+            double length = std::sqrt(x * x + y * y + z * z);
+            if (length > 0)
+            {
+                x /= length;
+                y /= length;
+                z /= length;
+            }
+            glColor3d((x + 1) / 2, (y + 1) / 2, (z + 1) / 2);
+            glVertex3fv(&mesh.positions[3 * idx]);
+        }
+    }
+    glEnd();
+    // Unlit frames are drawn in the current color
+    glColor3f(1, 1, 1);
+}
+
+void
+DrawBackground(GLuint backgroundImageTextureId)
+{
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(-1, 1, -1, 1, 0, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    // Draw the quad textured with the background image
+    glBindTexture(GL_TEXTURE_2D, backgroundImageTextureId);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 1);
+    glVertex2f(-1, -1);
+    glTexCoord2f(0, 0);
+    glVertex2f(-1, 1);
+    glTexCoord2f(1, 0);
+    glVertex2f(1, 1);
+    glTexCoord2f(1, 1);
+    glVertex2f(1, -1);
+    glEnd();
+
+    // Reset the projection matrix
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+void
+DrawForeground(const std::vector<tinyobj::shape_t>& shapes,
+               const std::vector<tinyobj::material_t>& materials,
+               const std::unordered_map<std::string, GLuint>& textureIds,
+               int maskMode)
+{
+    glDisable(GL_COLOR_MATERIAL);
+    glEnable(GL_TEXTURE_2D);
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    int preId = -1;
+    bool isTexture = false;
+    for (int i = 0; i < shapes.size(); ++i)
+    {
+        // IDs of the mask, 8 bits of stencil hold up to 255
+        if (maskMode == MASK_SHAPE)
+            glStencilFunc(GL_ALWAYS, std::min(i + 1, 255), 0xFF);
+        for (int f = 0; f < shapes[i].mesh.indices.size() / 3; ++f)
+        {
+            int material_id = shapes[i].mesh.material_ids[f];
+            if (material_id != preId)
+            {
+                if (maskMode == MASK_MATERIAL)
+                    glStencilFunc(GL_ALWAYS, std::min(material_id + 1, 255), 0xFF);
+                GLfloat ambient[4], diffuse[4], specular[4];
+                memcpy(ambient, materials[material_id].ambient, 3 * sizeof(float));
+                memcpy(diffuse, materials[material_id].diffuse, 3 * sizeof(float));
+                memcpy(specular, materials[material_id].specular, 3 * sizeof(float));
+                ambient[3] = diffuse[3] = specular[3] = materials[material_id].dissolve;
+                glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
+                glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
+                glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
+                glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, materials[material_id].shininess);
+
+                std::string map_Kd = materials[material_id].diffuse_texname;
+                auto got = textureIds.find(map_Kd);
+                if (got == textureIds.end())
+                {
+                    glBindTexture(GL_TEXTURE_2D, 0);
+                    isTexture = false;
+                }
+                else
+                {
+                    glBindTexture(GL_TEXTURE_2D, got->second);
+                    isTexture = true;
+                }
+                preId = material_id;
+            }
+
+            glBegin(GL_TRIANGLES);
+            for (int j = 0; j < 3; ++j)
+            {
+                int idx = shapes[i].mesh.indices[3 * f + j];
+                glNormal3fv(&shapes[i].mesh.normals[3 * idx]);
+                if (isTexture) glTexCoord2fv(&shapes[i].mesh.texcoords[2 * idx]);
+                glVertex3fv(&shapes[i].mesh.positions[3 * idx]);
+            }
+            glEnd();
+        }
+    }
+}
+
+void
+UploadBackground(GLuint backgroundImageTextureId, const cv::Mat& image)
+{
+    glBindTexture(GL_TEXTURE_2D, backgroundImageTextureId);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    // set texture filter to linear - we do not build mipmaps for speed
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // create the texture from OpenCV image data
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.cols, image.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, image.data);
+}
+
+void
+ReadPixels(cv::Mat& image, int channels)
+{
+    GLint vp[4];
+    glGetIntegerv(GL_VIEWPORT, vp);
+
+    int x, y, w, h;
+    x = vp[0];
+    y = vp[1];
+    w = vp[2];
+    h = vp[3];
+
+    // Reads into the caller's buffer when it already has the frame's size
+    if (!image.isContinuous())
+        image = cv::Mat();
+    image.create(h, w, CV_8UC(channels));
+
+    // Byte alignment (that is, no alignment)
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    // Read pixels from GPU memory
+    glReadPixels(x, y, w, h, channels == 4 ? GL_BGRA : GL_BGR, GL_UNSIGNED_BYTE, image.data);
+
+    // Flip around the x-axis
+    cv::flip(image, image, 0);
+}
+
+void
+ReadDepth(cv::Mat& depth)
+{
+    GLint vp[4];
+    glGetIntegerv(GL_VIEWPORT, vp);
+
+    if (!depth.isContinuous())
+        depth = cv::Mat();
+    depth.create(vp[3], vp[2], CV_32F);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(vp[0], vp[1], vp[2], vp[3], GL_DEPTH_COMPONENT, GL_FLOAT, depth.data);
+    cv::flip(depth, depth, 0);
+}
+
+void
+ReadStencil(cv::Mat& mask)
+{
+    GLint vp[4];
+    glGetIntegerv(GL_VIEWPORT, vp);
+
+    if (!mask.isContinuous())
+        mask = cv::Mat();
+    mask.create(vp[3], vp[2], CV_8U);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(vp[0], vp[1], vp[2], vp[3], GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, mask.data);
+    cv::flip(mask, mask, 0);
+}
+
+void
+LinearizeDepth(const cv::Mat& depth, double planeNear, double planeFar, cv::Mat& linear)
+{
+    // The inverse of the projection's z row: ndc = (f + n) / (f - n) - 2 f n / ((f - n) z)
+    double a = planeFar + planeNear;
+    double b = planeFar - planeNear;
+    double c = 2 * planeFar * planeNear;
+    linear.create(depth.size(), CV_32F);
+    for (int y = 0; y < depth.rows; ++y)
+    {
+        const float* in = depth.ptr<float>(y);
+        float* out = linear.ptr<float>(y);
+        for (int x = 0; x < depth.cols; ++x)
+            out[x] = in[x] < 1 ? (float)(c / (a - (2.0 * in[x] - 1) * b)) : 0.0f;
+    }
+}
+
+void
+DecodeNormals(const cv::Mat& colors, const cv::Mat& depth, cv::Mat& normals)
+{
+    normals.create(colors.size(), CV_32FC3);
+    for (int y = 0; y < colors.rows; ++y)
+    {
+        const uchar* in = colors.ptr<uchar>(y);
+        const float* d = depth.ptr<float>(y);
+        float* out = normals.ptr<float>(y);
+        for (int x = 0; x < colors.cols; ++x, in += 3, out += 3)
+        {
+            if (d[x] >= 1)
+            {
+                out[0] = out[1] = out[2] = 0;
+                continue;
+            }
+            // BGR readback of the (x, y, z) colors
+            float nx = in[2] / 127.5f - 1;
+            float ny = in[1] / 127.5f - 1;
+            float nz = in[0] / 127.5f - 1;
+            float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+            if (length > 0)
+            {
+                nx /= length;
+                ny /= length;
+                nz /= length;
+            }
+            out[0] = nx;
+            out[1] = ny;
+            out[2] = nz;
+        }
+    }
+}
+
+Renderer::Renderer()
+    : _backgroundTextureId(0)
+    , _backgroundSize(0, 0)
+    , _planeNear(0.01)
+    , _planeFar(100)
+    , _viewportWidth(0)
+    , _viewportHeight(0)
+    , _offsetRotation(Vec3::Zero())
+    , _offsetTranslation(Vec3::Zero())
+    , _offsetScale(1)
+    , _renderMode(RENDER_SOLID)
+    , _lightingOn(true)
+    , _blendFuncSeparate(NULL)
+{
+    _camera.fx = _camera.fy = _camera.cx = _camera.cy = 0;
+    _camera.width = _camera.height = 0;
+    for (int i = 0; i < 16; ++i)
+        _projectionMatrix[i] = 0;
+}
+
+void
+Renderer::create()
+{
+    InitRenderState();
+    _blendFuncSeparate = GetBlendFuncSeparate();
+    if (!_backgroundTextureId)
+        glGenTextures(1, &_backgroundTextureId);
+}
+
+void
+Renderer::destroy()
+{
+    if (_backgroundTextureId)
+        glDeleteTextures(1, &_backgroundTextureId);
+    _backgroundTextureId = 0;
+    _textureIds.clear();
+    _model.reset();
+}
+
+void
+Renderer::setModel(const std::shared_ptr<const Model>& model,
+                   const std::unordered_map<std::string, GLuint>& textureIds)
+{
+    _model = model;
+    _textureIds = textureIds;
+}
+
+void
+Renderer::setBackground(const cv::Mat& image)
+{
+    UploadBackground(_backgroundTextureId, image);
+    _backgroundSize = image.size();
+}
+
+void
+Renderer::setCamera(const CameraParameters& camera)
+{
+    _camera = camera;
+    BuildProjectionMatrix(_camera, _planeNear, _planeFar, _projectionMatrix);
+}
+
+void
+Renderer::setPlanes(double planeNear, double planeFar)
+{
+    _planeNear = planeNear;
+    _planeFar = planeFar;
+    if (hasCamera())
+        BuildProjectionMatrix(_camera, _planeNear, _planeFar, _projectionMatrix);
+}
+
+void
+Renderer::setViewport(int width, int height)
+{
+    _viewportWidth = width;
+    _viewportHeight = height;
+}
+
+void
+Renderer::setOffsetPose(const Vec3& r, const Vec3& t, double s)
+{
+    _offsetRotation = r;
+    _offsetTranslation = t;
+    _offsetScale = s;
+}
+
+void
+Renderer::getOffsetPose(Vec3& r, Vec3& t, double& s) const
+{
+    r = _offsetRotation;
+    t = _offsetTranslation;
+    s = _offsetScale;
+}
+
+void
+Renderer::loadProjection() const
+{
+    // Another renderer may have drawn in the same context since
+    if (_viewportWidth > 0 && _viewportHeight > 0)
+        glViewport(0, 0, (GLsizei)_viewportWidth, (GLsizei)_viewportHeight);
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixd(_projectionMatrix);
+    glMatrixMode(GL_MODELVIEW);
+}
+
+void
+Renderer::fillParameters(const Mat3& R, const Vec3& t, RenderParameters& params) const
+{
+    params.backgroundTextureId = _backgroundTextureId;
+    params.model = _model.get();
+    params.textureIds = &_textureIds;
+    params.R = R;
+    params.t = t;
+    params.offsetRotation = _offsetRotation;
+    params.offsetTranslation = _offsetTranslation;
+    params.offsetScale = _offsetScale;
+    params.renderMode = _renderMode;
+    params.lightingOn = _lightingOn;
+    params.isTransparent = false;
+    params.maskMode = MASK_NONE;
+    params.blendFuncSeparate = _blendFuncSeparate;
+}
+
+void
+Renderer::render(const Mat3& R, const Vec3& t, bool isTransparent, int maskMode) const
+{
+    loadProjection();
+    RenderParameters params;
+    fillParameters(R, t, params);
+    params.isTransparent = isTransparent;
+    params.maskMode = maskMode;
+    RenderFrame(params);
+}
+
+void
+Renderer::renderNormals(const Mat3& R, const Vec3& t) const
+{
+    loadProjection();
+    RenderParameters params;
+    fillParameters(R, t, params);
+    RenderNormals(params);
+}
+
+double
+Renderer::getScreenSize(const Mat3& R, const Vec3& t) const
+{
+    if (!_model)
+        return 0;
+
+    const double toRadian = std::acos(-1.0) / 180;
+    Mat3 offsetR = (Eigen::AngleAxisd(_offsetRotation[2] * toRadian, Vec3::UnitZ())
+                  * Eigen::AngleAxisd(_offsetRotation[1] * toRadian, Vec3::UnitY())
+                  * Eigen::AngleAxisd(_offsetRotation[0] * toRadian, Vec3::UnitX())).toRotationMatrix();
+    Vec3 center = _offsetTranslation + offsetR * (_offsetScale * (R * _model->boundingCenter + t));
+    double radius = _offsetScale * _model->boundingRadius;
+
+    // Inside the sphere the object can cover the whole view
+    if (center(2) <= radius)
+        return DBL_MAX;
+
+    double fx = _projectionMatrix[0] * _viewportWidth / 2;
+    return 2 * radius * fx / center(2);
+}
+
+} // namespace ov
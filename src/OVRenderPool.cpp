@@ -0,0 +1,168 @@
+#include "OVRenderPool.h"
+#include "OVError.h"
+
+namespace ov
+{
+
+RenderPool::RenderPool(BatchRenderer& renderer, int numThreads, const RendererFactory& createRenderer)
+    : _renderer(renderer), _createRenderer(createRenderer), _numQueued(0), _numSubmitted(0), _isStopping(false), _nextDeque(0)
+{
+    if (numThreads <= 1 || !createRenderer)
+        return;
+
+    for (int i = 0; i < numThreads; ++i)
+        _deques.push_back(std::unique_ptr<TaskDeque>(new TaskDeque));
+    for (int i = 0; i < numThreads; ++i)
+        _threads.push_back(std::thread(&RenderPool::run, this, i));
+}
+
+RenderPool::~RenderPool()
+{
+    // Queued tasks are still drawn, their futures may be waited on
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _isStopping = true;
+    }
+    _condition.notify_all();
+    for (size_t i = 0; i < _threads.size(); ++i)
+        _threads[i].join();
+}
+
+bool
+RenderPool::setScene(const std::shared_ptr<const RenderScene>& scene)
+{
+    _scene = scene;
+    if (!_threads.empty())
+    {
+        _renderer.setCamera(scene->camera);
+        return true;
+    }
+
+    if (!_renderer.setModel(scene->model) || !_renderer.setBackground(scene->background))
+        return false;
+    _renderer.setCamera(scene->camera);
+    return true;
+}
+
+std::shared_future<RenderResult>
+RenderPool::submit(int type, const Mat3& R, const Vec3& t, const ChannelOptions& options)
+{
+    std::shared_ptr<Task> task = std::make_shared<Task>();
+    task->type = type;
+    task->R = R;
+    task->t = t;
+    task->options = options;
+    task->scene = _scene;
+    std::shared_future<RenderResult> result = task->promise.get_future().share();
+
+    if (_threads.empty())
+    {
+        RenderResult drawn;
+        Draw(_renderer, *task, drawn);
+        task->promise.set_value(drawn);
+        return result;
+    }
+
+    TaskDeque& deque = *_deques[_nextDeque];
+    _nextDeque = (_nextDeque + 1) % (int)_deques.size();
+    {
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.tasks.push_back(task);
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_numQueued;
+        ++_numSubmitted;
+    }
+    _condition.notify_one();
+    _submitted.notify_all();
+    return result;
+}
+
+void
+RenderPool::run(int threadIndex)
+{
+    // The context is made and used on this thread only
+    std::unique_ptr<BatchRenderer> renderer = _createRenderer();
+    if (!renderer)
+        ReportError("Render thread " + std::to_string(threadIndex) + " has no renderer, its frames fail.\n");
+    // Kept alive, so a scene set up here is never mistaken for a new one
+    std::shared_ptr<const RenderScene> scene;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [this]() { return _numQueued > 0 || _isStopping; });
+            if (_numQueued == 0)
+                return;
+            --_numQueued;
+        }
+        std::shared_ptr<Task> task = take(threadIndex);
+
+        RenderResult result;
+        if (renderer && task->scene != scene)
+        {
+            scene.reset();
+            if (renderer->setModel(task->scene->model) && renderer->setBackground(task->scene->background))
+            {
+                renderer->setCamera(task->scene->camera);
+                scene = task->scene;
+            }
+        }
+        if (renderer && scene)
+            Draw(*renderer, *task, result);
+        task->promise.set_value(result);
+    }
+}
+
+std::shared_ptr<RenderPool::Task>
+RenderPool::take(int threadIndex)
+{
+    // Every reservation is backed by a queued task, a round over the
+    // deques finds one unless other threads took them first. They did so
+    // only if a task was submitted to a deque passed already, so a missed
+    // round is tried again once one was submitted since it began.
+    for (;;)
+    {
+        uint64_t numSubmitted;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            numSubmitted = _numSubmitted;
+        }
+        for (int k = 0; k < (int)_deques.size(); ++k)
+        {
+            TaskDeque& deque = *_deques[(threadIndex + k) % _deques.size()];
+            std::lock_guard<std::mutex> lock(deque.mutex);
+            if (deque.tasks.empty())
+                continue;
+            std::shared_ptr<Task> task;
+            if (k == 0)
+            {
+                task = deque.tasks.front();
+                deque.tasks.pop_front();
+            }
+            else
+            {
+                task = deque.tasks.back();
+                deque.tasks.pop_back();
+            }
+            return task;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _submitted.wait(lock, [&]() { return _numSubmitted != numSubmitted; });
+    }
+}
+
+void
+RenderPool::Draw(BatchRenderer& renderer, const Task& task, RenderResult& result)
+{
+    if (task.type == RENDER_TASK_CHANNELS)
+        result.isOk = renderer.renderChannels(task.R, task.t, task.options, result.image, result.channels);
+    else if (task.type == RENDER_TASK_LAYER)
+        result.isOk = renderer.renderLayer(task.R, task.t, result.image);
+    else
+        result.isOk = renderer.render(task.R, task.t, result.image);
+}
+
+} // namespace ov
@@ -0,0 +1,651 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <new>
+#include "OVAugment.h"
+#include "OVError.h"
+#include "OVManifest.h"
+#include "OVPose.h"
+#include "OVServer.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+typedef std::chrono::steady_clock Clock;
+
+static const char  RequestMagic[4] = { 'O', 'V', 'R', 'Q' };
+static const char  ResponseMagic[4] = { 'O', 'V', 'R', 'S' };
+static const DWORD PipeBufferSize = 1 << 16;
+
+static_assert(sizeof(ServerRequestHeader) == 96, "The request header is part of the protocol");
+static_assert(sizeof(ServerResponseHeader) == 104, "The response header is part of the protocol");
+
+static double
+SecondsSince(const Clock::time_point& start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (int i = 0; i < NumBuckets; ++i)
+        _buckets[i].store(0, std::memory_order_relaxed);
+    _count.store(0, std::memory_order_relaxed);
+    _maxMicroseconds.store(0, std::memory_order_relaxed);
+}
+
+void
+LatencyHistogram::record(double seconds)
+{
+    double microseconds = seconds * 1e6;
+    int bucket = microseconds < 1 ? 0 : std::min(NumBuckets - 1, (int)(4 * std::log2(microseconds)));
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t value = (int64_t)microseconds;
+    int64_t maximum = _maxMicroseconds.load(std::memory_order_relaxed);
+    while (value > maximum && !_maxMicroseconds.compare_exchange_weak(maximum, value, std::memory_order_relaxed))
+        ;
+}
+
+double
+LatencyHistogram::getPercentile(double percentile) const
+{
+    int64_t count = getCount();
+    if (count == 0)
+        return 0;
+
+    int64_t rank = (int64_t)std::ceil(percentile / 100 * count);
+    int64_t seen = 0;
+    for (int i = 0; i < NumBuckets; ++i)
+    {
+        seen += _buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return std::min(std::pow(2.0, (i + 1) / 4.0), (double)_maxMicroseconds.load(std::memory_order_relaxed)) / 1e6;
+    }
+    return _maxMicroseconds.load(std::memory_order_relaxed) / 1e6;
+}
+
+std::string
+LatencyHistogram::summary() const
+{
+    char text[160];
+    std::snprintf(text, sizeof(text), "n=%lld p50=%.2f p90=%.2f p99=%.2f max=%.2f ms",
+                  (long long)getCount(), getPercentile(50) * 1e3, getPercentile(90) * 1e3,
+                  getPercentile(99) * 1e3, _maxMicroseconds.load(std::memory_order_relaxed) / 1e3);
+    return text;
+}
+
+static std::string
+GetPipeName(const std::string& name)
+{
+    return "\\\\.\\pipe\\" + name;
+}
+
+static bool
+ReadAll(HANDLE pipe, void* data, uint64_t size)
+{
+    uchar* p = (uchar*)data;
+    while (size > 0)
+    {
+        DWORD numRead = 0;
+        if (!ReadFile(pipe, p, (DWORD)std::min<uint64_t>(size, 1 << 24), &numRead, NULL) || numRead == 0)
+            return false;
+        p += numRead;
+        size -= numRead;
+    }
+    return true;
+}
+
+static bool
+WriteAll(HANDLE pipe, const void* data, uint64_t size)
+{
+    const uchar* p = (const uchar*)data;
+    while (size > 0)
+    {
+        DWORD numWritten = 0;
+        if (!WriteFile(pipe, p, (DWORD)std::min<uint64_t>(size, 1 << 24), &numWritten, NULL) || numWritten == 0)
+            return false;
+        p += numWritten;
+        size -= numWritten;
+    }
+    return true;
+}
+
+static bool
+WriteResponse(HANDLE pipe, ServerResponseHeader& response, const std::string& message)
+{
+    std::memcpy(response.magic, ResponseMagic, sizeof(ResponseMagic));
+    response.messageLength = (uint32_t)message.size();
+    return WriteAll(pipe, &response, sizeof(response)) && WriteAll(pipe, message.data(), message.size());
+}
+
+static bool
+WriteStatus(HANDLE pipe, int status, const std::string& message)
+{
+    ServerResponseHeader response;
+    std::memset(&response, 0, sizeof(response));
+    response.status = status;
+    return WriteResponse(pipe, response, message);
+}
+
+// A client and the thread that serves it
+struct RenderServer::Connection
+{
+    Connection() : pipe(INVALID_HANDLE_VALUE), id(0), mapping(NULL), view(NULL), mappingSize(0), generation(0), isDone(false) {}
+
+    ~Connection()
+    {
+        releaseMapping();
+        if (pipe != INVALID_HANDLE_VALUE)
+            CloseHandle(pipe);
+    }
+
+    void releaseMapping()
+    {
+        if (view)
+            UnmapViewOfFile(view);
+        if (mapping)
+            CloseHandle(mapping);
+        view = NULL;
+        mapping = NULL;
+        mappingSize = 0;
+    }
+
+    // Room for the frames of a request, reused by the next one. Shared
+    // frames go to a mapping that is replaced under a new name to grow.
+    uchar* reserve(bool isShared, uint64_t size, const std::string& serverName)
+    {
+        if (!isShared)
+        {
+            frames.resize(size);
+            return frames.data();
+        }
+        if (size <= mappingSize && view)
+            return view;
+
+        releaseMapping();
+        mappingName = "Local\\" + serverName + "-" + std::to_string(id) + "-" + std::to_string(++generation);
+        if (mappingName.size() >= sizeof(ServerResponseHeader::mappingName))
+        {
+            ReportError("The server name \"" + serverName + "\" is too long for shared frames.\n");
+            return NULL;
+        }
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                     (DWORD)(size >> 32), (DWORD)size, mappingName.c_str());
+        if (mapping)
+            view = (uchar*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (!view)
+        {
+            ReportError("Cannot create the frame mapping \"" + mappingName + "\".\n");
+            releaseMapping();
+            return NULL;
+        }
+        mappingSize = size;
+        return view;
+    }
+
+    HANDLE             pipe;
+    int                id;
+    HANDLE             mapping;
+    uchar*             view;
+    uint64_t           mappingSize;
+    int                generation;
+    std::string        mappingName;
+    std::vector<uchar> frames; // inline results
+    std::thread        thread;
+    std::atomic<bool>  isDone;
+};
+
+// A render request on its way through the render thread
+struct RenderServer::Job
+{
+    Connection*                connection;
+    const ServerRequestHeader* request;
+    std::string                modelFile;
+    std::string                backgroundFile;
+    const double*              poses;
+    uchar*                     frames; // reserved by the render thread
+    int                        width;
+    int                        height;
+    std::string                error;
+    Clock::time_point          received;
+    std::promise<bool>         done;
+};
+
+RenderServer::RenderServer(BatchRenderer& renderer, const std::string& name)
+    : _renderer(renderer), _name(name), _assets(ServerMaxAssets)
+{
+    _isStopping = false;
+    _isAccepting = false;
+    _numConnections = 0;
+    _numFrames.store(0);
+    _numBatches.store(0);
+    _numBatchedJobs.store(0);
+}
+
+RenderServer::~RenderServer()
+{
+    stop();
+    if (_acceptThread.joinable())
+        _acceptThread.join();
+}
+
+static HANDLE
+CreatePipeInstance(const std::string& name, bool isFirst)
+{
+    return CreateNamedPipeA(GetPipeName(name).c_str(),
+                            PIPE_ACCESS_DUPLEX | (isFirst ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                            PIPE_UNLIMITED_INSTANCES, PipeBufferSize, PipeBufferSize, 0, NULL);
+}
+
+bool
+RenderServer::isStopping()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _isStopping;
+}
+
+void
+RenderServer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _isStopping = true;
+    }
+    _jobsChanged.notify_all();
+}
+
+bool
+RenderServer::run(double statsInterval, const std::function<void(const std::string&)>& log)
+{
+    // The first instance fails if another server has the name
+    HANDLE firstPipe = CreatePipeInstance(_name, true);
+    if (firstPipe == INVALID_HANDLE_VALUE)
+    {
+        ReportError("Cannot create the pipe \"" + GetPipeName(_name) + "\", is another server running?\n");
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _isStopping = false;
+        _isAccepting = true;
+    }
+    _acceptThread = std::thread(&RenderServer::acceptClients, this, (void*)firstPipe);
+
+    Clock::time_point lastStats = Clock::now();
+    int64_t lastCount = 0;
+    for (;;)
+    {
+        std::vector<Job*> jobs;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _jobsChanged.wait_for(lock, std::chrono::milliseconds(200), [this] { return !_jobs.empty() || _isStopping; });
+            jobs.swap(_jobs);
+            if (jobs.empty() && _isStopping)
+                break;
+        }
+        if (!jobs.empty())
+            renderJobs(jobs);
+
+        if (log && statsInterval > 0 && SecondsSince(lastStats) >= statsInterval
+            && _totalLatency.getCount() != lastCount)
+        {
+            lastStats = Clock::now();
+            lastCount = _totalLatency.getCount();
+            log(getStats());
+        }
+    }
+
+    // Connect to the waiting instance so the accept thread sees the stop
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_isAccepting)
+                break;
+        }
+        HANDLE client = CreateFileA(GetPipeName(_name).c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (client != INVALID_HANDLE_VALUE)
+            CloseHandle(client);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    _acceptThread.join();
+
+    // Every queued job is done, the clients only wait for their next request
+    std::lock_guard<std::mutex> lock(_connectionsMutex);
+    for (size_t i = 0; i < _connections.size(); ++i)
+    {
+        Connection& connection = *_connections[i];
+        while (!connection.isDone)
+        {
+            CancelSynchronousIo((HANDLE)connection.thread.native_handle());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        connection.thread.join();
+    }
+    _connections.clear();
+    if (log)
+        log(getStats());
+    return true;
+}
+
+void
+RenderServer::acceptClients(void* firstPipe)
+{
+    HANDLE pipe = (HANDLE)firstPipe;
+    while (pipe != INVALID_HANDLE_VALUE)
+    {
+        bool isConnected = ConnectNamedPipe(pipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED;
+        if (isStopping())
+        {
+            CloseHandle(pipe);
+            break;
+        }
+        if (!isConnected)
+        {
+            CloseHandle(pipe);
+            pipe = CreatePipeInstance(_name, false);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_connectionsMutex);
+
+            // Threads of clients that left
+            for (auto it = _connections.begin(); it != _connections.end();)
+            {
+                if ((*it)->isDone)
+                {
+                    (*it)->thread.join();
+                    it = _connections.erase(it);
+                }
+                else
+                    ++it;
+            }
+
+            std::unique_ptr<Connection> connection(new Connection());
+            connection->pipe = pipe;
+            connection->id = _numConnections++;
+            Connection& client = *connection;
+            _connections.push_back(std::move(connection));
+            client.thread = std::thread(&RenderServer::serveClient, this, std::ref(client));
+        }
+
+        pipe = CreatePipeInstance(_name, false);
+    }
+    if (pipe == INVALID_HANDLE_VALUE && !isStopping())
+        ReportError("Cannot create another instance of \"" + GetPipeName(_name) + "\".\n");
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _isAccepting = false;
+}
+
+void
+RenderServer::serveClient(Connection& connection)
+{
+    ServerRequestHeader request;
+    while (!isStopping() && ReadAll(connection.pipe, &request, sizeof(request)))
+    {
+        Clock::time_point received = Clock::now();
+        if (std::memcmp(request.magic, RequestMagic, sizeof(RequestMagic)) != 0
+            || request.version != ServerProtocolVersion)
+        {
+            WriteStatus(connection.pipe, 1, "Unknown protocol, expected version " + std::to_string(ServerProtocolVersion) + ".");
+            break;
+        }
+
+        bool isOk;
+        if (request.type == SERVER_RENDER)
+            isOk = handleRender(connection, request, received);
+        else if (request.type == SERVER_STATS)
+            isOk = WriteStatus(connection.pipe, 0, getStats());
+        else if (request.type == SERVER_STOP)
+        {
+            isOk = WriteStatus(connection.pipe, 0, "Stopping.");
+            stop();
+        }
+        else
+            isOk = WriteStatus(connection.pipe, 1, "Unknown request " + std::to_string(request.type) + ".");
+        if (!isOk)
+            break;
+    }
+    FlushFileBuffers(connection.pipe);
+    connection.isDone = true;
+}
+
+bool
+RenderServer::handleRender(Connection& connection, const ServerRequestHeader& request,
+                           const std::chrono::steady_clock::time_point& received)
+{
+    // Limits keep a broken client from making the server allocate anything;
+    // the rest of the request cannot be skipped, so the connection closes
+    if (request.numPoses > ServerMaxPoses || request.modelLength == 0
+        || request.modelLength > ServerMaxPathLength || request.backgroundLength > ServerMaxPathLength)
+    {
+        WriteStatus(connection.pipe, 1, "The request exceeds the server's limits.");
+        return false;
+    }
+
+    Job job;
+    job.connection = &connection;
+    job.request = &request;
+    job.modelFile.resize(request.modelLength);
+    job.backgroundFile.resize(request.backgroundLength);
+    std::vector<double> poses((size_t)request.numPoses * PoseSize);
+    if (!ReadAll(connection.pipe, &job.modelFile[0], request.modelLength)
+        || !ReadAll(connection.pipe, &job.backgroundFile[0], request.backgroundLength)
+        || !ReadAll(connection.pipe, poses.data(), poses.size() * sizeof(double)))
+        return false;
+    if (request.width <= 0 || request.height <= 0)
+        return WriteStatus(connection.pipe, 1, "The camera size must be positive.");
+    if ((uint64_t)request.width * request.height * 3 * request.numPoses > ServerMaxFrameBytes)
+        return WriteStatus(connection.pipe, 1, "The frames of the request exceed the server's limit of "
+                                               + std::to_string(ServerMaxFrameBytes) + " bytes.");
+
+    job.poses = poses.data();
+    job.frames = NULL;
+    job.width = job.height = 0;
+    job.received = received;
+    std::future<bool> done = job.done.get_future();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_isStopping)
+            return WriteStatus(connection.pipe, 1, "The server is stopping.");
+        _jobs.push_back(&job);
+    }
+    _jobsChanged.notify_all();
+    if (!done.get())
+        return WriteStatus(connection.pipe, 1, job.error);
+
+    // Augmentation runs here, in parallel with the next requests' rendering
+    uint64_t frameBytes = (uint64_t)job.width * job.height * 3;
+    if (request.blurSigma > 0 || request.noiseVariance > 0)
+    {
+        for (uint32_t i = 0; i < request.numPoses; ++i)
+        {
+            uchar* frameData = job.frames + i * frameBytes;
+            cv::Mat frame(job.height, job.width, CV_8UC3, frameData);
+            AugmentFrame(frame, request.blurSigma, request.noiseVariance, HashBytes(&i, sizeof(i), request.seed));
+            if (frame.data != frameData)
+            {
+                cv::Mat target(job.height, job.width, CV_8UC3, frameData);
+                frame.copyTo(target);
+            }
+        }
+    }
+
+    ServerResponseHeader response;
+    std::memset(&response, 0, sizeof(response));
+    response.numFrames = request.numPoses;
+    response.width = job.width;
+    response.height = job.height;
+    response.channels = 3;
+    response.frameBytes = frameBytes;
+    bool isShared = request.result == SERVER_RESULT_SHARED;
+    if (isShared)
+        std::strcpy(response.mappingName, connection.mappingName.c_str());
+    bool isOk = WriteResponse(connection.pipe, response, std::string())
+                && (isShared || WriteAll(connection.pipe, job.frames, frameBytes * request.numPoses));
+
+    _numFrames.fetch_add(request.numPoses, std::memory_order_relaxed);
+    _totalLatency.record(SecondsSince(received));
+    return isOk;
+}
+
+void
+RenderServer::renderJobs(std::vector<Job*>& jobs)
+{
+    // Requests that share assets are rendered back to back
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job* a, const Job* b)
+    {
+        if (a->modelFile != b->modelFile)
+            return a->modelFile < b->modelFile;
+        return a->backgroundFile < b->backgroundFile;
+    });
+    _numBatches.fetch_add(1, std::memory_order_relaxed);
+    _numBatchedJobs.fetch_add((int64_t)jobs.size(), std::memory_order_relaxed);
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        Job& job = *jobs[i];
+        _queueLatency.record(SecondsSince(job.received));
+        Clock::time_point start = Clock::now();
+        // Whatever a request fails to allocate fails it alone, not the server
+        bool isOk;
+        try
+        {
+            isOk = renderJob(job);
+        }
+        catch (const std::bad_alloc&)
+        {
+            job.error = "Out of memory for the request.";
+            isOk = false;
+        }
+        _renderLatency.record(SecondsSince(start));
+        job.done.set_value(isOk);
+    }
+}
+
+bool
+RenderServer::renderJob(Job& job)
+{
+    const ServerRequestHeader& request = *job.request;
+
+    std::shared_ptr<const Model> model = _assets.getModel(job.modelFile);
+    if (!model)
+    {
+        job.error = "Cannot load the model \"" + job.modelFile + "\".";
+        return false;
+    }
+    if (model != _currentModel)
+    {
+        _currentModel.reset();
+        if (!_renderer.setModel(model))
+        {
+            job.error = "Cannot set the model \"" + job.modelFile + "\".";
+            return false;
+        }
+        _currentModel = model;
+    }
+
+    // Without a background file the frames are black at the camera's size
+    std::string backgroundKey = job.backgroundFile;
+    if (backgroundKey.empty())
+        backgroundKey = "black " + std::to_string(request.width) + "x" + std::to_string(request.height);
+    if (backgroundKey != _currentBackground)
+    {
+        _currentBackground.clear();
+        cv::Mat background = job.backgroundFile.empty()
+                             ? cv::Mat(cv::Mat::zeros(request.height, request.width, CV_8UC3))
+                             : _assets.getBackground(job.backgroundFile);
+        if (background.empty())
+        {
+            job.error = "Cannot open \"" + job.backgroundFile + "\".";
+            return false;
+        }
+        if (!_renderer.setBackground(background))
+        {
+            job.error = "Cannot set the background \"" + job.backgroundFile + "\".";
+            return false;
+        }
+        _currentBackground = backgroundKey;
+        _frameSize = background.size();
+    }
+
+    CameraParameters camera;
+    camera.fx = request.fx;
+    camera.fy = request.fy;
+    camera.cx = request.cx;
+    camera.cy = request.cy;
+    camera.width = request.width;
+    camera.height = request.height;
+    _renderer.setCamera(camera);
+
+    job.width = _frameSize.width;
+    job.height = _frameSize.height;
+    uint64_t frameBytes = (uint64_t)job.width * job.height * 3;
+    uint64_t size = frameBytes * request.numPoses;
+    // The background decides the frame size, it can be larger than the camera's
+    if (size > ServerMaxFrameBytes)
+    {
+        job.error = "The frames of the request exceed the server's limit of " + std::to_string(ServerMaxFrameBytes) + " bytes.";
+        return false;
+    }
+    // A failed allocation fails this request, not the server
+    try
+    {
+        job.frames = job.connection->reserve(request.result == SERVER_RESULT_SHARED, size, _name);
+    }
+    catch (const std::bad_alloc&)
+    {
+        job.frames = NULL;
+    }
+    if (!job.frames && size > 0)
+    {
+        job.error = "Cannot allocate " + std::to_string(size) + " bytes for the frames.";
+        return false;
+    }
+
+    // Straight into the client's buffer
+    for (uint32_t i = 0; i < request.numPoses; ++i)
+    {
+        Mat3 R;
+        Vec3 t;
+        PoseToRt(job.poses + i * PoseSize, R, t);
+        uchar* frameData = job.frames + i * frameBytes;
+        cv::Mat frame(job.height, job.width, CV_8UC3, frameData);
+        if (!_renderer.render(R, t, frame))
+        {
+            job.error = "Cannot render frame " + std::to_string(i) + ".";
+            return false;
+        }
+        if (frame.data != frameData)
+        {
+            cv::Mat target(job.height, job.width, CV_8UC3, frameData);
+            frame.copyTo(target);
+        }
+    }
+    return true;
+}
+
+std::string
+RenderServer::getStats() const
+{
+    int64_t numBatches = _numBatches.load(std::memory_order_relaxed);
+    int64_t numBatchedJobs = _numBatchedJobs.load(std::memory_order_relaxed);
+    char batching[128];
+    std::snprintf(batching, sizeof(batching), "%lld frames, %.2f requests per render batch",
+                  (long long)_numFrames.load(std::memory_order_relaxed),
+                  numBatches > 0 ? (double)numBatchedJobs / numBatches : 0.0);
+    return _name + ": " + batching + "\n"
+           + "  total:  " + _totalLatency.summary() + "\n"
+           + "  queue:  " + _queueLatency.summary() + "\n"
+           + "  render: " + _renderLatency.summary() + "\n";
+}
+
+} // namespace ov
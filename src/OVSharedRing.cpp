@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include "OVError.h"
+#include "OVSharedRing.h"
+
+namespace ov
+{
+
+static const char SharedRingMagic[8] = { 'O', 'V', 'R', 'I', 'N', 'G', '0', '1' };
+
+static_assert(sizeof(SharedRingHeader) <= SharedRingHeaderSize, "The ring header outgrew its page");
+static_assert(sizeof(SharedFrameHeader) <= SharedFrameHeaderSize, "The frame header outgrew its space");
+
+// Named objects of the session, no privilege needed
+static std::string
+GetMappingName(const std::string& name)
+{
+    return "Local\\" + name;
+}
+
+SharedFrameRing::SharedFrameRing(const std::string& name, int numSlots, uint64_t slotBytes, double readerTimeout)
+    : _name(name), _numSlots(std::max(2, numSlots)), _slotBytes(slotBytes), _readerTimeout(readerTimeout)
+{
+    _mapping = NULL;
+    _view = NULL;
+    _header = NULL;
+    _head = 0;
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+    if (_header)
+        _header->isClosed.store(1, std::memory_order_release);
+    if (_view)
+        UnmapViewOfFile(_view);
+    if (_mapping)
+        CloseHandle(_mapping);
+}
+
+bool
+SharedFrameRing::create(uint64_t frameBytes)
+{
+    uint64_t slotSize = (SharedFrameHeaderSize + frameBytes + 4095) / 4096 * 4096;
+    uint64_t totalSize = SharedRingHeaderSize + slotSize * _numSlots;
+
+    std::string mappingName = GetMappingName(_name);
+    _mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                  (DWORD)(totalSize >> 32), (DWORD)totalSize, mappingName.c_str());
+    if (_mapping && GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        ReportError("The frame ring \"" + _name + "\" is already published by another process.\n");
+        CloseHandle(_mapping);
+        _mapping = NULL;
+        return false;
+    }
+    if (_mapping)
+        _view = (uchar*)MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!_view)
+    {
+        ReportError("Cannot create the frame ring \"" + _name + "\".\n");
+        if (_mapping)
+            CloseHandle(_mapping);
+        _mapping = NULL;
+        return false;
+    }
+
+    // Fresh pages are zero, the magic goes in last
+    _header = new (_view) SharedRingHeader();
+    _header->numSlots = _numSlots;
+    _header->slotSize = slotSize;
+    _header->totalSize = totalSize;
+    _header->head.store(0, std::memory_order_relaxed);
+    _header->isClosed.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < SharedRingMaxReaders; ++i)
+        _header->readers[i].position.store(SharedRingNone, std::memory_order_relaxed);
+    for (int i = 0; i < _numSlots; ++i)
+    {
+        SharedFrameHeader* slot = new (_view + SharedRingHeaderSize + slotSize * i) SharedFrameHeader();
+        slot->sequence.store(SharedRingNone, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(_header->magic, SharedRingMagic, sizeof(SharedRingMagic));
+    return true;
+}
+
+void
+SharedFrameRing::waitForReaders(uint64_t sequence)
+{
+    typedef std::chrono::steady_clock Clock;
+    for (int i = 0; i < SharedRingMaxReaders; ++i)
+    {
+        std::atomic<uint64_t>& position = _header->readers[i].position;
+        uint64_t last = position.load(std::memory_order_acquire);
+        Clock::time_point lastMove = Clock::now();
+        Backoff backoff;
+        for (;;)
+        {
+            uint64_t current = position.load(std::memory_order_acquire);
+            if (current == SharedRingNone || sequence - current < (uint64_t)_numSlots)
+                break;
+            if (current != last)
+            {
+                last = current;
+                lastMove = Clock::now();
+            }
+            else if (std::chrono::duration<double>(Clock::now() - lastMove).count() > _readerTimeout)
+            {
+                // Detach it; if it moved in the meantime it is alive after all
+                if (position.compare_exchange_strong(current, SharedRingNone))
+                    ReportError("Reader " + std::to_string(i) + " of \"" + _name + "\" stopped reading and was detached.\n");
+                continue;
+            }
+            backoff.wait();
+        }
+    }
+}
+
+bool
+SharedFrameRing::publish(const SharedFrameHeader& metadata, const uchar* data, size_t size)
+{
+    if (!_header && !create(_slotBytes > 0 ? _slotBytes : size))
+        return false;
+    if (SharedFrameHeaderSize + size > _header->slotSize)
+    {
+        ReportError("A frame of " + std::to_string(size) + " bytes does not fit the slots of \"" + _name + "\".\n");
+        return false;
+    }
+
+    waitForReaders(_head);
+
+    // Readers that hold the slot's old frame see it is gone on release
+    SharedFrameHeader* slot = (SharedFrameHeader*)(_view + SharedRingHeaderSize + _header->slotSize * (_head % _numSlots));
+    slot->sequence.store(SharedRingNone, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->lineIndex = metadata.lineIndex;
+    slot->frameIndex = metadata.frameIndex;
+    slot->width = metadata.width;
+    slot->height = metadata.height;
+    slot->channels = metadata.channels;
+    slot->depth = metadata.depth;
+    slot->dataSize = size;
+    slot->inputHash = metadata.inputHash;
+    std::memcpy(slot->pose, metadata.pose, sizeof(slot->pose));
+    slot->fx = metadata.fx;
+    slot->fy = metadata.fy;
+    slot->cx = metadata.cx;
+    slot->cy = metadata.cy;
+    slot->cameraWidth = metadata.cameraWidth;
+    slot->cameraHeight = metadata.cameraHeight;
+    std::memcpy((uchar*)slot + SharedFrameHeaderSize, data, size);
+
+    slot->sequence.store(_head, std::memory_order_release);
+    _header->head.store(++_head, std::memory_order_release);
+    return true;
+}
+
+SharedRingReader::SharedRingReader()
+{
+    _mapping = NULL;
+    _view = NULL;
+    _header = NULL;
+    _index = -1;
+    _position = 0;
+}
+
+SharedRingReader::~SharedRingReader()
+{
+    close();
+}
+
+bool
+SharedRingReader::open(const std::string& name)
+{
+    close();
+    _mapping = OpenFileMappingA(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, GetMappingName(name).c_str());
+    if (_mapping)
+        _view = (uchar*)MapViewOfFile(_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+    if (!_view)
+    {
+        close();
+        return false;
+    }
+    _header = (SharedRingHeader*)_view;
+    if (std::memcmp(_header->magic, SharedRingMagic, sizeof(SharedRingMagic)) != 0)
+    {
+        close();
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    for (int i = 0; i < SharedRingMaxReaders && _index < 0; ++i)
+    {
+        uint64_t expected = SharedRingNone;
+        uint64_t head = _header->head.load(std::memory_order_acquire);
+        if (_header->readers[i].position.compare_exchange_strong(expected, head))
+        {
+            _index = i;
+            _position = head;
+        }
+    }
+    if (_index < 0)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void
+SharedRingReader::close()
+{
+    if (_header && _index >= 0)
+    {
+        uint64_t expected = _position;
+        _header->readers[_index].position.compare_exchange_strong(expected, SharedRingNone);
+    }
+    if (_view)
+        UnmapViewOfFile(_view);
+    if (_mapping)
+        CloseHandle(_mapping);
+    _mapping = NULL;
+    _view = NULL;
+    _header = NULL;
+    _index = -1;
+}
+
+SharedFrameHeader*
+SharedRingReader::getSlot(uint64_t sequence) const
+{
+    return (SharedFrameHeader*)(_view + SharedRingHeaderSize + _header->slotSize * (sequence % _header->numSlots));
+}
+
+void
+SharedRingReader::reattach()
+{
+    // Detached by the producer, continue with the newest frame
+    uint64_t head = _header->head.load(std::memory_order_acquire);
+    uint64_t expected = _position;
+    std::atomic<uint64_t>& position = _header->readers[_index].position;
+    if (!position.compare_exchange_strong(expected, head))
+    {
+        expected = SharedRingNone;
+        if (!position.compare_exchange_strong(expected, head))
+        {
+            // Another reader took the cursor
+            close();
+            return;
+        }
+    }
+    _position = head;
+}
+
+const SharedFrameHeader*
+SharedRingReader::acquire()
+{
+    if (!_header || _header->head.load(std::memory_order_acquire) <= _position)
+        return NULL;
+    SharedFrameHeader* slot = getSlot(_position);
+    if (slot->sequence.load(std::memory_order_acquire) != _position)
+    {
+        // Published and gone, the ring went round without this reader
+        reattach();
+        return NULL;
+    }
+    return slot;
+}
+
+bool
+SharedRingReader::release()
+{
+    if (!_header)
+        return false;
+
+    // Seqlock check: the producer marks a slot before it overwrites it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    bool isIntact = getSlot(_position)->sequence.load(std::memory_order_relaxed) == _position;
+
+    uint64_t expected = _position;
+    if (!_header->readers[_index].position.compare_exchange_strong(expected, _position + 1))
+    {
+        reattach();
+        return false;
+    }
+    ++_position;
+    return isIntact;
+}
+
+bool
+SharedRingReader::isFinished() const
+{
+    return !_header
+           || (_header->isClosed.load(std::memory_order_acquire)
+               && _header->head.load(std::memory_order_acquire) <= _position);
+}
+
+} // namespace ov
@@ -0,0 +1,422 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "OVError.h"
+#include "OVSharedRing.h"
+#include "OVSink.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+static const char PackIndexMagic[8] = { 'O', 'V', 'P', 'A', 'C', 'K', 'I', '1' };
+static const char RawFramesMagic[8] = { 'O', 'V', 'F', 'R', 'A', 'M', 'E', 'S' };
+static const int  TarBlockSize = 512;
+
+bool
+ParseSinkOption(const std::string& key, const std::string& value, SinkOptions& options)
+{
+    if (key == "sink")
+    {
+        if (value == "png")
+            options.type = SINK_PNG;
+        else if (value == "shm")
+            options.type = SINK_SHM;
+        else if (value == "pack")
+            options.type = SINK_PACK;
+        else if (value == "tar")
+            options.type = SINK_TAR;
+        else if (value == "raw")
+            options.type = SINK_RAW;
+        else
+            return false;
+    }
+    else if (key == "compression")
+    {
+        if (value == "fast")
+            options.isCompressed = true;
+        else if (value == "none")
+            options.isCompressed = false;
+        else
+            return false;
+    }
+    else if (key == "shard-mb")
+    {
+        try
+        {
+            options.shardMegabytes = std::stoi(value);
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+        return options.shardMegabytes >= 0;
+    }
+    else if (key == "shm-name")
+    {
+        options.ringName = value;
+        return !value.empty();
+    }
+    else if (key == "shm-slots" || key == "shm-slot-mb" || key == "shm-timeout")
+    {
+        try
+        {
+            if (key == "shm-slots")
+                options.ringSlots = std::stoi(value);
+            else if (key == "shm-slot-mb")
+                options.ringSlotMegabytes = std::stoi(value);
+            else
+                options.ringTimeout = std::stod(value);
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+        return options.ringSlots >= 2 && options.ringSlotMegabytes >= 0 && options.ringTimeout > 0;
+    }
+    else
+        return ParsePngOption(key, value, options.png);
+    return true;
+}
+
+bool
+PngDirectorySink::write(const EncodedFrame& frame)
+{
+    // The file may be a hard link shared with other frames, see LinkFile()
+    DeleteFileA(frame.filename.c_str());
+    std::ofstream file(frame.filename, std::ios::out | std::ios::binary);
+    if (!file.write((const char*)frame.data.data(), frame.data.size()))
+        return false;
+    file.close();
+    return !file.fail();
+}
+
+ContainerSink::ContainerSink(const std::string& dir, const std::string& prefix, const std::string& extension, int shardMegabytes)
+    : _dir(dir), _prefix(prefix), _extension(extension)
+{
+    _offset = 0;
+    _shard = 0;
+    _shardBytes = (uint64_t)shardMegabytes << 20;
+}
+
+std::string
+ContainerSink::getShardFile(int shard, const std::string& extension) const
+{
+    return _dir + _prefix + "-" + ZeroPadNumber(shard, 5) + extension;
+}
+
+bool
+ContainerSink::openShard()
+{
+    std::string filename = getShardFile(_shard, _extension);
+    _file.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!_file.is_open())
+    {
+        ReportError("Cannot write \"" + filename + "\".\n");
+        return false;
+    }
+    _offset = 0;
+    return true;
+}
+
+bool
+ContainerSink::closeShard()
+{
+    bool isOk = endShard();
+    _file.close();
+    if (!isOk || _file.fail())
+    {
+        ReportError("Cannot complete \"" + getShardFile(_shard, _extension) + "\".\n");
+        return false;
+    }
+    return true;
+}
+
+bool
+ContainerSink::close()
+{
+    if (!_file.is_open())
+        return true;
+    return closeShard();
+}
+
+bool
+ContainerSink::write(const EncodedFrame& frame)
+{
+    uint64_t size = getFrameSize(frame);
+    if (_file.is_open() && _shardBytes > 0 && _offset > 0 && _offset + size > _shardBytes)
+    {
+        if (!closeShard())
+            return false;
+        ++_shard;
+    }
+    if (!_file.is_open() && (!openShard() || !beginShard(frame)))
+        return false;
+
+    if (!writeFrame(frame))
+        return false;
+    _offset += size;
+    return true;
+}
+
+PackSink::PackSink(const std::string& dir, const std::string& prefix, bool isCompressed, int shardMegabytes)
+    : ContainerSink(dir, prefix, ".pack", shardMegabytes), _isCompressed(isCompressed)
+{
+}
+
+bool
+PackSink::beginShard(const EncodedFrame& first)
+{
+    std::string filename = getShardFile(_shard, ".idx");
+    _index.open(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!_index.is_open())
+    {
+        ReportError("Cannot write \"" + filename + "\".\n");
+        return false;
+    }
+
+    uint32_t header[2] = { sizeof(PackIndexEntry), 0 };
+    _index.write(PackIndexMagic, sizeof(PackIndexMagic));
+    _index.write((const char*)header, sizeof(header));
+    return !_index.fail();
+}
+
+bool
+PackSink::writeFrame(const EncodedFrame& frame)
+{
+    // The frame goes first, an index entry never points past the data
+    if (!_file.write((const char*)frame.data.data(), frame.data.size()))
+        return false;
+
+    PackIndexEntry entry;
+    entry.offset = _offset;
+    entry.size = frame.data.size();
+    entry.frameIndex = frame.frameIndex;
+    entry.width = frame.width;
+    entry.height = frame.height;
+    entry.channels = frame.channels;
+    entry.encoding = frame.encoding;
+    entry.depth = frame.depth;
+    entry.inputHash = frame.inputHash;
+    std::memcpy(entry.pose, frame.pose, sizeof(entry.pose));
+    return !_index.write((const char*)&entry, sizeof(entry)).fail();
+}
+
+bool
+PackSink::endShard()
+{
+    _index.close();
+    return !_index.fail();
+}
+
+TarSink::TarSink(const std::string& dir, const std::string& prefix, int shardMegabytes)
+    : ContainerSink(dir, prefix, ".tar", shardMegabytes)
+{
+}
+
+static uint64_t
+RoundUpToBlock(uint64_t size)
+{
+    return (size + TarBlockSize - 1) / TarBlockSize * TarBlockSize;
+}
+
+// width - 1 octal digits and a NUL, the way tar stores numbers
+static void
+WriteOctal(char* field, int width, uint64_t value)
+{
+    field[width - 1] = 0;
+    for (int i = width - 2; i >= 0; --i, value >>= 3)
+        field[i] = (char)('0' + (value & 7));
+}
+
+bool
+TarSink::writeEntry(const std::string& name, const void* data, size_t size)
+{
+    char header[TarBlockSize];
+    std::memset(header, 0, sizeof(header));
+    std::strncpy(header, name.c_str(), 99);
+    WriteOctal(header + 100, 8, 0644);  // mode
+    WriteOctal(header + 108, 8, 0);     // uid
+    WriteOctal(header + 116, 8, 0);     // gid
+    WriteOctal(header + 124, 12, size);
+    WriteOctal(header + 136, 12, 0);    // mtime
+    header[156] = '0';                  // regular file
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+
+    // The checksum is taken with its own field set to spaces
+    std::memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (int i = 0; i < TarBlockSize; ++i)
+        checksum += (unsigned char)header[i];
+    WriteOctal(header + 148, 7, checksum);
+
+    static const char Padding[TarBlockSize] = { 0 };
+    _file.write(header, sizeof(header));
+    _file.write((const char*)data, size);
+    _file.write(Padding, RoundUpToBlock(size) - size);
+    return !_file.fail();
+}
+
+static std::string
+FormatPose(const double* pose)
+{
+    std::string text;
+    char number[32];
+    for (int i = 0; i < PoseSize; ++i)
+    {
+        std::snprintf(number, sizeof(number), i + 1 < PoseSize ? "%.17g " : "%.17g\n", pose[i]);
+        text += number;
+    }
+    return text;
+}
+
+uint64_t
+TarSink::getFrameSize(const EncodedFrame& frame) const
+{
+    // The pose text always fits one block
+    return 3 * TarBlockSize + RoundUpToBlock(frame.data.size());
+}
+
+bool
+TarSink::writeFrame(const EncodedFrame& frame)
+{
+    std::string name = ZeroPadNumber(frame.frameIndex, 6);
+    std::string pose = FormatPose(frame.pose);
+    return writeEntry(name + ".png", frame.data.data(), frame.data.size())
+           && writeEntry(name + ".pose", pose.data(), pose.size());
+}
+
+bool
+TarSink::endShard()
+{
+    // Two empty blocks end an archive
+    static const char End[2 * TarBlockSize] = { 0 };
+    return !_file.write(End, sizeof(End)).fail();
+}
+
+RawSink::RawSink(const std::string& dir, const std::string& prefix, int shardMegabytes)
+    : ContainerSink(dir, prefix, ".raw", shardMegabytes)
+{
+    std::memset(&_header, 0, sizeof(_header));
+}
+
+uint64_t
+RawSink::getFrameSize(const EncodedFrame& frame) const
+{
+    uint64_t size = RawRecordPrefixSize + (uint64_t)frame.width * frame.height * frame.channels * CV_ELEM_SIZE1(frame.depth);
+    return (size + 63) / 64 * 64;
+}
+
+bool
+RawSink::beginShard(const EncodedFrame& first)
+{
+    std::memcpy(_header.magic, RawFramesMagic, sizeof(RawFramesMagic));
+    _header.width = first.width;
+    _header.height = first.height;
+    _header.channels = first.channels;
+    _header.recordSize = (uint32_t)getFrameSize(first);
+    _header.numFrames = 0;
+    _header.depth = first.depth;
+
+    char buffer[RawFramesHeaderSize] = { 0 };
+    std::memcpy(buffer, &_header, sizeof(_header));
+    return !_file.write(buffer, sizeof(buffer)).fail();
+}
+
+bool
+RawSink::writeFrame(const EncodedFrame& frame)
+{
+    if (frame.width != _header.width || frame.height != _header.height || frame.channels != _header.channels
+        || frame.depth != _header.depth
+        || frame.data.size() != (size_t)frame.width * frame.height * frame.channels * CV_ELEM_SIZE1(frame.depth))
+    {
+        ReportError("Frame " + std::to_string(frame.frameIndex) + " does not fit the records of \""
+                    + getShardFile(_shard, ".raw") + "\".\n");
+        return false;
+    }
+
+    char prefix[RawRecordPrefixSize] = { 0 };
+    RawFrameRecord record;
+    record.frameIndex = frame.frameIndex;
+    record.inputHash = frame.inputHash;
+    std::memcpy(record.pose, frame.pose, sizeof(record.pose));
+    std::memcpy(prefix, &record, sizeof(record));
+
+    static const char Padding[64] = { 0 };
+    _file.write(prefix, sizeof(prefix));
+    _file.write((const char*)frame.data.data(), frame.data.size());
+    _file.write(Padding, _header.recordSize - RawRecordPrefixSize - frame.data.size());
+    if (_file.fail())
+        return false;
+    ++_header.numFrames;
+    return true;
+}
+
+bool
+RawSink::endShard()
+{
+    _file.seekp(0);
+    return !_file.write((const char*)&_header, sizeof(_header)).fail();
+}
+
+SharedMemorySink::SharedMemorySink(const std::shared_ptr<SharedFrameRing>& ring, int lineIndex, const CameraParameters& camera)
+    : _ring(ring), _lineIndex(lineIndex), _camera(camera)
+{
+}
+
+bool
+SharedMemorySink::write(const EncodedFrame& frame)
+{
+    SharedFrameHeader metadata;
+    metadata.lineIndex = _lineIndex;
+    metadata.frameIndex = frame.frameIndex;
+    metadata.width = frame.width;
+    metadata.height = frame.height;
+    metadata.channels = frame.channels;
+    metadata.depth = frame.depth;
+    metadata.inputHash = frame.inputHash;
+    std::memcpy(metadata.pose, frame.pose, sizeof(metadata.pose));
+    metadata.fx = _camera.fx;
+    metadata.fy = _camera.fy;
+    metadata.cx = _camera.cx;
+    metadata.cy = _camera.cy;
+    metadata.cameraWidth = _camera.width;
+    metadata.cameraHeight = _camera.height;
+    return _ring->publish(metadata, frame.data.data(), frame.data.size());
+}
+
+std::shared_ptr<FrameSink>
+SinkFactory::create(const SinkOptions& options, const std::string& dir, int lineIndex, const CameraParameters& camera)
+{
+    std::string prefix = "frames" + _shardSuffix;
+    std::shared_ptr<FrameSink> sink;
+    switch (options.type)
+    {
+    case SINK_PACK:
+        sink = std::make_shared<PackSink>(dir, prefix, options.isCompressed, options.shardMegabytes);
+        break;
+    case SINK_TAR:
+        sink = std::make_shared<TarSink>(dir, prefix, options.shardMegabytes);
+        break;
+    case SINK_RAW:
+        sink = std::make_shared<RawSink>(dir, prefix, options.shardMegabytes);
+        break;
+    case SINK_SHM:
+    {
+        std::string name = options.ringName + _shardSuffix;
+        std::shared_ptr<SharedFrameRing>& ring = _rings[name];
+        if (!ring)
+            ring = std::make_shared<SharedFrameRing>(name, options.ringSlots, (uint64_t)options.ringSlotMegabytes << 20, options.ringTimeout);
+        sink = std::make_shared<SharedMemorySink>(ring, lineIndex, camera);
+        break;
+    }
+    default:
+        sink = std::make_shared<PngDirectorySink>();
+        break;
+    }
+    sink->setPngOptions(options.png);
+    return sink;
+}
+
+} // namespace ov
@@ -1,9 +1,13 @@
-#include <wx/msgdlg.h>
+#define NOMINMAX
+#include <windows.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <string>
+#include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "OVError.h"
 #include "OVTexture.h"
 #include "OVUtil.h"
 #include "TinyObjLoader.h"
@@ -14,11 +18,48 @@ namespace ov
 GLubyte HeaderUTGA[12] = { 0,0, 2,0,0,0,0,0,0,0,0,0 }; // Uncompressed TGA Header
 GLubyte HeaderCTGA[12] = { 0,0,10,0,0,0,0,0,0,0,0,0 }; // Compressed TGA Header
 
+int TextureStreamer::StreamingSize = 4096;
+int TextureStreamer::CoarseSize = 1024;
+size_t TextureStreamer::MemoryBudget = 512 << 20;
+
+static cv::Size
+LevelSize(int width, int height, int level)
+{
+    return cv::Size(std::max(1, width >> level), std::max(1, height >> level));
+}
+
+// Downsample a level 0 image and keep the mip levels [first, last]
+static void
+BuildLevels(const cv::Mat& image, int first, int last, std::vector<cv::Mat>& levels)
+{
+    levels.clear();
+    cv::Mat level = image;
+    for (int l = 0; l <= last; ++l)
+    {
+        if (l > 0)
+        {
+            cv::Mat next;
+            cv::resize(level, next, LevelSize(image.cols, image.rows, l), 0, 0, cv::INTER_AREA);
+            level = next;
+        }
+        if (l >= first)
+            levels.push_back(level);
+    }
+}
+
+static void
+UploadLevel(int level, const cv::Mat& image, int format)
+{
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, image.cols, image.rows, 0, format, GL_UNSIGNED_BYTE, image.data);
+}
+
 bool
-LoadTextures(std::vector<tinyobj::material_t>& materials,
-             std::unordered_map<std::string, GLuint>& textureIds,
-             const std::string& dir)
-  {
+DecodeTextures(const std::vector<tinyobj::material_t>& materials,
+               std::unordered_map<std::string, cv::Mat>& textures,
+               const std::string& dir,
+               const std::function<bool(int, int)>& progress)
+{
+    std::vector<std::string> names;
     for (int i = 0; i < materials.size(); ++i)
     {
         std::string map_Kd = materials[i].diffuse_texname;
@@ -32,37 +73,105 @@ LoadTextures(std::vector<tinyobj::material_t>& materials,
             map_Kd = map_Kd.substr(strBegin, strRange);
         }
 
-        if (map_Kd != "" && textureIds.find(map_Kd) == textureIds.end())
+        if (map_Kd != "" && textures.find(map_Kd) == textures.end()
+            && std::find(names.begin(), names.end(), map_Kd) == names.end())
+            names.push_back(map_Kd);
+    }
+
+    for (int i = 0; i < names.size(); ++i)
+    {
+        cv::Mat texture;
+        if (!LoadTexture(texture, dir + names[i]))
+            return false;
+        textures[names[i]] = texture;
+        if (progress && !progress(i + 1, (int)names.size()))
+            return false;
+    }
+
+    return true;
+}
+
+void
+UploadTextures(const std::unordered_map<std::string, cv::Mat>& textures,
+               std::unordered_map<std::string, GLuint>& textureIds,
+               const std::string& dir,
+               TextureStreamer* streamer)
+{
+    for (auto it = textures.begin(); it != textures.end(); ++it)
+    {
+        const std::string& map_Kd = it->first;
+        const cv::Mat& texture = it->second;
+        if (textureIds.find(map_Kd) != textureIds.end())
+            continue;
+
+        if (streamer && std::max(texture.cols, texture.rows) > TextureStreamer::StreamingSize)
         {
-            cv::Mat texture;
-            if (!LoadTexture(texture, dir + map_Kd))
-                return false;
+            textureIds[map_Kd] = streamer->add(dir + map_Kd, texture);
+            continue;
+        }
 
-            GLuint textureId;
-            int width = texture.cols;
-            int height = texture.rows;
+        GLuint textureId;
+        int width = texture.cols;
+        int height = texture.rows;
 
-            if ((width * 3) % 4 == 0)
-                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-            else
-                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if ((width * 3) % 4 == 0)
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        else
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-            glGenTextures(1, &textureId);
-            glBindTexture(GL_TEXTURE_2D, textureId);
+        int type = (texture.type() == CV_8UC3) ? GL_BGR : GL_BGRA;
+        gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA, width, height, type, GL_UNSIGNED_BYTE, texture.data);
 
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        textureIds[map_Kd] = textureId;
+    }
+}
 
-            int type = (texture.type() == CV_8UC3) ? GL_BGR : GL_BGRA;
-            gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA, width, height, type, GL_UNSIGNED_BYTE, texture.data);
+void
+DeleteTextures(std::unordered_map<std::string, GLuint>& textureIds)
+{
+    for (auto it = textureIds.begin(); it != textureIds.end(); ++it)
+        glDeleteTextures(1, &it->second);
+    textureIds.clear();
+}
 
-            textureIds[map_Kd] = textureId;
+const std::unordered_map<std::string, GLuint>&
+TextureCache::get(const std::string& modelFile,
+                  const std::unordered_map<std::string, cv::Mat>& textures)
+{
+    auto it = _entries.find(modelFile);
+    if (it == _entries.end())
+    {
+        if (_maxModels > 0 && _entries.size() >= _maxModels)
+        {
+            auto oldest = std::min_element(_entries.begin(), _entries.end(),
+                [](const std::pair<const std::string, Entry>& a, const std::pair<const std::string, Entry>& b)
+                {
+                    return a.second.lastUse < b.second.lastUse;
+                });
+            DeleteTextures(oldest->second.textureIds);
+            _entries.erase(oldest);
         }
+        it = _entries.insert(std::make_pair(modelFile, Entry())).first;
+        UploadTextures(textures, it->second.textureIds, GetDir(modelFile));
     }
+    it->second.lastUse = ++_useCount;
+    return it->second.textureIds;
+}
 
-    return true;
+void
+TextureCache::clear()
+{
+    for (auto it = _entries.begin(); it != _entries.end(); ++it)
+        DeleteTextures(it->second.textureIds);
+    _entries.clear();
 }
 
 bool
@@ -80,8 +189,7 @@ LoadTexture(cv::Mat& texture, const std::string& filename)
         cv::flip(cv::imread(filename, CV_LOAD_IMAGE_COLOR), texture, 0);
         if (texture.empty())
         {
-            wxString msg = "Cannot open \"" + filename + "\"";
-            wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+            ReportError("Cannot open \"" + filename + "\"");
             return false;
         }
     }
@@ -96,8 +204,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
     fTGA = fopen(filename.c_str(), "rb");
     if (fTGA == NULL)
     {
-        wxString msg = "Cannot open \"" + filename + "\"";
-        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+        ReportError("Cannot open \"" + filename + "\"");
         return false;
     }
 
@@ -106,8 +213,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
     GLubyte headerUC[12];
     if (fread(&headerUC, sizeof(headerUC), 1, fTGA) == 0)
     {
-        wxString msg = "Cannot read header of \"" + filename + "\"";
-        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+        ReportError("Cannot read header of \"" + filename + "\"");
         return false;
     }
 
@@ -117,8 +223,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
         isCompressed = true;
     else
     {
-        wxString msg = "Cannot parse \"" + filename + "\"\n(TGA file should be type 2 or type 10)\n";
-        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+        ReportError("Cannot parse \"" + filename + "\"\n(TGA file should be type 2 or type 10)\n");
         fclose(fTGA);
         return false;
     }
@@ -126,8 +231,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
     GLubyte headerInfo[6];
     if (fread(headerInfo, sizeof(headerInfo), 1, fTGA) == 0)
     {
-        wxString msg = "Cannot read first part header of \"" + filename + "\"";
-        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+        ReportError("Cannot read first part header of \"" + filename + "\"");
         return false;
     }
 
@@ -138,8 +242,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
     bool flipH = (headerInfo[5] & 0x10) != 0;
     if ((width <= 0) || (height <= 0) || ((bpp != 24) && (bpp != 32)))
     {
-        wxString msg = "Invalid header of \"" + filename + "\"";
-        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+        ReportError("Invalid header of \"" + filename + "\"");
         return false;
     }
 
@@ -158,8 +261,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
             GLubyte chunkheader = 0;
             if (fread(&chunkheader, sizeof(GLubyte), 1, fTGA) == 0)
             {
-                wxString msg = "Invalid header of \"" + filename + "\"";
-                wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+                ReportError("Invalid header of \"" + filename + "\"");
                 fclose(fTGA);
                 delete[] colorbuffer;
                 return false;
@@ -172,8 +274,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
                 {
                     if (fread(colorbuffer, 1, bytesPerPixel, fTGA) != bytesPerPixel)
                     {
-                        wxString msg = "Cannot read \"" + filename + "\"";
-                        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+                        ReportError("Cannot read \"" + filename + "\"");
                         fclose(fTGA);
                         delete[] colorbuffer;
                         return false;
@@ -190,8 +291,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
 
                     if (currentpixel > imageSize)
                     {
-                        wxString msg = "Too many pixels in \"" + filename + "\"";
-                        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+                        ReportError("Too many pixels in \"" + filename + "\"");
                         fclose(fTGA);
                         delete[] colorbuffer;
                         return false;
@@ -203,8 +303,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
                 chunkheader -= 127;
                 if (fread(colorbuffer, 1, bytesPerPixel, fTGA) != bytesPerPixel)
                 {
-                    wxString msg = "Cannot read \"" + filename + "\"";
-                    wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+                    ReportError("Cannot read \"" + filename + "\"");
                     fclose(fTGA);
                     delete[] colorbuffer;
                     return false;
@@ -222,8 +321,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
 
                     if (currentpixel > imageSize)
                     {
-                        wxString msg = "Too many pixels in \"" + filename + "\"";
-                        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+                        ReportError("Too many pixels in \"" + filename + "\"");
                         fclose(fTGA);
                         delete[] colorbuffer;
                         return false;
@@ -237,8 +335,7 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
     {
         if (fread(texture.data, bytesPerPixel, imageSize, fTGA) != imageSize)
         {
-            wxString msg = "Cannot read the content of \"" + filename + "\"";
-            wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+            ReportError("Cannot read the content of \"" + filename + "\"");
             fclose(fTGA);
             return false;
         }
@@ -253,4 +350,251 @@ LoadTGA(cv::Mat& texture, const std::string& filename)
     return true;
 }
 
-} // namespace ov
\ No newline at end of file
+TextureStreamer::TextureStreamer()
+{
+    _residentBytes = 0;
+    _generation = 0;
+    _isStopping = false;
+    _worker = std::thread(&TextureStreamer::workerLoop, this);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _isStopping = true;
+    }
+    _condition.notify_all();
+    _worker.join();
+}
+
+GLuint
+TextureStreamer::add(const std::string& filename, const cv::Mat& texture)
+{
+    Texture t;
+    t.filename = filename;
+    t.width = texture.cols;
+    t.height = texture.rows;
+    t.format = (texture.type() == CV_8UC3) ? GL_BGR : GL_BGRA;
+
+    int size = std::max(t.width, t.height);
+    t.maxLevel = 0;
+    while ((size >> t.maxLevel) > 1)
+        ++t.maxLevel;
+    t.coarseLevel = 0;
+    while ((size >> t.coarseLevel) > CoarseSize)
+        ++t.coarseLevel;
+    t.residentLevel = t.requestedLevel = t.neededLevel = t.coarseLevel;
+
+    std::vector<cv::Mat> levels;
+    BuildLevels(texture, t.coarseLevel, t.maxLevel, levels);
+
+    glGenTextures(1, &t.id);
+    glBindTexture(GL_TEXTURE_2D, t.id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // Levels finer than the base level are never sampled, so they may stay empty
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.coarseLevel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, t.maxLevel);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < levels.size(); ++i)
+        UploadLevel(t.coarseLevel + i, levels[i], t.format);
+
+    _textures.push_back(t);
+    return t.id;
+}
+
+void
+TextureStreamer::clear()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_generation;
+        _requests.clear();
+        _results.clear();
+    }
+
+    for (int i = 0; i < _textures.size(); ++i)
+        glDeleteTextures(1, &_textures[i].id);
+    _textures.clear();
+    _residentBytes = 0;
+}
+
+void
+TextureStreamer::update(double screenSize)
+{
+    if (_textures.empty())
+        return;
+
+    // 1. Upload the levels the worker finished since the last frame
+    std::vector<Result> results;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        results.swap(_results);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < results.size(); ++i)
+    {
+        const Result& result = results[i];
+        if (result.generation != _generation)
+            continue;
+        Texture& t = _textures[result.index];
+
+        // Levels evicted after the request was sent are not wanted anymore
+        int first = std::max(result.level, t.requestedLevel);
+        if (first >= t.residentLevel)
+            continue;
+
+        glBindTexture(GL_TEXTURE_2D, t.id);
+        for (int l = first; l < t.residentLevel; ++l)
+        {
+            UploadLevel(l, result.levels[l - result.level], t.format);
+            _residentBytes += levelBytes(t, l);
+        }
+        t.residentLevel = first;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.residentLevel);
+    }
+
+    // 2. Find the finest level each texture needs: one texel per screen pixel
+    for (int i = 0; i < _textures.size(); ++i)
+    {
+        Texture& t = _textures[i];
+        int size = std::max(t.width, t.height);
+        t.neededLevel = t.coarseLevel;
+        while (t.neededLevel > 0 && (size >> t.neededLevel) < screenSize)
+            --t.neededLevel;
+    }
+
+    // 3. Under memory pressure drop the levels finer than needed first,
+    //    then everything finer than the coarse levels
+    bool isSystemPressure = isUnderMemoryPressure();
+    if (_residentBytes > MemoryBudget || isSystemPressure)
+    {
+        for (int i = 0; i < _textures.size(); ++i)
+        {
+            if (_textures[i].residentLevel < _textures[i].neededLevel)
+                evict(_textures[i], _textures[i].neededLevel);
+        }
+        for (int i = 0; i < _textures.size() && (_residentBytes > MemoryBudget || isSystemPressure); ++i)
+            evict(_textures[i], _textures[i].coarseLevel);
+    }
+    if (isSystemPressure)
+        return;
+
+    // 4. Ask the worker for the missing levels as long as they fit the budget,
+    //    counting the levels already asked for and not uploaded yet
+    size_t plannedBytes = _residentBytes;
+    for (int i = 0; i < _textures.size(); ++i)
+    {
+        for (int l = _textures[i].requestedLevel; l < _textures[i].residentLevel; ++l)
+            plannedBytes += levelBytes(_textures[i], l);
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int i = 0; i < _textures.size(); ++i)
+    {
+        Texture& t = _textures[i];
+        int level = t.requestedLevel;
+        while (level > t.neededLevel && plannedBytes + levelBytes(t, level - 1) <= MemoryBudget)
+            plannedBytes += levelBytes(t, --level);
+        if (level >= t.requestedLevel)
+            continue;
+
+        // A newer request supersedes one that has not been started yet
+        for (auto it = _requests.begin(); it != _requests.end(); ++it)
+        {
+            if (it->index == i)
+            {
+                _requests.erase(it);
+                break;
+            }
+        }
+
+        Request request;
+        request.index = i;
+        request.level = level;
+        request.generation = _generation;
+        request.filename = t.filename;
+        request.coarseLevel = t.coarseLevel;
+        _requests.push_back(request);
+        t.requestedLevel = level;
+    }
+    _condition.notify_one();
+}
+
+void
+TextureStreamer::workerLoop()
+{
+    for (;;)
+    {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [this] { return _isStopping || !_requests.empty(); });
+            if (_isStopping)
+                return;
+            request = _requests.front();
+            _requests.pop_front();
+        }
+
+        // The file is decoded again for every request, so only the levels
+        // counted against the budget stay in memory
+        cv::Mat image;
+        if (!LoadTexture(image, request.filename))
+            continue;
+
+        Result result;
+        result.index = request.index;
+        result.level = request.level;
+        result.generation = request.generation;
+        BuildLevels(image, request.level, request.coarseLevel - 1, result.levels);
+        image.release();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (request.generation != _generation)
+                continue;
+            _results.push_back(std::move(result));
+        }
+        if (_readyCallback)
+            _readyCallback();
+    }
+}
+
+void
+TextureStreamer::evict(Texture& texture, int keepLevel)
+{
+    if (texture.residentLevel >= keepLevel)
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, keepLevel);
+    // Respecifying a level with zero size releases its storage
+    for (int l = texture.residentLevel; l < keepLevel; ++l)
+    {
+        glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, 0, 0, 0, texture.format, GL_UNSIGNED_BYTE, NULL);
+        _residentBytes -= levelBytes(texture, l);
+    }
+    texture.residentLevel = keepLevel;
+    texture.requestedLevel = std::max(texture.requestedLevel, keepLevel);
+}
+
+size_t
+TextureStreamer::levelBytes(const Texture& texture, int level) const
+{
+    cv::Size size = LevelSize(texture.width, texture.height, level);
+    return (size_t)size.width * size.height * 4;
+}
+
+bool
+TextureStreamer::isUnderMemoryPressure() const
+{
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status))
+        return false;
+    return status.dwMemoryLoad >= 90;
+}
+
+} // namespace ov
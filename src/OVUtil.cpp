@@ -4,7 +4,6 @@
 #include <vector>
 #include <cmath>
 #include <stack>
-#include <AtlBase.h>
 #include <iomanip>
 #include "OVUtil.h"
 #include "OVCommon.h"
@@ -162,6 +161,7 @@ FromAxisAngleToRotationMatrix(const Vec3& r)
         return I + W * sin(a) / a + W2 * (1 - cos(a)) / (a * a);
 }
 
+#ifndef OV_HEADLESS
 wxCheckBox*
 CreateCheckBoxAndAddToSizer(wxWindow* parent,
     wxSizer *sizer,
@@ -173,6 +173,7 @@ CreateCheckBoxAndAddToSizer(wxWindow* parent,
 
     return checkbox;
 }
+#endif
 
 Mat
 LoadMatrix(std::string fileName)
@@ -262,4 +263,72 @@ CreateDirectorys(std::string path)
     }
 }
 
+bool
+GetFileStatus(const std::string& filename, uint64_t& size, uint64_t& writeTime)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data)
+        || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        return false;
+    size = (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+    writeTime = (uint64_t)data.ftLastWriteTime.dwHighDateTime << 32 | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+bool
+LinkFile(const std::string& target, const std::string& link)
+{
+    DeleteFileA(link.c_str());
+    if (CreateHardLinkA(link.c_str(), target.c_str(), NULL))
+        return true;
+    return CopyFileA(target.c_str(), link.c_str(), FALSE) != 0;
+}
+
+bool
+MappedFile::open(const std::string& filename)
+{
+    close();
+    _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size))
+    {
+        close();
+        return false;
+    }
+    _size = (size_t)size.QuadPart;
+
+    // Empty files cannot be mapped, they are just empty
+    if (_size == 0)
+        return true;
+
+    _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (_mapping)
+        _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!_data)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void
+MappedFile::close()
+{
+    if (_data)
+        UnmapViewOfFile(_data);
+    if (_mapping)
+        CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_file);
+    _file = INVALID_HANDLE_VALUE;
+    _mapping = NULL;
+    _data = NULL;
+    _size = 0;
+}
+
 } // namespace ov
@@ -11,6 +11,9 @@
 
 #define wxUSE_GUI 1
 
+#include <chrono>
+#include <cstdio>
+#include <memory>
 #include <string>
 #include <windows.h>
 #include <opencv2/opencv.hpp>
@@ -19,7 +22,9 @@
 #include <wx/filepicker.h>
 #include <wx/wfstream.h>
 #include "ObjViewer.h"
+#include "OVBatch.h"
 #include "OVCanvas.h"
+#include "OVOffscreen.h"
 #include "OVUtil.h"
 
 namespace ov
@@ -28,6 +33,8 @@ namespace ov
 // MyFrame constructor
 ObjViewer::ObjViewer(const wxString& title)
     : wxFrame(NULL, wxID_ANY, title, wxDefaultPosition, wxSize(660, 566))
+    , _loadTimer(this, ID_LOAD_TIMER)
+    , _isBatchCancelled(false)
 {
     _renderMode = RENDER_SOLID;
     _lightingOn = true;
@@ -47,6 +54,10 @@ ObjViewer::ObjViewer(const wxString& title)
     fileMenu->Append(ID_MENU_OPEN_BACKGROUND_IMAGE, wxT("Open &Background Image"), "Open background image file");
     fileMenu->Append(ID_MENU_SAVE_IMAGE, wxT("S&ave Image"), "Save current frame to image file");
     fileMenu->Append(ID_MENU_GEN_SEQ, wxT("G&enerate Sequences"), "G&enerate Image Sequences with Poses");
+    fileMenu->Append(ID_MENU_CANCEL_LOAD, wxT("&Cancel Loading"), "Stop loading the model");
+    fileMenu->Enable(ID_MENU_CANCEL_LOAD, false);
+    fileMenu->Append(ID_MENU_CANCEL_GEN_SEQ, wxT("Cancel Ge&neration"), "Stop generating the sequences after the current frame");
+    fileMenu->Enable(ID_MENU_CANCEL_GEN_SEQ, false);
     fileMenu->AppendSeparator();
     fileMenu->Append(ID_MENU_EXIT, wxT("E&xit\tEsc"), "Quit this program");
     // Make the "Help" menu
@@ -99,6 +110,9 @@ ObjViewer::ObjViewer(const wxString& title)
     _lightingCheckBox->SetValue(true);
     _resetButton = new wxButton(this, ID_RESET, "Reset");
     _controllerSizer->Add(_resetButton, 0, wxEXPAND | wxALL, 5);
+    _cancelGenSeqButton = new wxButton(this, ID_CANCEL_GEN_SEQ, "Cancel generation");
+    _cancelGenSeqButton->Disable();
+    _controllerSizer->Add(_cancelGenSeqButton, 0, wxEXPAND | wxALL, 5);
 
     reLayout();
     Show(true);
@@ -107,15 +121,23 @@ ObjViewer::ObjViewer(const wxString& title)
     Connect(ID_MENU_OPEN_BACKGROUND_IMAGE, wxEVT_MENU, wxCommandEventHandler(ObjViewer::onMenuFileOpenBackgroundImage));
     Connect(ID_MENU_SAVE_IMAGE, wxEVT_MENU, wxCommandEventHandler(ObjViewer::onMenuFileSaveImage));
     Connect(ID_MENU_GEN_SEQ, wxEVT_MENU, wxCommandEventHandler(ObjViewer::onMenuGenerateSequence));
+    Connect(ID_MENU_CANCEL_LOAD, wxEVT_MENU, wxCommandEventHandler(ObjViewer::onMenuCancelLoad));
+    Connect(ID_MENU_CANCEL_GEN_SEQ, wxEVT_MENU, wxCommandEventHandler(ObjViewer::onCancelGenerateSequence));
     Connect(ID_MENU_EXIT, wxEVT_MENU, wxCommandEventHandler(ObjViewer::onMenuFileExit));
     Connect(ID_MENU_HELP, wxEVT_MENU, wxCommandEventHandler(ObjViewer::onMenuHelpAbout));
     Connect(ID_RENDER_MODE_RADIO, wxEVT_RADIOBOX, wxCommandEventHandler(ObjViewer::onRenderModeRadio));
     Connect(ID_LIGHTING, wxEVT_CHECKBOX, wxCommandEventHandler(ObjViewer::onLightingCheck));
     Connect(ID_RESET, wxEVT_BUTTON, wxCommandEventHandler(ObjViewer::onReset));
+    Connect(ID_CANCEL_GEN_SEQ, wxEVT_BUTTON, wxCommandEventHandler(ObjViewer::onCancelGenerateSequence));
+    Connect(ID_LOAD_TIMER, wxEVT_TIMER, wxTimerEventHandler(ObjViewer::onLoadTimer));
 }
 
 ObjViewer::~ObjViewer()
 {
+    // Events the worker still posts are dropped with the frame
+    _isBatchCancelled = true;
+    if (_batchThread.joinable())
+        _batchThread.join();
     if (_ovCanvas) delete _ovCanvas;
 }
 
@@ -129,16 +151,55 @@ ObjViewer::onMenuFileOpenObjModel(wxCommandEvent& WXUNUSED(evt))
     if (objModelFile != "")
     {
         SetStatusText("Loading the new model file...");
-        if (_ovCanvas->setForegroundObject(objModelFile))
-        {
-            _ovCanvas->setIsNewFile(true);
-            _ovCanvas->resetMatrix();
-            _objModelFile = objModelFile;
-        }
-        SetStatusText(GetFileName(_objModelFile));
+        _modelLoader.start(objModelFile);
+        _loadTimer.Start(100);
+        GetMenuBar()->Enable(ID_MENU_CANCEL_LOAD, true);
     }
 }
 
+void
+ObjViewer::onLoadTimer(wxTimerEvent& WXUNUSED(evt))
+{
+    if (!_modelLoader.isDone())
+    {
+        LoadProgress p = _modelLoader.getProgress();
+        std::string statusTxt =   "Loading " + GetFileName(_modelLoader.getFilename())
+                                + ": " + std::to_string(p.bytesParsed >> 20) + "/" + std::to_string(p.numBytes >> 20) + " MB";
+        if (p.numTextures > 0)
+            statusTxt += ", textures " + std::to_string(p.texturesDecoded) + "/" + std::to_string(p.numTextures);
+        SetStatusText(statusTxt);
+        return;
+    }
+
+    // Only the texture upload is left for the GL thread
+    std::string objModelFile = _modelLoader.getFilename();
+    std::shared_ptr<Model> model = _modelLoader.take();
+    cancelModelLoad();
+    if (model)
+    {
+        _ovCanvas->setLoadedModel(model);
+        _ovCanvas->setIsNewFile(true);
+        _ovCanvas->resetMatrix();
+        _objModelFile = objModelFile;
+    }
+    SetStatusText(GetFileName(_objModelFile));
+}
+
+void
+ObjViewer::onMenuCancelLoad(wxCommandEvent& WXUNUSED(evt))
+{
+    cancelModelLoad();
+    SetStatusText(GetFileName(_objModelFile));
+}
+
+void
+ObjViewer::cancelModelLoad()
+{
+    _modelLoader.cancel();
+    _loadTimer.Stop();
+    GetMenuBar()->Enable(ID_MENU_CANCEL_LOAD, false);
+}
+
 void
 ObjViewer::onMenuFileOpenBackgroundImage(wxCommandEvent& WXUNUSED(evt))
 {
@@ -188,6 +249,9 @@ ObjViewer::onMenuFileSaveImage(wxCommandEvent& WXUNUSED(evt))
 void
 ObjViewer::onMenuGenerateSequence(wxCommandEvent& WXUNUSED(evt))
 {
+    if (_batchThread.joinable())
+        return;
+
     std::string generativeFile = wxFileSelector(wxT("Choose Generative File"), _dataFolder + "batch", wxT(""), wxT(""),
         wxT("Generative Files (*.txt)|*.txt|All files (*.*)|*.*"),
         wxFD_OPEN);
@@ -195,99 +259,96 @@ ObjViewer::onMenuGenerateSequence(wxCommandEvent& WXUNUSED(evt))
     if (generativeFile == "")
         return;
 
-    Vec3 r, t;
-    double s;
-    _ovCanvas->getOffsetPose(r, t, s);
-    _ovCanvas->setOffsetPose(Vec3(0, 0, 0), Vec3(0, 0, 0), 1);
-    double planeNear = OVCanvas::PlaneNear;
-    double planeFar = OVCanvas::PlaneFar;
-    OVCanvas::PlaneNear = 1;
-    OVCanvas::PlaneFar = 10000;
-
-    std::string batchDir = GetDir(generativeFile);
-    std::ifstream genIStream(generativeFile);
-    std::string line;
-    std::string modelFile;
-    while (std::getline(genIStream, line))
+    BatchOptions options;
+    if (std::ifstream(GetManifestFile(generativeFile, options)).is_open())
+    {
+        int answer = wxMessageBox(wxT("Some frames of this batch were generated before.\nSkip the frames that are still valid?"),
+                                  wxT("Resume"), wxYES_NO | wxICON_QUESTION);
+        options.isResuming = answer == wxYES;
+    }
+    _isBatchCancelled = false;
+    options.isCancelled = &_isBatchCancelled;
+
+    GetMenuBar()->Enable(ID_MENU_GEN_SEQ, false);
+    GetMenuBar()->Enable(ID_MENU_CANCEL_GEN_SEQ, true);
+    _cancelGenSeqButton->Enable();
+    SetStatusText("Generating sequences...");
+
+    // The canvas keeps its model, pose and planes, the frames are drawn
+    // offscreen like the command-line tool does
+    _batchThread = std::thread([this, generativeFile, options]()
     {
-        std::stringstream lineStream(line);
-        std::string token, posesFile;
-        // 1. .OBJ model file
-        lineStream >> modelFile;
-        if (!_ovCanvas->setForegroundObject(modelFile, false))
-            break;
-
-        // 2. Background image file
-        lineStream >> token;
-        if (!_ovCanvas->setBackgroundImamge(token))
-            break;
-
-        // 3. Camera parameter file
-        lineStream >> token;
-        if (!_ovCanvas->readCameraParameters(token))
-            break;
-
-        reLayout();
-
-        // 4. Poses file
-        lineStream >> posesFile;
-        Mat poses = LoadMatrix(posesFile);
-
-        // 5. Sigma of Gaussian blur kernal
-        lineStream >> token;
-        double blurSigma = std::stod(token);
-
-        // 6. Variance of Gaussian noise
-        lineStream >> token;
-        double noiseVariance = std::stod(token);
-
-        // 7. Output directory
-        lineStream >> token;
-        std::string imageDir = batchDir + token;
-        if (!IsDirectoryExists(imageDir))
-            CreateDirectorys(imageDir);
-
-        int num = poses.rows();
-        for (int i = 0; i < num; ++i)
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+        // Frames of the lines before the current one
+        int numFramesBefore = 0;
+        int lineIndex = 0;
+        int numLineFrames = 0;
+
+        BatchStats stats = BatchStats();
+        bool isOk = false;
         {
-            Mat3 R;
-            Vec3 t;
-            R << poses(i, 0), poses(i, 3), poses(i, 6),
-                 poses(i, 1), poses(i, 4), poses(i, 7),
-                 poses(i, 2), poses(i, 5), poses(i, 8);
-            t << poses(i, 9), poses(i, 10), poses(i, 11);
-            _ovCanvas->forceRender(R, t);
-            cv::Mat image;
-            _ovCanvas->printScreen(image);
-
-            // Image processing
-            if (blurSigma != 0)
-                cv::GaussianBlur(image, image, cv::Size(0, 0), blurSigma, blurSigma);
-            if (noiseVariance != 0)
+            // The GL context belongs to this thread
+            OffscreenRenderer renderer;
+            if (renderer.create(OFFSCREEN_GPU, 4096, 4096))
             {
-                cv::Mat gaussianNoise = cv::Mat(image.size(), CV_8UC3);
-
-                cv::randn(gaussianNoise, 0, noiseVariance);
-                image += gaussianNoise;
-                normalize(image, image, 0, 255, CV_MINMAX, CV_8UC3);
+                isOk = RunBatch(generativeFile, renderer, options, [&](const BatchProgress& p)
+                {
+                    if (p.lineIndex != lineIndex)
+                    {
+                        numFramesBefore += numLineFrames;
+                        lineIndex = p.lineIndex;
+                    }
+                    numLineFrames = p.frameIndex + 1;
+
+                    // Resumed frames count as done, the rate settles once the
+                    // run is past them
+                    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+                    double framesPerSecond = seconds > 0 ? (numFramesBefore + numLineFrames) / seconds : 0;
+                    char statusTxt[512];
+                    int n = std::snprintf(statusTxt, sizeof(statusTxt), "Line %d/%d, %s, frame %d",
+                                          p.lineIndex + 1, p.numLines, GetFileName(p.posesFile).c_str(), p.frameIndex + 1);
+                    if (p.numFrames >= 0)
+                        n += std::snprintf(statusTxt + n, sizeof(statusTxt) - n, "/%d", p.numFrames);
+                    n += std::snprintf(statusTxt + n, sizeof(statusTxt) - n, ", %.1f frames/s", framesPerSecond);
+                    if (p.numFrames >= 0 && framesPerSecond > 0)
+                    {
+                        int eta = (int)((p.numFrames - p.frameIndex - 1) / framesPerSecond + 0.5);
+                        std::snprintf(statusTxt + n, sizeof(statusTxt) - n, ", %d:%02d:%02d left of the line",
+                                      eta / 3600, eta / 60 % 60, eta % 60);
+                    }
+                    std::string text = statusTxt;
+                    CallAfter([this, text]() { SetStatusText(text); });
+                }, stats);
             }
-
-            std::string imageFile = imageDir + ZeroPadNumber(i, 6) + ".png";
-            cv::imwrite(imageFile, image);
-            std::string statusTxt =   "Now processing: " + posesFile
-                                    + ", Sigma of Gaussian blur kernal: " + std::to_string(blurSigma)
-                                    + ", Variance of Gaussian noise: " + std::to_string(noiseVariance)
-                                    + ", Frame index: " + std::to_string(i + 1) + "/" + std::to_string(num);
-            SetStatusText(statusTxt);
         }
-    }
+        CallAfter([this, stats, isOk]() { onSequenceGenerated(stats, isOk); });
+    });
+}
 
-    _ovCanvas->setForegroundObject(modelFile);
-    _ovCanvas->setOffsetPose(r, t, s);
-    OVCanvas::PlaneNear = planeNear;
-    OVCanvas::PlaneFar = planeFar;
-    _ovCanvas->forceRender(Mat3::Identity(), Vec3::Zero());
-    SetStatusText("OBJ Viewer");
+void
+ObjViewer::onCancelGenerateSequence(wxCommandEvent& WXUNUSED(evt))
+{
+    if (!_batchThread.joinable())
+        return;
+
+    _isBatchCancelled = true;
+    GetMenuBar()->Enable(ID_MENU_CANCEL_GEN_SEQ, false);
+    _cancelGenSeqButton->Disable();
+    SetStatusText("Cancelling, the frames in flight are still written...");
+}
+
+void
+ObjViewer::onSequenceGenerated(const BatchStats& stats, bool isOk)
+{
+    _batchThread.join();
+    GetMenuBar()->Enable(ID_MENU_GEN_SEQ, true);
+    GetMenuBar()->Enable(ID_MENU_CANCEL_GEN_SEQ, false);
+    _cancelGenSeqButton->Disable();
+    if (stats.summary.empty())
+        SetStatusText(isOk ? "Done" : "Generating sequences failed");
+    else
+        SetStatusText(stats.summary);
 }
 
 void 
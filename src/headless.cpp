@@ -0,0 +1,499 @@
+// Command-line batch renderer, runs batch files without the viewer:
+//   ObjViewerHeadless [options] <batch file>...
+// the reference reader of the shared memory frame ring:
+//   ObjViewerHeadless --consume <ring name> [--dump <dir>] [--wait <seconds>]
+// and a render server for local clients, see OVServer.h:
+//   ObjViewerHeadless --serve <pipe name>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "OVBatch.h"
+#include "OVError.h"
+#include "OVManifest.h"
+#include "OVOffscreen.h"
+#include "OVPipeline.h"
+#include "OVPose.h"
+#include "OVServer.h"
+#include "OVSharedRing.h"
+#include "OVUtil.h"
+
+using namespace ov;
+
+struct HeadlessOptions
+{
+    HeadlessOptions() : backend(OFFSCREEN_GPU), maxWidth(4096), maxHeight(4096), isQuiet(false), numProcesses(1),
+                        isFloatPoses(false), ringWait(60) {}
+
+    BatchOptions             batch;
+    int                      backend;
+    int                      maxWidth;  // bitmap size of the software backend
+    int                      maxHeight;
+    bool                     isQuiet;
+    int                      numProcesses; // > 1 runs as the coordinator of that many shards
+    std::vector<std::string> shardArguments; // passed on to every shard
+    std::vector<std::string> batchFiles;
+    std::string              poseInput;  // converts a pose file instead of rendering
+    std::string              poseOutput;
+    bool                     isFloatPoses;
+    std::string              ringName;   // reads a frame ring instead of rendering
+    std::string              dumpDir;    // where the ring's frames are saved, if anywhere
+    double                   ringWait;   // seconds to wait for the ring to attach to
+    std::string              serverName; // serves render requests instead of running batch files
+};
+
+static void
+PrintUsage()
+{
+    std::cerr << "Usage: ObjViewerHeadless [options] <batch file>...\n"
+              << "       ObjViewerHeadless --convert-poses <input> <output> [--float]\n"
+              << "       ObjViewerHeadless --consume <ring name> [--dump DIR] [--wait SEC]\n"
+              << "       ObjViewerHeadless --serve <pipe name> [--backend B] [--max-size WxH]\n"
+              << "  --threads N        post-processing threads (default: all but one core)\n"
+              << "  --renderers N      render threads with a context each (default: 1)\n"
+              << "  --backend B        gpu or software (default: gpu)\n"
+              << "  --max-size WxH     largest frame of the software backend (default: 4096x4096)\n"
+              << "  --output DIR       root of the output directories (default: each batch file's directory)\n"
+              << "  --progress SEC     seconds between progress or server stats lines (default: 1)\n"
+              << "  --wait SEC         seconds to wait for the frame ring to attach to (default: 60)\n"
+              << "  --resume           skip frames an earlier run of the batch file has written\n"
+              << "  --shards N         split the frames over N processes and merge their manifests\n"
+              << "  --shard K/N        render only shard K of N, used by --shards\n"
+              << "  --quiet            print errors only\n";
+}
+
+// Every option and the number of values following it; parsing and
+// forwarding to the shards both go by this table
+struct OptionInfo
+{
+    const char* name;
+    int         numValues;
+};
+
+static const OptionInfo Options[] =
+{
+    { "--shards", 1 }, { "--shard", 1 }, { "--threads", 1 }, { "--renderers", 1 }, { "--backend", 1 },
+    { "--max-size", 1 }, { "--output", 1 }, { "--progress", 1 }, { "--convert-poses", 2 }, { "--consume", 1 },
+    { "--dump", 1 }, { "--wait", 1 }, { "--serve", 1 }, { "--float", 0 }, { "--resume", 0 }, { "--quiet", 0 }
+};
+
+// The number of values of an option, -1 for an unknown option
+static int
+GetNumOptionValues(const std::string& arg)
+{
+    for (size_t i = 0; i < sizeof(Options) / sizeof(Options[0]); ++i)
+    {
+        if (arg == Options[i].name)
+            return Options[i].numValues;
+    }
+    return -1;
+}
+
+static bool
+ParseArguments(int argc, char** argv, HeadlessOptions& options)
+{
+    options.batch.progressInterval = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool isOption = arg.compare(0, 2, "--") == 0;
+        int numValues = isOption ? GetNumOptionValues(arg) : 0;
+        if (numValues < 0 || i + numValues >= argc)
+            return false;
+        if (arg != "--shards")
+        {
+            for (int k = 0; k <= numValues; ++k)
+                options.shardArguments.push_back(argv[i + k]);
+        }
+        try
+        {
+            if (arg == "--shards")
+            {
+                options.numProcesses = std::stoi(argv[++i]);
+                if (options.numProcesses < 1)
+                    return false;
+            }
+            else if (arg == "--shard")
+            {
+                if (std::sscanf(argv[++i], "%d/%d", &options.batch.shardIndex, &options.batch.numShards) != 2
+                    || options.batch.numShards < 1
+                    || options.batch.shardIndex < 0 || options.batch.shardIndex >= options.batch.numShards)
+                    return false;
+            }
+            else if (arg == "--threads")
+                options.batch.numWorkers = std::stoi(argv[++i]);
+            else if (arg == "--renderers")
+            {
+                options.batch.numRenderers = std::stoi(argv[++i]);
+                if (options.batch.numRenderers < 1)
+                    return false;
+            }
+            else if (arg == "--backend")
+            {
+                std::string backend = argv[++i];
+                if (backend == "gpu")
+                    options.backend = OFFSCREEN_GPU;
+                else if (backend == "software")
+                    options.backend = OFFSCREEN_SOFTWARE;
+                else
+                    return false;
+            }
+            else if (arg == "--max-size")
+            {
+                if (std::sscanf(argv[++i], "%dx%d", &options.maxWidth, &options.maxHeight) != 2
+                    || options.maxWidth <= 0 || options.maxHeight <= 0)
+                    return false;
+            }
+            else if (arg == "--output")
+                options.batch.outputRoot = argv[++i];
+            else if (arg == "--progress")
+                options.batch.progressInterval = std::stod(argv[++i]);
+            else if (arg == "--convert-poses")
+            {
+                options.poseInput = argv[++i];
+                options.poseOutput = argv[++i];
+            }
+            else if (arg == "--consume")
+                options.ringName = argv[++i];
+            else if (arg == "--dump")
+                options.dumpDir = argv[++i];
+            else if (arg == "--wait")
+                options.ringWait = std::stod(argv[++i]);
+            else if (arg == "--serve")
+                options.serverName = argv[++i];
+            else if (arg == "--float")
+                options.isFloatPoses = true;
+            else if (arg == "--resume")
+                options.batch.isResuming = true;
+            else if (arg == "--quiet")
+                options.isQuiet = true;
+            else
+                options.batchFiles.push_back(arg);
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+    if (options.numProcesses > 1 && options.batch.numShards > 1)
+        return false;
+    if (!options.poseInput.empty() || !options.ringName.empty() || !options.serverName.empty())
+        return options.batchFiles.empty();
+    return !options.batchFiles.empty();
+}
+
+// Shards report to the coordinator through a small file next to their manifest
+static std::string
+GetShardStatsFile(const std::string& batchFile, const BatchOptions& options, int shardIndex)
+{
+    return GetBaseName(GetShardManifestFile(batchFile, options, shardIndex)) + ".stats";
+}
+
+// Quote for the C runtime's argument parsing: backslashes only escape
+// when a quote follows
+static std::string
+QuoteArgument(const std::string& arg)
+{
+    std::string quoted = "\"";
+    int numBackslashes = 0;
+    for (size_t i = 0; i < arg.size(); ++i)
+    {
+        if (arg[i] == '\\')
+            ++numBackslashes;
+        else
+        {
+            if (arg[i] == '"')
+                quoted.append(numBackslashes + 1, '\\');
+            numBackslashes = 0;
+        }
+        quoted += arg[i];
+    }
+    quoted.append(numBackslashes, '\\');
+    return quoted + "\"";
+}
+
+// Start one process per shard, wait for all of them, then merge their
+// manifests and add up their throughput. Shards share nothing but files.
+static int
+RunCoordinator(const HeadlessOptions& options)
+{
+    BatchOptions shardOptions = options.batch;
+    shardOptions.numShards = options.numProcesses;
+
+    char exePath[MAX_PATH];
+    GetModuleFileNameA(NULL, exePath, MAX_PATH);
+
+    // Divide the cores unless the thread count is given
+    std::vector<std::string> arguments = options.shardArguments;
+    if (std::find(arguments.begin(), arguments.end(), "--threads") == arguments.end())
+    {
+        int numThreads = std::max(1, (int)std::thread::hardware_concurrency() / options.numProcesses);
+        arguments.push_back("--threads");
+        arguments.push_back(std::to_string(numThreads));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<PROCESS_INFORMATION> processes;
+    for (int k = 0; k < options.numProcesses; ++k)
+    {
+        // The arguments came in the ANSI code page and go out in it again
+        std::string commandLine = QuoteArgument(exePath);
+        commandLine += " --shard " + std::to_string(k) + "/" + std::to_string(options.numProcesses);
+        for (size_t i = 0; i < arguments.size(); ++i)
+            commandLine += " " + QuoteArgument(arguments[i]);
+
+        STARTUPINFOA startupInfo;
+        ZeroMemory(&startupInfo, sizeof(startupInfo));
+        startupInfo.cb = sizeof(startupInfo);
+        PROCESS_INFORMATION process;
+        std::vector<char> buffer(commandLine.begin(), commandLine.end());
+        buffer.push_back(0);
+        if (!CreateProcessA(NULL, buffer.data(), NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &process))
+        {
+            ReportError("Cannot start shard " + std::to_string(k) + ".\n");
+            continue;
+        }
+        processes.push_back(process);
+    }
+
+    bool isOk = (int)processes.size() == options.numProcesses;
+    for (size_t k = 0; k < processes.size(); ++k)
+    {
+        WaitForSingleObject(processes[k].hProcess, INFINITE);
+        DWORD exitCode = 1;
+        GetExitCodeProcess(processes[k].hProcess, &exitCode);
+        isOk = isOk && exitCode == 0;
+        CloseHandle(processes[k].hThread);
+        CloseHandle(processes[k].hProcess);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < options.batchFiles.size(); ++i)
+    {
+        const std::string& batchFile = options.batchFiles[i];
+        std::string manifestFile = GetManifestFile(batchFile, shardOptions);
+
+        // A resumed run keeps the frames of the combined manifest
+        std::vector<std::string> parts;
+        if (options.batch.isResuming)
+            parts.push_back(manifestFile);
+        int64_t numWritten = 0, numSkipped = 0, numBytes = 0, numCulled = 0;
+        for (int k = 0; k < options.numProcesses; ++k)
+        {
+            parts.push_back(GetShardManifestFile(batchFile, shardOptions, k));
+
+            std::string statsFile = GetShardStatsFile(batchFile, shardOptions, k);
+            std::ifstream file(statsFile);
+            int64_t written = 0, skipped = 0, bytes = 0, culled = 0;
+            double shardSeconds = 0;
+            if (file >> written >> skipped >> bytes)
+            {
+                numWritten += written;
+                numSkipped += skipped;
+                numBytes += bytes;
+                if (file >> shardSeconds >> culled)
+                    numCulled += culled;
+            }
+            file.close();
+            DeleteFileA(statsFile.c_str());
+        }
+
+        // Shard manifests stay behind when the merge fails, a resume reads them
+        if (MergeManifests(parts, manifestFile))
+        {
+            for (int k = 0; k < options.numProcesses; ++k)
+                DeleteFileA(GetShardManifestFile(batchFile, shardOptions, k).c_str());
+        }
+        else
+            isOk = false;
+
+        char summary[256];
+        std::snprintf(summary, sizeof(summary), "%lld frames (%lld resumed, %lld culled) in %.1f s, %.1f frames/s, %.1f MB/s over %d shards",
+                      (long long)numWritten, (long long)numSkipped, (long long)numCulled, seconds,
+                      numWritten / seconds, numBytes / seconds / 1e6, options.numProcesses);
+        std::cout << batchFile << ": " << summary << std::endl;
+    }
+
+    return isOk ? 0 : 1;
+}
+
+// Reads every frame of a ring in place until the producer is done,
+// reporting the rate and optionally saving the frames
+static int
+RunConsumer(const HeadlessOptions& options)
+{
+    // The producer creates the ring with its first frame
+    SharedRingReader reader;
+    if (!options.isQuiet)
+        std::cout << "Waiting for \"" << options.ringName << "\"" << std::endl;
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point waitStart = Clock::now();
+    while (!reader.open(options.ringName))
+    {
+        if (std::chrono::duration<double>(Clock::now() - waitStart).count() > options.ringWait)
+        {
+            ReportError("Cannot attach to the frame ring \"" + options.ringName + "\": it was not created, "
+                        "or has no room for another reader.\n");
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (!options.dumpDir.empty() && !IsDirectoryExists(options.dumpDir))
+        CreateDirectorys(options.dumpDir);
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point lastProgress = start;
+    int64_t numFrames = 0, numBytes = 0, numLost = 0;
+    Backoff backoff;
+    bool isDumpWarned = false;
+    while (!reader.isFinished())
+    {
+        const SharedFrameHeader* frame = reader.acquire();
+        if (!frame)
+        {
+            backoff.wait();
+            continue;
+        }
+        backoff.reset();
+
+        // A header on the ring's memory, no copy; channel frames carry
+        // 16-bit or float samples
+        cv::Mat image(frame->height, frame->width, CV_MAKETYPE(frame->depth, frame->channels), (void*)reader.getPixels(frame));
+        bool isPngDepth = frame->depth == CV_8U || frame->depth == CV_16U;
+        if (!options.dumpDir.empty() && !isPngDepth && !isDumpWarned)
+        {
+            ReportError("Frames with float samples are not saved as PNG, skipping them.\n");
+            isDumpWarned = true;
+        }
+        if (!options.dumpDir.empty() && isPngDepth)
+        {
+            std::string filename = options.dumpDir + "\\" + ZeroPadNumber(frame->lineIndex, 4)
+                                   + "_" + ZeroPadNumber(frame->frameIndex, 6) + ".png";
+            cv::imwrite(filename, image);
+        }
+        numBytes += frame->dataSize;
+        if (reader.release())
+            ++numFrames;
+        else
+            ++numLost;
+
+        Clock::time_point now = Clock::now();
+        if (!options.isQuiet && std::chrono::duration<double>(now - lastProgress).count() >= options.batch.progressInterval)
+        {
+            lastProgress = now;
+            std::cout << options.ringName << ": " << numFrames << " frames" << std::endl;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    char summary[256];
+    std::snprintf(summary, sizeof(summary), "%lld frames (%lld overwritten while read) in %.1f s, %.1f frames/s, %.1f MB/s",
+                  (long long)numFrames, (long long)numLost, seconds, numFrames / seconds, numBytes / seconds / 1e6);
+    std::cout << options.ringName << ": " << summary << std::endl;
+    return numLost == 0 ? 0 : 1;
+}
+
+// Keeps the renderer and its assets until a client asks it to stop
+static int
+RunServer(const HeadlessOptions& options)
+{
+    OffscreenRenderer renderer;
+    if (!renderer.create(options.backend, options.maxWidth, options.maxHeight))
+        return 1;
+
+    // Textures of the models the server keeps, clients can ask for any number
+    renderer.setMaxModels(ServerMaxAssets);
+    RenderServer server(renderer, options.serverName);
+    std::function<void(const std::string&)> log;
+    if (!options.isQuiet)
+    {
+        std::cout << "Serving \"" << options.serverName << "\"" << std::endl;
+        log = [](const std::string& stats) { std::cout << stats << std::flush; };
+    }
+    return server.run(options.batch.progressInterval, log) ? 0 : 1;
+}
+
+int
+main(int argc, char** argv)
+{
+    HeadlessOptions options;
+    if (!ParseArguments(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    SetErrorHandler([](const std::string& msg) { std::cerr << "Error: " << msg << std::flush; });
+
+    if (!options.poseInput.empty())
+        return ConvertPoseFile(options.poseInput, options.poseOutput, options.isFloatPoses) ? 0 : 1;
+
+    if (!options.ringName.empty())
+        return RunConsumer(options);
+
+    if (!options.serverName.empty())
+        return RunServer(options);
+
+    if (options.numProcesses > 1)
+        return RunCoordinator(options);
+
+    std::string shardName;
+    if (options.batch.numShards > 1)
+        shardName = "[shard " + std::to_string(options.batch.shardIndex) + "/" + std::to_string(options.batch.numShards) + "] ";
+
+    OffscreenRenderer renderer;
+    if (!renderer.create(options.backend, options.maxWidth, options.maxHeight))
+        return 1;
+    // Render threads draw with contexts of their own, the one above only
+    // answers for the camera
+    int backend = options.backend;
+    int maxWidth = options.maxWidth;
+    int maxHeight = options.maxHeight;
+    options.batch.createRenderer = [backend, maxWidth, maxHeight]()
+    {
+        std::unique_ptr<BatchRenderer> renderer;
+        std::unique_ptr<OffscreenRenderer> offscreen(new OffscreenRenderer);
+        if (offscreen->create(backend, maxWidth, maxHeight))
+            renderer = std::move(offscreen);
+        return renderer;
+    };
+
+    int numFailed = 0;
+    for (size_t i = 0; i < options.batchFiles.size(); ++i)
+    {
+        const std::string& batchFile = options.batchFiles[i];
+        BatchProgressCallback progress;
+        if (!options.isQuiet)
+        {
+            progress = [&batchFile, &shardName](const BatchProgress& p)
+            {
+                std::cout << shardName << batchFile
+                          << " line " << p.lineIndex + 1 << "/" << p.numLines
+                          << ": " << p.posesFile
+                          << " frame " << p.frameIndex + 1;
+                if (p.numFrames >= 0)
+                    std::cout << "/" << p.numFrames;
+                std::cout << std::endl;
+            };
+        }
+
+        BatchStats stats;
+        bool isOk = RunBatch(batchFile, renderer, options.batch, progress, stats);
+        if (!isOk)
+            ++numFailed;
+        if (!options.isQuiet || !isOk)
+            std::cout << shardName << batchFile << (isOk ? " done. " : " failed. ") << stats.summary << std::endl;
+
+        if (options.batch.numShards > 1)
+        {
+            std::ofstream file(GetShardStatsFile(batchFile, options.batch, options.batch.shardIndex));
+            file << stats.numWritten << ' ' << stats.numSkipped << ' ' << stats.numBytes << ' ' << stats.seconds << ' ' << stats.numCulled << '\n';
+        }
+    }
+
+    return numFailed == 0 ? 0 : 1;
+}
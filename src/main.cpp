@@ -1,14 +1,77 @@
 #include "main.h"
 #include "ObjViewer.h"
+#include "OVError.h"
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
 namespace ov
 {
 
 IMPLEMENT_APP(MyApp)
 
+// Errors of worker threads waiting to be shown, and whether showing them
+// is already queued on the main thread
+static std::mutex               WorkerErrorsMutex;
+static std::vector<std::string> WorkerErrors;
+static bool                     IsShowingWorkerErrors = false;
+
+// Show the collected worker errors one box at a time, a summary when
+// there are many; errors reported meanwhile go into the next box
+static void
+ShowWorkerErrors()
+{
+    const size_t maxListed = 10;
+    for (;;)
+    {
+        std::vector<std::string> errors;
+        {
+            std::lock_guard<std::mutex> lock(WorkerErrorsMutex);
+            errors.swap(WorkerErrors);
+            if (errors.empty())
+            {
+                IsShowingWorkerErrors = false;
+                return;
+            }
+        }
+
+        std::string msg;
+        if (errors.size() > 1)
+            msg = std::to_string(errors.size()) + " errors:\n\n";
+        for (size_t i = 0; i < errors.size() && i < maxListed; ++i)
+        {
+            msg += errors[i];
+            if (errors[i].empty() || errors[i].back() != '\n')
+                msg += '\n';
+        }
+        if (errors.size() > maxListed)
+            msg += "...and " + std::to_string(errors.size() - maxListed) + " more.\n";
+        wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+    }
+}
+
 // The program execution starts here
 bool MyApp::OnInit()
 {
+    // Message boxes can only be shown from the main thread
+    SetErrorHandler([](const std::string& msg)
+    {
+        if (wxIsMainThread())
+        {
+            wxMessageBox(msg, wxT("Error"), wxICON_ERROR);
+            return;
+        }
+
+        // A batch with many bad lines reports from many threads at once
+        std::lock_guard<std::mutex> lock(WorkerErrorsMutex);
+        WorkerErrors.push_back(msg);
+        if (!IsShowingWorkerErrors)
+        {
+            IsShowingWorkerErrors = true;
+            wxTheApp->CallAfter([]() { ShowWorkerErrors(); });
+        }
+    });
+
     ObjViewer *viewer = new ObjViewer(wxT("OBJ Viewer"));
 
     return true;
@@ -0,0 +1,457 @@
+// Python module around the offscreen renderer, renders poses straight into
+// preallocated NumPy arrays without files in between:
+//   import numpy as np, ovrender
+//   renderer = ovrender.Renderer()             # backend='gpu' or 'software'
+//   renderer.load_model('model.obj')
+//   renderer.load_camera('camera.txt')         # or set_camera(fx, fy, cx, cy, width, height)
+//   renderer.set_background('background.png')  # or an HxWx3 uint8 BGR array
+//   frames = np.empty((len(poses), renderer.height, renderer.width, 3), np.uint8)
+//   renderer.render(poses, frames)             # float64 poses, PoseSize values each
+// Any object with the buffer protocol works in place of a NumPy array. The
+// GIL is released while models load and frames render. GL contexts belong
+// to a thread, so a Renderer is used from the thread that created it.
+
+// The release interpreter is linked in debug builds too
+#ifdef _DEBUG
+#undef _DEBUG
+#include <Python.h>
+#define _DEBUG
+#else
+#include <Python.h>
+#endif
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "OVCamera.h"
+#include "OVError.h"
+#include "OVModel.h"
+#include "OVOffscreen.h"
+#include "OVPose.h"
+
+using namespace ov;
+
+// Reported errors become the message of the exception raised for them
+static std::mutex  LastErrorMutex;
+static std::string LastError;
+
+static void
+KeepError(const std::string& msg)
+{
+    std::lock_guard<std::mutex> lock(LastErrorMutex);
+    LastError = msg;
+}
+
+static PyObject*
+RaiseError(const std::string& fallback)
+{
+    std::string msg;
+    {
+        std::lock_guard<std::mutex> lock(LastErrorMutex);
+        msg.swap(LastError);
+    }
+    if (msg.empty())
+        msg = fallback;
+    while (!msg.empty() && msg.back() == '\n')
+        msg.pop_back();
+    PyErr_SetString(PyExc_RuntimeError, msg.c_str());
+    return NULL;
+}
+
+// A buffer of an argument, released with the view
+class BufferView
+{
+public:
+    BufferView() : _isValid(false) {}
+    ~BufferView() { if (_isValid) PyBuffer_Release(&_view); }
+
+    bool get(PyObject* object, bool isWritable)
+    {
+        int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (isWritable ? PyBUF_WRITABLE : 0);
+        _isValid = PyObject_GetBuffer(object, &_view, flags) == 0;
+        return _isValid;
+    }
+
+    // The struct format character, without a byte order prefix
+    char getFormat() const
+    {
+        const char* format = _view.format ? _view.format : "B";
+        if (*format == '<' || *format == '=' || *format == '@')
+            ++format;
+        return format[1] == '\0' ? format[0] : '\0';
+    }
+
+    const Py_buffer& operator*() const { return _view; }
+    const Py_buffer* operator->() const { return &_view; }
+
+private:
+    BufferView(const BufferView&);
+    BufferView& operator=(const BufferView&);
+
+    Py_buffer _view;
+    bool      _isValid;
+};
+
+struct RendererState
+{
+    RendererState() : hasCamera(false), width(0), height(0) {}
+
+    OffscreenRenderer            renderer;
+    std::thread::id              owner;
+    std::shared_ptr<const Model> model;
+    CameraParameters             camera;
+    bool                         hasCamera;
+    int                          width; // of the background, and so of the frames
+    int                          height;
+};
+
+struct PyRenderer
+{
+    PyObject_HEAD
+    RendererState* state;
+};
+
+static bool
+IsOwner(PyRenderer* self)
+{
+    if (!self->state)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "The renderer is not initialized.");
+        return false;
+    }
+    if (self->state->owner != std::this_thread::get_id())
+    {
+        PyErr_SetString(PyExc_RuntimeError, "A renderer is used from the thread that created it only.");
+        return false;
+    }
+    if (!self->state->renderer.makeCurrent())
+    {
+        RaiseError("Cannot make the renderer's GL context current.");
+        return false;
+    }
+    return true;
+}
+
+static bool
+SetBackground(RendererState& state, const cv::Mat& image)
+{
+    if (!state.renderer.setBackground(image))
+        return false;
+    state.width = image.cols;
+    state.height = image.rows;
+    return true;
+}
+
+static bool
+SetCamera(RendererState& state, const CameraParameters& camera)
+{
+    state.renderer.setCamera(camera);
+    state.camera = camera;
+    state.hasCamera = true;
+
+    // Frames of the camera's size on black until a background is set
+    if (state.width == 0 || state.height == 0)
+        return SetBackground(state, cv::Mat::zeros(camera.height, camera.width, CV_8UC3));
+    return true;
+}
+
+static void
+Renderer_dealloc(PyRenderer* self)
+{
+    if (self->state)
+    {
+        // The context is destroyed by the thread that owns it, anywhere
+        // else it is leaked rather than torn down from the wrong thread
+        if (self->state->owner == std::this_thread::get_id())
+            delete self->state;
+        self->state = NULL;
+    }
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject*
+Renderer_new(PyTypeObject* type, PyObject* args, PyObject* kwargs)
+{
+    PyRenderer* self = (PyRenderer*)type->tp_alloc(type, 0);
+    if (self)
+        self->state = NULL;
+    return (PyObject*)self;
+}
+
+static int
+Renderer_init(PyRenderer* self, PyObject* args, PyObject* kwargs)
+{
+    static const char* keywords[] = { "backend", "max_width", "max_height", NULL };
+    const char* backendName = "gpu";
+    int maxWidth = 4096;
+    int maxHeight = 4096;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|sii", (char**)keywords, &backendName, &maxWidth, &maxHeight))
+        return -1;
+
+    int backend;
+    if (std::strcmp(backendName, "gpu") == 0)
+        backend = OFFSCREEN_GPU;
+    else if (std::strcmp(backendName, "software") == 0)
+        backend = OFFSCREEN_SOFTWARE;
+    else
+    {
+        PyErr_Format(PyExc_ValueError, "Unknown backend \"%s\", use gpu or software.", backendName);
+        return -1;
+    }
+
+    if (self->state)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "The renderer is already initialized.");
+        return -1;
+    }
+
+    std::unique_ptr<RendererState> state(new RendererState());
+    state->owner = std::this_thread::get_id();
+    if (!state->renderer.create(backend, maxWidth, maxHeight))
+    {
+        RaiseError("Cannot create the offscreen renderer.");
+        return -1;
+    }
+    self->state = state.release();
+    return 0;
+}
+
+// Same as the viewer's foreground object; unitize scales it into the unit sphere
+static PyObject*
+Renderer_load_model(PyRenderer* self, PyObject* args, PyObject* kwargs)
+{
+    static const char* keywords[] = { "path", "unitize", NULL };
+    const char* path;
+    int isUnitization = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|p", (char**)keywords, &path, &isUnitization))
+        return NULL;
+    if (!IsOwner(self))
+        return NULL;
+
+    std::string filename(path);
+    std::shared_ptr<Model> model = std::make_shared<Model>();
+    bool isLoaded;
+    Py_BEGIN_ALLOW_THREADS
+    isLoaded = LoadModel(*model, filename, isUnitization != 0);
+    Py_END_ALLOW_THREADS
+    if (!isLoaded)
+        return RaiseError("Cannot load the model \"" + filename + "\".");
+
+    RendererState& state = *self->state;
+    state.model = model;
+    if (!state.renderer.setModel(state.model))
+        return RaiseError("Cannot upload the textures of \"" + filename + "\".");
+    Py_RETURN_NONE;
+}
+
+// A camera parameter file, as the viewer reads it
+static PyObject*
+Renderer_load_camera(PyRenderer* self, PyObject* args)
+{
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return NULL;
+    if (!IsOwner(self))
+        return NULL;
+
+    CameraParameters camera;
+    if (!LoadCameraParameters(path, camera))
+        return RaiseError(std::string("Cannot read the camera parameters \"") + path + "\".");
+    if (!SetCamera(*self->state, camera))
+        return RaiseError("Cannot size the renderer for the camera.");
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+Renderer_set_camera(PyRenderer* self, PyObject* args)
+{
+    CameraParameters camera;
+    if (!PyArg_ParseTuple(args, "ddddii", &camera.fx, &camera.fy, &camera.cx, &camera.cy,
+                          &camera.width, &camera.height))
+        return NULL;
+    if (camera.width <= 0 || camera.height <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "The camera's width and height must be positive.");
+        return NULL;
+    }
+    if (!IsOwner(self))
+        return NULL;
+
+    if (!SetCamera(*self->state, camera))
+        return RaiseError("Cannot size the renderer for the camera.");
+    Py_RETURN_NONE;
+}
+
+// An image file or an HxWx3 uint8 BGR buffer; sets the frame size
+static PyObject*
+Renderer_set_background(PyRenderer* self, PyObject* args)
+{
+    PyObject* object;
+    if (!PyArg_ParseTuple(args, "O", &object))
+        return NULL;
+    if (!IsOwner(self))
+        return NULL;
+
+    if (PyUnicode_Check(object))
+    {
+        const char* path = PyUnicode_AsUTF8(object);
+        if (!path)
+            return NULL;
+        cv::Mat image = cv::imread(path, CV_LOAD_IMAGE_COLOR);
+        if (image.empty())
+            return RaiseError(std::string("Cannot read the background \"") + path + "\".");
+        if (!SetBackground(*self->state, image))
+            return RaiseError("Cannot size the renderer for the background.");
+        Py_RETURN_NONE;
+    }
+
+    BufferView view;
+    if (!view.get(object, false))
+        return NULL;
+    if (view->ndim != 3 || view->shape[2] != 3 || view.getFormat() != 'B')
+    {
+        PyErr_SetString(PyExc_ValueError, "The background must be an HxWx3 uint8 array.");
+        return NULL;
+    }
+    cv::Mat image((int)view->shape[0], (int)view->shape[1], CV_8UC3, view->buf);
+    if (!SetBackground(*self->state, image))
+        return RaiseError("Cannot size the renderer for the background.");
+    Py_RETURN_NONE;
+}
+
+// poses: float64, PoseSize values per pose, any shape
+// out:   writable uint8, C-contiguous, N x height x width x 3
+static PyObject*
+Renderer_render(PyRenderer* self, PyObject* args)
+{
+    PyObject* posesObject;
+    PyObject* outObject;
+    if (!PyArg_ParseTuple(args, "OO", &posesObject, &outObject))
+        return NULL;
+    if (!IsOwner(self))
+        return NULL;
+
+    RendererState& state = *self->state;
+    if (!state.model || !state.hasCamera)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Load a model and set a camera before rendering.");
+        return NULL;
+    }
+
+    BufferView poses, out;
+    if (!poses.get(posesObject, false) || !out.get(outObject, true))
+        return NULL;
+    if (poses.getFormat() != 'd' || poses->len % (PoseSize * sizeof(double)) != 0)
+    {
+        PyErr_Format(PyExc_ValueError, "The poses must be float64 with %d values per pose.", PoseSize);
+        return NULL;
+    }
+    Py_ssize_t numPoses = poses->len / (PoseSize * sizeof(double));
+    Py_ssize_t frameBytes = (Py_ssize_t)state.width * state.height * 3;
+    if (out.getFormat() != 'B' || out->len != numPoses * frameBytes)
+    {
+        PyErr_Format(PyExc_ValueError, "The output must be a uint8 array of %zd x %d x %d x 3.",
+                     numPoses, state.height, state.width);
+        return NULL;
+    }
+
+    const double* pose = (const double*)poses->buf;
+    uchar* frames = (uchar*)out->buf;
+    bool isRendered = true;
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < numPoses && isRendered; ++i)
+    {
+        Mat3 R;
+        Vec3 t;
+        PoseToRt(pose + i * PoseSize, R, t);
+
+        // The renderer reads the frame straight into the array
+        uchar* frameData = frames + i * frameBytes;
+        cv::Mat frame(state.height, state.width, CV_8UC3, frameData);
+        isRendered = state.renderer.render(R, t, frame);
+        if (isRendered && frame.data != frameData)
+        {
+            cv::Mat target(state.height, state.width, CV_8UC3, frameData);
+            frame.copyTo(target);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    if (!isRendered)
+        return RaiseError("Cannot render the frame.");
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+Renderer_get_width(PyRenderer* self, void*)
+{
+    return PyLong_FromLong(self->state ? self->state->width : 0);
+}
+
+static PyObject*
+Renderer_get_height(PyRenderer* self, void*)
+{
+    return PyLong_FromLong(self->state ? self->state->height : 0);
+}
+
+static PyMethodDef RendererMethods[] =
+{
+    { "load_model",     (PyCFunction)Renderer_load_model,     METH_VARARGS | METH_KEYWORDS,
+      "load_model(path, unitize=False)\nLoad the OBJ model to render." },
+    { "load_camera",    (PyCFunction)Renderer_load_camera,    METH_VARARGS,
+      "load_camera(path)\nRead the camera parameters from a file." },
+    { "set_camera",     (PyCFunction)Renderer_set_camera,     METH_VARARGS,
+      "set_camera(fx, fy, cx, cy, width, height)\nSet the camera intrinsics." },
+    { "set_background", (PyCFunction)Renderer_set_background, METH_VARARGS,
+      "set_background(image)\nAn image file or an HxWx3 uint8 BGR array, sets the frame size." },
+    { "render",         (PyCFunction)Renderer_render,         METH_VARARGS,
+      "render(poses, out)\nRender float64 poses of 12 values into a uint8 N x height x width x 3 array." },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef RendererProperties[] =
+{
+    { (char*)"width",  (getter)Renderer_get_width,  NULL, (char*)"Width of the frames",  NULL },
+    { (char*)"height", (getter)Renderer_get_height, NULL, (char*)"Height of the frames", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyTypeObject RendererType =
+{
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "ovrender.Renderer"
+};
+
+static PyModuleDef RenderModule =
+{
+    PyModuleDef_HEAD_INIT,
+    "ovrender",
+    "Offscreen rendering of OBJ models into NumPy arrays",
+    -1,
+    NULL
+};
+
+PyMODINIT_FUNC
+PyInit_ovrender()
+{
+    RendererType.tp_basicsize = sizeof(PyRenderer);
+    RendererType.tp_flags = Py_TPFLAGS_DEFAULT;
+    RendererType.tp_doc = "Renderer(backend='gpu', max_width=4096, max_height=4096)";
+    RendererType.tp_new = Renderer_new;
+    RendererType.tp_init = (initproc)Renderer_init;
+    RendererType.tp_dealloc = (destructor)Renderer_dealloc;
+    RendererType.tp_methods = RendererMethods;
+    RendererType.tp_getset = RendererProperties;
+    if (PyType_Ready(&RendererType) < 0)
+        return NULL;
+
+    PyObject* module = PyModule_Create(&RenderModule);
+    if (!module)
+        return NULL;
+
+    SetErrorHandler(KeepError);
+    Py_INCREF(&RendererType);
+    PyModule_AddObject(module, "Renderer", (PyObject*)&RendererType);
+    return module;
+}
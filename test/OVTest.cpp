@@ -0,0 +1,132 @@
+// Unit tests of the batch renderer's building blocks:
+//   ObjViewerTests [name filter]
+// runs the tests whose names contain the filter, all by default, and
+// exits with the number of failed tests.
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "OVError.h"
+#include "OVTest.h"
+#include "OVUtil.h"
+
+namespace ov
+{
+
+struct Test
+{
+    const char*  name;
+    TestFunction function;
+};
+
+// Filled during static initialization, before any other global is safe to use
+static std::vector<Test>&
+GetTests()
+{
+    static std::vector<Test> tests;
+    return tests;
+}
+
+static const char* CurrentTest = NULL;
+static int         NumFailedChecks = 0;
+
+bool
+RegisterTest(const char* name, TestFunction function)
+{
+    Test test = { name, function };
+    GetTests().push_back(test);
+    return true;
+}
+
+void
+FailCheck(const char* expression, const char* file, int line)
+{
+    std::cerr << file << "(" << line << "): " << CurrentTest << ": check failed: " << expression << std::endl;
+    ++NumFailedChecks;
+}
+
+std::string
+GetTestDir()
+{
+    char tempDir[MAX_PATH + 1];
+    DWORD length = GetTempPathA(sizeof(tempDir), tempDir);
+    std::string dir = std::string(tempDir, length) + "ObjViewerTests\\" + CurrentTest + "\\";
+    CreateDirectorys(dir);
+    return dir;
+}
+
+bool
+WriteTestFile(const std::string& filename, const std::string& contents)
+{
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+    file.close();
+    return !file.fail();
+}
+
+std::string
+ReadTestFile(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+bool
+IsSameImage(const cv::Mat& a, const cv::Mat& b)
+{
+    if (a.size() != b.size() || a.type() != b.type())
+        return false;
+    for (int y = 0; y < a.rows; ++y)
+        if (std::memcmp(a.ptr(y), b.ptr(y), a.cols * a.elemSize()) != 0)
+            return false;
+    return true;
+}
+
+ErrorCatcher::ErrorCatcher()
+{
+    SetErrorHandler([this](const std::string& msg) { _errors.push_back(msg); });
+}
+
+ErrorCatcher::~ErrorCatcher()
+{
+    SetErrorHandler(ErrorHandler());
+}
+
+} // namespace ov
+
+using namespace ov;
+
+int
+main(int argc, char** argv)
+{
+    std::string filter = argc > 1 ? argv[1] : "";
+    const std::vector<Test>& tests = GetTests();
+    int numRun = 0, numFailed = 0;
+    for (size_t i = 0; i < tests.size(); ++i)
+    {
+        if (std::string(tests[i].name).find(filter) == std::string::npos)
+            continue;
+
+        CurrentTest = tests[i].name;
+        NumFailedChecks = 0;
+        try
+        {
+            tests[i].function();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << CurrentTest << ": exception: " << e.what() << std::endl;
+            ++NumFailedChecks;
+        }
+        ++numRun;
+        if (NumFailedChecks > 0)
+            ++numFailed;
+        std::cout << (NumFailedChecks > 0 ? "FAILED " : "ok     ") << CurrentTest << std::endl;
+    }
+
+    std::cout << numRun - numFailed << " of " << numRun << " tests passed" << std::endl;
+    return numFailed;
+}
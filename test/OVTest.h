@@ -0,0 +1,61 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+namespace ov
+{
+
+typedef void (*TestFunction)();
+
+// Called by OV_TEST before main(); the tests run in the order they are
+// registered, file by file
+bool
+RegisterTest(const char* name, TestFunction function);
+
+void
+FailCheck(const char* expression, const char* file, int line);
+
+// A directory of the running test's own for its files, with a trailing
+// separator; files of an earlier run are still there
+std::string
+GetTestDir();
+
+bool
+WriteTestFile(const std::string& filename, const std::string& contents);
+
+// The whole file, empty if it cannot be read
+std::string
+ReadTestFile(const std::string& filename);
+
+// Same size, type and samples
+bool
+IsSameImage(const cv::Mat& a, const cv::Mat& b);
+
+// Keeps the errors reported while it lives instead of printing them
+class ErrorCatcher
+{
+public:
+    ErrorCatcher();
+    ~ErrorCatcher();
+
+    const std::vector<std::string>& getErrors() const { return _errors; }
+
+private:
+    ErrorCatcher(const ErrorCatcher&);
+    ErrorCatcher& operator=(const ErrorCatcher&);
+
+    std::vector<std::string> _errors;
+};
+
+} // namespace ov
+
+#define OV_TEST(name) \
+    static void name(); \
+    static const bool name##IsRegistered = ov::RegisterTest(#name, &name); \
+    static void name()
+
+// A failed check is reported and fails the test, the test goes on
+#define OV_CHECK(expression) \
+    do { if (!(expression)) ov::FailCheck(#expression, __FILE__, __LINE__); } while (0)
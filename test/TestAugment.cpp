@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include "OVAugment.h"
+#include "OVPipeline.h"
+#include "OVTest.h"
+
+using namespace ov;
+
+// Edges in every direction, so a blur changes every row and column
+static cv::Mat
+MakePattern(int rows, int cols, int type)
+{
+    cv::Mat image(rows, cols, type);
+    for (int y = 0; y < rows; ++y)
+    {
+        uchar* row = image.ptr<uchar>(y);
+        for (int i = 0; i < cols * image.channels(); ++i)
+            row[i] = (uchar)((i * 7 + y * 13 + (i / 16 + y / 16) % 2 * 128) & 255);
+    }
+    return image;
+}
+
+// The frame augmented with every parallel_for_ split from one band up
+static bool
+IsSameForAnyThreads(const cv::Mat& image, double blurSigma, double noiseVariance, uint64_t seed)
+{
+    int numThreads = cv::getNumThreads();
+    cv::setNumThreads(1);
+    cv::Mat expected = image.clone();
+    AugmentFrame(expected, blurSigma, noiseVariance, seed);
+
+    bool isSame = true;
+    for (int n = 2; n <= 8 && isSame; n *= 2)
+    {
+        cv::setNumThreads(n);
+        cv::Mat augmented = image.clone();
+        AugmentFrame(augmented, blurSigma, noiseVariance, seed);
+        isSame = IsSameImage(augmented, expected);
+    }
+    cv::setNumThreads(numThreads);
+    return isSame;
+}
+
+OV_TEST(GaussianPairIsStandardNormal)
+{
+    const int numPairs = 100000;
+    double sum = 0, sumOfSquares = 0;
+    for (int i = 0; i < numPairs; ++i)
+    {
+        float n0, n1;
+        GaussianPair(42, i, n0, n1);
+        sum += n0 + n1;
+        sumOfSquares += n0 * n0 + n1 * n1;
+    }
+    double mean = sum / (2 * numPairs);
+    double variance = sumOfSquares / (2 * numPairs) - mean * mean;
+    OV_CHECK(std::abs(mean) < 0.01);
+    OV_CHECK(std::abs(variance - 1) < 0.02);
+
+    // A pure function of seed and counter
+    float a0, a1, b0, b1;
+    GaussianPair(42, 7, a0, a1);
+    GaussianPair(42, 7, b0, b1);
+    OV_CHECK(a0 == b0 && a1 == b1);
+    GaussianPair(43, 7, b0, b1);
+    OV_CHECK(a0 != b0 || a1 != b1);
+}
+
+OV_TEST(FrameSeedsDiffer)
+{
+    std::set<uint64_t> seeds;
+    for (int sequence = 0; sequence < 100; ++sequence)
+        for (int frame = 0; frame < 100; ++frame)
+            seeds.insert(FrameSeed(sequence, frame));
+    OV_CHECK(seeds.size() == 100 * 100);
+    OV_CHECK(FrameSeed(3, 5) == FrameSeed(3, 5));
+}
+
+OV_TEST(AugmentWithoutBlurOrNoiseKeepsFrame)
+{
+    cv::Mat image = MakePattern(31, 17, CV_8UC3);
+    cv::Mat augmented = image.clone();
+    AugmentFrame(augmented, 0, 0, 1);
+    OV_CHECK(IsSameImage(augmented, image));
+}
+
+OV_TEST(AugmentBlurKeepsFlatFrame)
+{
+    // Both blurs are normalized, a flat frame stays flat up to rounding
+    double sigmas[] = { 1.5, RecursiveBlurSigma * 2 };
+    for (int i = 0; i < 2; ++i)
+    {
+        cv::Mat image(40, 50, CV_8UC3, cv::Scalar(100, 150, 200));
+        AugmentFrame(image, sigmas[i], 0, 1);
+        bool isFlat = true;
+        for (int y = 0; y < image.rows; ++y)
+            for (int x = 0; x < image.cols * 3; ++x)
+                isFlat = isFlat && std::abs(image.ptr<uchar>(y)[x] - (100 + x % 3 * 50)) <= 1;
+        OV_CHECK(isFlat);
+    }
+}
+
+OV_TEST(AugmentIsDeterministic)
+{
+    cv::Mat image = MakePattern(97, 61, CV_8UC3);
+    uint64_t seed = FrameSeed(1, 2);
+    OV_CHECK(IsSameForAnyThreads(image, 0, 10, seed));
+    OV_CHECK(IsSameForAnyThreads(image, 2, 0, seed));
+    OV_CHECK(IsSameForAnyThreads(image, 2, 10, seed));
+    OV_CHECK(IsSameForAnyThreads(image, RecursiveBlurSigma * 2, 10, seed));
+    OV_CHECK(IsSameForAnyThreads(MakePattern(64, 64, CV_8UC1), 3, 5, seed));
+
+    cv::Mat a = image.clone(), b = image.clone();
+    AugmentFrame(a, 2, 10, seed);
+    AugmentFrame(b, 2, 10, seed + 1);
+    OV_CHECK(!IsSameImage(a, b));
+}
+
+OV_TEST(AugmentNoiseIsNormalized)
+{
+    cv::Mat image(32, 32, CV_8UC1, cv::Scalar(100));
+    AugmentFrame(image, 0, 20, 5);
+    int minValue = 255, maxValue = 0;
+    for (int y = 0; y < image.rows; ++y)
+        for (int x = 0; x < image.cols; ++x)
+        {
+            minValue = std::min(minValue, (int)image.ptr<uchar>(y)[x]);
+            maxValue = std::max(maxValue, (int)image.ptr<uchar>(y)[x]);
+        }
+    OV_CHECK(minValue == 0 && maxValue == 255);
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+#include "OVComposite.h"
+#include "OVTest.h"
+
+using namespace ov;
+
+// A premultiplied layer: covered pixels in a band of rows and columns,
+// with every alpha from transparent to opaque
+static cv::Mat
+MakeLayer(int rows, int cols)
+{
+    cv::Mat bgra(rows, cols, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+    for (int y = rows / 4; y < rows * 3 / 4; ++y)
+        for (int x = 3; x < cols - 5; ++x)
+        {
+            uchar* p = bgra.ptr<uchar>(y) + 4 * x;
+            int alpha = (x * 37 + y * 11) % 256;
+            p[0] = (uchar)(alpha * ((x * 5) % 256) / 255);
+            p[1] = (uchar)(alpha * ((y * 9) % 256) / 255);
+            p[2] = (uchar)(alpha * 200 / 255);
+            p[3] = (uchar)alpha;
+        }
+    return bgra;
+}
+
+static cv::Mat
+MakeBackground(int rows, int cols)
+{
+    cv::Mat background(rows, cols, CV_8UC3);
+    for (int y = 0; y < rows; ++y)
+        for (int i = 0; i < cols * 3; ++i)
+            background.ptr<uchar>(y)[i] = (uchar)((i * 13 + y * 7) % 256);
+    return background;
+}
+
+OV_TEST(CompositeMatchesOver)
+{
+    // Wide enough for whole vectors and a tail in every row
+    cv::Mat bgra = MakeLayer(24, 45);
+    cv::Mat background = MakeBackground(24, 45);
+    cv::Mat original = background.clone();
+
+    ForegroundLayer layer;
+    layer.set(bgra);
+    OV_CHECK(layer.size() == bgra.size());
+    cv::Mat image;
+    layer.composite(background, image);
+    OV_CHECK(IsSameImage(background, original));
+    OV_CHECK(image.data != background.data);
+
+    bool isSame = image.size() == background.size() && image.type() == CV_8UC3;
+    for (int y = 0; isSame && y < image.rows; ++y)
+        for (int x = 0; x < image.cols; ++x)
+            for (int c = 0; c < 3; ++c)
+            {
+                const uchar* color = bgra.ptr<uchar>(y) + 4 * x;
+                int b = background.ptr<uchar>(y)[3 * x + c];
+                int expected = std::min(255, color[c] + (int)std::floor(b * (255 - color[3]) / 255.0 + 0.5));
+                isSame = isSame && image.ptr<uchar>(y)[3 * x + c] == expected;
+            }
+    OV_CHECK(isSame);
+}
+
+OV_TEST(CompositeReusesLayer)
+{
+    // One layer over many backgrounds, a transparent layer keeps them as they are
+    cv::Mat bgra = MakeLayer(16, 40);
+    ForegroundLayer layer, empty;
+    layer.set(bgra);
+    empty.set(cv::Mat(16, 40, CV_8UC4, cv::Scalar(0, 0, 0, 0)));
+
+    cv::Mat first, second, image;
+    cv::Mat background = MakeBackground(16, 40);
+    layer.composite(background, first);
+    layer.composite(cv::Mat(16, 40, CV_8UC3, cv::Scalar(1, 2, 3)), second);
+    layer.composite(background, image);
+    OV_CHECK(IsSameImage(image, first));
+    OV_CHECK(!IsSameImage(image, second));
+
+    empty.composite(background, image);
+    OV_CHECK(IsSameImage(image, background));
+}
+
+OV_TEST(CompositeOpaqueLayer)
+{
+    cv::Mat bgra(8, 20, CV_8UC4, cv::Scalar(10, 20, 30, 255));
+    ForegroundLayer layer;
+    layer.set(bgra);
+    cv::Mat image;
+    layer.composite(MakeBackground(8, 20), image);
+    OV_CHECK(IsSameImage(image, cv::Mat(8, 20, CV_8UC3, cv::Scalar(10, 20, 30))));
+}
@@ -0,0 +1,104 @@
+#include <cmath>
+#include "OVAnnotation.h"
+#include "OVRender.h"
+#include "OVTest.h"
+
+using namespace ov;
+
+static const double PlaneNear = 0.1;
+static const double PlaneFar = 100;
+
+// 640x480 with a focal length of 500, so the frame's right edge is at
+// x = 0.64 z and its bottom at y = 0.48 z
+static void
+GetProjection(double projectionMatrix[16])
+{
+    CameraParameters camera;
+    camera.fx = camera.fy = 500;
+    camera.cx = 320;
+    camera.cy = 240;
+    camera.width = 640;
+    camera.height = 480;
+    BuildProjectionMatrix(camera, PlaneNear, PlaneFar, projectionMatrix);
+}
+
+static bool
+IsInFrustum(const Vec3& p)
+{
+    return p[2] >= PlaneNear && p[2] <= PlaneFar && std::abs(p[0]) <= 0.64 * p[2] && std::abs(p[1]) <= 0.48 * p[2];
+}
+
+OV_TEST(CullSpheresOutsideThePlanes)
+{
+    double projection[16];
+    GetProjection(projection);
+    Mat4 identity = Mat4::Identity();
+
+    OV_CHECK(IsSphereInFrustum(projection, identity, Vec3(0, 0, 5), 0.1));
+    OV_CHECK(!IsSphereInFrustum(projection, identity, Vec3(0, 0, -5), 0.1));
+    // 0.67 from the right plane
+    OV_CHECK(!IsSphereInFrustum(projection, identity, Vec3(4, 0, 5), 0.5));
+    OV_CHECK(IsSphereInFrustum(projection, identity, Vec3(4, 0, 5), 1));
+    OV_CHECK(!IsSphereInFrustum(projection, identity, Vec3(0, -3, 5), 0.3));
+    OV_CHECK(IsSphereInFrustum(projection, identity, Vec3(0, -3, 5), 0.7));
+    OV_CHECK(!IsSphereInFrustum(projection, identity, Vec3(0, 0, 150), 1));
+    OV_CHECK(IsSphereInFrustum(projection, identity, Vec3(0, 0, 150), 60));
+    OV_CHECK(!IsSphereInFrustum(projection, identity, Vec3(0, 0, 0.05), 0.01));
+    OV_CHECK(IsSphereInFrustum(projection, identity, Vec3(0, 0, 0.05), 0.1));
+}
+
+OV_TEST(CullSpheresThroughTheModelView)
+{
+    double projection[16];
+    GetProjection(projection);
+
+    // A pose turned half way around y puts a point behind the model in view
+    Mat3 R = Eigen::AngleAxisd(CV_PI, Vec3::UnitY()).toRotationMatrix();
+    Mat4 turned = ComposeModelView(Vec3::Zero(), Vec3::Zero(), 1, R, Vec3::Zero());
+    OV_CHECK(IsSphereInFrustum(projection, turned, Vec3(0, 0, -5), 0.1));
+    OV_CHECK(!IsSphereInFrustum(projection, turned, Vec3(0, 0, 5), 0.1));
+
+    // The scale of the viewer's offset grows the radius too
+    Mat4 scaled = ComposeModelView(Vec3::Zero(), Vec3::Zero(), 10, Mat3::Identity(), Vec3::Zero());
+    OV_CHECK(!IsSphereInFrustum(projection, scaled, Vec3(0.4, 0, 0.5), 0.05));
+    OV_CHECK(IsSphereInFrustum(projection, scaled, Vec3(0.4, 0, 0.5), 0.1));
+}
+
+OV_TEST(CullingIsConservative)
+{
+    // A sphere with any point in the frustum is never culled
+    double projection[16];
+    GetProjection(projection);
+    Mat3 R = Eigen::AngleAxisd(0.3, Vec3(1, 2, 3).normalized()).toRotationMatrix();
+    Mat4 modelView = ComposeModelView(Vec3(10, 20, 30), Vec3(0.5, -0.2, 3), 2, R, Vec3(0.1, 0.2, 0.3));
+
+    uint32_t state = 1;
+    int numCulled = 0;
+    bool isConservative = true;
+    for (int i = 0; i < 2000; ++i)
+    {
+        double values[4];
+        for (int j = 0; j < 4; ++j)
+        {
+            state = state * 1664525 + 1013904223;
+            values[j] = (state >> 8) / 16777216.0;
+        }
+        Vec3 center(values[0] * 16 - 8, values[1] * 12 - 6, values[2] * 20 - 6);
+        double radius = 0.01 + values[3] * 2;
+        bool isInFrustum = IsSphereInFrustum(projection, modelView, center, radius);
+        numCulled += isInFrustum ? 0 : 1;
+        for (int k = 0; k < 200 && !isInFrustum; ++k)
+        {
+            double theta = k * 0.61803398875 * 2 * CV_PI, z = 1 - 2 * (k + 0.5) / 200;
+            Vec3 direction(std::sqrt(1 - z * z) * std::cos(theta), std::sqrt(1 - z * z) * std::sin(theta), z);
+            for (double d = 0; d <= radius; d += radius / 4)
+            {
+                Vec3 p = (modelView * (center + d * direction).homogeneous()).head<3>();
+                isConservative = isConservative && !IsInFrustum(p);
+            }
+        }
+    }
+    OV_CHECK(isConservative);
+    // Both outcomes were tried
+    OV_CHECK(numCulled > 100 && numCulled < 1900);
+}
@@ -0,0 +1,171 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "OVManifest.h"
+#include "OVTest.h"
+#include "OVUtil.h"
+
+using namespace ov;
+
+static std::vector<unsigned char>
+ToBytes(const std::string& s)
+{
+    return std::vector<unsigned char>(s.begin(), s.end());
+}
+
+// Record a frame file the way the writer does, after it is on disk
+static void
+WriteFrame(Manifest& manifest, const std::string& filename, uint64_t inputHash, const std::string& contents)
+{
+    OV_CHECK(WriteTestFile(filename, contents));
+    manifest.record(filename, inputHash, ToBytes(contents));
+}
+
+OV_TEST(HashBytesContinues)
+{
+    std::string s = "0123456789abcdef";
+    OV_CHECK(HashBytes(s.data(), 0) == HashBasis);
+    OV_CHECK(HashBytes(s.data() + 5, s.size() - 5, HashBytes(s.data(), 5)) == HashBytes(s.data(), s.size()));
+
+    std::string filename = GetTestDir() + "hashed.bin";
+    OV_CHECK(WriteTestFile(filename, s));
+    uint64_t hash = 0;
+    OV_CHECK(HashFile(filename, hash) && hash == HashBytes(s.data(), s.size()));
+    OV_CHECK(!HashFile(GetTestDir() + "missing.bin", hash));
+}
+
+OV_TEST(ManifestRoundTrip)
+{
+    std::string dir = GetTestDir();
+    std::string manifestFile = dir + "manifest.txt";
+    {
+        Manifest manifest;
+        OV_CHECK(manifest.open(manifestFile, dir, false));
+        WriteFrame(manifest, dir + "000000.png", 1, "first frame");
+        WriteFrame(manifest, dir + "000001.png", 2, "second frame");
+        manifest.recordEmpty(dir + "000002.png", 3);
+        OV_CHECK(LinkFile(dir + "000000.png", dir + "000003.png"));
+        manifest.recordLink(dir + "000003.png", 4, dir + "000000.png");
+        manifest.close();
+    }
+
+    // A resumed run loads the manifest and appends to it
+    Manifest manifest;
+    OV_CHECK(manifest.load(manifestFile));
+    OV_CHECK(manifest.open(manifestFile, dir, true));
+    OV_CHECK(manifest.isValid(dir + "000000.png", 1));
+    OV_CHECK(manifest.isValid(dir + "000001.png", 2));
+    OV_CHECK(manifest.isValid(dir + "000002.png", 3));
+    OV_CHECK(manifest.isValid(dir + "000003.png", 4));
+    OV_CHECK(!manifest.isValid(dir + "000000.png", 2));
+    OV_CHECK(!manifest.isValid(dir + "000004.png", 1));
+    manifest.close();
+
+    // Paths are relative to the output root
+    std::string text = ReadTestFile(manifestFile);
+    OV_CHECK(text.compare(0, 11, "000000.png\t") == 0);
+    OV_CHECK(text.find(dir) == std::string::npos);
+}
+
+OV_TEST(ManifestChangedFiles)
+{
+    std::string dir = GetTestDir();
+    Manifest manifest;
+    OV_CHECK(manifest.open(dir + "manifest.txt", dir, false));
+    WriteFrame(manifest, dir + "resized.png", 1, "frame");
+    WriteFrame(manifest, dir + "rewritten.png", 2, "frame");
+    WriteFrame(manifest, dir + "touched.png", 3, "frame");
+    WriteFrame(manifest, dir + "deleted.png", 4, "frame");
+
+    // Past the resolution of the file system's write times
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    OV_CHECK(WriteTestFile(dir + "resized.png", "frame!"));
+    OV_CHECK(WriteTestFile(dir + "rewritten.png", "FRAME"));
+    OV_CHECK(WriteTestFile(dir + "touched.png", "frame"));
+    OV_CHECK(DeleteFileA((dir + "deleted.png").c_str()));
+
+    OV_CHECK(!manifest.isValid(dir + "resized.png", 1));
+    OV_CHECK(!manifest.isValid(dir + "rewritten.png", 2));
+    // A new write time alone makes the file hashed, not invalid
+    OV_CHECK(manifest.isValid(dir + "touched.png", 3));
+    OV_CHECK(!manifest.isValid(dir + "deleted.png", 4));
+    manifest.close();
+}
+
+OV_TEST(ManifestLoadsOlderFormat)
+{
+    std::string dir = GetTestDir();
+    OV_CHECK(WriteTestFile(dir + "000000.png", "frame"));
+    OV_CHECK(WriteTestFile(dir + "000001.png", "frame"));
+
+    // Lines without a write time, the frame is hashed; a torn last line is ignored
+    uint64_t outputHash = HashBytes("frame", 5);
+    char line[128];
+    std::snprintf(line, sizeof(line), "000000.png\t%016llx\t5\t%016llx\n", 7ULL, (unsigned long long)outputHash);
+    OV_CHECK(WriteTestFile(dir + "manifest.txt", std::string(line) + "000001.png\t0000000000000008\t5\t00"));
+
+    Manifest manifest;
+    OV_CHECK(manifest.load(dir + "manifest.txt"));
+    OV_CHECK(manifest.open(dir + "manifest.txt", dir, true));
+    OV_CHECK(manifest.isValid(dir + "000000.png", 7));
+    OV_CHECK(!manifest.isValid(dir + "000001.png", 8));
+    manifest.close();
+}
+
+OV_TEST(ManifestMerge)
+{
+    std::string dir = GetTestDir();
+    std::vector<std::string> parts;
+    for (int i = 0; i < 2; ++i)
+    {
+        parts.push_back(dir + "manifest-" + std::to_string(i) + ".txt");
+        Manifest manifest;
+        OV_CHECK(manifest.open(parts.back(), dir, false));
+        WriteFrame(manifest, dir + "shard" + std::to_string(i) + ".png", 1, "frame");
+        manifest.recordEmpty(dir + "shared.png", 10 + i);
+        manifest.close();
+    }
+    OV_CHECK(MergeManifests(parts, dir + "manifest.txt"));
+
+    Manifest manifest;
+    OV_CHECK(manifest.load(dir + "manifest.txt"));
+    OV_CHECK(manifest.open(dir + "manifest.txt", dir, true));
+    OV_CHECK(manifest.isValid(dir + "shard0.png", 1));
+    OV_CHECK(manifest.isValid(dir + "shard1.png", 1));
+    OV_CHECK(manifest.isValid(dir + "shared.png", 11));
+    OV_CHECK(!manifest.isValid(dir + "shared.png", 10));
+    manifest.close();
+}
+
+OV_TEST(ManifestResumesFromTornLine)
+{
+    // A run killed mid-write, the last line has no line end
+    std::string dir = GetTestDir();
+    std::string manifestFile = dir + "manifest.txt";
+    {
+        Manifest manifest;
+        OV_CHECK(manifest.open(manifestFile, dir, false));
+        WriteFrame(manifest, dir + "000000.png", 1, "first frame");
+        manifest.close();
+    }
+    OV_CHECK(WriteTestFile(manifestFile, ReadTestFile(manifestFile) + "000001.png\t00000000"));
+
+    // The frame recorded on resume survives the next resume
+    {
+        Manifest manifest;
+        OV_CHECK(manifest.load(manifestFile));
+        OV_CHECK(manifest.open(manifestFile, dir, true));
+        WriteFrame(manifest, dir + "000001.png", 2, "second frame");
+        manifest.close();
+    }
+    Manifest manifest;
+    OV_CHECK(manifest.load(manifestFile));
+    OV_CHECK(manifest.open(manifestFile, dir, true));
+    OV_CHECK(manifest.isValid(dir + "000000.png", 1));
+    OV_CHECK(manifest.isValid(dir + "000001.png", 2));
+    manifest.close();
+    std::string text = ReadTestFile(manifestFile);
+    OV_CHECK(!text.empty() && text[text.size() - 1] == '\n');
+}
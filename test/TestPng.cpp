@@ -0,0 +1,136 @@
+#include <string>
+#include <vector>
+#include "OVPng.h"
+#include "OVTest.h"
+
+using namespace ov;
+
+enum IMAGE_CONTENT
+{
+    IMAGE_NOISE,    // no matches, every filter type wins somewhere
+    IMAGE_GRADIENT, // smooth, what Up and Paeth are for
+    IMAGE_FLAT      // long matches and runs
+};
+
+static cv::Mat
+MakeImage(int rows, int cols, int channels, int content)
+{
+    cv::Mat image(rows, cols, CV_8UC(channels));
+    uint32_t state = 12345;
+    for (int y = 0; y < rows; ++y)
+    {
+        uchar* row = image.ptr<uchar>(y);
+        for (int i = 0; i < cols * channels; ++i)
+        {
+            state = state * 1664525 + 1013904223;
+            if (content == IMAGE_NOISE)
+                row[i] = (uchar)(state >> 24);
+            else if (content == IMAGE_GRADIENT)
+                row[i] = (uchar)(i / channels + y * 2 + i % channels * 40 + (state >> 30));
+            else
+                row[i] = (uchar)(i % channels * 60 + (y / 8) % 2 * 100);
+        }
+    }
+    return image;
+}
+
+// The encoder's PNG decodes to the frame exactly
+static bool
+IsRoundTrip(PngEncoder& encoder, const cv::Mat& image, int level)
+{
+    std::vector<uchar> png;
+    if (!encoder.encode(image, level, png))
+        return false;
+    return IsSameImage(cv::imdecode(cv::Mat(png), cv::IMREAD_UNCHANGED), image);
+}
+
+OV_TEST(PngRoundTrip)
+{
+    PngEncoder encoder;
+    const int sizes[][2] = { { 1, 1 }, { 3, 7 }, { 64, 48 }, { 33, 301 } };
+    for (int s = 0; s < 4; ++s)
+        for (int channels = 1; channels <= 4; ++channels)
+        {
+            if (channels == 2)
+                continue;
+            for (int content = IMAGE_NOISE; content <= IMAGE_FLAT; ++content)
+            {
+                cv::Mat image = MakeImage(sizes[s][0], sizes[s][1], channels, content);
+                for (int level = -1; level <= 3; ++level)
+                    OV_CHECK(IsRoundTrip(encoder, image, level));
+            }
+        }
+}
+
+OV_TEST(PngRoundTripOfView)
+{
+    // Rows of a view are not contiguous
+    PngEncoder encoder;
+    cv::Mat image = MakeImage(40, 50, 3, IMAGE_GRADIENT);
+    cv::Mat view = image(cv::Rect(5, 3, 31, 29));
+    OV_CHECK(!view.isContinuous());
+    OV_CHECK(IsRoundTrip(encoder, view, 1));
+    OV_CHECK(IsRoundTrip(encoder, view, 2));
+}
+
+OV_TEST(PngBandsRoundTrip)
+{
+    // Frames over PngBandBytes are deflated in bands, joined into one stream
+    PngEncoder encoder;
+    cv::Mat large = MakeImage(700, 640, 3, IMAGE_GRADIENT);
+    OV_CHECK(large.total() * large.elemSize() > (size_t)PngBandBytes);
+    for (int level = 0; level <= 2; ++level)
+        OV_CHECK(IsRoundTrip(encoder, large, level));
+    OV_CHECK(IsRoundTrip(encoder, MakeImage(1200, 1000, 4, IMAGE_NOISE), 1));
+    OV_CHECK(IsRoundTrip(encoder, MakeImage(1500, 900, 1, IMAGE_FLAT), 2));
+
+    // The encoder's buffers are reused from frame to frame
+    OV_CHECK(IsRoundTrip(encoder, MakeImage(20, 30, 3, IMAGE_NOISE), 1));
+    OV_CHECK(IsRoundTrip(encoder, large, 1));
+}
+
+OV_TEST(PngIsSameForAnyThreads)
+{
+    cv::Mat image = MakeImage(900, 800, 3, IMAGE_GRADIENT);
+    int numThreads = cv::getNumThreads();
+    std::vector<uchar> expected, png;
+    PngEncoder encoder;
+    cv::setNumThreads(1);
+    OV_CHECK(encoder.encode(image, 2, expected));
+    for (int n = 2; n <= 8; n *= 2)
+    {
+        cv::setNumThreads(n);
+        OV_CHECK(encoder.encode(image, 2, png) && png == expected);
+    }
+    cv::setNumThreads(numThreads);
+}
+
+OV_TEST(PngOtherDepthsFallBack)
+{
+    // 16 bit frames go to OpenCV's encoder
+    cv::Mat image(20, 30, CV_16UC1);
+    for (int y = 0; y < image.rows; ++y)
+        for (int x = 0; x < image.cols; ++x)
+            image.ptr<ushort>(y)[x] = (ushort)(y * 3000 + x * 7);
+
+    PngEncoder encoder;
+    std::vector<uchar> png;
+    OV_CHECK(!encoder.encode(image, 1, png));
+
+    PngOptions options;
+    OV_CHECK(ParsePngOption("png", "fast", options));
+    OV_CHECK(EncodePng(image, options, encoder, png));
+    OV_CHECK(IsSameImage(cv::imdecode(cv::Mat(png), cv::IMREAD_UNCHANGED), image));
+}
+
+OV_TEST(PngOptionParsing)
+{
+    PngOptions options;
+    OV_CHECK(ParsePngOption("png", "fast", options) && options.encoder == PNG_ENCODER_FAST);
+    OV_CHECK(ParsePngOption("png-level", "9", options) && options.level == 9);
+    OV_CHECK(ParsePngOption("png-strategy", "rle", options) && options.strategy == cv::IMWRITE_PNG_STRATEGY_RLE);
+    OV_CHECK(!ParsePngOption("png-level", "10", options));
+    OV_CHECK(!ParsePngOption("png-level", "fast", options));
+    OV_CHECK(!ParsePngOption("png", "zlib", options));
+    OV_CHECK(!ParsePngOption("png-filter", "sub", options));
+}
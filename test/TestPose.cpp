@@ -0,0 +1,155 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "OVPose.h"
+#include "OVTest.h"
+
+using namespace ov;
+
+// Numbers of every shape the text reader takes: signs, exponents, no
+// integer or fraction digits, and more digits than the fast path handles
+static const char* const Numbers[] =
+{
+    "0", "1", "-1", "+2.5", "0.1", "-0.30000000000000004", "1e3", "-2.5E-3", "6.02214076e+23",
+    ".5", "5.", "123456789012345678901234", "0.12345678901234567890123", "1e-300", "-0", "3.141592653589793"
+};
+static const int NumNumbers = sizeof(Numbers) / sizeof(Numbers[0]);
+
+// Pose i of the test file, as text and as the values strtod gives
+static std::string
+MakePoseLine(int i, double pose[PoseSize])
+{
+    std::string line;
+    for (int j = 0; j < PoseSize; ++j)
+    {
+        const char* number = Numbers[(i * PoseSize + j) % NumNumbers];
+        pose[j] = std::strtod(number, NULL);
+        line += (j == 0 ? "" : j % 3 == 0 ? "\t" : "  ") + std::string(number);
+    }
+    return line;
+}
+
+static bool
+IsSamePose(const double* a, const double* b)
+{
+    return std::memcmp(a, b, PoseSize * sizeof(double)) == 0;
+}
+
+// Text poses with blank lines, CRLF line ends and extra numbers
+static void
+WritePoseText(const std::string& filename, int numPoses, std::vector<double>& poses)
+{
+    std::string text = "\n";
+    poses.resize(numPoses * PoseSize);
+    for (int i = 0; i < numPoses; ++i)
+    {
+        text += MakePoseLine(i, &poses[i * PoseSize]);
+        text += i % 3 == 1 ? " 99 98\r\n" : i % 3 == 2 ? "\r\n \t\r\n" : "\n";
+    }
+    // The last line has no line end
+    text.resize(text.size() - 1);
+    OV_CHECK(WriteTestFile(filename, text));
+}
+
+OV_TEST(PoseTextMatchesStrtod)
+{
+    std::string filename = GetTestDir() + "poses.txt";
+    std::vector<double> poses;
+    WritePoseText(filename, 10, poses);
+
+    PoseReader reader;
+    OV_CHECK(reader.open(filename));
+    OV_CHECK(reader.getNumPoses() == -1);
+    double pose[PoseSize];
+    int numPoses = 0;
+    for (; reader.next(pose); ++numPoses)
+        OV_CHECK(numPoses < 10 && IsSamePose(pose, &poses[numPoses * PoseSize]));
+    OV_CHECK(numPoses == 10);
+    OV_CHECK(!reader.hasError());
+}
+
+OV_TEST(PoseBinaryRoundTrip)
+{
+    std::string dir = GetTestDir();
+    std::vector<double> poses;
+    WritePoseText(dir + "poses.txt", 7, poses);
+
+    OV_CHECK(ConvertPoseFile(dir + "poses.txt", dir + "poses.bin", false));
+    PoseReader reader;
+    OV_CHECK(reader.open(dir + "poses.bin"));
+    OV_CHECK(reader.getNumPoses() == 7);
+    double pose[PoseSize];
+    int numPoses = 0;
+    for (; reader.next(pose); ++numPoses)
+        OV_CHECK(numPoses < 7 && IsSamePose(pose, &poses[numPoses * PoseSize]));
+    OV_CHECK(numPoses == 7 && !reader.hasError());
+
+    OV_CHECK(ConvertPoseFile(dir + "poses.txt", dir + "poses-float.bin", true));
+    std::vector<float> floatPoses;
+    OV_CHECK(LoadPoses(dir + "poses-float.bin", floatPoses));
+    bool isSame = floatPoses.size() == poses.size();
+    for (size_t i = 0; isSame && i < poses.size(); ++i)
+        isSame = floatPoses[i] == (float)poses[i];
+    OV_CHECK(isSame);
+    OV_CHECK(ReadTestFile(dir + "poses-float.bin").size() == sizeof(PoseFileHeader) + poses.size() * sizeof(float));
+
+    // Binary files convert too, as a copy
+    OV_CHECK(ConvertPoseFile(dir + "poses.bin", dir + "poses-copy.bin", false));
+    OV_CHECK(ReadTestFile(dir + "poses-copy.bin") == ReadTestFile(dir + "poses.bin"));
+}
+
+OV_TEST(PoseEmptyFile)
+{
+    std::string filename = GetTestDir() + "empty.txt";
+    OV_CHECK(WriteTestFile(filename, ""));
+    std::vector<double> poses(1);
+    OV_CHECK(LoadPoses(filename, poses));
+    OV_CHECK(poses.empty());
+}
+
+OV_TEST(PoseMalformedFiles)
+{
+    std::string dir = GetTestDir();
+    double pose[PoseSize];
+    std::string line = MakePoseLine(0, pose);
+    const std::string files[] =
+    {
+        line + "\n1 2 3 4 5 6 7 8 9 10 11\n",     // a number short
+        line + "\n1 2 3 4 5 6 7 8 9 10 11 x\n",   // not a number
+        line + "\n1 2 3 4 5 6 7 8 9 10 11 12a\n", // trailing garbage
+        line + "\n1 2 3 4 5 6 7 8 9 10 11 1e\n"   // no exponent digits
+    };
+    for (int i = 0; i < 4; ++i)
+    {
+        std::string filename = dir + "malformed-" + std::to_string(i) + ".txt";
+        OV_CHECK(WriteTestFile(filename, files[i]));
+
+        ErrorCatcher errors;
+        PoseReader reader;
+        OV_CHECK(reader.open(filename));
+        OV_CHECK(reader.next(pose) && !reader.hasError());
+        OV_CHECK(!reader.next(pose) && reader.hasError());
+        OV_CHECK(errors.getErrors().size() == 1);
+
+        std::vector<double> poses;
+        OV_CHECK(!LoadPoses(filename, poses));
+    }
+}
+
+OV_TEST(PoseTruncatedBinaryFile)
+{
+    std::string dir = GetTestDir();
+    std::vector<double> poses;
+    WritePoseText(dir + "poses.txt", 3, poses);
+    OV_CHECK(ConvertPoseFile(dir + "poses.txt", dir + "poses.bin", false));
+    std::string data = ReadTestFile(dir + "poses.bin");
+    OV_CHECK(WriteTestFile(dir + "truncated.bin", data.substr(0, data.size() - 8)));
+
+    ErrorCatcher errors;
+    PoseReader reader;
+    OV_CHECK(!reader.open(dir + "truncated.bin") && reader.hasError());
+    OV_CHECK(errors.getErrors().size() == 1);
+    OV_CHECK(!reader.open(dir + "missing.bin"));
+}
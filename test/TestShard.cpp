@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "OVBatch.h"
+#include "OVTest.h"
+
+using namespace ov;
+
+OV_TEST(ShardsSplitEveryFrameOnce)
+{
+    for (int numShards = 1; numShards <= 5; ++numShards)
+    {
+        BatchOptions options;
+        options.numShards = numShards;
+        for (int lineIndex = 0; lineIndex < 4; ++lineIndex)
+        {
+            std::vector<int> numFrames(numShards, 0);
+            for (int frameIndex = 0; frameIndex < 100; ++frameIndex)
+            {
+                int numOwners = 0;
+                for (options.shardIndex = 0; options.shardIndex < numShards; ++options.shardIndex)
+                {
+                    if (!IsInShard(lineIndex, frameIndex, options))
+                        continue;
+                    ++numOwners;
+                    ++numFrames[options.shardIndex];
+                }
+                OV_CHECK(numOwners == 1);
+            }
+            // Any line is spread evenly, whatever its length
+            auto range = std::minmax_element(numFrames.begin(), numFrames.end());
+            OV_CHECK(*range.second - *range.first <= 1);
+        }
+    }
+}
+
+OV_TEST(ShardsBalanceShortLines)
+{
+    // Lines of one frame each still go to every shard
+    BatchOptions options;
+    options.numShards = 3;
+    std::vector<int> numFrames(options.numShards, 0);
+    for (int lineIndex = 0; lineIndex < 9; ++lineIndex)
+        for (options.shardIndex = 0; options.shardIndex < options.numShards; ++options.shardIndex)
+            numFrames[options.shardIndex] += IsInShard(lineIndex, 0, options) ? 1 : 0;
+    for (int i = 0; i < options.numShards; ++i)
+        OV_CHECK(numFrames[i] == 3);
+}
+
+OV_TEST(ShardManifestFiles)
+{
+    BatchOptions options;
+    options.numShards = 3;
+    OV_CHECK(GetManifestFile("C:\\data\\run.txt", options) == "C:\\data\\run.manifest");
+    OV_CHECK(GetShardManifestFile("C:\\data\\run.txt", options, 1) == "C:\\data\\run.shard-1-of-3.manifest");
+
+    options.outputRoot = "D:\\frames";
+    OV_CHECK(GetManifestFile("C:\\data\\run.txt", options) == "D:\\frames\\run.manifest");
+    OV_CHECK(GetShardManifestFile("C:\\data\\run.txt", options, 2) == "D:\\frames\\run.shard-2-of-3.manifest");
+
+    options.manifestFile = "D:\\runs\\all.manifest";
+    OV_CHECK(GetShardManifestFile("C:\\data\\run.txt", options, 0) == "D:\\runs\\all.shard-0-of-3.manifest");
+}
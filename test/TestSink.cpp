@@ -0,0 +1,241 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "OVSink.h"
+#include "OVTest.h"
+#include "OVUtil.h"
+
+using namespace ov;
+
+// A frame of width * height * channels samples of the given depth, or of
+// size bytes for encoded frames; the bytes and pose depend on the index
+static EncodedFrame
+MakeFrame(int frameIndex, int width, int height, int channels, int depth, size_t size = 0)
+{
+    EncodedFrame frame;
+    frame.index = frameIndex;
+    frame.frameIndex = frameIndex;
+    frame.inputHash = 1000 + frameIndex;
+    frame.width = width;
+    frame.height = height;
+    frame.channels = channels;
+    frame.depth = depth;
+    frame.encoding = ENCODING_RAW;
+    for (int i = 0; i < PoseSize; ++i)
+        frame.pose[i] = frameIndex + i * 0.1;
+    frame.data.resize(size > 0 ? size : (size_t)width * height * channels * CV_ELEM_SIZE1(depth));
+    for (size_t i = 0; i < frame.data.size(); ++i)
+        frame.data[i] = (uchar)(i * 31 + frameIndex);
+    return frame;
+}
+
+template <typename T>
+static T
+ReadAt(const std::string& file, size_t offset)
+{
+    T value;
+    std::memset(&value, 0, sizeof(value));
+    if (offset + sizeof(value) <= file.size())
+        std::memcpy(&value, file.data() + offset, sizeof(value));
+    return value;
+}
+
+static bool
+IsSameData(const std::string& file, size_t offset, const std::vector<uchar>& data)
+{
+    return offset + data.size() <= file.size() && std::memcmp(file.data() + offset, data.data(), data.size()) == 0;
+}
+
+OV_TEST(SinkOptionParsing)
+{
+    SinkOptions options;
+    OV_CHECK(ParseSinkOption("sink", "tar", options) && options.type == SINK_TAR);
+    OV_CHECK(ParseSinkOption("compression", "none", options) && !options.isCompressed);
+    OV_CHECK(ParseSinkOption("shard-mb", "0", options) && options.shardMegabytes == 0);
+    OV_CHECK(!ParseSinkOption("shard-mb", "-1", options));
+    OV_CHECK(!ParseSinkOption("shard-mb", "big", options));
+    OV_CHECK(!ParseSinkOption("sink", "zip", options));
+    OV_CHECK(!ParseSinkOption("shm-slots", "1", options));
+}
+
+OV_TEST(PackSinkRoundTrip)
+{
+    std::string dir = GetTestDir();
+    std::vector<EncodedFrame> frames;
+    frames.push_back(MakeFrame(0, 4, 3, 3, CV_8U));
+    frames.push_back(MakeFrame(2, 4, 3, 3, CV_8U, 100));
+    frames.push_back(MakeFrame(5, 4, 3, 3, CV_8U));
+    {
+        PackSink sink(dir, "frames", false, 0);
+        OV_CHECK(sink.getEncoding() == ENCODING_RAW);
+        for (size_t i = 0; i < frames.size(); ++i)
+            OV_CHECK(sink.write(frames[i]));
+        OV_CHECK(sink.close());
+        OV_CHECK(sink.close());
+    }
+
+    std::string pack = ReadTestFile(dir + "frames-00000.pack");
+    std::string index = ReadTestFile(dir + "frames-00000.idx");
+    OV_CHECK(index.compare(0, 8, "OVPACKI1") == 0);
+    OV_CHECK(ReadAt<uint32_t>(index, 8) == sizeof(PackIndexEntry));
+    OV_CHECK(index.size() == 16 + frames.size() * sizeof(PackIndexEntry));
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        PackIndexEntry entry = ReadAt<PackIndexEntry>(index, 16 + i * sizeof(PackIndexEntry));
+        OV_CHECK(entry.offset == offset && entry.size == frames[i].data.size());
+        OV_CHECK(entry.frameIndex == frames[i].frameIndex && entry.inputHash == frames[i].inputHash);
+        OV_CHECK(entry.width == 4 && entry.height == 3 && entry.channels == 3);
+        OV_CHECK(entry.encoding == ENCODING_RAW && entry.depth == CV_8U);
+        OV_CHECK(std::memcmp(entry.pose, frames[i].pose, sizeof(entry.pose)) == 0);
+        OV_CHECK(IsSameData(pack, (size_t)entry.offset, frames[i].data));
+        offset += entry.size;
+    }
+    OV_CHECK(pack.size() == offset);
+}
+
+OV_TEST(PackSinkShards)
+{
+    // Every frame is over half a shard, each starts a file of its own
+    std::string dir = GetTestDir();
+    std::vector<EncodedFrame> frames;
+    for (int i = 0; i < 3; ++i)
+        frames.push_back(MakeFrame(i, 4, 3, 3, CV_8U, 600 << 10));
+    {
+        PackSink sink(dir, "frames", true, 1);
+        OV_CHECK(sink.getEncoding() == ENCODING_PNG_FAST);
+        for (size_t i = 0; i < frames.size(); ++i)
+            OV_CHECK(sink.write(frames[i]));
+        OV_CHECK(sink.close());
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        std::string shard = dir + "frames-" + ZeroPadNumber(i, 5);
+        std::string pack = ReadTestFile(shard + ".pack");
+        std::string index = ReadTestFile(shard + ".idx");
+        PackIndexEntry entry = ReadAt<PackIndexEntry>(index, 16);
+        OV_CHECK(index.size() == 16 + sizeof(PackIndexEntry));
+        OV_CHECK(entry.offset == 0 && entry.frameIndex == i);
+        OV_CHECK(pack.size() == frames[i].data.size() && IsSameData(pack, 0, frames[i].data));
+    }
+}
+
+// Octal number of a tar header field
+static uint64_t
+ReadOctal(const std::string& file, size_t offset, int width)
+{
+    return std::strtoull(file.substr(offset, width).c_str(), NULL, 8);
+}
+
+OV_TEST(TarSinkRoundTrip)
+{
+    std::string dir = GetTestDir();
+    std::vector<EncodedFrame> frames;
+    frames.push_back(MakeFrame(0, 4, 3, 3, CV_8U, 700));
+    frames.push_back(MakeFrame(1, 4, 3, 3, CV_8U, 512));
+    frames.push_back(MakeFrame(12, 4, 3, 3, CV_8U, 1));
+    {
+        TarSink sink(dir, "frames", 0);
+        for (size_t i = 0; i < frames.size(); ++i)
+            OV_CHECK(sink.write(frames[i]));
+        OV_CHECK(sink.close());
+    }
+
+    std::string tar = ReadTestFile(dir + "frames-00000.tar");
+    OV_CHECK(tar.size() % 512 == 0);
+    size_t offset = 0;
+    for (size_t i = 0; i < 2 * frames.size(); ++i)
+    {
+        OV_CHECK(offset + 512 <= tar.size());
+        if (offset + 512 > tar.size())
+            return;
+
+        // The checksum is the sum of the header bytes with its field as spaces
+        std::string header = tar.substr(offset, 512);
+        uint64_t checksum = ReadOctal(header, 148, 8);
+        std::memset(&header[148], ' ', 8);
+        uint64_t sum = 0;
+        for (int j = 0; j < 512; ++j)
+            sum += (unsigned char)header[j];
+        OV_CHECK(checksum == sum);
+        OV_CHECK(header.compare(257, 6, std::string("ustar\0", 6)) == 0 && header[156] == '0');
+
+        const EncodedFrame& frame = frames[i / 2];
+        std::string name = header.substr(0, header.find('\0'));
+        uint64_t size = ReadOctal(header, 124, 12);
+        std::string data = tar.substr(offset + 512, (size_t)size);
+        if (i % 2 == 0)
+        {
+            OV_CHECK(name == ZeroPadNumber(frame.frameIndex, 6) + ".png");
+            OV_CHECK(size == frame.data.size() && IsSameData(data, 0, frame.data));
+        }
+        else
+        {
+            // The pose as text, every number round-trips
+            OV_CHECK(name == ZeroPadNumber(frame.frameIndex, 6) + ".pose");
+            const char* p = data.c_str();
+            bool isSame = true;
+            for (int j = 0; j < PoseSize; ++j)
+            {
+                char* end;
+                double value = std::strtod(p, &end);
+                isSame = isSame && value == frame.pose[j];
+                p = end;
+            }
+            OV_CHECK(isSame && *p == '\n');
+        }
+        offset += 512 + (size_t)(size + 511) / 512 * 512;
+    }
+    OV_CHECK(tar.size() == offset + 1024 && tar.find_first_not_of('\0', offset) == std::string::npos);
+}
+
+OV_TEST(RawSinkRoundTrip)
+{
+    std::string dir = GetTestDir();
+    std::vector<EncodedFrame> frames;
+    for (int i = 0; i < 3; ++i)
+        frames.push_back(MakeFrame(i * 2, 5, 3, 1, CV_16U));
+    {
+        RawSink sink(dir, "frames", 0);
+        for (size_t i = 0; i < frames.size(); ++i)
+            OV_CHECK(sink.write(frames[i]));
+
+        // Records have the first frame's size
+        ErrorCatcher errors;
+        OV_CHECK(!sink.write(MakeFrame(7, 5, 3, 3, CV_16U)));
+        OV_CHECK(errors.getErrors().size() == 1);
+        OV_CHECK(sink.close());
+    }
+
+    std::string raw = ReadTestFile(dir + "frames-00000.raw");
+    RawFramesHeader header = ReadAt<RawFramesHeader>(raw, 0);
+    OV_CHECK(std::memcmp(header.magic, "OVFRAMES", 8) == 0);
+    OV_CHECK(header.width == 5 && header.height == 3 && header.channels == 1 && header.depth == CV_16U);
+    OV_CHECK(header.numFrames == frames.size());
+    OV_CHECK(header.recordSize % 64 == 0 && header.recordSize >= RawRecordPrefixSize + frames[0].data.size());
+    OV_CHECK(raw.size() == RawFramesHeaderSize + frames.size() * header.recordSize);
+
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        size_t offset = RawFramesHeaderSize + i * header.recordSize;
+        RawFrameRecord record = ReadAt<RawFrameRecord>(raw, offset);
+        OV_CHECK(record.frameIndex == frames[i].frameIndex && record.inputHash == frames[i].inputHash);
+        OV_CHECK(std::memcmp(record.pose, frames[i].pose, sizeof(record.pose)) == 0);
+        OV_CHECK(IsSameData(raw, offset + RawRecordPrefixSize, frames[i].data));
+    }
+}
+
+OV_TEST(SinkClosesOnDestruction)
+{
+    // Without close() the destructor still completes the file
+    std::string dir = GetTestDir();
+    {
+        RawSink sink(dir, "frames", 0);
+        OV_CHECK(sink.write(MakeFrame(0, 2, 2, 3, CV_8U)));
+        OV_CHECK(sink.write(MakeFrame(1, 2, 2, 3, CV_8U)));
+    }
+    std::string raw = ReadTestFile(dir + "frames-00000.raw");
+    OV_CHECK(ReadAt<RawFramesHeader>(raw, 0).numFrames == 2);
+}